@@ -32,8 +32,57 @@ namespace nosonapp
     return (int)std::floor(value + 0.5);
   }
 
+  /**
+   * @return true if all the characters are ASCII. The characters are merged
+   * by blocks, so the inner loop is vectorized by the compiler.
+   */
+  static inline bool isAsciiString(const QString& str)
+  {
+    const ushort * p = str.utf16();
+    int n = str.size();
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+      ushort bits = 0;
+      for (int k = 0; k < 16; ++k)
+        bits |= p[i + k];
+      if (bits & 0xff80)
+        return false;
+    }
+    for (; i < n; ++i)
+    {
+      if (p[i] & 0xff80)
+        return false;
+    }
+    return true;
+  }
+
   static inline QString normalizedString(const QString& str)
   {
+    if (isAsciiString(str))
+    {
+      // the decomposition leaves the ASCII as is, and it has no mark to
+      // strip: only the spaces are collapsed, and trimmed
+      int n = str.size();
+      const QChar * p = str.constData();
+      bool clean = (n == 0 || (p[0] != ' ' && p[n - 1] != ' '));
+      for (int i = 1; clean && i < n; ++i)
+        clean = (p[i] != ' ' || p[i - 1] != ' ');
+      if (clean)
+        return str;
+      QString ret;
+      ret.reserve(n);
+      bool space = true;
+      for (int i = 0; i < n; ++i)
+      {
+        if (p[i] != ' ' || !space)
+          ret.append(p[i]);
+        space = (p[i] == ' ');
+      }
+      if (!ret.isEmpty() && space)
+        ret.truncate(ret.length() - 1);
+      return ret;
+    }
     QString ret;
     QString tmp = str.normalized(QString::NormalizationForm_D);
     ret.reserve(tmp.size());
@@ -21,6 +21,8 @@
 #include "mediafile.h"
 
 #include <QMap>
+#include <QList>
+#include <QByteArray>
 #include <QSharedPointer>
 
 namespace mediascanner
@@ -92,6 +94,71 @@ public:
 
 };
 
+/**
+ * The filter of a model on the keys of the tags, as the lowered values are
+ * held by the interned strings. An empty key matches any value.
+ */
+struct LibraryFilter
+{
+  enum Tag
+  {
+    TagArtist = 0,
+    TagAlbum,
+    TagGenre,
+    TagComposer,
+  };
+  static const int TagCount = TagComposer + 1;
+
+  QByteArray keys[TagCount];
+
+  static const QByteArray& keyOf(const MediaInfo& info, Tag tag)
+  {
+    switch (tag)
+    {
+    case TagArtist:
+      return info.artist.key();
+    case TagAlbum:
+      return info.album.key();
+    case TagGenre:
+      return info.genre.key();
+    default:
+      return info.composer.key();
+    }
+  }
+
+  void set(Tag tag, const QString& value) { keys[tag] = (value.isEmpty() ? QByteArray() : InternedString::keyOf(value)); }
+
+  bool isEmpty() const
+  {
+    for (const QByteArray& key : keys)
+      if (!key.isEmpty())
+        return false;
+    return true;
+  }
+
+  bool matches(const MediaInfo& info) const
+  {
+    for (int t = 0; t < TagCount; ++t)
+      if (!keys[t].isEmpty() && keys[t] != keyOf(info, static_cast<Tag>(t)))
+        return false;
+    return true;
+  }
+};
+
+/**
+ * The changes applied to the library index by a batch of files. The keys
+ * are the ones of the aggregates created, or erased, by the batch.
+ */
+struct LibraryChanges
+{
+  MediaFileList files;
+  QList<QByteArray> artists;
+  QList<QByteArray> albums;
+  QList<QByteArray> genres;
+  QList<QByteArray> composers;
+  QList<QByteArray> tracks;
+};
+
 }
 
 #endif /* AGGREGATOR_H */
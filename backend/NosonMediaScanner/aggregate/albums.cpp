@@ -16,6 +16,7 @@
  *
  */
 #include "albums.h"
+#include "libraryindex.h"
 
 using namespace mediascanner;
 
@@ -24,12 +25,21 @@ AlbumModel::AlbumModel(const MediaFilePtr& file)
 {
   if (file->mediaInfo)
   {
-    m_key = file->mediaInfo->artist.toLower().toUtf8()
-        .append("/").append(file->mediaInfo->album.toLower().toUtf8());
-    m_normalized = normalizedString(file->mediaInfo->album);
+    m_key = keyOf(*file->mediaInfo);
+    m_normalized = file->mediaInfo->album.normalized();
   }
 }
 
+QByteArray AlbumModel::keyOf(const MediaInfo& info)
+{
+  const QByteArray& artist = info.artist.key();
+  const QByteArray& album = info.album.key();
+  QByteArray key;
+  key.reserve(artist.size() + 1 + album.size());
+  key.append(artist).append('/').append(album);
+  return key;
+}
+
 QVariant AlbumModel::payload() const
 {
   QVariant var;
@@ -41,6 +51,8 @@ Albums::Albums(QObject * parent)
 : ListModel(parent)
 , m_artistFilter()
 , m_composerFilter()
+, m_filter()
+, m_filtered()
 {
 }
 
@@ -49,33 +61,49 @@ Albums::~Albums()
   clear();
 }
 
-void Albums::addItem(ItemPtr& item)
+void Albums::setArtistFilter(const QString& filter)
+{
+  {
+    LockGuard<QRecursiveMutex> g(m_lock);
+    m_artistFilter = filter;
+    m_filter.set(LibraryFilter::TagArtist, filter);
+    resubscribe();
+  }
+  emit artistChanged();
+}
+
+void Albums::setComposerFilter(const QString& filter)
+{
+  {
+    LockGuard<QRecursiveMutex> g(m_lock);
+    m_composerFilter = filter;
+    m_filter.set(LibraryFilter::TagComposer, filter);
+    resubscribe();
+  }
+  emit composerChanged();
+}
+
+void Albums::addItems(const QList<ItemPtr>& items)
 {
+  if (items.isEmpty())
+    return;
   {
     LockGuard<QRecursiveMutex> lock(m_lock);
-    beginInsertRows(QModelIndex(), rowCount(), rowCount());
-    m_items << item;
-    endInsertRows();
+    if (m_sortBy == ListModel::SortNone)
+      appendRows(m_items, m_rows, items);
+    else
+      insertRows(m_items, m_rows, items, [this](const ItemPtr& a, const ItemPtr& b) { return lessThan(a, b); });
   }
   emit countChanged();
 }
 
-void Albums::removeItem(const QByteArray& id)
+void Albums::removeItems(const QList<QByteArray>& keys)
 {
+  if (keys.isEmpty())
+    return;
   {
     LockGuard<QRecursiveMutex> lock(m_lock);
-    int row = 0;
-    for (const ItemPtr& item : m_items)
-    {
-      if (item->model.key() == id)
-      {
-        beginRemoveRows(QModelIndex(), row, row);
-        m_items.removeOne(item);
-        endRemoveRows();
-        break;
-      }
-      ++row;
-    }
+    removeRows(m_items, m_rows, keys);
   }
   emit countChanged();
 }
@@ -180,8 +208,10 @@ void Albums::clear()
   {
     beginRemoveRows(QModelIndex(), 0, m_items.count()-1);
     m_items.clear();
+    m_rows.clear();
     endRemoveRows();
   }
+  m_filtered.clear();
   m_dataState = ListModel::NoData;
 }
 
@@ -192,11 +222,26 @@ bool Albums::load()
     beginResetModel();
     clear();
 
-    m_data.clear();
-    QList<MediaFilePtr> list = m_provider->allParsedFiles();
-    for (const MediaFilePtr& file : list)
-      onFileAdded(file);
+    const LibraryIndex * index = m_provider->index();
+    if (!isFiltered())
+    {
+      // the rows are taken from the index as they are
+      m_items = index->albums().values();
+    }
+    else
+    {
+      // the rows hold only the matching files, as the index holds them all
+      QByteArray key;
+      for (const MediaFilePtr& file : index->files(m_filter))
+      {
+        if (m_filtered.insertFile(file, &key))
+          m_items << m_filtered.value(key);
+      }
+    }
 
+    if (m_sortBy != ListModel::SortNone)
+      std::sort(m_items.begin(), m_items.end(), [this](const ItemPtr& a, const ItemPtr& b) { return lessThan(a, b); });
+    indexRows(m_items, m_rows);
     m_dataState = ListModel::Loaded;
     endResetModel();
   }
@@ -205,19 +250,53 @@ bool Albums::load()
   return true;
 }
 
-void Albums::onFileAdded(const MediaFilePtr& file)
+bool Albums::lessThan(const ItemPtr& a, const ItemPtr& b) const
 {
-  QByteArray key;
-  if (
-          (m_artistFilter.isEmpty() || m_artistFilter.compare(file->mediaInfo->artist, Qt::CaseSensitivity::CaseInsensitive) == 0) &&
-          (m_composerFilter.isEmpty() || m_composerFilter.compare(file->mediaInfo->composer, Qt::CaseSensitivity::CaseInsensitive) == 0) &&
-          m_data.insertFile(file, &key))
-    addItem(m_data.find(key).value());
+  if (m_sortBy == ListModel::SortByYear && a->model.year() != b->model.year())
+    return a->model.year() < b->model.year();
+  int c = a->model.normalized().compare(b->model.normalized());
+  return (c != 0 ? c < 0 : a->model.key() < b->model.key());
 }
 
-void Albums::onFileRemoved(const MediaFilePtr& file)
+void Albums::onFilesAdded(const LibraryChanges& changes)
 {
-  QByteArray key;
-  if (m_data.removeFile(file, &key))
-    removeItem(key);
+  QList<ItemPtr> items;
+  if (!isFiltered())
+  {
+    const AggregateType& albums = m_provider->index()->albums();
+    for (const QByteArray& key : changes.albums)
+      items << albums.value(key);
+  }
+  else
+  {
+    // an album is shown while one of its files matches, as notified
+    LockGuard<QRecursiveMutex> lock(m_lock);
+    QByteArray key;
+    for (const MediaFilePtr& file : changes.files)
+    {
+      if (m_filtered.insertFile(file, &key))
+        items << m_filtered.value(key);
+    }
+  }
+  addItems(items);
+}
+
+void Albums::onFilesRemoved(const LibraryChanges& changes)
+{
+  if (!isFiltered())
+  {
+    removeItems(changes.albums);
+    return;
+  }
+  QList<QByteArray> keys;
+  {
+    LockGuard<QRecursiveMutex> lock(m_lock);
+    QByteArray key;
+    for (const MediaFilePtr& file : changes.files)
+    {
+      if (m_filtered.removeFile(file, &key))
+        keys << key;
+    }
+  }
+  removeItems(keys);
 }
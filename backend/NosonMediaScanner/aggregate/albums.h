@@ -30,9 +30,10 @@ class AlbumModel : public Model
 public:
   AlbumModel(const MediaFilePtr& file);
   const QByteArray& key() const { return m_key; }
-  const QString& artist() { return m_file->mediaInfo->artist; }
-  const QString& album() { return m_file->mediaInfo->album; }
-  const QString& filePath() { return m_file->filePath; }
+  static QByteArray keyOf(const MediaInfo& info);
+  const QString& artist() { return m_file->mediaInfo->artist.value(); }
+  const QString& album() { return m_file->mediaInfo->album.value(); }
+  QString filePath() { return m_file->filePath(); }
   int year() { return m_file->mediaInfo->year; }
   bool hasArt() { return m_file->mediaInfo->hasArt; }
   const QString& normalized() { return m_normalized; }
@@ -71,14 +72,14 @@ public:
   virtual ~Albums() override;
 
   const QString& artistFilter() { return m_artistFilter; }
-  void setArtistFilter(const QString& filter) { m_artistFilter = filter; emit artistChanged(); }
+  void setArtistFilter(const QString& filter);
 
   const QString& composerFilter() { return m_composerFilter; }
-  void setComposerFilter(const QString& filter) { m_composerFilter = filter; emit composerChanged(); }
+  void setComposerFilter(const QString& filter);
 
-  void addItem(ItemPtr& item);
+  void addItems(const QList<ItemPtr>& items);
 
-  void removeItem(const QByteArray& key);
+  void removeItems(const QList<QByteArray>& keys);
 
   int rowCount(const QModelIndex& parent = QModelIndex()) const override;
 
@@ -96,8 +97,10 @@ public:
 
   Q_INVOKABLE bool load() override;
 
-  void onFileAdded(const MediaFilePtr& file) override;
-  void onFileRemoved(const MediaFilePtr& file) override;
+  LibraryFilter filter() const override { return m_filter; }
+
+  void onFilesAdded(const LibraryChanges& changes) override;
+  void onFilesRemoved(const LibraryChanges& changes) override;
 
 signals:
   void countChanged();
@@ -111,10 +114,16 @@ protected:
   QHash<int, QByteArray> roleNames() const override;
 
 private:
-  AggregateType m_data;
   QList<ItemPtr> m_items;
+  QHash<QByteArray, int> m_rows;  // the row of each key
+
+  bool lessThan(const ItemPtr& a, const ItemPtr& b) const;
   QString m_artistFilter;
   QString m_composerFilter;
+  LibraryFilter m_filter;
+  AggregateType m_filtered;  // the albums of the files matching the filters
+
+  bool isFiltered() const { return !m_filter.isEmpty(); }
 };
 
 }
@@ -16,6 +16,7 @@
  *
  */
 #include "composers.h"
+#include "libraryindex.h"
 
 using namespace mediascanner;
 
@@ -24,8 +25,9 @@ ComposerModel::ComposerModel(const MediaFilePtr& file)
 {
   if (file->mediaInfo)
   {
-    m_key = file->mediaInfo->composer.toLower().toUtf8();
-    m_normalized = normalizedString(file->mediaInfo->composer);
+    // shared with the interned tag
+    m_key = file->mediaInfo->composer.key();
+    m_normalized = file->mediaInfo->composer.normalized();
   }
 }
 
@@ -46,33 +48,27 @@ Composers::~Composers()
   clear();
 }
 
-void Composers::addItem(ItemPtr& item)
+void Composers::addItems(const QList<ItemPtr>& items)
 {
+  if (items.isEmpty())
+    return;
   {
     LockGuard<QRecursiveMutex> lock(m_lock);
-    beginInsertRows(QModelIndex(), rowCount(), rowCount());
-    m_items << item;
-    endInsertRows();
+    if (m_sortBy == ListModel::SortNone)
+      appendRows(m_items, m_rows, items);
+    else
+      insertRows(m_items, m_rows, items, [this](const ItemPtr& a, const ItemPtr& b) { return lessThan(a, b); });
   }
   emit countChanged();
 }
 
-void Composers::removeItem(const QByteArray& id)
+void Composers::removeItems(const QList<QByteArray>& keys)
 {
+  if (keys.isEmpty())
+    return;
   {
     LockGuard<QRecursiveMutex> lock(m_lock);
-    int row = 0;
-    for (const ItemPtr& item : m_items)
-    {
-      if (item->model.key() == id)
-      {
-        beginRemoveRows(QModelIndex(), row, row);
-        m_items.removeOne(item);
-        endRemoveRows();
-        break;
-      }
-      ++row;
-    }
+    removeRows(m_items, m_rows, keys);
   }
   emit countChanged();
 }
@@ -160,6 +156,7 @@ void Composers::clear()
   {
     beginRemoveRows(QModelIndex(), 0, m_items.count()-1);
     m_items.clear();
+    m_rows.clear();
     endRemoveRows();
   }
   m_dataState = ListModel::NoData;
@@ -172,11 +169,12 @@ bool Composers::load()
     beginResetModel();
     clear();
 
-    m_data.clear();
-    QList<MediaFilePtr> list = m_provider->allParsedFiles();
-    for (const MediaFilePtr& file : list)
-      onFileAdded(file);
+    // the rows are taken from the index as they are
+    m_items = m_provider->index()->composers().values();
 
+    if (m_sortBy != ListModel::SortNone)
+      std::sort(m_items.begin(), m_items.end(), [this](const ItemPtr& a, const ItemPtr& b) { return lessThan(a, b); });
+    indexRows(m_items, m_rows);
     m_dataState = ListModel::Loaded;
     endResetModel();
   }
@@ -185,16 +183,23 @@ bool Composers::load()
   return true;
 }
 
-void Composers::onFileAdded(const MediaFilePtr& file)
+bool Composers::lessThan(const ItemPtr& a, const ItemPtr& b) const
 {
-  QByteArray key;
-  if (m_data.insertFile(file, &key))
-    addItem(m_data.find(key).value());
+  // the name is the only key
+  int c = a->model.normalized().compare(b->model.normalized());
+  return (c != 0 ? c < 0 : a->model.key() < b->model.key());
 }
 
-void Composers::onFileRemoved(const MediaFilePtr& file)
+void Composers::onFilesAdded(const LibraryChanges& changes)
 {
-  QByteArray key;
-  if (m_data.removeFile(file, &key))
-    removeItem(key);
+  const AggregateType& composers = m_provider->index()->composers();
+  QList<ItemPtr> items;
+  for (const QByteArray& key : changes.composers)
+    items << composers.value(key);
+  addItems(items);
+}
+
+void Composers::onFilesRemoved(const LibraryChanges& changes)
+{
+  removeItems(changes.composers);
 }
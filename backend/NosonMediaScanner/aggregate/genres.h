@@ -30,7 +30,7 @@ class GenreModel : public Model
 public:
   GenreModel(const MediaFilePtr& file);
   const QByteArray& key() const { return m_key; }
-  const QString& genre() { return m_file->mediaInfo->genre; }
+  const QString& genre() { return m_file->mediaInfo->genre.value(); }
   const QString& normalized() { return m_normalized; }
   QVariant payload() const;
 private:
@@ -59,9 +59,9 @@ public:
   Genres(QObject* parent = nullptr);
   virtual ~Genres() override;
 
-  void addItem(ItemPtr& item);
+  void addItems(const QList<ItemPtr>& items);
 
-  void removeItem(const QByteArray& key);
+  void removeItems(const QList<QByteArray>& keys);
 
   int rowCount(const QModelIndex& parent = QModelIndex()) const override;
 
@@ -79,8 +79,8 @@ public:
 
   Q_INVOKABLE bool load() override;
 
-  void onFileAdded(const MediaFilePtr& file) override;
-  void onFileRemoved(const MediaFilePtr& file) override;
+  void onFilesAdded(const LibraryChanges& changes) override;
+  void onFilesRemoved(const LibraryChanges& changes) override;
 
 signals:
   void countChanged();
@@ -91,8 +91,10 @@ protected:
   QHash<int, QByteArray> roleNames() const override;
 
 private:
-  AggregateType m_data;
   QList<ItemPtr> m_items;
+  QHash<QByteArray, int> m_rows;  // the row of each key
+
+  bool lessThan(const ItemPtr& a, const ItemPtr& b) const;
 };
 
 }
@@ -16,6 +16,7 @@
  *
  */
 #include "tracks.h"
+#include "libraryindex.h"
 
 #include <string>
 
@@ -24,13 +25,18 @@ using namespace mediascanner;
 TrackModel::TrackModel(const MediaFilePtr& file)
 : Model(file)
 {
-  m_key = QByteArray(std::to_string(file->fileId).c_str());
+  m_key = keyOf(*file);
   if (file->mediaInfo)
   {
     m_normalized = normalizedString(file->mediaInfo->title);
   }
 }
 
+QByteArray TrackModel::keyOf(const MediaFile& file)
+{
+  return QByteArray(std::to_string(file.fileId).c_str());
+}
+
 QVariant TrackModel::payload() const
 {
   QVariant var;
@@ -44,6 +50,7 @@ Tracks::Tracks(QObject * parent)
 , m_albumFilter()
 , m_genreFilter()
 , m_composerFilter()
+, m_filter()
 {
 }
 
@@ -52,33 +59,71 @@ Tracks::~Tracks()
   clear();
 }
 
-void Tracks::addItem(ItemPtr& item)
+void Tracks::setArtistFilter(const QString& filter)
+{
+  {
+    LockGuard<QRecursiveMutex> g(m_lock);
+    m_artistFilter = filter;
+    m_filter.set(LibraryFilter::TagArtist, filter);
+    resubscribe();
+  }
+  emit artistChanged();
+}
+
+void Tracks::setAlbumFilter(const QString& filter)
+{
+  {
+    LockGuard<QRecursiveMutex> g(m_lock);
+    m_albumFilter = filter;
+    m_filter.set(LibraryFilter::TagAlbum, filter);
+    resubscribe();
+  }
+  emit albumChanged();
+}
+
+void Tracks::setGenreFilter(const QString& filter)
+{
+  {
+    LockGuard<QRecursiveMutex> g(m_lock);
+    m_genreFilter = filter;
+    m_filter.set(LibraryFilter::TagGenre, filter);
+    resubscribe();
+  }
+  emit genreChanged();
+}
+
+void Tracks::setComposerFilter(const QString& filter)
+{
+  {
+    LockGuard<QRecursiveMutex> g(m_lock);
+    m_composerFilter = filter;
+    m_filter.set(LibraryFilter::TagComposer, filter);
+    resubscribe();
+  }
+  emit composerChanged();
+}
+
+void Tracks::addItems(const QList<ItemPtr>& items)
 {
+  if (items.isEmpty())
+    return;
   {
     LockGuard<QRecursiveMutex> lock(m_lock);
-    beginInsertRows(QModelIndex(), rowCount(), rowCount());
-    m_items << item;
-    endInsertRows();
+    if (m_sortBy == ListModel::SortNone)
+      appendRows(m_items, m_rows, items);
+    else
+      insertRows(m_items, m_rows, items, [this](const ItemPtr& a, const ItemPtr& b) { return lessThan(a, b); });
   }
   emit countChanged();
 }
 
-void Tracks::removeItem(const QByteArray& id)
+void Tracks::removeItems(const QList<QByteArray>& keys)
 {
+  if (keys.isEmpty())
+    return;
   {
     LockGuard<QRecursiveMutex> lock(m_lock);
-    int row = 0;
-    for (const ItemPtr& item : m_items)
-    {
-      if (item->model.key() == id)
-      {
-        beginRemoveRows(QModelIndex(), row, row);
-        m_items.removeOne(item);
-        endRemoveRows();
-        break;
-      }
-      ++row;
-    }
+    removeRows(m_items, m_rows, keys);
   }
   emit countChanged();
 }
@@ -225,6 +270,7 @@ void Tracks::clear()
   {
     beginRemoveRows(QModelIndex(), 0, m_items.count()-1);
     m_items.clear();
+    m_rows.clear();
     endRemoveRows();
   }
   m_dataState = ListModel::NoData;
@@ -237,11 +283,21 @@ bool Tracks::load()
     beginResetModel();
     clear();
 
-    m_data.clear();
-    QList<MediaFilePtr> list = m_provider->allParsedFiles();
-    for (const MediaFilePtr& file : list)
-      onFileAdded(file);
+    const AggregateType& tracks = m_provider->index()->tracks();
+    if (!isFiltered())
+    {
+      // the rows are taken from the index as they are
+      m_items = tracks.values();
+    }
+    else
+    {
+      for (const MediaFilePtr& file : m_provider->index()->files(m_filter))
+        m_items << tracks.value(TrackModel::keyOf(*file));
+    }
 
+    if (m_sortBy != ListModel::SortNone)
+      std::sort(m_items.begin(), m_items.end(), [this](const ItemPtr& a, const ItemPtr& b) { return lessThan(a, b); });
+    indexRows(m_items, m_rows);
     m_dataState = ListModel::Loaded;
     endResetModel();
   }
@@ -250,21 +306,27 @@ bool Tracks::load()
   return true;
 }
 
-void Tracks::onFileAdded(const MediaFilePtr& file)
+bool Tracks::lessThan(const ItemPtr& a, const ItemPtr& b) const
+{
+  if (m_sortBy == ListModel::SortByYear && a->model.year() != b->model.year())
+    return a->model.year() < b->model.year();
+  if (m_sortBy == ListModel::SortByTrack && a->model.albumTrackNo() != b->model.albumTrackNo())
+    return a->model.albumTrackNo() < b->model.albumTrackNo();
+  int c = a->model.normalized().compare(b->model.normalized());
+  return (c != 0 ? c < 0 : a->model.key() < b->model.key());
+}
+
+void Tracks::onFilesAdded(const LibraryChanges& changes)
 {
-  QByteArray key;
-  if (
-          (m_artistFilter.isEmpty() || m_artistFilter.compare(file->mediaInfo->artist, Qt::CaseSensitivity::CaseInsensitive) == 0) &&
-          (m_albumFilter.isEmpty() || m_albumFilter.compare(file->mediaInfo->album, Qt::CaseSensitivity::CaseInsensitive) == 0) &&
-          (m_genreFilter.isEmpty() || m_genreFilter.compare(file->mediaInfo->genre, Qt::CaseSensitivity::CaseInsensitive) == 0) &&
-          (m_composerFilter.isEmpty() || m_composerFilter.compare(file->mediaInfo->composer, Qt::CaseSensitivity::CaseInsensitive) == 0) &&
-          m_data.insertFile(file, &key))
-    addItem(m_data.find(key).value());
+  // a filtered model is notified with the tracks matching its filter only
+  const AggregateType& tracks = m_provider->index()->tracks();
+  QList<ItemPtr> items;
+  for (const QByteArray& key : changes.tracks)
+    items << tracks.value(key);
+  addItems(items);
 }
 
-void Tracks::onFileRemoved(const MediaFilePtr& file)
+void Tracks::onFilesRemoved(const LibraryChanges& changes)
 {
-  QByteArray key;
-  if (m_data.removeFile(file, &key))
-    removeItem(key);
+  removeItems(changes.tracks);
 }
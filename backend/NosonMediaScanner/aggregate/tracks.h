@@ -30,13 +30,14 @@ class TrackModel : public Model
 public:
   TrackModel(const MediaFilePtr& file);
   const QByteArray& key() const { return m_key; }
+  static QByteArray keyOf(const MediaFile& file);
   const QString& title() { return m_file->mediaInfo->title; }
-  const QString& author() { return m_file->mediaInfo->artist; }
-  const QString& album() { return m_file->mediaInfo->album; }
-  const QString& genre() { return m_file->mediaInfo->genre; }
-  const QString& composer() { return m_file->mediaInfo->composer; }
+  const QString& author() { return m_file->mediaInfo->artist.value(); }
+  const QString& album() { return m_file->mediaInfo->album.value(); }
+  const QString& genre() { return m_file->mediaInfo->genre.value(); }
+  const QString& composer() { return m_file->mediaInfo->composer.value(); }
   const QString& codec() { return m_file->mediaInfo->codec; }
-  const QString& filePath() { return m_file->filePath; }
+  QString filePath() { return m_file->filePath(); }
   int albumTrackNo() { return m_file->mediaInfo->trackNo; }
   int year() { return m_file->mediaInfo->year; }
   int duration() { return m_file->mediaInfo->duration; }
@@ -94,17 +95,17 @@ public:
   virtual ~Tracks() override;
 
   const QString& artistFilter() { return m_artistFilter; }
-  void setArtistFilter(const QString& filter) { m_artistFilter = filter; emit artistChanged(); }
+  void setArtistFilter(const QString& filter);
   const QString& albumFilter() { return m_albumFilter; }
-  void setAlbumFilter(const QString& filter) { m_albumFilter = filter; emit albumChanged(); }
+  void setAlbumFilter(const QString& filter);
   const QString& genreFilter() { return m_genreFilter; }
-  void setGenreFilter(const QString& filter) { m_genreFilter = filter; emit genreChanged(); }
+  void setGenreFilter(const QString& filter);
   const QString& composerFilter() { return m_composerFilter; }
-  void setComposerFilter(const QString& filter) { m_composerFilter = filter; emit composerChanged(); }
+  void setComposerFilter(const QString& filter);
 
-  void addItem(ItemPtr& item);
+  void addItems(const QList<ItemPtr>& items);
 
-  void removeItem(const QByteArray& key);
+  void removeItems(const QList<QByteArray>& keys);
 
   int rowCount(const QModelIndex& parent = QModelIndex()) const override;
 
@@ -122,8 +123,10 @@ public:
 
   Q_INVOKABLE bool load() override;
 
-  void onFileAdded(const MediaFilePtr& file) override;
-  void onFileRemoved(const MediaFilePtr& file) override;
+  LibraryFilter filter() const override { return m_filter; }
+
+  void onFilesAdded(const LibraryChanges& changes) override;
+  void onFilesRemoved(const LibraryChanges& changes) override;
 
 signals:
   void countChanged();
@@ -139,12 +142,17 @@ protected:
   QHash<int, QByteArray> roleNames() const override;
 
 private:
-  AggregateType m_data;
   QList<ItemPtr> m_items;
+  QHash<QByteArray, int> m_rows;  // the row of each key
+
+  bool lessThan(const ItemPtr& a, const ItemPtr& b) const;
   QString m_artistFilter;
   QString m_albumFilter;
   QString m_genreFilter;
   QString m_composerFilter;
+  LibraryFilter m_filter;
+
+  bool isFiltered() const { return !m_filter.isEmpty(); }
 };
 
 }
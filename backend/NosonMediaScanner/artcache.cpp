@@ -0,0 +1,346 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "artcache.h"
+#include "mediadatabase.h"
+#include "mediaparser.h"
+#include "scannermetrics.h"
+#include "mediaextractor.h"
+#include "locked.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QSaveFile>
+#include <QDir>
+#include <QDirIterator>
+#include <QDataStream>
+#include <QBuffer>
+#include <QImage>
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+
+#define ARTCACHE_INDEX    "index"
+#define ARTCACHE_MAGIC    0x4e4d5341 // NMSA
+#define ARTCACHE_VERSION  2
+#define ARTCACHE_QUALITY  85
+
+using namespace mediascanner;
+
+/* the sizes of the variants, in ascending order */
+static const int _variants[] = { 128, 256, 512 };
+static const int _variants_len = sizeof(_variants) / sizeof(int);
+
+/* the suffixes of the originals, indexed by format */
+static const char * _suffixes[] = { "jpg", "png", "img" };
+
+static int _image_format(const QByteArray& image)
+{
+  if (image.startsWith("\xff\xd8"))
+    return 0;
+  if (image.startsWith("\x89PNG"))
+    return 1;
+  return 2;
+}
+
+ArtCache::ArtCache()
+: m_rootPath()
+, m_enabled(0)
+, m_entries()
+, m_images()
+, m_storing()
+, m_lock(new QMutex())
+, m_dirty(false)
+{
+}
+
+ArtCache::~ArtCache()
+{
+  delete m_lock;
+}
+
+bool ArtCache::load()
+{
+  LockGuard<QMutex> g(m_lock);
+  m_entries.clear();
+  m_images.clear();
+  m_dirty = false;
+  if (m_rootPath.isEmpty())
+    return false;
+
+  QFile file(QString(m_rootPath).append("/").append(ARTCACHE_INDEX));
+  if (!file.exists())
+    return true; // nothing to load
+  if (!file.open(QIODevice::ReadOnly))
+  {
+    qWarning("%s: cannot open %s", __FUNCTION__, file.fileName().toUtf8().constData());
+    return false;
+  }
+
+  QDataStream in(&file);
+  in.setVersion(QDataStream::Qt_5_6);
+  quint32 magic, version, count;
+  in >> magic >> version;
+  if (magic != ARTCACHE_MAGIC || version != ARTCACHE_VERSION)
+  {
+    qWarning("%s: discard incompatible index %s", __FUNCTION__, file.fileName().toUtf8().constData());
+    m_dirty = true;
+    return false;
+  }
+  in >> count;
+  while (count-- > 0 && in.status() == QDataStream::Ok)
+  {
+    QByteArray hash;
+    Image image;
+    qint32 side;
+    quint8 format;
+    in >> hash >> side >> format;
+    image.side = side;
+    image.format = (format < sizeof(_suffixes) / sizeof(_suffixes[0]) ? format : 0);
+    if (in.status() == QDataStream::Ok)
+      m_images.insert(hash, image);
+  }
+  in >> count;
+  m_entries.reserve(count);
+  while (count-- > 0 && in.status() == QDataStream::Ok)
+  {
+    QString path;
+    Entry entry;
+    in >> path >> entry.lastModified >> entry.hash;
+    if (in.status() == QDataStream::Ok)
+      m_entries.insert(path, entry);
+  }
+  if (in.status() != QDataStream::Ok)
+  {
+    qWarning("%s: discard corrupted index %s", __FUNCTION__, file.fileName().toUtf8().constData());
+    m_entries.clear();
+    m_images.clear();
+    m_dirty = true;
+    return false;
+  }
+  qInfo("%s: %d images for %d files loaded from %s", __FUNCTION__, m_images.size(), m_entries.size(), m_rootPath.toUtf8().constData());
+  return true;
+}
+
+bool ArtCache::save()
+{
+  LockGuard<QMutex> g(m_lock);
+  if (m_rootPath.isEmpty())
+    return false;
+  QDir().mkpath(m_rootPath);
+
+  QSaveFile file(QString(m_rootPath).append("/").append(ARTCACHE_INDEX));
+  if (!file.open(QIODevice::WriteOnly))
+  {
+    qWarning("%s: cannot open %s", __FUNCTION__, file.fileName().toUtf8().constData());
+    return false;
+  }
+
+  QDataStream out(&file);
+  out.setVersion(QDataStream::Qt_5_6);
+  out << (quint32)ARTCACHE_MAGIC << (quint32)ARTCACHE_VERSION;
+  out << (quint32)m_images.size();
+  for (QHash<QByteArray, Image>::const_iterator it = m_images.constBegin(); it != m_images.constEnd(); ++it)
+    out << it.key() << (qint32)it.value().side << (quint8)it.value().format;
+  out << (quint32)m_entries.size();
+  for (QHash<QString, Entry>::const_iterator it = m_entries.constBegin(); it != m_entries.constEnd(); ++it)
+    out << it.key() << it.value().lastModified << it.value().hash;
+  if (out.status() != QDataStream::Ok || !file.commit())
+  {
+    qWarning("%s: failed to write %s", __FUNCTION__, file.fileName().toUtf8().constData());
+    return false;
+  }
+  m_dirty = false;
+  return true;
+}
+
+bool ArtCache::find(const MediaFile& file)
+{
+  QString filePath = file.filePath();
+  LockGuard<QMutex> g(m_lock);
+  QHash<QString, Entry>::const_iterator it = m_entries.constFind(filePath);
+  return (it != m_entries.constEnd() && it.value().lastModified == file.mtime);
+}
+
+bool ArtCache::extract(MediaFile& file)
+{
+  IOStats io = IOStats::local();
+  QElapsedTimer timer;
+  timer.start();
+
+  QByteArray image;
+  QByteArray hash;
+  bool found = (file.parser && file.parser->extractArt(&file, image) && !image.isEmpty());
+  if (found)
+  {
+    hash = QCryptographicHash::hash(image, QCryptographicHash::Sha1).toHex();
+    bool stored;
+    {
+      LockGuard<QMutex> g(m_lock);
+      stored = (m_images.contains(hash) || m_storing.contains(hash));
+      if (!stored)
+        m_storing.insert(hash);
+    }
+    // a new image is written out of the lock
+    Image picture;
+    picture.format = _image_format(image);
+    picture.side = (stored ? 0 : storeImage(hash, image, picture.format));
+    LockGuard<QMutex> g(m_lock);
+    if (!stored)
+      m_storing.remove(hash);
+    if (picture.side < 0)
+      found = false;
+    else if (!stored)
+      m_images.insert(hash, picture);
+  }
+  {
+    // a picture which cannot be stored is recorded too, so the file is
+    // not parsed again until it changes
+    LockGuard<QMutex> g(m_lock);
+    Entry entry;
+    entry.lastModified = file.mtime;
+    if (found)
+      entry.hash = hash;
+    m_entries.insert(file.filePath(), entry);
+    m_dirty = true;
+  }
+
+  const IOStats& now = IOStats::local();
+  io.bytesRead = now.bytesRead - io.bytesRead;
+  io.reads = now.reads - io.reads;
+  io.seeks = now.seeks - io.seeks;
+  ScannerMetrics::addProbe("art", timer.nsecsElapsed() / 1000, io);
+  return found;
+}
+
+QString ArtCache::lookup(const QString& filePath, int size) const
+{
+  LockGuard<QMutex> g(m_lock);
+  QHash<QString, Entry>::const_iterator it = m_entries.constFind(filePath);
+  if (it == m_entries.constEnd())
+    return QString();
+  const QByteArray& hash = it.value().hash;
+  if (hash.isEmpty())
+    return QString(); // no picture
+  QHash<QByteArray, Image>::const_iterator image = m_images.constFind(hash);
+  if (image == m_images.constEnd())
+    return QString();
+  if (size > 0)
+  {
+    // a variant exists for the sizes lower than the image
+    for (int i = 0; i < _variants_len && _variants[i] < image.value().side; ++i)
+    {
+      if (_variants[i] >= size)
+        return imagePath(hash, _variants[i], image.value().format);
+    }
+  }
+  return imagePath(hash, 0, image.value().format);
+}
+
+int ArtCache::purge(const MediaDatabase& database)
+{
+  LockGuard<QMutex> g(m_lock);
+  QSet<QByteArray> linked;
+  QHash<QString, Entry>::iterator it = m_entries.begin();
+  while (it != m_entries.end())
+  {
+    const QByteArray& hash = it.value().hash;
+    if ((!hash.isEmpty() && !m_images.contains(hash)) || !database.contains(it.key(), it.value().lastModified))
+    {
+      it = m_entries.erase(it);
+      m_dirty = true;
+      continue;
+    }
+    if (!hash.isEmpty())
+      linked.insert(hash);
+    ++it;
+  }
+  QHash<QByteArray, Image>::iterator image = m_images.begin();
+  while (image != m_images.end())
+  {
+    if (!linked.contains(image.key()))
+    {
+      image = m_images.erase(image);
+      m_dirty = true;
+      continue;
+    }
+    ++image;
+  }
+  // sweep the files of the images erased, and those left by a discarded index
+  int removed = 0;
+  if (m_rootPath.isEmpty())
+    return removed;
+  QDirIterator files(m_rootPath, QDir::Files, QDirIterator::Subdirectories);
+  while (files.hasNext())
+  {
+    files.next();
+    QString name = files.fileName();
+    if (name == QLatin1String(ARTCACHE_INDEX))
+      continue;
+    int p = name.indexOf(QChar('-'));
+    if (p < 0)
+      p = name.indexOf(QChar('.'));
+    QByteArray hash = name.left(p).toLatin1();
+    if (m_images.contains(hash) || m_storing.contains(hash))
+      continue;
+    if (QFile::remove(files.filePath()))
+      ++removed;
+  }
+  return removed;
+}
+
+QString ArtCache::imagePath(const QByteArray& hash, int size, int format) const
+{
+  QString path(m_rootPath);
+  path.append(QChar('/')).append(QString::fromLatin1(hash.left(2))).append(QChar('/')).append(QString::fromLatin1(hash));
+  if (size > 0)
+    return path.append(QChar('-')).append(QString::number(size)).append(".jpg");
+  return path.append(QChar('.')).append(_suffixes[format]);
+}
+
+/**
+ * Write the image and its variants, and return the longest side of the
+ * image, or -1 on failure.
+ */
+int ArtCache::storeImage(const QByteArray& hash, const QByteArray& image, int format)
+{
+  QImage decoded;
+  if (!decoded.loadFromData(image))
+    return -1;
+  int side = qMax(decoded.width(), decoded.height());
+  QString path(m_rootPath);
+  path.append(QChar('/')).append(QString::fromLatin1(hash.left(2)));
+  QDir().mkpath(path);
+  path.append(QChar('/')).append(QString::fromLatin1(hash));
+
+  QSaveFile file(QString(path).append(QChar('.')).append(_suffixes[format]));
+  if (!file.open(QIODevice::WriteOnly) || file.write(image) != image.size() || !file.commit())
+  {
+    qWarning("%s: failed to write %s", __FUNCTION__, file.fileName().toUtf8().constData());
+    return -1;
+  }
+  for (int i = 0; i < _variants_len && _variants[i] < side; ++i)
+  {
+    QImage scaled = decoded.scaled(_variants[i], _variants[i], Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    QSaveFile variant(QString(path).append(QChar('-')).append(QString::number(_variants[i])).append(".jpg"));
+    if (!variant.open(QIODevice::WriteOnly) || !scaled.save(&variant, "JPG", ARTCACHE_QUALITY) || !variant.commit())
+    {
+      qWarning("%s: failed to write %s", __FUNCTION__, variant.fileName().toUtf8().constData());
+      return -1;
+    }
+  }
+  return side;
+}
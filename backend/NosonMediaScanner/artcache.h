@@ -0,0 +1,117 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef ARTCACHE_H
+#define ARTCACHE_H
+
+#include "mediafile.h"
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QSet>
+#include <QMutex>
+#include <QAtomicInt>
+
+namespace mediascanner
+{
+
+class MediaDatabase;
+
+/**
+ * The cache of the embedded pictures. The images are stored once on disk,
+ * addressed by the hash of their content, along with downscaled variants.
+ * The files are linked to their image by path and modification time, and
+ * the files holding the same picture share one image.
+ */
+class ArtCache
+{
+public:
+  ArtCache();
+  ~ArtCache();
+
+  void setRootPath(const QString& rootPath) { m_rootPath = rootPath; }
+  const QString& rootPath() const { return m_rootPath; }
+
+  void setEnabled(bool enabled) { m_enabled.store(enabled ? 1 : 0); }
+  bool isEnabled() const { return m_enabled.load() != 0; }
+
+  bool load();
+  bool save();
+  bool isDirty() const { return m_dirty; }
+
+  /**
+   * Check the picture of the file has been extracted, stored or not.
+   * @param file
+   * @return true if the file needs no extraction
+   */
+  bool find(const MediaFile& file);
+
+  /**
+   * Extract the image of the file with its parser, and store it. A picture
+   * which cannot be stored is recorded as missing until the file changes.
+   * @param file
+   * @return true if the file has its image
+   */
+  bool extract(MediaFile& file);
+
+  /**
+   * Return the path of the cached image for the file, in the smallest
+   * variant fitting the size, else the original.
+   * @param filePath
+   * @param size the size of the view, 0 for the original
+   * @return the path of the image, or empty when not cached
+   */
+  QString lookup(const QString& filePath, int size) const;
+
+  /**
+   * Erase the links of the files gone or changed since the database was
+   * purged, then the images no longer linked, and the files of the cache
+   * unknown to the index.
+   * @param database the purged database of the parsed files
+   * @return the count of files removed
+   */
+  int purge(const MediaDatabase& database);
+
+private:
+  struct Entry
+  {
+    qint64 lastModified;
+    QByteArray hash;    // empty when the picture cannot be stored
+  };
+
+  struct Image
+  {
+    int side;           // the longest side
+    int format;         // gives the suffix of the original
+  };
+
+  QString imagePath(const QByteArray& hash, int size, int format) const;
+  int storeImage(const QByteArray& hash, const QByteArray& image, int format);
+
+  QString m_rootPath;
+  QAtomicInt m_enabled;
+  QHash<QString, Entry> m_entries;
+  QHash<QByteArray, Image> m_images;
+  QSet<QByteArray> m_storing;           // the images written out of the lock
+  mutable QMutex * m_lock;
+  bool m_dirty;
+};
+
+}
+
+#endif /* ARTCACHE_H */
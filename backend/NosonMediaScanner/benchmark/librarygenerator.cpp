@@ -0,0 +1,578 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "librarygenerator.h"
+
+#include <QDir>
+#include <QFile>
+
+#define MP3_FRAME_SIZE        417   // MPEG1 layer 3, 128kbps, 44100Hz, no padding
+#define MP3_SAMPLES_PER_FRAME 1152
+#define OGG_PAGE_PAYLOAD      4096
+#define SAMPLE_RATE           44100
+#define PADDING_SIZE          256
+
+using namespace mediascanner;
+
+static const char * _kinds[] = { "flac", "mp3-xing", "mp3-vbri", "mp3-cbr", "ogg", "m4a" };
+static const char * _suffixes[] = { "flac", "mp3", "mp3", "mp3", "ogg", "m4a" };
+
+struct Genre
+{
+  const char * name;
+  unsigned char id3v1;
+};
+
+static const Genre _genres[] = {
+  { "Blues", 0 }, { "Classic Rock", 1 }, { "Country", 2 }, { "Dance", 3 },
+  { "Jazz", 8 }, { "Pop", 13 }, { "Rock", 17 }, { "Classical", 32 },
+};
+static const int _genres_len = sizeof(_genres) / sizeof(Genre);
+
+static void put8(QByteArray& b, unsigned v)
+{
+  b.append(char(v & 0xff));
+}
+
+static void put16be(QByteArray& b, unsigned v)
+{
+  put8(b, v >> 8);
+  put8(b, v);
+}
+
+static void put24be(QByteArray& b, unsigned v)
+{
+  put8(b, v >> 16);
+  put16be(b, v);
+}
+
+static void put32be(QByteArray& b, quint32 v)
+{
+  put16be(b, v >> 16);
+  put16be(b, v);
+}
+
+static void put32le(QByteArray& b, quint32 v)
+{
+  put8(b, v);
+  put8(b, v >> 8);
+  put8(b, v >> 16);
+  put8(b, v >> 24);
+}
+
+static void put64le(QByteArray& b, quint64 v)
+{
+  put32le(b, quint32(v));
+  put32le(b, quint32(v >> 32));
+}
+
+static void putAtom(QByteArray& b, const char * type, const QByteArray& payload)
+{
+  put32be(b, payload.size() + 8);
+  b.append(type, 4);
+  b.append(payload);
+}
+
+static quint32 _ogg_crc(const QByteArray& data)
+{
+  static quint32 table[256] = { 0 };
+  if (table[1] == 0)
+  {
+    for (quint32 i = 0; i < 256; ++i)
+    {
+      quint32 r = i << 24;
+      for (int k = 0; k < 8; ++k)
+        r = (r & 0x80000000) ? (r << 1) ^ 0x04c11db7 : (r << 1);
+      table[i] = r;
+    }
+  }
+  quint32 crc = 0;
+  for (int i = 0; i < data.size(); ++i)
+    crc = (crc << 8) ^ table[((crc >> 24) ^ (unsigned char)data.at(i)) & 0xff];
+  return crc;
+}
+
+LibraryGenerator::LibraryGenerator(const Options& options)
+: m_options(options)
+, m_state(options.seed ? options.seed : 1)
+, m_files(0)
+, m_directories(0)
+, m_bytes(0)
+, m_filesByKind()
+{
+}
+
+LibraryGenerator::Options LibraryGenerator::defaultOptions()
+{
+  Options options;
+  options.depth = 2;
+  options.fanout = 8;
+  options.filesPerDir = 12;
+  options.artists = 40;
+  options.albums = 4;
+  options.artSize = 16384;
+  options.audioSize = 32768;
+  options.seed = 1;
+  return options;
+}
+
+const char * LibraryGenerator::kindName(Kind kind)
+{
+  return (kind >= 0 && kind < KindCount ? _kinds[kind] : "");
+}
+
+bool LibraryGenerator::generate(const QString& rootPath)
+{
+  m_state = (m_options.seed ? m_options.seed : 1);
+  m_files = m_directories = 0;
+  m_bytes = 0;
+  m_filesByKind.clear();
+  int sequence = 0;
+  return generateDir(rootPath, 0, sequence);
+}
+
+bool LibraryGenerator::generateDir(const QString& dirPath, int level, int& sequence)
+{
+  if (!QDir().mkpath(dirPath))
+  {
+    qWarning("%s: cannot create %s", __FUNCTION__, dirPath.toUtf8().constData());
+    return false;
+  }
+  ++m_directories;
+  if (level < m_options.depth)
+  {
+    for (int i = 0; i < m_options.fanout; ++i)
+    {
+      QString name = QString("%1 %2").arg(QString(level == 0 ? "Artist" : "Album")).arg(i + 1, 3, 10, QChar('0'));
+      if (!generateDir(dirPath + "/" + name, level + 1, sequence))
+        return false;
+    }
+    return true;
+  }
+
+  for (int i = 0; i < m_options.filesPerDir; ++i, ++sequence)
+  {
+    Kind kind = Kind(sequence % KindCount);
+    Tags tags = nextTags(sequence);
+    tags.trackNo = i + 1;
+    QByteArray data;
+    switch (kind)
+    {
+    case KindFLAC:
+      data = makeFLAC(tags);
+      break;
+    case KindMP3Xing:
+    case KindMP3VBRI:
+    case KindMP3CBR:
+      data = makeMP3(tags, kind);
+      break;
+    case KindOGG:
+      data = makeOGG(tags);
+      break;
+    default:
+      data = makeM4A(tags);
+      break;
+    }
+    QString name = QString("%1 - %2.%3").arg(tags.trackNo, 2, 10, QChar('0')).arg(tags.title).arg(_suffixes[kind]);
+    if (!writeFile(dirPath + "/" + name, data))
+      return false;
+    m_filesByKind[_kinds[kind]] += 1;
+  }
+  return true;
+}
+
+bool LibraryGenerator::writeFile(const QString& filePath, const QByteArray& data)
+{
+  QFile file(filePath);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(data) != data.size())
+  {
+    qWarning("%s: cannot write %s", __FUNCTION__, filePath.toUtf8().constData());
+    return false;
+  }
+  ++m_files;
+  m_bytes += data.size();
+  return true;
+}
+
+unsigned LibraryGenerator::random()
+{
+  // xorshift32: cheap and reproducible on every platform
+  m_state ^= m_state << 13;
+  m_state ^= m_state >> 17;
+  m_state ^= m_state << 5;
+  return m_state;
+}
+
+LibraryGenerator::Tags LibraryGenerator::nextTags(int sequence)
+{
+  Tags tags;
+  unsigned artist = random() % unsigned(m_options.artists > 0 ? m_options.artists : 1);
+  unsigned album = random() % unsigned(m_options.albums > 0 ? m_options.albums : 1);
+  tags.title = QString("Track %1").arg(sequence + 1);
+  // some names with accents to exercise the normalization of the keys
+  if (artist % 4 == 3)
+    tags.artist = QString::fromUtf8("Orchestre de l'\xc3\x89t\xc3\xa9 %1").arg(artist + 1);
+  else
+    tags.artist = QString("Artist %1").arg(artist + 1);
+  tags.album = QString("%1 Album %2").arg(tags.artist).arg(album + 1);
+  tags.genre = QString::fromLatin1(_genres[(artist + album) % _genres_len].name);
+  tags.composer = QString("Composer %1").arg(artist % 7 + 1);
+  tags.year = 1960 + int(random() % 60);
+  tags.trackNo = 0;
+  tags.hasArt = (m_options.artSize > 0 && (random() & 1) == 0);
+  return tags;
+}
+
+QByteArray LibraryGenerator::makeArt()
+{
+  QByteArray art;
+  art.reserve(m_options.artSize);
+  // JFIF markers around a random body
+  art.append("\xff\xd8\xff\xe0", 4);
+  while (art.size() < m_options.artSize - 2)
+    put8(art, random());
+  art.append("\xff\xd9", 2);
+  return art;
+}
+
+QByteArray LibraryGenerator::makeVorbisComment(const Tags& tags, bool framing)
+{
+  QByteArray b;
+  QByteArray vendor("scannerbench");
+  put32le(b, vendor.size());
+  b.append(vendor);
+  QList<QByteArray> comments;
+  comments.push_back(QString("TITLE=%1").arg(tags.title).toUtf8());
+  comments.push_back(QString("ARTIST=%1").arg(tags.artist).toUtf8());
+  comments.push_back(QString("ALBUM=%1").arg(tags.album).toUtf8());
+  comments.push_back(QString("GENRE=%1").arg(tags.genre).toUtf8());
+  comments.push_back(QString("COMPOSER=%1").arg(tags.composer).toUtf8());
+  comments.push_back(QString("TRACKNUMBER=%1").arg(tags.trackNo).toUtf8());
+  comments.push_back(QString("DATE=%1-01-01").arg(tags.year).toUtf8());
+  put32le(b, comments.size());
+  for (const QByteArray& comment : comments)
+  {
+    put32le(b, comment.size());
+    b.append(comment);
+  }
+  if (framing)
+    put8(b, 1);
+  return b;
+}
+
+QByteArray LibraryGenerator::makeFLAC(const Tags& tags)
+{
+  QByteArray b("fLaC");
+  // STREAMINFO
+  quint64 samples = quint64(SAMPLE_RATE) * (60 + random() % 300);
+  put8(b, 0x00);
+  put24be(b, 34);
+  put16be(b, 4096);       // min block size
+  put16be(b, 4096);       // max block size
+  put24be(b, 0);          // min frame size
+  put24be(b, 0);          // max frame size
+  put32be(b, (quint32(SAMPLE_RATE) << 12) | ((2 - 1) << 9) | ((16 - 1) << 4) | quint32((samples >> 32) & 0x0f));
+  put32be(b, quint32(samples));
+  b.append(QByteArray(16, '\0')); // MD5
+  // VORBIS_COMMENT
+  QByteArray comment = makeVorbisComment(tags, false);
+  put8(b, 0x04);
+  put24be(b, comment.size());
+  b.append(comment);
+  // PICTURE
+  if (tags.hasArt)
+  {
+    QByteArray art = makeArt();
+    QByteArray picture;
+    put32be(picture, 3);  // front cover
+    put32be(picture, 10);
+    picture.append("image/jpeg");
+    put32be(picture, 0);  // description
+    put32be(picture, 300);
+    put32be(picture, 300);
+    put32be(picture, 24);
+    put32be(picture, 0);
+    put32be(picture, art.size());
+    picture.append(art);
+    put8(b, 0x06);
+    put24be(b, picture.size());
+    b.append(picture);
+  }
+  // PADDING is the last block
+  put8(b, 0x80 | 0x01);
+  put24be(b, PADDING_SIZE);
+  b.append(QByteArray(PADDING_SIZE, '\0'));
+  // frames
+  b.append("\xff\xf8", 2);
+  b.append(QByteArray(m_options.audioSize, '\0'));
+  return b;
+}
+
+QByteArray LibraryGenerator::makeID3v2(const Tags& tags)
+{
+  QByteArray frames;
+  struct { const char * id; QString text; } texts[] = {
+    { "TIT2", tags.title },
+    { "TPE1", tags.artist },
+    { "TALB", tags.album },
+    { "TCON", tags.genre },
+    { "TCOM", tags.composer },
+    { "TRCK", QString::number(tags.trackNo) },
+    { "TYER", QString::number(tags.year) },
+  };
+  for (const auto& text : texts)
+  {
+    QByteArray value = text.text.toLatin1();
+    frames.append(text.id, 4);
+    put32be(frames, value.size() + 1);
+    put16be(frames, 0);
+    put8(frames, 0x00); // ISO-8859-1
+    frames.append(value);
+  }
+  if (tags.hasArt)
+  {
+    QByteArray art = makeArt();
+    QByteArray apic;
+    put8(apic, 0x00);
+    apic.append("image/jpeg").append('\0');
+    put8(apic, 0x03); // front cover
+    put8(apic, 0x00); // empty description
+    apic.append(art);
+    frames.append("APIC", 4);
+    put32be(frames, apic.size());
+    put16be(frames, 0);
+    frames.append(apic);
+  }
+  frames.append(QByteArray(PADDING_SIZE, '\0'));
+
+  // ID3v2.3 header with a synchsafe size
+  QByteArray b("ID3");
+  put8(b, 0x03);
+  put8(b, 0x00);
+  put8(b, 0x00);
+  quint32 size = frames.size();
+  put8(b, (size >> 21) & 0x7f);
+  put8(b, (size >> 14) & 0x7f);
+  put8(b, (size >> 7) & 0x7f);
+  put8(b, size & 0x7f);
+  b.append(frames);
+  return b;
+}
+
+QByteArray LibraryGenerator::makeMP3(const Tags& tags, Kind kind)
+{
+  static const char header[4] = { '\xff', '\xfb', '\x90', '\x00' };
+  int count = m_options.audioSize / MP3_FRAME_SIZE;
+  if (count < 8)
+    count = 8;
+  QByteArray frame(MP3_FRAME_SIZE, '\0');
+  frame.replace(0, 4, header, 4);
+
+  QByteArray b;
+  if (kind != KindMP3CBR)
+    b.append(makeID3v2(tags));
+
+  // the VBR headers are stored in the first frame, after the side info
+  if (kind == KindMP3Xing)
+  {
+    QByteArray xing(frame.constData(), 4 + 32);
+    xing.append("Xing", 4);
+    put32be(xing, 0x03); // frames and bytes
+    put32be(xing, count);
+    put32be(xing, count * MP3_FRAME_SIZE);
+    b.append(xing).append(QByteArray(MP3_FRAME_SIZE - xing.size(), '\0'));
+  }
+  else if (kind == KindMP3VBRI)
+  {
+    QByteArray vbri(frame.constData(), 4 + 32);
+    vbri.append("VBRI", 4);
+    put16be(vbri, 1);    // version
+    put16be(vbri, 0);    // delay
+    put16be(vbri, 75);   // quality
+    put32be(vbri, count * MP3_FRAME_SIZE);
+    put32be(vbri, count);
+    put16be(vbri, 0);    // TOC entries
+    put16be(vbri, 1);    // TOC scale
+    put16be(vbri, 2);    // TOC entry size
+    put16be(vbri, 1);    // frames per TOC entry
+    b.append(vbri).append(QByteArray(MP3_FRAME_SIZE - vbri.size(), '\0'));
+  }
+  for (int i = 0; i < count; ++i)
+    b.append(frame);
+
+  // the headerless file is tagged by ID3v1 only
+  if (kind == KindMP3CBR)
+  {
+    QByteArray tag("TAG");
+    tag.append(tags.title.toLatin1().leftJustified(30, '\0', true));
+    tag.append(tags.artist.toLatin1().leftJustified(30, '\0', true));
+    tag.append(tags.album.toLatin1().leftJustified(30, '\0', true));
+    tag.append(QByteArray::number(tags.year));
+    tag.append(QByteArray(28, '\0'));
+    put8(tag, 0);
+    put8(tag, tags.trackNo);
+    unsigned char genre = 12; // Other
+    for (int i = 0; i < _genres_len; ++i)
+    {
+      if (tags.genre == QLatin1String(_genres[i].name))
+        genre = _genres[i].id3v1;
+    }
+    put8(tag, genre);
+    b.append(tag);
+  }
+  return b;
+}
+
+QByteArray LibraryGenerator::makeOggPage(const QByteArray& packet, unsigned char flags, quint64 granule, quint32 sequence)
+{
+  QByteArray page("OggS");
+  put8(page, 0);        // version
+  put8(page, flags);
+  put64le(page, granule);
+  put32le(page, m_options.seed);  // serial
+  put32le(page, sequence);
+  put32le(page, 0);     // CRC, computed below
+  QByteArray lacing;
+  int rest = packet.size();
+  for (; rest >= 255; rest -= 255)
+    put8(lacing, 255);
+  put8(lacing, rest);
+  put8(page, lacing.size());
+  page.append(lacing).append(packet);
+  quint32 crc = _ogg_crc(page);
+  page[22] = char(crc & 0xff);
+  page[23] = char((crc >> 8) & 0xff);
+  page[24] = char((crc >> 16) & 0xff);
+  page[25] = char((crc >> 24) & 0xff);
+  return page;
+}
+
+QByteArray LibraryGenerator::makeOGG(const Tags& tags)
+{
+  QByteArray b;
+  quint32 sequence = 0;
+  // identification header
+  QByteArray id;
+  put8(id, 0x01);
+  id.append("vorbis", 6);
+  put32le(id, 0);           // version
+  put8(id, 2);              // channels
+  put32le(id, SAMPLE_RATE);
+  put32le(id, 0);           // bitrate maximum
+  put32le(id, 128000);      // bitrate nominal
+  put32le(id, 0);           // bitrate minimum
+  put8(id, 0xb8);           // block sizes 256 and 2048
+  put8(id, 0x01);           // framing
+  b.append(makeOggPage(id, 0x02, 0, sequence++));
+  // comment header
+  QByteArray comment;
+  put8(comment, 0x03);
+  comment.append("vorbis", 6);
+  comment.append(makeVorbisComment(tags, true));
+  b.append(makeOggPage(comment, 0x00, 0, sequence++));
+  // setup header: a placeholder, as no one decodes the audio
+  QByteArray setup;
+  put8(setup, 0x05);
+  setup.append("vorbis", 6);
+  setup.append(QByteArray(64, '\0'));
+  put8(setup, 0x01);
+  b.append(makeOggPage(setup, 0x00, 0, sequence++));
+  // audio pages, the last one flagged end of stream
+  quint64 samples = quint64(SAMPLE_RATE) * (60 + random() % 300);
+  int pages = (m_options.audioSize + OGG_PAGE_PAYLOAD - 1) / OGG_PAGE_PAYLOAD;
+  if (pages < 1)
+    pages = 1;
+  for (int i = 1; i <= pages; ++i)
+  {
+    quint64 granule = samples * i / pages;
+    b.append(makeOggPage(QByteArray(OGG_PAGE_PAYLOAD, '\0'), (i == pages ? 0x04 : 0x00), granule, sequence++));
+  }
+  return b;
+}
+
+static QByteArray _m4a_item(const char * type, unsigned dataType, const QByteArray& value)
+{
+  QByteArray data;
+  put32be(data, dataType);
+  put32be(data, 0);     // locale
+  data.append(value);
+  QByteArray atom;
+  putAtom(atom, "data", data);
+  QByteArray item;
+  putAtom(item, type, atom);
+  return item;
+}
+
+QByteArray LibraryGenerator::makeM4A(const Tags& tags)
+{
+  QByteArray b;
+  QByteArray ftyp("M4A ");
+  put32be(ftyp, 0);
+  ftyp.append("M4A mp42isom");
+  putAtom(b, "ftyp", ftyp);
+
+  quint32 duration = SAMPLE_RATE * (60 + random() % 300);
+  QByteArray mvhd;
+  put32be(mvhd, 0);             // version and flags
+  put32be(mvhd, 0);             // creation time
+  put32be(mvhd, 0);             // modification time
+  put32be(mvhd, SAMPLE_RATE);   // time scale
+  put32be(mvhd, duration);
+  put32be(mvhd, 0x00010000);    // rate
+  put16be(mvhd, 0x0100);        // volume
+  mvhd.append(QByteArray(10, '\0'));
+  static const quint32 matrix[9] = { 0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000 };
+  for (quint32 v : matrix)
+    put32be(mvhd, v);
+  mvhd.append(QByteArray(24, '\0'));
+  put32be(mvhd, 2);             // next track id
+
+  QByteArray ilst;
+  ilst.append(_m4a_item("\xa9nam", 1, tags.title.toUtf8()));
+  ilst.append(_m4a_item("\xa9" "ART", 1, tags.artist.toUtf8()));
+  ilst.append(_m4a_item("\xa9" "alb", 1, tags.album.toUtf8()));
+  ilst.append(_m4a_item("\xa9gen", 1, tags.genre.toUtf8()));
+  ilst.append(_m4a_item("\xa9wrt", 1, tags.composer.toUtf8()));
+  ilst.append(_m4a_item("\xa9" "day", 1, QByteArray::number(tags.year)));
+  QByteArray trkn;
+  put16be(trkn, 0);
+  put16be(trkn, tags.trackNo);
+  put16be(trkn, 0);
+  put16be(trkn, 0);
+  ilst.append(_m4a_item("trkn", 0, trkn));
+  if (tags.hasArt)
+    ilst.append(_m4a_item("covr", 13, makeArt()));
+
+  QByteArray hdlr;
+  put32be(hdlr, 0);
+  put32be(hdlr, 0);
+  hdlr.append("mdirappl", 8);
+  hdlr.append(QByteArray(9, '\0'));
+  QByteArray meta;
+  put32be(meta, 0);             // version and flags
+  putAtom(meta, "hdlr", hdlr);
+  putAtom(meta, "ilst", ilst);
+  QByteArray udta;
+  putAtom(udta, "meta", meta);
+  QByteArray moov;
+  putAtom(moov, "mvhd", mvhd);
+  putAtom(moov, "udta", udta);
+  putAtom(b, "moov", moov);
+
+  putAtom(b, "mdat", QByteArray(m_options.audioSize, '\0'));
+  return b;
+}
@@ -0,0 +1,115 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LIBRARYGENERATOR_H
+#define LIBRARYGENERATOR_H
+
+#include <QString>
+#include <QByteArray>
+#include <QMap>
+
+namespace mediascanner
+{
+
+/**
+ * Generate a synthetic music library for the scanner benchmark. The tree is
+ * fully determined by the options, so two runs with the same seed produce
+ * the same files. Each leaf directory gets a mix of FLAC, MP3 (Xing, VBRI
+ * and headerless CBR), Ogg Vorbis and M4A files, with small valid headers,
+ * tags and optional cover art, followed by a dummy payload.
+ */
+class LibraryGenerator
+{
+public:
+  struct Options
+  {
+    int depth;            // levels of directories below the root
+    int fanout;           // sub-directories per directory
+    int filesPerDir;      // files per leaf directory
+    int artists;          // distinct artists in the tags
+    int albums;           // distinct albums per artist
+    int artSize;          // size of the embedded cover art, 0 for none
+    int audioSize;        // size of the dummy audio payload
+    unsigned seed;
+  };
+
+  enum Kind
+  {
+    KindFLAC = 0,
+    KindMP3Xing,
+    KindMP3VBRI,
+    KindMP3CBR,
+    KindOGG,
+    KindM4A,
+    KindCount
+  };
+
+  explicit LibraryGenerator(const Options& options);
+
+  /**
+   * Write the tree in the given directory, which is created if needed.
+   * @return false on write error
+   */
+  bool generate(const QString& rootPath);
+
+  int files() const { return m_files; }
+  int directories() const { return m_directories; }
+  qint64 bytes() const { return m_bytes; }
+  const QMap<QString, int>& filesByKind() const { return m_filesByKind; }
+
+  static Options defaultOptions();
+  static const char * kindName(Kind kind);
+
+private:
+  struct Tags
+  {
+    QString title;
+    QString artist;
+    QString album;
+    QString genre;
+    QString composer;
+    int year;
+    int trackNo;
+    bool hasArt;
+  };
+
+  bool generateDir(const QString& dirPath, int level, int& sequence);
+  bool writeFile(const QString& filePath, const QByteArray& data);
+  Tags nextTags(int sequence);
+  unsigned random();
+
+  QByteArray makeFLAC(const Tags& tags);
+  QByteArray makeMP3(const Tags& tags, Kind kind);
+  QByteArray makeOGG(const Tags& tags);
+  QByteArray makeM4A(const Tags& tags);
+
+  QByteArray makeArt();
+  QByteArray makeID3v2(const Tags& tags);
+  QByteArray makeVorbisComment(const Tags& tags, bool framing);
+  QByteArray makeOggPage(const QByteArray& packet, unsigned char flags, quint64 granule, quint32 sequence);
+
+  Options m_options;
+  unsigned m_state;
+  int m_files;
+  int m_directories;
+  qint64 m_bytes;
+  QMap<QString, int> m_filesByKind;
+};
+
+}
+
+#endif /* LIBRARYGENERATOR_H */
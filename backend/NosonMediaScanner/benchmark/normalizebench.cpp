@@ -0,0 +1,217 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Micro-benchmark of the normalization of the tags.
+ *
+ * A corpus of tags is drawn from a list of names in various scripts, with
+ * the given share of pure ASCII, as a western library is mostly. Then the
+ * reference normalization, the one with the ASCII fast path, and the lookup
+ * of the interned tags are timed over the corpus. The results of the fast
+ * path are checked against the reference.
+ */
+
+#include "stringpool.h"
+#include "tools.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QVector>
+
+#include <cstdio>
+
+#define DEFAULT_TAGS          100000
+#define DEFAULT_ROUNDS        5
+#define DEFAULT_ASCII         80
+
+using namespace mediascanner;
+
+static const char * _names[] = {
+  "The Beatles",
+  "Pink Floyd",
+  "Miles Davis Quintet",
+  "Rock",
+  "Hip-Hop",
+  "Original Soundtrack",
+  "Led Zeppelin",
+  "Kind of Blue",
+  "Electronic",
+  "Johann Sebastian Bach",
+  "Beyonc\xc3\xa9",
+  "Sigur R\xc3\xb3s",
+  "Mot\xc3\xb6rhead",
+  "\xc3\x89" "dith Piaf",
+  "Cam\xc3\xa9l\xc3\xa9on",
+  "Musique du Monde",
+  "Bj\xc3\xb6rk",
+  "Die \xc3\x84rzte",
+  "Stra\xc3\x9f" "enmusik",
+  "Antonin Dvo\xc5\x99\xc3\xa1k",
+  "Fr\xc3\xa9" "d\xc3\xa9ric Chopin",
+  "Wojciech Kilar",
+  "\xc5\x81\xc3\xb3" "d\xc5\xba",
+  "Jo\xc3\xa3o Gilberto",
+  "Canci\xc3\xb3n",
+  "Ma\xc3\xb1" "ana",
+  "T\xc3\xbcrk\xc3\xbc",
+  "Sezen Aksu",
+  "Tr\xe1\xbb\x8bnh C\xc3\xb4ng S\xc6\xa1n",
+  "Nh\xe1\xba\xa1" "c Tr\xe1\xba\xbb",
+  "\xce\x9c\xce\xaf\xce\xba\xce\xb7\xcf\x82 \xce\x98\xce\xb5\xce\xbf\xce\xb4\xcf\x89\xcf\x81\xce\xac\xce\xba\xce\xb7\xcf\x82",
+  "\xd0\x9f\xd1\x91\xd1\x82\xd1\x80 \xd0\xa7\xd0\xb0\xd0\xb9\xd0\xba\xd0\xbe\xd0\xb2\xd1\x81\xd0\xba\xd0\xb8\xd0\xb9",
+  "\xd0\x9a\xd0\xb8\xd0\xbd\xd0\xbe",
+  "\xe5\x9d\x82\xe6\x9c\xac\xe9\xbe\x8d\xe4\xb8\x80",
+  "\xe3\x82\xb5\xe3\x82\xab\xe3\x83\x8a\xe3\x82\xaf\xe3\x82\xb7\xe3\x83\xa7\xe3\x83\xb3",
+  "\xe3\x81\x8d\xe3\x82\x83\xe3\x82\x8a\xe3\x83\xbc\xe3\x81\xb1\xe3\x81\xbf\xe3\x82\x85\xe3\x81\xb1\xe3\x81\xbf\xe3\x82\x85",
+  "\xe5\x91\xa8\xe6\x9d\xb0\xe5\x80\xab",
+  "\xe7\x8e\x8b\xe8\x8f\xb2",
+  "\xeb\xb0\xa9\xed\x83\x84\xec\x86\x8c\xeb\x85\x84\xeb\x8b\xa8",
+  "\xec\x95\x84\xec\x9d\xb4\xec\x9c\xa0",
+  "\xd9\x81\xd9\x8a\xd8\xb1\xd9\x88\xd8\xb2",
+  "\xd8\xa3\xd9\x85\xd9\x91 \xd9\x83\xd9\x84\xd8\xab\xd9\x88\xd9\x85",
+  "\xd7\xa2\xd7\x95\xd7\xa4\xd7\xa8\xd7\x94 \xd7\x97\xd7\x96\xd7\x94",
+  "Ry\xc5\xabichi Sakamoto",
+  "Ensemble Mod\xc3\xa9rn",
+};
+
+static const char * _suffixes[] = {
+  "", "", "", " (Live)", " - Remastered", " Vol. 2", " [Deluxe Edition]", " feat. ",
+};
+
+/**
+ * The normalization without the fast path.
+ */
+static QString referenceNormalizedString(const QString& str)
+{
+  QString ret;
+  QString tmp = str.normalized(QString::NormalizationForm_D);
+  ret.reserve(tmp.size());
+  for (QString::const_iterator it = tmp.begin(); it != tmp.end(); ++it)
+  {
+    int cat = it->category();
+    if (cat != QChar::Mark_NonSpacing && cat != QChar::Mark_SpacingCombining)
+      ret.append(*it);
+  }
+  return ret;
+}
+
+static QVector<QString> makeCorpus(int count, int asciiPercent, unsigned seed)
+{
+  QStringList ascii, other;
+  for (const char * name : _names)
+  {
+    QString str = QString::fromUtf8(name);
+    if (isAsciiString(str))
+      ascii.push_back(str);
+    else
+      other.push_back(str);
+  }
+  const int suffixes = sizeof(_suffixes) / sizeof(_suffixes[0]);
+  unsigned state = (seed ? seed : 1);
+  auto random = [&state]() { state ^= state << 13; state ^= state >> 17; state ^= state << 5; return state; };
+  QVector<QString> corpus;
+  corpus.reserve(count);
+  for (int i = 0; i < count; ++i)
+  {
+    bool isAscii = (int(random() % 100) < asciiPercent);
+    const QStringList& names = (isAscii ? ascii : other);
+    QString tag = names[random() % unsigned(names.size())];
+    tag.append(QString::fromLatin1(_suffixes[random() % unsigned(suffixes)]));
+    // the featured artist keeps the script of the tag
+    if (tag.endsWith(' '))
+      tag.append(names[random() % unsigned(names.size())]);
+    // a number so the tags are distinct, as the tracks of an album
+    tag.append(QString(" %1").arg(i % 997));
+    corpus.push_back(tag);
+  }
+  return corpus;
+}
+
+template<class F>
+static double timeRounds(const QVector<QString>& corpus, int rounds, F normalize, qint64& checksum)
+{
+  QElapsedTimer timer;
+  qint64 best = -1;
+  for (int r = 0; r < rounds; ++r)
+  {
+    checksum = 0;
+    timer.start();
+    for (const QString& tag : corpus)
+      checksum += normalize(tag).size();
+    qint64 elapsed = timer.nsecsElapsed();
+    if (best < 0 || elapsed < best)
+      best = elapsed;
+  }
+  return (corpus.isEmpty() ? 0.0 : double(best) / corpus.size());
+}
+
+int main(int argc, char *argv[])
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("normalizebench");
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Micro-benchmark of the normalization of the tags");
+  parser.addHelpOption();
+  QCommandLineOption tagsOption("tags", "Number of tags in the corpus.", "n", QString::number(DEFAULT_TAGS));
+  QCommandLineOption roundsOption("rounds", "Rounds over the corpus, the best is reported.", "n", QString::number(DEFAULT_ROUNDS));
+  QCommandLineOption asciiOption("ascii", "Share of pure ASCII tags in percent.", "percent", QString::number(DEFAULT_ASCII));
+  QCommandLineOption seedOption("seed", "Seed of the corpus.", "n", "1");
+  parser.addOptions({ tagsOption, roundsOption, asciiOption, seedOption });
+  parser.process(app);
+
+  int rounds = qMax(1, parser.value(roundsOption).toInt());
+  QVector<QString> corpus = makeCorpus(qMax(1, parser.value(tagsOption).toInt()),
+                                       qBound(0, parser.value(asciiOption).toInt(), 100),
+                                       parser.value(seedOption).toUInt());
+
+  int ascii = 0, mismatches = 0;
+  for (const QString& tag : corpus)
+  {
+    if (isAsciiString(tag))
+      ++ascii;
+    if (normalizedString(tag) != referenceNormalizedString(tag))
+    {
+      if (mismatches++ == 0)
+        fprintf(stderr, "mismatch on \"%s\"\n", tag.toUtf8().constData());
+    }
+  }
+
+  qint64 sumReference = 0, sumFast = 0, sumInterned = 0;
+  double reference = timeRounds(corpus, rounds, referenceNormalizedString, sumReference);
+  double fast = timeRounds(corpus, rounds, [](const QString& tag) { return normalizedString(tag); }, sumFast);
+  // the pool is warm after the first round, as when the tags are repeated
+  // over the files of a library
+  double interned = timeRounds(corpus, rounds, [](const QString& tag) {
+    return StringPool::instance().intern(tag).normalized();
+  }, sumInterned);
+
+  fprintf(stdout, "%d tags, %d%% ascii, best of %d rounds\n", corpus.size(), 100 * ascii / corpus.size(), rounds);
+  fprintf(stdout, "%-12s %10s %9s\n", "method", "ns/tag", "speedup");
+  fprintf(stdout, "%-12s %10.1f %9.2f\n", "reference", reference, 1.0);
+  fprintf(stdout, "%-12s %10.1f %9.2f\n", "fast path", fast, (fast > 0 ? reference / fast : 0.0));
+  fprintf(stdout, "%-12s %10.1f %9.2f\n", "interned", interned, (interned > 0 ? reference / interned : 0.0));
+  if (mismatches > 0 || sumFast != sumReference || sumInterned != sumReference)
+  {
+    fprintf(stderr, "%d tags differ from the reference\n", mismatches);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,523 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Benchmark of the media scanner over a synthetic library.
+ *
+ * The library is generated first, then the scanner is run over it once per
+ * thread count and run, each time in a fresh child process, so the peak RSS
+ * and the syscall counters of a run are not polluted by the previous one.
+ * Unless --warm is given the index is removed before each run: the runs are
+ * cold for the scanner, not for the page cache, which isn't dropped.
+ * With --remove the root is removed once scanned, and the time to empty the
+ * list models of the library is measured.
+ */
+
+#include "librarygenerator.h"
+#include "mediascanner.h"
+#include "mediafile.h"
+#include "directorytable.h"
+#include "stringpool.h"
+#include "bytesource.h"
+#include "id3parser.h"
+#include "prefetcher.h"
+#include "aggregate/artists.h"
+#include "aggregate/albums.h"
+#include "aggregate/genres.h"
+#include "aggregate/composers.h"
+#include "aggregate/tracks.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QProcess>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QFile>
+#include <QDir>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QAtomicInt>
+
+#include <sys/resource.h>
+#include <cstdio>
+#include <algorithm>
+
+#define APPLICATION_NAME      "scannerbench"
+#define DATABASE_FILE         "mediascanner.db"
+#define POLL_INTERVAL_MS      20
+#define DEFAULT_THREADS       "1,2,4,8"
+#define DEFAULT_RUNS          3
+#define DEFAULT_TIMEOUT       600
+#define DEFAULT_PREFETCH      "none"
+
+using namespace mediascanner;
+
+struct ProcStats
+{
+  qint64 readSyscalls;
+  qint64 writeSyscalls;
+  qint64 readBytes;
+  qint64 peakRssKB;
+  qint64 voluntarySwitches;
+  qint64 involuntarySwitches;
+
+  static ProcStats sample()
+  {
+    ProcStats stats = { -1, -1, -1, -1, -1, -1 };
+    // the syscall counters need the task IO accounting of the kernel
+    QFile file("/proc/self/io");
+    if (file.open(QIODevice::ReadOnly))
+    {
+      for (const QByteArray& line : file.readAll().split('\n'))
+      {
+        if (line.startsWith("syscr:"))
+          stats.readSyscalls = line.mid(6).trimmed().toLongLong();
+        else if (line.startsWith("syscw:"))
+          stats.writeSyscalls = line.mid(6).trimmed().toLongLong();
+        else if (line.startsWith("rchar:"))
+          stats.readBytes = line.mid(6).trimmed().toLongLong();
+      }
+    }
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+      stats.peakRssKB = usage.ru_maxrss;
+      stats.voluntarySwitches = usage.ru_nvcsw;
+      stats.involuntarySwitches = usage.ru_nivcsw;
+    }
+    return stats;
+  }
+};
+
+static qint64 delta(qint64 before, qint64 after)
+{
+  return (before < 0 || after < 0 ? -1 : after - before);
+}
+
+static QString databasePath()
+{
+  return QStandardPaths::writableLocation(QStandardPaths::CacheLocation).append("/").append(DATABASE_FILE);
+}
+
+/**
+ * Fill the list models from the scanned library, then remove the root and
+ * wait until the models are emptied.
+ * @return the elapsed time in milliseconds, or -1 on timeout
+ */
+static qint64 removeRoot(QCoreApplication& app, const QString& rootPath, int timeout, int& rows)
+{
+  MediaScanner * scanner = MediaScanner::instance();
+  Artists artists;
+  Albums albums;
+  Genres genres;
+  Composers composers;
+  Tracks tracks;
+  QList<ListModel*> models = { &artists, &albums, &genres, &composers, &tracks };
+  artists.init();
+  albums.init();
+  genres.init();
+  composers.init();
+  tracks.init();
+  rows = 0;
+  for (ListModel * model : models)
+    rows += model->rowCount();
+
+  qint64 elapsed = -1;
+  QElapsedTimer timer;
+  QTimer poll;
+  poll.setInterval(POLL_INTERVAL_MS);
+  QObject::connect(&poll, &QTimer::timeout, [&]() {
+    int count = 0;
+    for (ListModel * model : models)
+      count += model->rowCount();
+    if (count == 0)
+    {
+      elapsed = timer.elapsed();
+      app.quit();
+    }
+    else if (timer.elapsed() > qint64(timeout) * 1000)
+      app.quit();
+  });
+
+  timer.start();
+  scanner->removeRootPath(rootPath);
+  poll.start();
+  app.exec();
+  poll.stop();
+  return elapsed;
+}
+
+/**
+ * Scan the library with the given number of threads, and print the sample
+ * as a JSON object on the standard output.
+ */
+static int runChild(QCoreApplication& app, const QString& rootPath, int threads, int timeout, bool debug, bool remove)
+{
+  MediaScanner * scanner = MediaScanner::instance();
+  scanner->debug(debug);
+  scanner->clearRoots();
+  scanner->addRootPath(rootPath);
+
+  // the signal is emitted by the engine thread when the scanner starts and
+  // stops working, that is once the extraction is drained
+  QAtomicInt transitions(0);
+  QObject::connect(scanner, &MediaScanner::workingChanged, [&transitions]() { transitions.ref(); });
+
+  bool timedOut = false;
+  qint64 wallMs = 0;
+  QElapsedTimer timer;
+  QTimer poll;
+  poll.setInterval(POLL_INTERVAL_MS);
+  QObject::connect(&poll, &QTimer::timeout, [&]() {
+    int count = transitions.load();
+    if (count > 0 && (count & 1) == 0)
+    {
+      // the walk and the extraction are over
+      wallMs = timer.elapsed();
+      app.quit();
+      return;
+    }
+    if (timer.elapsed() > qint64(timeout) * 1000)
+    {
+      timedOut = true;
+      wallMs = timer.elapsed();
+      app.quit();
+    }
+  });
+
+  ProcStats before = ProcStats::sample();
+  timer.start();
+  scanner->start(threads);
+  poll.start();
+  app.exec();
+  poll.stop();
+  ProcStats after = ProcStats::sample();
+
+  QVariantMap metrics = scanner->metrics();
+  qint64 parserReads = 0, parserSeeks = 0;
+  QVariantMap parsers = metrics["parsers"].toMap();
+  for (const QVariant& item : parsers)
+  {
+    parserReads += item.toMap()["reads"].toLongLong();
+    parserSeeks += item.toMap()["seeks"].toLongLong();
+  }
+  QList<MediaFilePtr> files = scanner->allParsedFiles();
+  qint64 footprint = DirectoryTable::instance().footprint();
+  for (const MediaFilePtr& file : files)
+    footprint += file->footprint();
+  qint64 count = metrics["files"].toLongLong();
+
+  static const char * prefetchModes[] = { "none", "advise", "uring" };
+  QJsonObject sample;
+  sample["threads"] = threads;
+  // the size chosen by the tuner for the device of the library, and why
+  QVariantMap concurrency = metrics["concurrency"].toMap();
+  QVariantMap device = concurrency["devices"].toMap()[concurrency["current"].toString()].toMap();
+  if (!device.isEmpty())
+  {
+    sample["tunedThreads"] = device["threads"].toInt();
+    sample["tuning"] = device["rationale"].toString();
+  }
+  sample["prefetch"] = prefetchModes[Prefetcher::mode()];
+  sample["timedOut"] = timedOut;
+  sample["wallMs"] = wallMs;
+  sample["files"] = count;
+  sample["parsed"] = metrics["parsed"].toLongLong();
+  sample["failed"] = metrics["failed"].toLongLong();
+  sample["cached"] = metrics["cached"].toLongLong();
+  sample["retries"] = metrics["retries"].toLongLong();
+  sample["duplicates"] = metrics["duplicates"].toLongLong();
+  qint64 extracted = metrics["parsed"].toLongLong() + metrics["failed"].toLongLong();
+  sample["filesPerSec"] = (wallMs > 0 ? 1000.0 * extracted / wallMs : 0.0);
+  sample["peakRssKB"] = after.peakRssKB;
+  sample["startRssKB"] = before.peakRssKB;
+  sample["readSyscalls"] = delta(before.readSyscalls, after.readSyscalls);
+  sample["writeSyscalls"] = delta(before.writeSyscalls, after.writeSyscalls);
+  sample["readBytes"] = delta(before.readBytes, after.readBytes);
+  sample["parserReads"] = parserReads;
+  sample["parserSeeks"] = parserSeeks;
+  sample["parserBytesRead"] = metrics["bytesRead"].toLongLong();
+  sample["contextSwitches"] = delta(before.voluntarySwitches, after.voluntarySwitches) +
+                              delta(before.involuntarySwitches, after.involuntarySwitches);
+  sample["indexBytesPerFile"] = (files.isEmpty() ? 0 : footprint / files.size());
+  sample["internedTags"] = StringPool::instance().count();
+  sample["queueMaxDepth"] = metrics["queue"].toMap()["maxDepth"].toInt();
+  sample["queueWaits"] = metrics["queue"].toMap()["enqueueWaits"].toLongLong();
+  sample["probes"] = QJsonObject::fromVariantMap(metrics["probes"].toMap());
+  if (remove && !timedOut)
+  {
+    int rows = 0;
+    qint64 removeMs = removeRoot(app, rootPath, timeout, rows);
+    timedOut = (removeMs < 0);
+    sample["timedOut"] = timedOut;
+    sample["removeMs"] = removeMs;
+    sample["removedRows"] = rows;
+  }
+
+  fprintf(stdout, "%s\n", QJsonDocument(sample).toJson(QJsonDocument::Compact).constData());
+  fflush(stdout);
+
+  delete scanner;
+  return (timedOut ? 1 : 0);
+}
+
+static bool spawnChild(const QStringList& arguments, int timeout, bool debug, QJsonObject& sample)
+{
+  QProcess child;
+  child.setProcessChannelMode(debug ? QProcess::ForwardedErrorChannel : QProcess::SeparateChannels);
+  child.start(QCoreApplication::applicationFilePath(), arguments);
+  if (!child.waitForStarted() || !child.waitForFinished(timeout * 1000 + 30000))
+  {
+    child.kill();
+    child.waitForFinished();
+    return false;
+  }
+  QList<QByteArray> lines = child.readAllStandardOutput().trimmed().split('\n');
+  QJsonDocument doc = QJsonDocument::fromJson(lines.last());
+  if (!doc.isObject())
+  {
+    if (!debug)
+      fprintf(stderr, "%s", child.readAllStandardError().constData());
+    return false;
+  }
+  sample = doc.object();
+  return (child.exitStatus() == QProcess::NormalExit && child.exitCode() == 0);
+}
+
+static void printSample(const QJsonObject& s)
+{
+  double files = s["files"].toDouble();
+  QString threads = (s["threads"].toInt() == MEDIASCANNER_AUTO_THREAD
+                     ? QString("auto:%1").arg(s["tunedThreads"].toInt()) : QString::number(s["threads"].toInt()));
+  fprintf(stdout, "%8s %7s %9lld %9.1f %9lld %11lld %9.1f %11lld %11lld %9lld %9lld %9lld %9lld\n",
+          s["prefetch"].toString().toUtf8().constData(),
+          threads.toUtf8().constData(),
+          (long long)s["wallMs"].toDouble(),
+          s["filesPerSec"].toDouble(),
+          (long long)s["peakRssKB"].toDouble(),
+          (long long)s["readSyscalls"].toDouble(),
+          (files > 0 ? s["readSyscalls"].toDouble() / files : 0.0),
+          (long long)s["writeSyscalls"].toDouble(),
+          (long long)s["parserReads"].toDouble(),
+          (long long)s["parserSeeks"].toDouble(),
+          (long long)s["contextSwitches"].toDouble(),
+          (long long)s["indexBytesPerFile"].toDouble(),
+          (long long)s["removeMs"].toDouble(-1));
+}
+
+int main(int argc, char *argv[])
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName(APPLICATION_NAME);
+  // keep the index of the benchmark apart from the user one
+  QStandardPaths::setTestModeEnabled(true);
+
+  LibraryGenerator::Options gen = LibraryGenerator::defaultOptions();
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Benchmark of the media scanner over a synthetic library");
+  parser.addHelpOption();
+  QCommandLineOption rootOption("root", "Generate the library in <dir>, else in a temporary directory.", "dir");
+  QCommandLineOption threadsOption("threads", "Comma separated list of thread counts to run, auto to let the scanner tune it.", "list", DEFAULT_THREADS);
+  QCommandLineOption runsOption("runs", "Number of runs per thread count, the median is reported.", "n", QString::number(DEFAULT_RUNS));
+  QCommandLineOption warmOption("warm", "Keep the index between runs, to measure a rescan.");
+  QCommandLineOption timeoutOption("timeout", "Abort a run after <sec> seconds.", "sec", QString::number(DEFAULT_TIMEOUT));
+  QCommandLineOption jsonOption("json", "Write all the samples to <file>.", "file");
+  QCommandLineOption debugOption("debug", "Enable the debug output of the scanner.");
+  QCommandLineOption mmapOption("mmap", "Let the parsers map the files in memory.");
+  QCommandLineOption durationOption("duration", "Duration mode of the MP3 without VBR header: header, sampled or exact.", "mode", "sampled");
+  QCommandLineOption removeOption("remove", "Remove the root once scanned, and measure the time to empty the models.");
+  QCommandLineOption prefetchOption("prefetch", "Comma separated list of read ahead modes to run: none, advise or uring.", "list", DEFAULT_PREFETCH);
+  QCommandLineOption depthOption("depth", "Levels of directories.", "n", QString::number(gen.depth));
+  QCommandLineOption fanoutOption("fanout", "Sub-directories per directory.", "n", QString::number(gen.fanout));
+  QCommandLineOption filesOption("files", "Files per leaf directory.", "n", QString::number(gen.filesPerDir));
+  QCommandLineOption artistsOption("artists", "Distinct artists.", "n", QString::number(gen.artists));
+  QCommandLineOption albumsOption("albums", "Distinct albums per artist.", "n", QString::number(gen.albums));
+  QCommandLineOption artOption("art-size", "Size of the cover art in bytes, 0 for none.", "bytes", QString::number(gen.artSize));
+  QCommandLineOption audioOption("audio-size", "Size of the audio payload in bytes.", "bytes", QString::number(gen.audioSize));
+  QCommandLineOption seedOption("seed", "Seed of the generator.", "n", QString::number(gen.seed));
+  QCommandLineOption childOption("child", "Internal: run the scanner with <n> threads.", "n");
+  parser.addOptions({ rootOption, threadsOption, runsOption, warmOption, timeoutOption, jsonOption, debugOption, mmapOption,
+                      durationOption, removeOption, prefetchOption, depthOption, fanoutOption, filesOption, artistsOption, albumsOption, artOption, audioOption,
+                      seedOption, childOption });
+  parser.process(app);
+
+  int timeout = parser.value(timeoutOption).toInt();
+  bool debug = parser.isSet(debugOption);
+  bool useMap = parser.isSet(mmapOption);
+  QString duration = parser.value(durationOption);
+  bool remove = parser.isSet(removeOption);
+
+  if (parser.isSet(childOption))
+  {
+    ByteSource::setMapEnabled(useMap);
+    if (duration == "header")
+      ID3Parser::setDurationMode(ID3Parser::DurationHeaderOnly);
+    else if (duration == "exact")
+      ID3Parser::setDurationMode(ID3Parser::DurationExact);
+    else
+      ID3Parser::setDurationMode(ID3Parser::DurationSampled);
+    QString prefetch = parser.value(prefetchOption);
+    if (prefetch == "uring")
+      Prefetcher::setMode(Prefetcher::PrefetchUring);
+    else if (prefetch == "advise")
+      Prefetcher::setMode(Prefetcher::PrefetchAdvise);
+    else
+      Prefetcher::setMode(Prefetcher::PrefetchNone);
+    return runChild(app, parser.value(rootOption), parser.value(childOption).toInt(), timeout, debug, remove);
+  }
+
+  gen.depth = parser.value(depthOption).toInt();
+  gen.fanout = parser.value(fanoutOption).toInt();
+  gen.filesPerDir = parser.value(filesOption).toInt();
+  gen.artists = parser.value(artistsOption).toInt();
+  gen.albums = parser.value(albumsOption).toInt();
+  gen.artSize = parser.value(artOption).toInt();
+  gen.audioSize = parser.value(audioOption).toInt();
+  gen.seed = parser.value(seedOption).toUInt();
+
+  QTemporaryDir tmp;
+  QString rootPath = parser.value(rootOption);
+  if (rootPath.isEmpty())
+  {
+    if (!tmp.isValid())
+    {
+      fprintf(stderr, "cannot create a temporary directory\n");
+      return 1;
+    }
+    rootPath = tmp.path();
+  }
+  rootPath = QDir(rootPath).absolutePath();
+
+  LibraryGenerator generator(gen);
+  QElapsedTimer timer;
+  timer.start();
+  if (!generator.generate(rootPath))
+    return 1;
+  fprintf(stdout, "library: %s\n", rootPath.toUtf8().constData());
+  fprintf(stdout, "generated %d files in %d directories, %lld KB, in %lld ms\n",
+          generator.files(), generator.directories(), generator.bytes() / 1024, timer.elapsed());
+  for (QMap<QString, int>::const_iterator it = generator.filesByKind().constBegin(); it != generator.filesByKind().constEnd(); ++it)
+    fprintf(stdout, "  %-10s %d\n", it.key().toUtf8().constData(), it.value());
+
+  QList<int> threadCounts;
+  for (const QString& str : parser.value(threadsOption).split(','))
+  {
+    if (str == "auto")
+      threadCounts.push_back(MEDIASCANNER_AUTO_THREAD);
+    else if (str.toInt() > 0)
+      threadCounts.push_back(str.toInt());
+  }
+  QStringList prefetchModes;
+  for (const QString& str : parser.value(prefetchOption).split(','))
+  {
+    if (!str.isEmpty())
+      prefetchModes.push_back(str);
+  }
+  if (prefetchModes.isEmpty())
+    prefetchModes.push_back(DEFAULT_PREFETCH);
+  int runs = qMax(1, parser.value(runsOption).toInt());
+  bool warm = parser.isSet(warmOption);
+
+  fprintf(stdout, "\n%s runs%s, mp3 duration %s, median of %d\n", warm ? "warm" : "cold", useMap ? " with mmap" : "",
+          duration.toUtf8().constData(), runs);
+  fprintf(stdout, "%8s %7s %9s %9s %9s %11s %9s %11s %11s %9s %9s %9s %9s\n",
+          "prefetch", "threads", "wall(ms)", "files/s", "rss(KB)", "read(sys)", "per file", "write(sys)",
+          "reads", "seeks", "ctxsw", "B/file", "rm(ms)");
+  QJsonArray results;
+  bool failed = false;
+  for (int run = 0; run < prefetchModes.size() * threadCounts.size(); ++run)
+  {
+    // compare the read ahead modes at each thread count
+    const QString& prefetch = prefetchModes[run % prefetchModes.size()];
+    int threads = threadCounts[run / prefetchModes.size()];
+    QStringList arguments;
+    arguments << "--child" << QString::number(threads) << "--root" << rootPath << "--timeout" << QString::number(timeout);
+    arguments << "--prefetch" << prefetch;
+    if (debug)
+      arguments << "--debug";
+    if (useMap)
+      arguments << "--mmap";
+    arguments << "--duration" << duration;
+    if (remove)
+      arguments << "--remove";
+    QFile::remove(databasePath());
+    QJsonObject sample;
+    if (warm && !spawnChild(arguments, timeout, debug, sample))
+    {
+      fprintf(stderr, "run with %d threads failed\n", threads);
+      failed = true;
+      continue;
+    }
+    QList<QJsonObject> samples;
+    for (int r = 0; r < runs; ++r)
+    {
+      if (!warm)
+        QFile::remove(databasePath());
+      if (!spawnChild(arguments, timeout, debug, sample))
+      {
+        fprintf(stderr, "run with %d threads failed\n", threads);
+        failed = true;
+        break;
+      }
+      samples.push_back(sample);
+      results.push_back(sample);
+    }
+    if (samples.isEmpty())
+      continue;
+    std::sort(samples.begin(), samples.end(), [](const QJsonObject& a, const QJsonObject& b) {
+      return a["wallMs"].toDouble() < b["wallMs"].toDouble();
+    });
+    printSample(samples[samples.size() / 2]);
+  }
+  QFile::remove(databasePath());
+
+  if (parser.isSet(jsonOption))
+  {
+    QJsonObject options;
+    options["depth"] = gen.depth;
+    options["fanout"] = gen.fanout;
+    options["filesPerDir"] = gen.filesPerDir;
+    options["artists"] = gen.artists;
+    options["albums"] = gen.albums;
+    options["artSize"] = gen.artSize;
+    options["audioSize"] = gen.audioSize;
+    options["seed"] = qint64(gen.seed);
+    options["files"] = generator.files();
+    options["bytes"] = generator.bytes();
+    options["warm"] = warm;
+    options["mmap"] = useMap;
+    options["duration"] = duration;
+    options["remove"] = remove;
+    options["prefetch"] = QJsonArray::fromStringList(prefetchModes);
+    options["runs"] = runs;
+    QJsonObject report;
+    report["options"] = options;
+    report["samples"] = results;
+    QFile file(parser.value(jsonOption));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(QJsonDocument(report).toJson()) < 0)
+    {
+      fprintf(stderr, "cannot write %s\n", parser.value(jsonOption).toUtf8().constData());
+      failed = true;
+    }
+  }
+  return (failed ? 1 : 0);
+}
@@ -0,0 +1,406 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "bytesource.h"
+#include "iostats.h"
+
+#include <QFile>
+#include <QAtomicInt>
+#include <cstring>
+#include <cerrno>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_POSIX_IO
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+#if defined(__linux__)
+#define HAVE_STATFS
+#include <sys/vfs.h>
+#endif
+
+#define WINDOW_SIZE           65536
+
+using namespace mediascanner;
+
+static QAtomicInt _mapEnabled(0);
+static thread_local Preload * _preload = nullptr;
+
+/**
+ * The window of the thread. It is lent to one source at a time, so the
+ * window is allocated once per worker instead of once per parsed file. A
+ * source opened while it is lent allocates its own.
+ */
+struct WindowBuffer
+{
+  unsigned char * data;
+  bool lent;
+  WindowBuffer() : data(nullptr), lent(false) { }
+  ~WindowBuffer() { delete [] data; }
+};
+
+static WindowBuffer& _window_buffer()
+{
+  static thread_local WindowBuffer buffer;
+  return buffer;
+}
+
+Preload::~Preload()
+{
+#ifdef HAVE_POSIX_IO
+  if (fd >= 0)
+    ::close(fd);
+#endif
+}
+
+#ifdef HAVE_STATFS
+/**
+ * A mapping is worth only on local file systems: on a network one, each page
+ * fault is a round trip.
+ */
+static bool _is_local(int fd)
+{
+  struct statfs fs;
+  if (fstatfs(fd, &fs) != 0)
+    return false;
+  switch ((unsigned long)fs.f_type)
+  {
+  case 0x6969:      // NFS
+  case 0x517b:      // SMB
+  case 0xff534d42:  // CIFS
+  case 0xfe534d42:  // SMB2
+  case 0x65735546:  // FUSE
+  case 0x01021997:  // 9P
+  case 0x00c36400:  // CEPH
+  case 0x5346414f:  // AFS
+  case 0x73757245:  // CODA
+    return false;
+  default:
+    return true;
+  }
+}
+#endif
+
+ByteSource::ByteSource()
+: m_fd(-1)
+, m_fp(nullptr)
+, m_size(0)
+, m_pos(0)
+, m_map(nullptr)
+, m_mapOwned(false)
+, m_buffer(nullptr)
+, m_bufferLent(false)
+, m_window(nullptr)
+, m_windowOffset(0)
+, m_windowLength(0)
+, m_head()
+, m_tail()
+{
+}
+
+ByteSource::~ByteSource()
+{
+  close();
+}
+
+void ByteSource::setMapEnabled(bool enabled)
+{
+  _mapEnabled.store(enabled ? 1 : 0);
+}
+
+bool ByteSource::mapEnabled()
+{
+  return _mapEnabled.load() != 0;
+}
+
+void ByteSource::setPreload(Preload * preload)
+{
+  _preload = preload;
+}
+
+bool ByteSource::open(const QString& filePath)
+{
+  close();
+  QByteArray path = QFile::encodeName(filePath);
+#ifdef HAVE_POSIX_IO
+  Preload * preload = (_preload && _preload->filePath == filePath ? _preload : nullptr);
+  if (preload && preload->fd >= 0)
+  {
+    // adopt the descriptor opened ahead
+    m_fd = preload->fd;
+    m_size = preload->size;
+    preload->fd = -1;
+  }
+  else
+  {
+    m_fd = ::open(path.constData(), O_RDONLY | O_CLOEXEC);
+    if (m_fd < 0)
+      return false;
+    struct stat st;
+    if (fstat(m_fd, &st) != 0)
+    {
+      close();
+      return false;
+    }
+    m_size = st.st_size;
+  }
+  // the preloaded bytes are valid as long as the file is unchanged
+  if (preload && preload->size == m_size)
+  {
+    m_head = preload->head;
+    m_tail = preload->tail;
+  }
+#ifdef HAVE_STATFS
+  if (mapEnabled() && m_size > 0 && _is_local(m_fd))
+  {
+    void * map = mmap(nullptr, (size_t)m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+    if (map != MAP_FAILED)
+    {
+      m_map = static_cast<unsigned char*>(map);
+      m_mapOwned = true;
+    }
+  }
+#endif
+#else
+  m_fp = fopen(path.constData(), "rb");
+  if (!m_fp)
+    return false;
+  if (fseek(m_fp, 0, SEEK_END) == 0)
+    m_size = ftell(m_fp);
+#endif
+  return true;
+}
+
+bool ByteSource::open(const char * data, size_t size)
+{
+  close();
+  if (!data)
+    return false;
+  m_map = reinterpret_cast<unsigned char*>(const_cast<char*>(data));
+  m_size = (qint64)size;
+  return true;
+}
+
+void ByteSource::close()
+{
+#ifdef HAVE_POSIX_IO
+  if (m_map && m_mapOwned)
+    munmap(m_map, (size_t)m_size);
+  if (m_fd >= 0)
+    ::close(m_fd);
+#else
+  if (m_fp)
+    fclose(m_fp);
+#endif
+  m_fd = -1;
+  m_fp = nullptr;
+  m_map = nullptr;
+  m_mapOwned = false;
+  m_size = m_pos = 0;
+  releaseBuffer();
+  m_window = nullptr;
+  m_windowOffset = 0;
+  m_windowLength = 0;
+  m_head.clear();
+  m_tail.clear();
+}
+
+bool ByteSource::isOpen() const
+{
+  return (m_fd >= 0 || m_fp != nullptr || m_map != nullptr);
+}
+
+size_t ByteSource::read(void * buf, size_t size)
+{
+  unsigned char * out = static_cast<unsigned char*>(buf);
+  size_t done = 0;
+  if (m_map)
+  {
+    if (m_pos < m_size)
+    {
+      done = qMin<qint64>(size, m_size - m_pos);
+      memcpy(out, m_map + m_pos, done);
+      m_pos += done;
+      if (m_mapOwned)
+        IOStats::local().bytesRead += done;
+    }
+    return done;
+  }
+  while (done < size)
+  {
+    if (m_pos >= m_windowOffset && m_pos < m_windowOffset + (qint64)m_windowLength)
+    {
+      size_t offset = (size_t)(m_pos - m_windowOffset);
+      size_t len = qMin(size - done, m_windowLength - offset);
+      memcpy(out + done, m_window + offset, len);
+      done += len;
+      m_pos += len;
+      continue;
+    }
+    // a large read goes straight to the buffer of the caller
+    if (size - done >= WINDOW_SIZE)
+    {
+      size_t len = readAt(m_pos, out + done, size - done);
+      done += len;
+      m_pos += len;
+      break;
+    }
+    if (!fill(m_pos))
+      break;
+  }
+  return done;
+}
+
+const char * ByteSource::fetch(size_t size)
+{
+  const unsigned char * data = nullptr;
+  if (m_map)
+  {
+    if (m_pos < 0 || m_pos + (qint64)size > m_size)
+      return nullptr;
+    data = m_map + m_pos;
+    if (m_mapOwned)
+      IOStats::local().bytesRead += size;
+  }
+  else
+  {
+    if (size > WINDOW_SIZE)
+      return nullptr;
+    if (m_pos < m_windowOffset || m_pos + (qint64)size > m_windowOffset + (qint64)m_windowLength)
+    {
+      if (!fill(m_pos) || m_windowLength < size)
+        return nullptr;
+    }
+    data = m_window + (m_pos - m_windowOffset);
+  }
+  m_pos += size;
+  return reinterpret_cast<const char*>(data);
+}
+
+int ByteSource::seek(qint64 offset, int whence)
+{
+  qint64 pos;
+  switch (whence)
+  {
+  case SEEK_SET:
+    pos = offset;
+    break;
+  case SEEK_CUR:
+    pos = m_pos + offset;
+    break;
+  case SEEK_END:
+    pos = m_size + offset;
+    break;
+  default:
+    return -1;
+  }
+  if (pos < 0 || !isOpen())
+    return -1;
+  // only the seeks out of the window will cost a read
+  if (!m_map && (pos < m_windowOffset || pos >= m_windowOffset + (qint64)m_windowLength))
+    ++IOStats::local().seeks;
+  m_pos = pos;
+  return 0;
+}
+
+bool ByteSource::fill(qint64 offset)
+{
+  if (fillPreloaded(m_head, 0, offset) || fillPreloaded(m_tail, m_size - m_tail.size(), offset))
+    return true;
+  if (!m_buffer)
+    acquireBuffer();
+  m_window = m_buffer;
+  m_windowOffset = offset;
+  m_windowLength = readAt(offset, m_buffer, WINDOW_SIZE);
+  return (m_windowLength > 0);
+}
+
+void ByteSource::acquireBuffer()
+{
+  WindowBuffer& buffer = _window_buffer();
+  if (!buffer.lent)
+  {
+    if (!buffer.data)
+      buffer.data = new unsigned char [WINDOW_SIZE];
+    buffer.lent = true;
+    m_buffer = buffer.data;
+    m_bufferLent = true;
+  }
+  else
+  {
+    m_buffer = new unsigned char [WINDOW_SIZE];
+    m_bufferLent = false;
+  }
+}
+
+void ByteSource::releaseBuffer()
+{
+  if (m_bufferLent)
+    _window_buffer().lent = false;
+  else
+    delete [] m_buffer;
+  m_buffer = nullptr;
+  m_bufferLent = false;
+}
+
+/**
+ * Set the window in place on the preloaded bytes, when they hold a full
+ * window from the offset, or up to the end of file.
+ */
+bool ByteSource::fillPreloaded(const QByteArray& data, qint64 begin, qint64 offset)
+{
+  qint64 end = begin + data.size();
+  if (data.isEmpty() || offset < begin || offset >= end || (end - offset < WINDOW_SIZE && end != m_size))
+    return false;
+  m_window = reinterpret_cast<const unsigned char*>(data.constData()) + (offset - begin);
+  m_windowOffset = offset;
+  m_windowLength = (size_t)qMin<qint64>(end - offset, WINDOW_SIZE);
+  return true;
+}
+
+size_t ByteSource::readAt(qint64 offset, void * buf, size_t size)
+{
+  unsigned char * out = static_cast<unsigned char*>(buf);
+  size_t done = 0;
+  IOStats& stats = IOStats::local();
+  while (done < size)
+  {
+    size_t len = size - done;
+#ifdef HAVE_POSIX_IO
+    ssize_t r = pread(m_fd, out + done, len, (off_t)(offset + done));
+    ++stats.reads;
+    if (r < 0 && errno == EINTR)
+      continue;
+#else
+    if (fseek(m_fp, (long)(offset + done), SEEK_SET) != 0)
+      break;
+    long r = (long)fread(out + done, 1, len, m_fp);
+    ++stats.reads;
+#endif
+    if (r <= 0)
+      break;
+    done += (size_t)r;
+    // a short read is the end of file
+    if ((size_t)r < len)
+      break;
+  }
+  stats.bytesRead += done;
+  return done;
+}
@@ -0,0 +1,134 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef BYTESOURCE_H
+#define BYTESOURCE_H
+
+#include <QString>
+#include <QByteArray>
+#include <cstdio>
+
+namespace mediascanner
+{
+
+/**
+ * The opening of a file done ahead by the prefetcher. A source opened on
+ * the same path adopts the descriptor, and serves the first and the last
+ * bytes of the file from memory.
+ */
+struct Preload
+{
+  Preload() : filePath(), fd(-1), size(-1), head(), tail() { }
+  ~Preload();
+  Preload(const Preload& other) = delete;
+  Preload& operator=(const Preload& other) = delete;
+
+  QString filePath;
+  int fd;               // else -1
+  qint64 size;
+  QByteArray head;      // from the start of file
+  QByteArray tail;      // up to the end of file
+};
+
+/**
+ * A read-only view on a file for the parsers. The reads are served from a
+ * read-ahead window, so the small reads of the headers cost one syscall per
+ * window instead of one per call, and a seek within the window is free.
+ * The window is borrowed from the thread, as the sources are short-lived.
+ * Optionally the local files are mapped in memory instead.
+ */
+class ByteSource
+{
+public:
+  ByteSource();
+  ~ByteSource();
+  ByteSource(const ByteSource& other) = delete;
+  ByteSource& operator=(const ByteSource& other) = delete;
+
+  bool open(const QString& filePath);
+
+  /**
+   * Open a view on a buffer in memory, which must outlive the source.
+   */
+  bool open(const char * data, size_t size);
+  void close();
+  bool isOpen() const;
+  bool isMapped() const { return m_map != nullptr && m_mapOwned; }
+
+  qint64 size() const { return m_size; }
+  qint64 tell() const { return m_pos; }
+
+  /**
+   * Read up to size bytes at the current position.
+   * @return the count of bytes read, less than size at end of file
+   */
+  size_t read(void * buf, size_t size);
+
+  /**
+   * Return a pointer on the next size bytes, and move past them. It avoids
+   * the copy of read(): the data are seen in place in the window or in the
+   * mapping, and they are valid until the next call on the source.
+   * @return nullptr if the bytes are not available or don't fit the window
+   */
+  const char * fetch(size_t size);
+
+  /**
+   * Move the current position as fseek does. A position beyond the end is
+   * allowed, then the next read returns 0.
+   * @return 0 on success, else -1
+   */
+  int seek(qint64 offset, int whence = SEEK_SET);
+
+  /**
+   * Map the local files in memory rather than reading them through the
+   * window. It is off by default: a mapped file truncated while parsed
+   * would fault.
+   */
+  static void setMapEnabled(bool enabled);
+  static bool mapEnabled();
+
+  /**
+   * Set the preload of the file about to be parsed by the current thread,
+   * or nullptr. It must outlive the sources opened on the file.
+   */
+  static void setPreload(Preload * preload);
+
+private:
+  bool fill(qint64 offset);
+  void acquireBuffer();
+  void releaseBuffer();
+  bool fillPreloaded(const QByteArray& data, qint64 begin, qint64 offset);
+  size_t readAt(qint64 offset, void * buf, size_t size);
+
+  int m_fd;            // on POSIX systems
+  FILE * m_fp;          // elsewhere
+  qint64 m_size;
+  qint64 m_pos;
+  unsigned char * m_map;
+  bool m_mapOwned;      // else it is a buffer of the caller
+  unsigned char * m_buffer;
+  bool m_bufferLent;    // else it is owned
+  const unsigned char * m_window; // in the buffer or in the preload
+  qint64 m_windowOffset;
+  size_t m_windowLength;
+  QByteArray m_head;
+  QByteArray m_tail;
+};
+
+}
+
+#endif /* BYTESOURCE_H */
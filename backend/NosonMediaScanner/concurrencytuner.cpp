@@ -0,0 +1,281 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "concurrencytuner.h"
+#include "locked.h"
+
+#include <QStorageInfo>
+
+#define TUNER_INTERVAL_MS     1000
+#define TUNER_MIN_SAMPLES     16
+#define TUNER_TOLERANCE       0.05  // the relative change taken as noise
+#define TUNER_STARVED_RATIO   0.5   // the utilisation below which the workers wait for the walk
+#define TUNER_HOLD_INTERVALS  5     // the steady intervals before probing again
+#define TUNER_INITIAL_THREAD  2
+
+using namespace mediascanner;
+
+ConcurrencyTuner::ConcurrencyTuner(WorkerPool * pool)
+: m_pool(pool)
+, m_lock(new QMutex())
+, m_enabled(false)
+, m_minThread(1)
+, m_maxThread(TUNER_INITIAL_THREAD)
+, m_devices()
+, m_current(-1)
+, m_timer()
+, m_busyUs(0)
+, m_idleUs(0)
+{
+}
+
+ConcurrencyTuner::~ConcurrencyTuner()
+{
+  delete m_lock;
+}
+
+void ConcurrencyTuner::setEnabled(bool enabled)
+{
+  LockGuard<QMutex> g(m_lock);
+  m_enabled = enabled;
+  if (!enabled)
+    m_current = -1;
+}
+
+bool ConcurrencyTuner::isEnabled() const
+{
+  LockGuard<QMutex> g(m_lock);
+  return m_enabled;
+}
+
+void ConcurrencyTuner::setBounds(int minThread, int maxThread)
+{
+  LockGuard<QMutex> g(m_lock);
+  m_minThread = qMax(1, minThread);
+  m_maxThread = qMax(m_minThread, maxThread);
+}
+
+int ConcurrencyTuner::select(const QString& path)
+{
+  // the mounted device, else the path itself
+  QStorageInfo storage(path);
+  QString name = (storage.isValid() ? QString::fromUtf8(storage.device()) : path);
+  int threads;
+  {
+    LockGuard<QMutex> g(m_lock);
+    if (!m_enabled)
+      return -1;
+    m_current = -1;
+    for (int i = 0; i < m_devices.size(); ++i)
+    {
+      if (m_devices[i].name == name)
+      {
+        m_current = i;
+        break;
+      }
+    }
+    if (m_current < 0)
+    {
+      Device device;
+      device.name = name;
+      device.threads = TUNER_INITIAL_THREAD;
+      device.direction = 1;
+      device.hold = 0;
+      device.baselineThreads = 0;
+      device.baseline = 0.0;
+      device.filesPerSec = device.bytesPerSec = 0.0;
+      device.meanUs = 0;
+      device.steps = 0;
+      device.rationale = "initial";
+      m_current = m_devices.size();
+      m_devices.push_back(device);
+    }
+    Device& device = m_devices[m_current];
+    device.threads = qBound(m_minThread, device.threads, m_maxThread);
+    // the throughput measured during the last scan is stale
+    device.baseline = 0.0;
+    restartInterval(device);
+    threads = device.threads;
+  }
+  m_pool->setMaxThread(threads);
+  return m_current;
+}
+
+void ConcurrencyTuner::addSample(int device, qint64 elapsedUs, qint64 bytesRead)
+{
+  int threads = 0;
+  {
+    LockGuard<QMutex> g(m_lock);
+    if (!m_enabled || device < 0 || device != m_current)
+      return;
+    Device& d = m_devices[device];
+    ++d.files;
+    d.bytes += bytesRead;
+    d.sumUs += elapsedUs;
+    qint64 intervalUs = m_timer.nsecsElapsed() / 1000;
+    if (intervalUs < TUNER_INTERVAL_MS * 1000 || d.files < TUNER_MIN_SAMPLES)
+      return;
+    WorkerPool::Stats stats = m_pool->stats();
+    qint64 busy = stats.busyUs - m_busyUs;
+    qint64 idle = stats.idleUs - m_idleUs;
+    double utilisation = (busy + idle > 0 ? double(busy) / double(busy + idle) : 1.0);
+    int before = d.threads;
+    threads = tune(d, intervalUs, utilisation);
+    restartInterval(d);
+    if (threads == before)
+      threads = 0;
+  }
+  // out of the lock, as resizing could wait for a retired worker
+  if (threads > 0)
+    m_pool->setMaxThread(threads);
+}
+
+/**
+ * Judge the interval, and return the pool size for the next one.
+ * The lock MUST be held by the caller.
+ */
+int ConcurrencyTuner::tune(Device& d, qint64 intervalUs, double utilisation)
+{
+  d.filesPerSec = 1000000.0 * d.files / intervalUs;
+  d.bytesPerSec = 1000000.0 * d.bytes / intervalUs;
+  d.meanUs = d.sumUs / d.files;
+  if (utilisation < TUNER_STARVED_RATIO)
+  {
+    // more workers wouldn't help, and the measure doesn't reflect the storage
+    d.baseline = 0.0;
+    d.rationale = QString("%1 threads: the workers wait for the walk (%2% busy)")
+        .arg(d.threads).arg(100.0 * utilisation, 0, 'f', 0);
+    return d.threads;
+  }
+  if (d.baseline > 0.0 && d.baselineThreads != d.threads)
+  {
+    // judge the last step
+    double change = 100.0 * (d.filesPerSec / d.baseline - 1.0);
+    if (change > 100.0 * TUNER_TOLERANCE)
+    {
+      d.rationale = QString("%1 threads: %2% files/s over %3 threads, mean latency %4 ms")
+          .arg(d.threads).arg(change, 0, 'f', 0).arg(d.baselineThreads).arg(d.meanUs / 1000.0, 0, 'f', 1);
+      // go on the same way
+      if (step(d))
+        d.rationale.append(QString(", probing %1").arg(d.threads));
+      else
+      {
+        d.baseline = 0.0;
+        d.hold = TUNER_HOLD_INTERVALS;
+      }
+      return d.threads;
+    }
+    if (change < -100.0 * TUNER_TOLERANCE)
+    {
+      d.rationale = QString("%1 threads: %2% files/s with %3 threads, mean latency %4 ms")
+          .arg(d.baselineThreads).arg(change, 0, 'f', 0).arg(d.threads).arg(d.meanUs / 1000.0, 0, 'f', 1);
+      d.threads = d.baselineThreads;
+      d.direction = -d.direction;
+    }
+    else
+    {
+      // the fewer threads do the same work with less contention
+      d.rationale = QString("%1 threads: flat files/s with %2 threads, mean latency %3 ms")
+          .arg(qMin(d.threads, d.baselineThreads)).arg(d.threads).arg(d.meanUs / 1000.0, 0, 'f', 1);
+      d.threads = qMin(d.threads, d.baselineThreads);
+      d.direction = -1;
+    }
+    d.baseline = 0.0;
+    d.hold = TUNER_HOLD_INTERVALS;
+    return d.threads;
+  }
+  if (d.hold > 0)
+  {
+    --d.hold;
+    return d.threads;
+  }
+  // probe the neighbour size, else the other one at a bound
+  if (!step(d))
+  {
+    d.direction = -d.direction;
+    if (!step(d))
+    {
+      d.rationale = QString("%1 threads: fixed by the bounds").arg(d.threads);
+      d.hold = TUNER_HOLD_INTERVALS;
+      return d.threads;
+    }
+  }
+  d.rationale = QString("probing %1 threads from %2 files/s with %3 threads")
+      .arg(d.threads).arg(d.baseline, 0, 'f', 1).arg(d.baselineThreads);
+  return d.threads;
+}
+
+/**
+ * Move the size by one in the current direction, taking the throughput of
+ * the interval as the baseline.
+ * @return false if a bound is reached
+ */
+bool ConcurrencyTuner::step(Device& d)
+{
+  int next = qBound(m_minThread, d.threads + d.direction, m_maxThread);
+  if (next == d.threads)
+    return false;
+  d.baseline = d.filesPerSec;
+  d.baselineThreads = d.threads;
+  d.threads = next;
+  ++d.steps;
+  return true;
+}
+
+void ConcurrencyTuner::restartInterval(Device& d)
+{
+  WorkerPool::Stats stats = m_pool->stats();
+  m_busyUs = stats.busyUs;
+  m_idleUs = stats.idleUs;
+  m_timer.start();
+  d.files = 0;
+  d.bytes = 0;
+  d.sumUs = 0;
+}
+
+QVariantMap ConcurrencyTuner::toVariantMap() const
+{
+  LockGuard<QMutex> g(m_lock);
+  QVariantMap map;
+  map["auto"] = m_enabled;
+  map["minThread"] = m_minThread;
+  map["maxThread"] = m_maxThread;
+  map["current"] = (m_current >= 0 ? m_devices[m_current].name : QString());
+  QVariantMap devices;
+  for (const Device& d : m_devices)
+  {
+    QVariantMap item;
+    item["threads"] = d.threads;
+    item["filesPerSec"] = d.filesPerSec;
+    item["bytesPerSec"] = d.bytesPerSec;
+    item["meanUs"] = d.meanUs;
+    item["steps"] = d.steps;
+    item["rationale"] = d.rationale;
+    devices[d.name] = item;
+  }
+  map["devices"] = devices;
+  return map;
+}
+
+QString ConcurrencyTuner::toString() const
+{
+  LockGuard<QMutex> g(m_lock);
+  if (!m_enabled || m_current < 0)
+    return QString();
+  const Device& d = m_devices[m_current];
+  return QString("threads=%1 (%2)").arg(d.threads).arg(d.rationale);
+}
@@ -0,0 +1,114 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef CONCURRENCYTUNER_H
+#define CONCURRENCYTUNER_H
+
+#include "workerpool.h"
+
+#include <QString>
+#include <QVector>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <QVariantMap>
+
+namespace mediascanner
+{
+
+/**
+ * The controller sizing the extraction pool from the observed storage. The
+ * extractions report their parse time and the bytes read, and on interval
+ * the throughput is compared with the one measured before the last step: a
+ * step which pays is followed by another, a loss is reverted, and a flat
+ * result keeps the fewer threads. The state is kept per device, as the
+ * roots could sit on distinct storages, and the pool is sized for the
+ * device being scanned.
+ */
+class ConcurrencyTuner
+{
+public:
+  explicit ConcurrencyTuner(WorkerPool * pool);
+  ~ConcurrencyTuner();
+  ConcurrencyTuner(const ConcurrencyTuner& other) = delete;
+  ConcurrencyTuner& operator=(const ConcurrencyTuner& other) = delete;
+
+  void setEnabled(bool enabled);
+  bool isEnabled() const;
+
+  /**
+   * Configure the bounds of the pool size. They apply from the next scan.
+   */
+  void setBounds(int minThread, int maxThread);
+
+  /**
+   * Make current the device holding the given path, and size the pool for
+   * it.
+   * @param path
+   * @return the device to report the samples to, else -1 when disabled
+   */
+  int select(const QString& path);
+
+  /**
+   * Record the extraction of a file. The samples of a device which isn't
+   * current anymore are dropped.
+   * @param device
+   * @param elapsedUs the extraction time in microseconds
+   * @param bytesRead
+   */
+  void addSample(int device, qint64 elapsedUs, qint64 bytesRead);
+
+  QVariantMap toVariantMap() const;
+  QString toString() const;
+
+private:
+  struct Device
+  {
+    QString name;
+    int threads;
+    int direction;        // of the next probe
+    int hold;             // intervals left before the next probe
+    int baselineThreads;
+    double baseline;      // files/s measured before the last step, else 0
+    qint64 files;         // of the running interval
+    qint64 bytes;
+    qint64 sumUs;
+    double filesPerSec;   // of the last interval
+    double bytesPerSec;
+    qint64 meanUs;
+    qint64 steps;
+    QString rationale;
+  };
+
+  int tune(Device& device, qint64 intervalUs, double utilisation);
+  bool step(Device& device);
+  void restartInterval(Device& device);
+
+  WorkerPool * m_pool;
+  mutable QMutex * m_lock;
+  bool m_enabled;
+  int m_minThread;
+  int m_maxThread;
+  QVector<Device> m_devices;
+  int m_current;
+  QElapsedTimer m_timer;
+  qint64 m_busyUs;        // counters of the pool at the start of the interval
+  qint64 m_idleUs;
+};
+
+}
+
+#endif /* CONCURRENCYTUNER_H */
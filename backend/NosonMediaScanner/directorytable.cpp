@@ -0,0 +1,123 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "directorytable.h"
+#include "locked.h"
+
+using namespace mediascanner;
+
+DirectoryTable& DirectoryTable::instance()
+{
+  static DirectoryTable _table;
+  return _table;
+}
+
+DirectoryTable::DirectoryTable()
+: m_lock(new QMutex())
+, m_ids()
+, m_blocks()
+, m_size(1)
+, m_free()
+{
+  m_blocks[0].storeRelease(new Entry[BlockSize]);
+}
+
+DirectoryTable::~DirectoryTable()
+{
+  for (int i = 0; i < MaxBlocks; ++i)
+    delete [] m_blocks[i].loadAcquire();
+  delete m_lock;
+}
+
+unsigned DirectoryTable::intern(const QString& dirPath)
+{
+  if (dirPath.isEmpty())
+    return 0;
+  LockGuard<QMutex> g(m_lock);
+  QHash<QString, unsigned>::const_iterator it = m_ids.constFind(dirPath);
+  if (it != m_ids.constEnd())
+  {
+    entry(it.value())->refs.ref();
+    return it.value();
+  }
+  unsigned id;
+  if (!m_free.isEmpty())
+    id = m_free.takeLast();
+  else
+  {
+    id = m_size;
+    if (id >= static_cast<unsigned>(MaxIds))
+    {
+      qWarning("%s: the table is full", __FUNCTION__);
+      return 0;
+    }
+    // publish the new block before any id it holds
+    if (!m_blocks[id >> BlockBits].loadAcquire())
+      m_blocks[id >> BlockBits].storeRelease(new Entry[BlockSize]);
+    ++m_size;
+  }
+  Entry * e = entry(id);
+  e->path = dirPath;
+  e->refs.store(1);
+  m_ids.insert(dirPath, id);
+  return id;
+}
+
+void DirectoryTable::release(unsigned id)
+{
+  if (id == 0 || id >= static_cast<unsigned>(MaxIds))
+    return;
+  Entry * e = entry(id);
+  if (e->refs.deref())
+    return;
+  LockGuard<QMutex> g(m_lock);
+  // the path could be interned again, or already reclaimed by a concurrent release
+  if (e->refs.load() != 0 || e->path.isEmpty())
+    return;
+  m_ids.remove(e->path);
+  e->path = QString();
+  m_free.push_back(id);
+}
+
+const QString& DirectoryTable::path(unsigned id) const
+{
+  static const QString _empty;
+  if (id == 0 || id >= static_cast<unsigned>(MaxIds))
+    return _empty;
+  Entry * block = m_blocks[id >> BlockBits].loadAcquire();
+  if (!block)
+    return _empty;
+  return block[id & (BlockSize - 1)].path;
+}
+
+int DirectoryTable::count() const
+{
+  LockGuard<QMutex> g(m_lock);
+  return m_ids.size();
+}
+
+qint64 DirectoryTable::footprint() const
+{
+  LockGuard<QMutex> g(m_lock);
+  qint64 bytes = sizeof(m_blocks) + m_free.capacity() * sizeof(unsigned);
+  bytes += (((m_size - 1) >> BlockBits) + 1) * BlockSize * sizeof(Entry);
+  for (QHash<QString, unsigned>::const_iterator it = m_ids.constBegin(); it != m_ids.constEnd(); ++it)
+    bytes += it.key().capacity() * sizeof(QChar);
+  // the hash shares the strings of the entries
+  bytes += m_ids.capacity() * (sizeof(QString) + sizeof(unsigned) + sizeof(void*));
+  return bytes;
+}
@@ -0,0 +1,98 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef DIRECTORYTABLE_H
+#define DIRECTORYTABLE_H
+
+#include <QString>
+#include <QHash>
+#include <QVector>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QAtomicPointer>
+
+namespace mediascanner
+{
+
+/**
+ * The table interns the paths of the scanned directories, so the files
+ * refer to their parent by id instead of holding a copy of its path. The ids
+ * are counted by reference and recycled once released by all. The entries
+ * are stored in blocks that never move, so a referenced path is read without
+ * lock. The id 0 is reserved for the empty path.
+ */
+class DirectoryTable
+{
+public:
+  static DirectoryTable& instance();
+
+  /**
+   * Take a reference on the id of the path, interning it when needed.
+   * @return the id, or 0 when the path is empty or the table is full
+   */
+  unsigned intern(const QString& dirPath);
+
+  /**
+   * Release a reference taken by intern.
+   */
+  void release(unsigned id);
+
+  /**
+   * @return the path of an id held by the caller
+   */
+  const QString& path(unsigned id) const;
+
+  int count() const;
+
+  /**
+   * @return the estimated size of the table in bytes
+   */
+  qint64 footprint() const;
+
+private:
+  DirectoryTable();
+  ~DirectoryTable();
+
+  struct Entry
+  {
+    QString path;
+    QAtomicInt refs;
+  };
+
+  enum
+  {
+    BlockBits = 10,
+    BlockSize = 1 << BlockBits,
+    MaxBlocks = 4096,
+    MaxIds = MaxBlocks * BlockSize,
+  };
+
+  Entry * entry(unsigned id) const
+  {
+    return m_blocks[id >> BlockBits].loadAcquire() + (id & (BlockSize - 1));
+  }
+
+  mutable QMutex * m_lock;
+  QHash<QString, unsigned> m_ids;
+  QAtomicPointer<Entry> m_blocks[MaxBlocks];
+  unsigned m_size;            // the ids allocated so far
+  QVector<unsigned> m_free;   // the ids released
+};
+
+}
+
+#endif /* DIRECTORYTABLE_H */
@@ -0,0 +1,180 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "directorytree.h"
+
+using namespace mediascanner;
+
+DirectoryTree::DirectoryTree()
+: m_nodes()
+, m_items()
+, m_roots()
+{
+}
+
+DirectoryTree::~DirectoryTree()
+{
+  clear();
+}
+
+DirectoryTree::Node * DirectoryTree::addRoot(const QString& dirPath)
+{
+  Node * node = find(dirPath);
+  if (node)
+    return node;
+  node = new Node();
+  node->path = dirPath;
+  node->parent = nullptr;
+  node->index = m_roots.size();
+  node->scanned = false;
+  m_roots.push_back(node);
+  m_nodes.insert(dirPath, node);
+  return node;
+}
+
+DirectoryTree::Node * DirectoryTree::addChild(Node * parent, const MediaFilePtr& record, const QString& dirPath)
+{
+  Node * node = new Node();
+  node->path = dirPath;
+  node->record = record;
+  node->parent = parent;
+  node->index = parent->children.size();
+  node->scanned = false;
+  parent->children.push_back(node);
+  m_nodes.insert(dirPath, node);
+  return node;
+}
+
+void DirectoryTree::addItem(Node * node, const MediaFilePtr& file, const QString& filePath)
+{
+  Item item;
+  item.file = file;
+  item.node = node;
+  m_items.insert(filePath, item);
+  node->files.push_back(file);
+}
+
+MediaFilePtr DirectoryTree::removeItem(const QString& filePath)
+{
+  QHash<QString, Item>::iterator it = m_items.find(filePath);
+  if (it == m_items.end())
+    return MediaFilePtr();
+  Item item = it.value();
+  m_items.erase(it);
+  QVector<MediaFilePtr>& files = item.node->files;
+  int i = files.indexOf(item.file);
+  if (i >= 0)
+  {
+    // the order of the files doesn't matter
+    files[i] = files.last();
+    files.removeLast();
+  }
+  return item.file;
+}
+
+void DirectoryTree::reset(Node * node)
+{
+  for (const MediaFilePtr& file : node->files)
+    file->isPinned = false;
+  for (Node * child : node->children)
+    child->record->isPinned = false;
+}
+
+void DirectoryTree::clean(Node * node, bool evenPinned, QList<MediaFilePtr>& files, QStringList& dirs)
+{
+  // compact the vectors in place
+  int n = 0;
+  for (int i = 0; i < node->files.size(); ++i)
+  {
+    const MediaFilePtr& file = node->files[i];
+    if (evenPinned || !file->isPinned)
+    {
+      files.push_back(file);
+      m_items.remove(file->filePath());
+    }
+    else if (n != i)
+      node->files[n++] = file;
+    else
+      ++n;
+  }
+  node->files.resize(n);
+  n = 0;
+  for (int i = 0; i < node->children.size(); ++i)
+  {
+    Node * child = node->children[i];
+    if (evenPinned || !child->record->isPinned)
+      destroy(child, files, dirs);
+    else
+    {
+      child->index = n;
+      node->children[n++] = child;
+    }
+  }
+  node->children.resize(n);
+}
+
+void DirectoryTree::remove(Node * node, QList<MediaFilePtr>& files, QStringList& dirs)
+{
+  detach(node);
+  destroy(node, files, dirs);
+}
+
+void DirectoryTree::clear()
+{
+  QList<MediaFilePtr> files;
+  QStringList dirs;
+  for (Node * node : m_roots)
+    destroy(node, files, dirs);
+  m_roots.clear();
+  m_nodes.clear();
+  m_items.clear();
+}
+
+QList<MediaFilePtr> DirectoryTree::items() const
+{
+  QList<MediaFilePtr> list;
+  list.reserve(m_items.size());
+  for (QHash<QString, Item>::const_iterator it = m_items.constBegin(); it != m_items.constEnd(); ++it)
+    list.push_back(it.value().file);
+  return list;
+}
+
+/**
+ * Unlink the node from its parent, or from the roots.
+ */
+void DirectoryTree::detach(Node * node)
+{
+  QVector<Node*>& siblings = (node->parent ? node->parent->children : m_roots);
+  Node * last = siblings.last();
+  last->index = node->index;
+  siblings[node->index] = last;
+  siblings.removeLast();
+}
+
+void DirectoryTree::destroy(Node * node, QList<MediaFilePtr>& files, QStringList& dirs)
+{
+  for (Node * child : node->children)
+    destroy(child, files, dirs);
+  for (const MediaFilePtr& file : node->files)
+  {
+    files.push_back(file);
+    m_items.remove(file->filePath());
+  }
+  dirs.push_back(node->path);
+  m_nodes.remove(node->path);
+  delete node;
+}
@@ -0,0 +1,115 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef DIRECTORYTREE_H
+#define DIRECTORYTREE_H
+
+#include "mediafile.h"
+
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QVector>
+#include <QList>
+
+namespace mediascanner
+{
+
+/**
+ * The tree of the scanned directories. Each node holds its files and its
+ * sub-nodes, and the nodes and the files are indexed by path. So a lookup
+ * is a hash, and the reset or the removal of a subtree runs in time
+ * proportional to the subtree. It isn't thread safe: the caller holds the
+ * lock of the items.
+ */
+class DirectoryTree
+{
+public:
+  struct Node
+  {
+    QString path;
+    MediaFilePtr record;          // the directory, null for a root
+    Node * parent;
+    int index;                    // in the children of the parent
+    bool scanned;                 // its content has been scanned once
+    QVector<Node*> children;
+    QVector<MediaFilePtr> files;
+  };
+
+  DirectoryTree();
+  ~DirectoryTree();
+  DirectoryTree(const DirectoryTree& other) = delete;
+  DirectoryTree& operator=(const DirectoryTree& other) = delete;
+
+  Node * find(const QString& dirPath) const { return m_nodes.value(dirPath, nullptr); }
+  Node * addRoot(const QString& dirPath);
+  Node * addChild(Node * parent, const MediaFilePtr& record, const QString& dirPath);
+
+  MediaFilePtr findItem(const QString& filePath) const { return m_items.value(filePath).file; }
+  void addItem(Node * node, const MediaFilePtr& file, const QString& filePath);
+
+  /**
+   * Detach the item of a file from its node.
+   * @return the removed item, else null
+   */
+  MediaFilePtr removeItem(const QString& filePath);
+
+  /**
+   * Unpin the files and the sub-nodes of the node, before a scan pins the
+   * ones still there.
+   */
+  void reset(Node * node);
+
+  /**
+   * Remove the files and the sub-nodes of the node left unpinned by a scan,
+   * or all of them.
+   * @param node
+   * @param evenPinned true to remove all
+   * @param files the removed items
+   * @param dirs the paths of the removed nodes
+   */
+  void clean(Node * node, bool evenPinned, QList<MediaFilePtr>& files, QStringList& dirs);
+
+  /**
+   * Remove the node and its subtree.
+   */
+  void remove(Node * node, QList<MediaFilePtr>& files, QStringList& dirs);
+
+  void clear();
+
+  QList<MediaFilePtr> items() const;
+  int nodeCount() const { return m_nodes.size(); }
+  int itemCount() const { return m_items.size(); }
+
+private:
+  struct Item
+  {
+    MediaFilePtr file;
+    Node * node;
+  };
+
+  void detach(Node * node);
+  void destroy(Node * node, QList<MediaFilePtr>& files, QStringList& dirs);
+
+  QHash<QString, Node*> m_nodes;
+  QHash<QString, Item> m_items;
+  QVector<Node*> m_roots;
+};
+
+}
+
+#endif /* DIRECTORYTREE_H */
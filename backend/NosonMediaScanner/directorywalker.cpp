@@ -0,0 +1,216 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "directorywalker.h"
+#include "locked.h"
+
+#include <QRunnable>
+
+#define THREAD_EXPIRY_TIMEOUT 10000
+#define DEFAULT_MAX_THREAD    4
+
+using namespace mediascanner;
+
+class DirectoryWalker::Worker : public QRunnable
+{
+public:
+  Worker(DirectoryWalker * walker, int self) : m_walker(walker), m_self(self) { }
+  void run() override { m_walker->work(m_self); }
+private:
+  DirectoryWalker * m_walker;
+  int m_self;
+};
+
+DirectoryWalker::DirectoryWalker(void * handle, Visitor visitor)
+: m_handle(handle)
+, m_visitor(visitor)
+, m_maxThread(DEFAULT_MAX_THREAD)
+, m_pool()
+, m_deques()
+, m_urgent()
+, m_pending(0)
+, m_queued(0)
+, m_visited(0)
+, m_interrupted(0)
+, m_idleLock(new QMutex())
+, m_idle()
+{
+  m_pool.setExpiryTimeout(THREAD_EXPIRY_TIMEOUT);
+  m_pool.setMaxThreadCount(m_maxThread);
+}
+
+DirectoryWalker::~DirectoryWalker()
+{
+  interrupt();
+  m_pool.waitForDone();
+  for (Deque * deque : m_deques)
+    delete deque;
+  delete m_idleLock;
+}
+
+void DirectoryWalker::setMaxThread(int maxThread)
+{
+  // applied on the next walk
+  m_maxThread = (maxThread > 0 ? maxThread : 1);
+}
+
+int DirectoryWalker::walk(const QStringList& dirPaths)
+{
+  if (dirPaths.isEmpty())
+    return 0;
+  int count = m_maxThread;
+  m_pool.setMaxThreadCount(count);
+  while (m_deques.size() < count)
+    m_deques.push_back(new Deque());
+
+  {
+    // an interruption arrived before the start cancels the walk
+    LockGuard<QMutex> g(m_idleLock);
+    if (m_interrupted.load() != 0)
+    {
+      m_interrupted.store(0);
+      return 0;
+    }
+  }
+  m_visited.store(0);
+  m_pending.store(dirPaths.size());
+  m_queued.store(dirPaths.size());
+  // deal the roots to the workers
+  for (int i = 0; i < dirPaths.size(); ++i)
+    m_deques[i % count]->items.push_back(dirPaths[i]);
+
+  for (int i = 0; i < count; ++i)
+    m_pool.start(new Worker(this, i));
+  m_pool.waitForDone();
+
+  // purge the remaining on interruption
+  for (Deque * deque : m_deques)
+    deque->items.clear();
+  m_urgent.items.clear();
+  // the interruption has been consumed by this walk
+  LockGuard<QMutex> g(m_idleLock);
+  m_interrupted.store(0);
+  return m_visited.load();
+}
+
+bool DirectoryWalker::prioritize(const QString& dirPath)
+{
+  // join the walk only while it is pending, as it completes at zero
+  for (;;)
+  {
+    int pending = m_pending.load();
+    if (pending == 0 || m_interrupted.load() != 0)
+      return false;
+    if (m_pending.testAndSetOrdered(pending, pending + 1))
+      break;
+  }
+  {
+    LockGuard<QMutex> g(&m_urgent.lock);
+    m_urgent.items.append(dirPath);
+  }
+  m_queued.ref();
+  LockGuard<QMutex> g(m_idleLock);
+  m_idle.wakeAll();
+  return true;
+}
+
+void DirectoryWalker::interrupt()
+{
+  m_interrupted.store(1);
+  LockGuard<QMutex> g(m_idleLock);
+  m_idle.wakeAll();
+}
+
+bool DirectoryWalker::pop(int self, QString& dirPath)
+{
+  {
+    LockGuard<QMutex> g(&m_urgent.lock);
+    if (!m_urgent.items.isEmpty())
+    {
+      dirPath = m_urgent.items.takeFirst();
+      m_queued.deref();
+      return true;
+    }
+  }
+  {
+    Deque * own = m_deques[self];
+    LockGuard<QMutex> g(&own->lock);
+    if (!own->items.isEmpty())
+    {
+      dirPath = own->items.takeLast();
+      m_queued.deref();
+      return true;
+    }
+  }
+  // steal the oldest entry from the others, as it should hold the largest tree
+  int count = m_pool.maxThreadCount();
+  for (int i = 1; i < count; ++i)
+  {
+    Deque * victim = m_deques[(self + i) % count];
+    LockGuard<QMutex> g(&victim->lock);
+    if (!victim->items.isEmpty())
+    {
+      dirPath = victim->items.takeFirst();
+      m_queued.deref();
+      return true;
+    }
+  }
+  return false;
+}
+
+void DirectoryWalker::push(int self, const QStringList& dirPaths)
+{
+  m_pending.fetchAndAddOrdered(dirPaths.size());
+  {
+    Deque * own = m_deques[self];
+    LockGuard<QMutex> g(&own->lock);
+    own->items.append(dirPaths);
+  }
+  m_queued.fetchAndAddOrdered(dirPaths.size());
+  // wake the idle workers to steal the new work
+  LockGuard<QMutex> g(m_idleLock);
+  m_idle.wakeAll();
+}
+
+void DirectoryWalker::work(int self)
+{
+  QString dirPath;
+  while (m_interrupted.load() == 0)
+  {
+    if (pop(self, dirPath))
+    {
+      QStringList subDirs;
+      m_visitor(m_handle, dirPath, subDirs);
+      m_visited.ref();
+      if (!subDirs.isEmpty())
+        push(self, subDirs);
+      if (m_pending.fetchAndAddOrdered(-1) == 1)
+      {
+        // the walk is completed: release the idle workers
+        LockGuard<QMutex> g(m_idleLock);
+        m_idle.wakeAll();
+        break;
+      }
+      continue;
+    }
+    LockGuard<QMutex> g(m_idleLock);
+    if (m_pending.load() == 0)
+      break;
+    if (m_queued.load() == 0 && m_interrupted.load() == 0)
+      m_idle.wait(m_idleLock);
+  }
+}
@@ -0,0 +1,105 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef DIRECTORYWALKER_H
+#define DIRECTORYWALKER_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QThreadPool>
+#include <QWaitCondition>
+#include <QMutex>
+#include <QAtomicInt>
+
+namespace mediascanner
+{
+
+/**
+ * Walk directory trees with a bounded pool of workers. Each worker owns a
+ * deque of directories: it pops its own work from the back (depth first),
+ * and steals from the front of the others when it runs out of work. The
+ * visitor is called concurrently for each directory, and returns the list
+ * of sub-directories to walk next.
+ */
+class DirectoryWalker
+{
+public:
+  typedef void (*Visitor)(void * handle, const QString& dirPath, QStringList& subDirs);
+
+  DirectoryWalker(void * handle, Visitor visitor);
+  ~DirectoryWalker();
+
+  /**
+   * Set the number of threads of the next walks.
+   */
+  void setMaxThread(int maxThread);
+
+  /**
+   * Walk the given trees. The call is blocking until all directories have
+   * been visited or the walk has been interrupted.
+   * @param dirPaths the directories to visit first
+   * @return the number of visited directories
+   */
+  int walk(const QStringList& dirPaths);
+
+  /**
+   * Interrupt the running walk, else cancel the next one.
+   */
+  void interrupt();
+
+  /**
+   * Visit the given directory before any other of the running walk, then
+   * its sub-directories depth first.
+   * @param dirPath
+   * @return false if no walk is running
+   */
+  bool prioritize(const QString& dirPath);
+
+  int visited() const { return m_visited.load(); }
+  int pending() const { return m_pending.load(); }
+
+private:
+  class Worker;
+
+  struct Deque
+  {
+    QMutex lock;
+    QStringList items;
+  };
+
+  bool pop(int self, QString& dirPath);
+  void push(int self, const QStringList& dirPaths);
+  void work(int self);
+
+  void * m_handle;
+  Visitor m_visitor;
+  int m_maxThread;
+  QThreadPool m_pool;
+  QVector<Deque*> m_deques;
+  Deque m_urgent;
+  QAtomicInt m_pending;     // queued or in progress
+  QAtomicInt m_queued;      // queued only
+  QAtomicInt m_visited;
+  QAtomicInt m_interrupted;
+  QMutex * m_idleLock;
+  QWaitCondition m_idle;
+};
+
+}
+
+#endif /* DIRECTORYWALKER_H */
@@ -0,0 +1,529 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "filesystemwatcher.h"
+#include "locked.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QFileSystemWatcher>
+#include <QThread>
+#include <QHash>
+#include <QElapsedTimer>
+
+#if defined(__linux__)
+#define HAVE_INOTIFY
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#endif
+
+#define SETTLE_TIMEOUT_MS     500
+#define MAX_LATENCY_MS        3000
+#define WRITE_TIMEOUT_MS      60000
+#define EVENT_BUFFER_SIZE     65536
+
+using namespace mediascanner;
+
+namespace
+{
+
+/**
+ * The portable backend. It reports a rescan of the directory for any change,
+ * and a change of the file for any watched file.
+ */
+class QtBackend : public FileSystemWatcher::Backend
+{
+public:
+  QtBackend(void * handle, FileSystemWatcher::Callback callback)
+  : m_handle(handle)
+  , m_callback(callback)
+  , m_watcher()
+  , m_lock() { }
+
+  void start() override
+  {
+    void * handle = m_handle;
+    FileSystemWatcher::Callback callback = m_callback;
+    QObject::connect(&m_watcher, &QFileSystemWatcher::directoryChanged, [handle, callback](const QString& path) {
+      FileSystemWatcher::DeltaList deltas;
+      deltas.push_back(FileSystemWatcher::Delta(FileSystemWatcher::DirectoryChanged, path));
+      callback(handle, deltas);
+    });
+    QObject::connect(&m_watcher, &QFileSystemWatcher::fileChanged, [handle, callback](const QString& path) {
+      FileSystemWatcher::DeltaList deltas;
+      deltas.push_back(FileSystemWatcher::Delta(FileSystemWatcher::FileChanged, path));
+      callback(handle, deltas);
+    });
+  }
+
+  void stop() override
+  {
+    m_watcher.disconnect();
+  }
+
+  // QFileSystemWatcher isn't thread-safe, whereas nodes are scanned concurrently
+  bool addPath(const QString& path, bool isDirectory) override
+  {
+    Q_UNUSED(isDirectory);
+    LockGuard<QMutex> g(&m_lock);
+    return m_watcher.addPath(path);
+  }
+
+  void removePath(const QString& path, bool isDirectory) override
+  {
+    Q_UNUSED(isDirectory);
+    LockGuard<QMutex> g(&m_lock);
+    m_watcher.removePath(path);
+  }
+
+  bool isNative() const override { return false; }
+
+private:
+  void * m_handle;
+  FileSystemWatcher::Callback m_callback;
+  QFileSystemWatcher m_watcher;
+  QMutex m_lock;
+};
+
+#ifdef HAVE_INOTIFY
+
+/**
+ * The native backend. All watches share one inotify descriptor, which is
+ * read by a dedicated thread. The events are accumulated by path, and a
+ * path is delivered once it has been quiet for SETTLE_TIMEOUT_MS. A new
+ * file is held until it has been closed after writing.
+ */
+class InotifyBackend : public FileSystemWatcher::Backend, private QThread
+{
+public:
+  InotifyBackend(void * handle, FileSystemWatcher::Callback callback);
+  ~InotifyBackend() override;
+
+  bool isValid() const { return m_fd >= 0; }
+
+  void start() override;
+  void stop() override;
+  bool addPath(const QString& path, bool isDirectory) override;
+  void removePath(const QString& path, bool isDirectory) override;
+  bool isNative() const override { return true; }
+
+private:
+  void run() override;
+  void readEvents();
+  void handleEvent(const struct inotify_event * event);
+  void renamePaths(const QString& from, const QString& to);
+  int flush();
+
+  enum
+  {
+    Created   = 0x01,
+    Written   = 0x02,
+    Removed   = 0x04,
+    IsDir     = 0x08,
+    Rescan    = 0x10,
+  };
+
+  struct Pending
+  {
+    int flags;
+    qint64 first;
+    qint64 last;
+  };
+
+  void * m_handle;
+  FileSystemWatcher::Callback m_callback;
+  int m_fd;
+  int m_pipe[2];
+  char * m_buffer;
+  QMutex * m_lock;
+  // the kernel returns the same watch for the same inode, so a moved
+  // directory can be watched by several paths, the last being the current
+  QHash<int, QStringList> m_wdPaths;
+  QHash<QString, int> m_pathWds;
+  QHash<quint32, QString> m_moves;  // the directories moved from, by cookie
+  QHash<QString, Pending> m_pending;
+  QElapsedTimer m_clock;
+  bool m_limitReached;
+};
+
+InotifyBackend::InotifyBackend(void * handle, FileSystemWatcher::Callback callback)
+: QThread()
+, m_handle(handle)
+, m_callback(callback)
+, m_fd(-1)
+, m_buffer(nullptr)
+, m_lock(new QMutex())
+, m_wdPaths()
+, m_pathWds()
+, m_moves()
+, m_pending()
+, m_clock()
+, m_limitReached(false)
+{
+  m_pipe[0] = m_pipe[1] = -1;
+  if (::pipe2(m_pipe, O_NONBLOCK | O_CLOEXEC) != 0)
+    return;
+  m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (m_fd < 0)
+    qWarning("%s: inotify is not available (%d)", __FUNCTION__, errno);
+  m_buffer = new char [EVENT_BUFFER_SIZE];
+  m_clock.start();
+}
+
+InotifyBackend::~InotifyBackend()
+{
+  stop();
+  if (m_fd >= 0)
+    ::close(m_fd);
+  if (m_pipe[0] >= 0)
+    ::close(m_pipe[0]);
+  if (m_pipe[1] >= 0)
+    ::close(m_pipe[1]);
+  delete [] m_buffer;
+  delete m_lock;
+}
+
+void InotifyBackend::start()
+{
+  if (!QThread::isRunning())
+    QThread::start();
+}
+
+void InotifyBackend::stop()
+{
+  if (QThread::isRunning())
+  {
+    QThread::requestInterruption();
+    // wake the thread
+    char c = 0;
+    if (::write(m_pipe[1], &c, 1) < 0)
+      qWarning("%s: failed to wake the thread (%d)", __FUNCTION__, errno);
+    QThread::wait();
+  }
+}
+
+bool InotifyBackend::addPath(const QString& path, bool isDirectory)
+{
+  if (!isDirectory)
+    return true; // covered by the watch of the parent directory
+  int wd = inotify_add_watch(m_fd, QFile::encodeName(path).constData(),
+                             IN_CREATE | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                             IN_ONLYDIR | IN_EXCL_UNLINK);
+  if (wd < 0)
+  {
+    if (errno == ENOSPC && !m_limitReached)
+    {
+      m_limitReached = true;
+      qWarning("%s: the limit of inotify watches is reached", __FUNCTION__);
+    }
+    return false;
+  }
+  LockGuard<QMutex> g(m_lock);
+  QHash<QString, int>::iterator it = m_pathWds.find(path);
+  if (it != m_pathWds.end() && it.value() != wd)
+  {
+    // the path has been replaced by another directory
+    QStringList& paths = m_wdPaths[it.value()];
+    paths.removeAll(path);
+    if (paths.isEmpty())
+    {
+      inotify_rm_watch(m_fd, it.value());
+      m_wdPaths.remove(it.value());
+    }
+  }
+  QStringList& paths = m_wdPaths[wd];
+  paths.removeAll(path);
+  paths.push_back(path);
+  m_pathWds.insert(path, wd);
+  return true;
+}
+
+void InotifyBackend::removePath(const QString& path, bool isDirectory)
+{
+  if (!isDirectory)
+    return;
+  LockGuard<QMutex> g(m_lock);
+  QHash<QString, int>::iterator it = m_pathWds.find(path);
+  if (it != m_pathWds.end())
+  {
+    int wd = it.value();
+    m_pathWds.erase(it);
+    QHash<int, QStringList>::iterator w = m_wdPaths.find(wd);
+    if (w != m_wdPaths.end())
+    {
+      w.value().removeAll(path);
+      // the watch is kept while another path leads to the directory
+      if (!w.value().isEmpty())
+        return;
+      m_wdPaths.erase(w);
+    }
+    inotify_rm_watch(m_fd, wd);
+  }
+}
+
+/**
+ * Follow a directory moved within the watched tree: the watches of the
+ * directory and its sub-directories are kept, under the new paths.
+ * It must be called with the lock held.
+ */
+void InotifyBackend::renamePaths(const QString& from, const QString& to)
+{
+  QString prefix = from + "/";
+  QStringList moved;
+  for (QHash<QString, int>::const_iterator it = m_pathWds.constBegin(); it != m_pathWds.constEnd(); ++it)
+  {
+    if (it.key() == from || it.key().startsWith(prefix))
+      moved.push_back(it.key());
+  }
+  for (const QString& path : moved)
+  {
+    int wd = m_pathWds.take(path);
+    QString newPath = to + path.mid(from.length());
+    QStringList& paths = m_wdPaths[wd];
+    paths.removeAll(path);
+    paths.removeAll(newPath);
+    paths.push_back(newPath);
+    m_pathWds.insert(newPath, wd);
+  }
+}
+
+void InotifyBackend::run()
+{
+  struct pollfd fds[2];
+  fds[0].fd = m_fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = m_pipe[0];
+  fds[1].events = POLLIN;
+  int timeout = -1;
+  while (!isInterruptionRequested())
+  {
+    int r = ::poll(fds, 2, timeout);
+    if (r < 0 && errno != EINTR)
+    {
+      qWarning("%s: poll failed (%d)", __FUNCTION__, errno);
+      break;
+    }
+    if (r > 0 && (fds[1].revents & POLLIN))
+    {
+      char c[16];
+      while (::read(m_pipe[0], c, sizeof(c)) > 0);
+    }
+    if (r > 0 && (fds[0].revents & POLLIN))
+      readEvents();
+    // sleep until the next pending path is due
+    timeout = flush();
+  }
+  m_pending.clear();
+}
+
+void InotifyBackend::readEvents()
+{
+  for (;;)
+  {
+    ssize_t len = ::read(m_fd, m_buffer, EVENT_BUFFER_SIZE);
+    if (len <= 0)
+      break;
+    const char * p = m_buffer;
+    while (p < m_buffer + len)
+    {
+      const struct inotify_event * event = reinterpret_cast<const struct inotify_event*>(p);
+      handleEvent(event);
+      p += sizeof(struct inotify_event) + event->len;
+    }
+  }
+  // the pair of a move is queued at once, so a directory left unpaired has
+  // been moved out of the watched tree
+  LockGuard<QMutex> g(m_lock);
+  m_moves.clear();
+}
+
+void InotifyBackend::handleEvent(const struct inotify_event * event)
+{
+  qint64 now = m_clock.elapsed();
+  if (event->mask & IN_Q_OVERFLOW)
+  {
+    // events have been lost: rescan all watched directories
+    qWarning("%s: event queue overflow", __FUNCTION__);
+    LockGuard<QMutex> g(m_lock);
+    for (const QString& path : m_pathWds.keys())
+    {
+      Pending& pending = m_pending[path];
+      pending.flags = Rescan | IsDir;
+      pending.first = pending.last = now;
+    }
+    return;
+  }
+
+  QString dirPath;
+  {
+    LockGuard<QMutex> g(m_lock);
+    QHash<int, QStringList>::iterator it = m_wdPaths.find(event->wd);
+    if (it == m_wdPaths.end() || it.value().isEmpty())
+      return;
+    dirPath = it.value().last();
+    if (event->mask & IN_IGNORED)
+    {
+      // the watch has been removed by the kernel
+      for (const QString& path : it.value())
+        m_pathWds.remove(path);
+      m_wdPaths.erase(it);
+      return;
+    }
+  }
+  if (event->len == 0)
+    return; // the removal of the directory itself is reported by its parent
+
+  QString path = dirPath + "/" + QFile::decodeName(event->name);
+  if ((event->mask & IN_ISDIR) && event->cookie != 0)
+  {
+    LockGuard<QMutex> g(m_lock);
+    if (event->mask & IN_MOVED_FROM)
+      m_moves.insert(event->cookie, path);
+    else if (event->mask & IN_MOVED_TO)
+    {
+      QHash<quint32, QString>::iterator it = m_moves.find(event->cookie);
+      if (it != m_moves.end())
+      {
+        renamePaths(it.value(), path);
+        m_moves.erase(it);
+      }
+    }
+  }
+  QHash<QString, Pending>::iterator it = m_pending.find(path);
+  if (it == m_pending.end())
+  {
+    Pending pending = { 0, now, now };
+    it = m_pending.insert(path, pending);
+  }
+  Pending& pending = it.value();
+  pending.last = now;
+  if (event->mask & IN_ISDIR)
+    pending.flags |= IsDir;
+  if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+    pending.flags = (pending.flags & IsDir) | Removed;
+  if (event->mask & (IN_CREATE | IN_MOVED_TO))
+  {
+    pending.flags = (pending.flags & ~Removed) | Created;
+    // a moved file is complete
+    if (event->mask & IN_MOVED_TO)
+      pending.flags |= Written;
+  }
+  if (event->mask & IN_CLOSE_WRITE)
+    pending.flags |= Written;
+}
+
+/**
+ * Deliver the pending paths which are due.
+ * @return the delay in ms until the next pending path is due, else -1
+ */
+int InotifyBackend::flush()
+{
+  qint64 now = m_clock.elapsed();
+  qint64 next = -1;
+  FileSystemWatcher::DeltaList deltas;
+  QHash<QString, Pending>::iterator it = m_pending.begin();
+  while (it != m_pending.end())
+  {
+    const Pending& pending = it.value();
+    qint64 due;
+    if ((pending.flags & (Created | Written | Removed | IsDir | Rescan)) == Created)
+      due = pending.first + WRITE_TIMEOUT_MS; // wait until the file is complete
+    else
+      due = qMin(pending.last + SETTLE_TIMEOUT_MS, pending.first + MAX_LATENCY_MS);
+    if (due > now)
+    {
+      if (next < 0 || due < next)
+        next = due;
+      ++it;
+      continue;
+    }
+    if (pending.flags & Rescan)
+      deltas.push_back(FileSystemWatcher::Delta(FileSystemWatcher::DirectoryChanged, it.key()));
+    else if (pending.flags & Removed)
+      deltas.push_back(FileSystemWatcher::Delta((pending.flags & IsDir) ? FileSystemWatcher::DirectoryRemoved : FileSystemWatcher::FileRemoved, it.key()));
+    else if (pending.flags & IsDir)
+      deltas.push_back(FileSystemWatcher::Delta(FileSystemWatcher::DirectoryAdded, it.key()));
+    else
+      deltas.push_back(FileSystemWatcher::Delta(FileSystemWatcher::FileChanged, it.key()));
+    it = m_pending.erase(it);
+  }
+  if (!deltas.isEmpty())
+    m_callback(m_handle, deltas);
+  return (next < 0 ? -1 : (int)(next - now));
+}
+
+#endif /* HAVE_INOTIFY */
+
+}
+
+FileSystemWatcher::FileSystemWatcher(void * handle, Callback callback)
+: m_backend(nullptr)
+{
+#ifdef HAVE_INOTIFY
+  InotifyBackend * native = new InotifyBackend(handle, callback);
+  if (native->isValid())
+    m_backend = native;
+  else
+    delete native;
+#endif
+  if (!m_backend)
+    m_backend = new QtBackend(handle, callback);
+}
+
+FileSystemWatcher::~FileSystemWatcher()
+{
+  m_backend->stop();
+  delete m_backend;
+}
+
+void FileSystemWatcher::start()
+{
+  m_backend->start();
+}
+
+void FileSystemWatcher::stop()
+{
+  m_backend->stop();
+}
+
+bool FileSystemWatcher::addDirectory(const QString& dirPath)
+{
+  return m_backend->addPath(dirPath, true);
+}
+
+void FileSystemWatcher::removeDirectory(const QString& dirPath)
+{
+  m_backend->removePath(dirPath, true);
+}
+
+bool FileSystemWatcher::addFile(const QString& filePath)
+{
+  return m_backend->addPath(filePath, false);
+}
+
+void FileSystemWatcher::removeFile(const QString& filePath)
+{
+  m_backend->removePath(filePath, false);
+}
+
+bool FileSystemWatcher::isNative() const
+{
+  return m_backend->isNative();
+}
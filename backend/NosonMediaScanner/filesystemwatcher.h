@@ -0,0 +1,91 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef FILESYSTEMWATCHER_H
+#define FILESYSTEMWATCHER_H
+
+#include <QString>
+#include <QList>
+
+namespace mediascanner
+{
+
+/**
+ * The watcher reports the changes of the watched directories as a list of
+ * coalesced deltas. On Linux it uses one inotify descriptor for the whole
+ * tree with one watch per directory only. Events are buffered until the
+ * tree settles, so a burst of changes is delivered as one list holding one
+ * delta per path. On other platforms it falls back to QFileSystemWatcher.
+ */
+class FileSystemWatcher
+{
+public:
+  enum Change
+  {
+    FileChanged       = 0,  // the file has been created or rewritten
+    FileRemoved       = 1,
+    DirectoryAdded    = 2,
+    DirectoryRemoved  = 3,
+    DirectoryChanged  = 4,  // the content must be rescanned
+  };
+
+  struct Delta
+  {
+    Change change;
+    QString path;
+    Delta(Change _change, const QString& _path) : change(_change), path(_path) { }
+  };
+
+  typedef QList<Delta> DeltaList;
+  typedef void (*Callback)(void * handle, const DeltaList& deltas);
+
+  FileSystemWatcher(void * handle, Callback callback);
+  ~FileSystemWatcher();
+
+  void start();
+  void stop();
+
+  bool addDirectory(const QString& dirPath);
+  void removeDirectory(const QString& dirPath);
+
+  /**
+   * Watch a single file. It is only required by the fallback backend, as
+   * the native one reports the changes of any file in a watched directory.
+   */
+  bool addFile(const QString& filePath);
+  void removeFile(const QString& filePath);
+
+  bool isNative() const;
+
+  class Backend
+  {
+  public:
+    virtual ~Backend() { }
+    virtual void start() = 0;
+    virtual void stop() = 0;
+    virtual bool addPath(const QString& path, bool isDirectory) = 0;
+    virtual void removePath(const QString& path, bool isDirectory) = 0;
+    virtual bool isNative() const = 0;
+  };
+
+private:
+  Backend * m_backend;
+};
+
+}
+
+#endif /* FILESYSTEMWATCHER_H */
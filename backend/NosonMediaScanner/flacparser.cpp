@@ -19,6 +19,7 @@
 #include "mediafile.h"
 #include "mediainfo.h"
 #include "byteorder.h"
+#include "bytesource.h"
 
 #include <cstdio>
 #include <string>
@@ -26,6 +27,7 @@
 
 #define FLAC_CODEC        "flac"
 #define FLAC_BLOCK_SIZE   20
+#define FLAC_PICTURE_FRONT 3
 
 
 using namespace mediascanner;
@@ -46,23 +48,23 @@ bool FLACParser::match(const QFileInfo& fileInfo)
 
 bool FLACParser::parse(MediaFile * file, MediaInfo * info, bool debug)
 {
-  std::string path(file->filePath.toUtf8().constData());
+  std::string path(file->filePath().toUtf8().constData());
   unsigned char buf[FLAC_BLOCK_SIZE];
   bool isLast = false;
   bool isInfoValid = false;
-  FILE * fp = fopen(path.c_str(), "rb");
-  if (!fp)
+  ByteSource src;
+  if (!src.open(file->filePath()))
     return false;
 
   // check the magic file header, else close and return a null payload
-  if (fread(buf, 1, 4, fp) != 4 || memcmp(buf, "fLaC", 4) != 0)
+  if (src.read(buf, 4) != 4 || memcmp(buf, "fLaC", 4) != 0)
   {
     qWarning("%s: ERROR: bad magic header in file %s", __FUNCTION__, path.c_str());
-    fclose(fp);
+    src.close();
     return false;
   }
   // loop over metadata blocks until one match with requirements
-  while (!isLast && fread(buf, 1, 4, fp) == 4)
+  while (!isLast && src.read(buf, 4) == 4)
   {
     // get last block flag. if true next loop will stop
     isLast = ((*buf & 0x80) != 0);
@@ -82,7 +84,7 @@ bool FLACParser::parse(MediaFile * file, MediaInfo * info, bool debug)
         isInfoValid = false;
         break; // only one STREAMINFO block is allowed
       }
-      if (fread(buf, 1, FLAC_BLOCK_SIZE, fp) != FLAC_BLOCK_SIZE)
+      if (src.read(buf, FLAC_BLOCK_SIZE) != FLAC_BLOCK_SIZE)
         break;
       offset -= FLAC_BLOCK_SIZE;
       unsigned stream = read32be(buf + 10) >> 4;
@@ -110,7 +112,7 @@ bool FLACParser::parse(MediaFile * file, MediaInfo * info, bool debug)
       unsigned char * vorbis = new unsigned char [offset];
       unsigned char * ve = vorbis + offset;
 
-      if (fread(vorbis, 1, offset, fp) != offset)
+      if (src.read(vorbis, offset) != offset)
       {
         delete [] vorbis;
         break;
@@ -156,14 +158,14 @@ bool FLACParser::parse(MediaFile * file, MediaInfo * info, bool debug)
         break; // parsing vorbis comments failed
       }
       if (info->title.isEmpty())
-        info->title = file->baseName; // default title
+        info->title = file->baseName(); // default title
     }
     /*
      * PICTURE
      */
     else if (block == 0x06)
     {
-      if (fread(buf, 1, 4, fp) != 4)
+      if (src.read(buf, 4) != 4)
         break;
       offset -= 4;
       if (debug)
@@ -172,12 +174,84 @@ bool FLACParser::parse(MediaFile * file, MediaInfo * info, bool debug)
     }
 
     // first block MUST be STREAMINFO, else return an error
-    if (!isInfoValid || fseek(fp, offset, SEEK_CUR) != 0)
+    if (!isInfoValid || src.seek(offset, SEEK_CUR) != 0)
       break;
   }
-  fclose(fp);
+  src.close();
   if (debug)
       qDebug("%s: info:%s complete:%s", __FUNCTION__, isInfoValid ? "true" : "false", isLast ? "true" : "false");
   // parsing is completed if all blocks have been parsed and info is valid
   return (isInfoValid && isLast);
 }
+
+bool FLACParser::extractArt(MediaFile * file, QByteArray& image)
+{
+  unsigned char buf[4];
+  bool isLast = false;
+  bool found = false;
+  ByteSource src;
+  if (!src.open(file->filePath()))
+    return false;
+
+  if (src.read(buf, 4) != 4 || memcmp(buf, "fLaC", 4) != 0)
+  {
+    src.close();
+    return false;
+  }
+  // loop over metadata blocks until the front cover
+  while (!isLast && src.read(buf, 4) == 4)
+  {
+    isLast = ((*buf & 0x80) != 0);
+    unsigned block = *buf & 0x7f;
+    unsigned offset = (read32be(buf) & 0xffffff);
+    if (block == 0x06)
+    {
+      QByteArray data(offset, Qt::Uninitialized);
+      unsigned type = 0;
+      if (src.read(data.data(), offset) != offset)
+        break;
+      offset = 0;
+      QByteArray picture;
+      if (loadPicture(reinterpret_cast<const unsigned char*>(data.constData()), data.size(), picture, &type))
+      {
+        // keep the first picture, unless the front cover follows
+        if (!found || type == FLAC_PICTURE_FRONT)
+          image = picture;
+        found = true;
+        if (type == FLAC_PICTURE_FRONT)
+          break;
+      }
+    }
+    if (src.seek(offset, SEEK_CUR) != 0)
+      break;
+  }
+  src.close();
+  return found;
+}
+
+bool FLACParser::loadPicture(const unsigned char * data, size_t size, QByteArray& image, unsigned * type)
+{
+  const unsigned char * p = data;
+  const unsigned char * end = data + size;
+  if (end - p < 8)
+    return false;
+  *type = (unsigned)read32be(p);
+  p += 4;
+  uint32_t len = (uint32_t)read32be(p); // mime type
+  p += 4;
+  if ((uint64_t)(end - p) < (uint64_t)len + 4)
+    return false;
+  p += len;
+  len = (uint32_t)read32be(p); // description
+  p += 4;
+  // pass the description, then width, height, depth and colors
+  if ((uint64_t)(end - p) < (uint64_t)len + 20)
+    return false;
+  p += len + 16;
+  len = (uint32_t)read32be(p); // picture data
+  p += 4;
+  if ((uint64_t)(end - p) < len || len == 0)
+    return false;
+  image = QByteArray(reinterpret_cast<const char*>(p), len);
+  return true;
+}
@@ -29,6 +29,18 @@ public:
   const char * commonName() override { return "FLAC"; }
   bool match(const QFileInfo& fileInfo) override;
   bool parse(MediaFile * file, MediaInfo * info, bool debug) override;
+  bool extractArt(MediaFile * file, QByteArray& image) override;
+
+  /**
+   * Load the image of a PICTURE block, as stored in FLAC or in the
+   * METADATA_BLOCK_PICTURE comment of Vorbis and Opus.
+   * @param data the block without header
+   * @param size
+   * @param image
+   * @param type the picture type, 3 for the front cover
+   * @return false if the block is invalid
+   */
+  static bool loadPicture(const unsigned char * data, size_t size, QByteArray& image, unsigned * type);
 };
 
 }
@@ -22,17 +22,35 @@
 #include "mediafile.h"
 #include "mediainfo.h"
 #include "byteorder.h"
+#include "bytesource.h"
+#include "scannermetrics.h"
 #include "packed.h"
 
 #include <QDebug>
+#include <QAtomicInt>
+#include <QElapsedTimer>
 #include <cstdio>
 #include <cassert>
 
 #define ID3V2_HEADER_SIZE 10
 #define ID3V2_FOOTER_SIZE 10
+#define ID3_PICTURE_FRONT 3
+#define ID3_PICTURE_MAX_SIZE  0x1000000 /* 16 MB */
 
 using namespace mediascanner;
 
+static QAtomicInt _durationMode(ID3Parser::DurationSampled);
+
+void ID3Parser::setDurationMode(DurationMode mode)
+{
+  _durationMode.store(mode);
+}
+
+ID3Parser::DurationMode ID3Parser::durationMode()
+{
+  return static_cast<DurationMode>(_durationMode.load());
+}
+
 static const char * _exts[] = {
   "MP3", "AAC",
 #ifdef ENABLE_MEDIA_MP2
@@ -52,8 +70,6 @@ bool ID3Parser::match(const QFileInfo& fileInfo)
   return false;
 }
 
-typedef QByteArray(*cs_conv_t)(const char * data, unsigned size);
-
 static const unsigned id3_num_encodings = 5;
 
 enum ID3Encoding
@@ -65,24 +81,31 @@ enum ID3Encoding
   UTF16LE = 4,
 };
 
+/*
+ * The fields are decoded straight into their final strings, which are shared
+ * with the media info then.
+ */
 struct ID3Iinfo
 {
-  QByteArray title;
-  QByteArray album;
-  QByteArray genre;
-  QByteArray artist;
-  QByteArray composer;
+  QString title;
+  QString album;
+  QString genre;
+  QString artist;
+  QString composer;
   int artist_priority;
   int track_no;
   bool has_art;
+  QByteArray * picture;     /* where to extract the picture, if requested */
+  int picture_type;
 };
 
 struct ID3v2FrameHeader
 {
   char frame_id[4];
   unsigned int frame_size;
-  int compression;
-  int data_length_indicator;
+  unsigned int data_offset; /* bytes before the data: group id, data length */
+  bool skip;                /* compressed or encrypted */
+  bool unsync;
 };
 
 PACK (
@@ -96,40 +119,35 @@ struct ID3v1Tag
   unsigned char genre;
 });
 
-static QByteArray _cs_conv_latin1(const char * data, unsigned size);
-static QByteArray _cs_conv_utf16(const char * data, unsigned size);
-static QByteArray _cs_conv_utf16be(const char * data, unsigned size);
-static QByteArray _cs_conv_utf8(const char * data, unsigned size);
-static QByteArray _cs_conv_utf16le(const char * data, unsigned size);
-static long _find_id3v2(FILE * fp, off_t * sync_offset);
-static int _parse_id3v2(FILE * fp, long id3v2_offset, ID3Iinfo * info, off_t * ptag_size);
-static int _parse_id3v1(FILE * fp, ID3Iinfo * info, cs_conv_t csconv);
-static int _parse_mpeg_header(FILE * fp, off_t off, MediaInfo * audio_info, size_t size);
-
+static long _find_id3v2(ByteSource * src, off_t * sync_offset);
+static int _parse_id3v2(ByteSource * src, long id3v2_offset, ID3Iinfo * info, off_t * ptag_size);
+static int _parse_id3v1(ByteSource * src, ID3Iinfo * info);
+static int _parse_mpeg_header(ByteSource * src, off_t off, MediaInfo * audio_info, size_t size);
 bool ID3Parser::parse(MediaFile * file, MediaInfo * info, bool debug)
 {
   ID3Iinfo id3info;
   id3info.track_no = -1;
   id3info.artist_priority = 0;
   id3info.has_art = false;
+  id3info.picture = nullptr;
+  id3info.picture_type = -1;
 
   int r = 0;
   long id3v2_offset;
   off_t sync_offset = 0;
 
-  std::string path(file->filePath.toUtf8().constData());
-  FILE * fp = fopen(path.c_str(), "rb");
-  if (!fp)
+  ByteSource src;
+  if (!src.open(file->filePath()))
     return false;
 
-  id3v2_offset = _find_id3v2(fp, &sync_offset);
+  id3v2_offset = _find_id3v2(&src, &sync_offset);
   if (id3v2_offset >= 0)
   {
     off_t id3v2_size = 3;
 
     sync_offset = id3v2_offset;
 
-    if (_parse_id3v2(fp, id3v2_offset, &id3info, &id3v2_size) != 0 ||
+    if (_parse_id3v2(&src, id3v2_offset, &id3info, &id3v2_size) != 0 ||
             id3info.title.isEmpty() ||
             id3info.artist.isEmpty() ||
             id3info.album.isEmpty() ||
@@ -148,13 +166,13 @@ bool ID3Parser::parse(MediaFile * file, MediaInfo * info, bool debug)
   {
     char tag[3];
     /* check for id3v1 tag */
-    if (fseek(fp, -128, SEEK_END) != 0)
+    if (src.seek(-128, SEEK_END) != 0)
     {
       r = -3;
       goto done;
     }
 
-    if (fread(&tag, 1, 3, fp) != 3)
+    if (src.read(&tag, 3) != 3)
     {
       r = -4;
       goto done;
@@ -162,7 +180,7 @@ bool ID3Parser::parse(MediaFile * file, MediaInfo * info, bool debug)
 
     if (memcmp(tag, "TAG", 3) == 0)
     {
-      if (_parse_id3v1(fp, &id3info, _cs_conv_utf8) != 0)
+      if (_parse_id3v1(&src, &id3info) != 0)
       {
         r = -5;
         goto done;
@@ -170,58 +188,46 @@ bool ID3Parser::parse(MediaFile * file, MediaInfo * info, bool debug)
     }
   }
 
-  info->container = file->suffix.toLower();
-  info->title = id3info.title.isEmpty() ? file->baseName : id3info.title;
+  info->container = file->suffix().toLower();
+  info->title = id3info.title.isEmpty() ? file->baseName() : id3info.title;
   info->album = id3info.album;
   info->genre = id3info.genre;
   info->artist = id3info.artist;
+  info->composer = id3info.composer;
   info->trackNo = id3info.track_no > 0 ? id3info.track_no : 0;
   info->hasArt = id3info.has_art;
 
-  r = _parse_mpeg_header(fp, sync_offset, info, file->size);
+  r = _parse_mpeg_header(&src, sync_offset, info, file->size);
 
 done:
-  fclose(fp);
+  src.close();
   return (r == 0);
 }
 
-static QByteArray _cs_conv_latin1(const char * data, unsigned size)
+bool ID3Parser::extractArt(MediaFile * file, QByteArray& image)
 {
-  return QString::fromLatin1(QByteArray(data, size)).toUtf8();
-}
+  ID3Iinfo id3info;
+  id3info.track_no = -1;
+  id3info.artist_priority = 0;
+  id3info.has_art = false;
+  id3info.picture = &image;
+  id3info.picture_type = -1;
 
-static QByteArray _cs_conv_utf16(const char * data, unsigned size)
-{
-  return QString::fromUtf16((const char16_t*) data, size / 2).toUtf8();
-}
+  long id3v2_offset;
+  off_t sync_offset = 0, id3v2_size = 0;
 
-static QByteArray _cs_conv_utf16be(const char * data, unsigned size)
-{
-  static const char * _BOM = "\xfe\xff";
-  if (memcmp(data, _BOM, 2) == 0)
-    return _cs_conv_utf16(data, size);
-  QByteArray buf;
-  buf.append(_BOM).append(data, size);
-  return _cs_conv_utf16(buf.constData(), buf.length());
-}
+  ByteSource src;
+  if (!src.open(file->filePath()))
+    return false;
 
-static QByteArray _cs_conv_utf8(const char * data, unsigned size)
-{
-  return QByteArray(data, size);
-}
+  id3v2_offset = _find_id3v2(&src, &sync_offset);
+  if (id3v2_offset >= 0)
+    _parse_id3v2(&src, id3v2_offset, &id3info, &id3v2_size);
 
-static QByteArray _cs_conv_utf16le(const char * data, unsigned size)
-{
-  static const char * _BOM = "\xff\xfe";
-  if (memcmp(data, _BOM, 2) == 0)
-    return _cs_conv_utf16(data, size);
-  QByteArray buf;
-  buf.append(_BOM).append(data, size);
-  return _cs_conv_utf16(buf.constData(), buf.length());
+  src.close();
+  return (id3info.picture_type >= 0);
 }
 
-static cs_conv_t _cs_conv[] = {_cs_conv_latin1, _cs_conv_utf16, _cs_conv_utf16be, _cs_conv_utf8, _cs_conv_utf16le};
-
 static unsigned int _to_uint(const char * data, int data_size)
 {
   unsigned int sum = 0;
@@ -260,14 +266,14 @@ static inline int _is_id3v2_second_synch_byte(unsigned char byte)
 /**
  * Returns the offset in fd to the position after the ID3 tag
  */
-static long _find_id3v2(FILE * fp, off_t * sync_offset)
+static long _find_id3v2(ByteSource * src, off_t * sync_offset)
 {
   static const char pattern[3] = {'I', 'D', '3'};
   char buffer[3];
   unsigned int prev_part_match, prev_part_match_sync = 0;
   long buffer_offset;
 
-  if (fread(buffer, 1, sizeof(buffer), fp) != sizeof(buffer))
+  if (src->read(buffer, sizeof(buffer)) != sizeof(buffer))
     return -1;
 
   if (memcmp(buffer, pattern, sizeof(pattern)) == 0)
@@ -358,7 +364,7 @@ static long _find_id3v2(FILE * fp, off_t * sync_offset)
       }
     }
 
-    if (fread(buffer, 1, sizeof(buffer), fp) != sizeof(buffer))
+    if (src->read(buffer, sizeof(buffer)) != sizeof(buffer))
       return -1;
     buffer_offset += sizeof(buffer);
   }
@@ -379,8 +385,9 @@ static unsigned int _get_id3v2_frame_header_size(unsigned int version)
   }
 }
 
-static void _parse_id3v2_frame_header(char * data, unsigned int version, struct ID3v2FrameHeader * fh)
+static void _parse_id3v2_frame_header(const char * data, unsigned int version, bool unsync, struct ID3v2FrameHeader * fh)
 {
+  unsigned char flags;
   switch (version)
   {
   case 0:
@@ -389,98 +396,231 @@ static void _parse_id3v2_frame_header(char * data, unsigned int version, struct
     memcpy(fh->frame_id, data, 3);
     fh->frame_id[3] = 0;
     fh->frame_size = _to_uint(data + 3, 3);
-    fh->compression = 0;
-    fh->data_length_indicator = 0;
+    fh->data_offset = 0;
+    fh->skip = false;
+    fh->unsync = false;
     break;
   case 3:
     memcpy(fh->frame_id, data, 4);
     fh->frame_size = _to_uint(data + 4, 4);
-    fh->compression = data[9] & 0x40;
-    fh->data_length_indicator = 0;
+    flags = data[9];
+    fh->skip = (flags & 0xc0);              /* compression, encryption */
+    fh->data_offset = (flags & 0x20) ? 1 : 0; /* grouping identity */
+    fh->unsync = false;                     /* done for the whole tag */
     break;
   case 4:
   default:
     memcpy(fh->frame_id, data, 4);
-    fh->frame_size = _to_uint(data + 4, 4);
-    fh->compression = data[9] & 0x4;
-    fh->data_length_indicator = data[9] & 0x1;
+    /* the size is synchsafe, but some writers stored a plain integer */
+    if ((data[4] | data[5] | data[6] | data[7]) & 0x80)
+      fh->frame_size = _to_uint(data + 4, 4);
+    else
+      fh->frame_size = _to_uint_max7b(data + 4, 4);
+    flags = data[9];
+    fh->skip = (flags & 0x0c);              /* compression, encryption */
+    fh->data_offset = ((flags & 0x40) ? 1 : 0) + ((flags & 0x01) ? 4 : 0);
+    fh->unsync = (unsync || (flags & 0x02));
     break;
   }
 }
 
-static inline void _get_id3v2_frame_info(const char * frame_data, unsigned int frame_size, QByteArray * str, cs_conv_t csconv, int strip)
+/**
+ * Remove in place the 0x00 inserted after each 0xff by the unsynchronisation
+ * scheme. Returns the new size.
+ */
+static unsigned int _resync(char * data, unsigned int size)
 {
-  if (frame_size == 0)
-    return;
-  if (strip)
-    *str = csconv(frame_data, frame_size).trimmed();
+  unsigned int i, j;
+  for (i = 0, j = 0; i < size; ++i)
+  {
+    data[j++] = data[i];
+    if ((unsigned char) data[i] == 0xff && i + 1 < size && data[i + 1] == 0)
+      ++i;
+  }
+  return j;
+}
+
+static bool _need_resync(const char * data, unsigned int size)
+{
+  const char *p = data, *end = data + size;
+  while (p < end && (p = (const char*) memchr(p, 0xff, end - p)))
+  {
+    if (++p < end && *p == 0)
+      return true;
+  }
+  return false;
+}
+
+/**
+ * The buffer of the thread for the data to resynchronize. It is used only
+ * when the data must be changed, and it keeps its capacity between files.
+ */
+static QByteArray& _resync_buffer()
+{
+  static thread_local QByteArray buffer;
+  return buffer;
+}
+
+/* ASCII white spaces, as trimmed by QByteArray */
+static inline bool _is_space(unsigned int c)
+{
+  return (c == ' ' || (c >= '\t' && c <= '\r'));
+}
+
+/**
+ * Pass the BOM if any, and returns the byte order of the UTF-16 text.
+ */
+static bool _utf16_is_be(unsigned int encoding, const char ** data, unsigned int * size)
+{
+  const unsigned char * u = (const unsigned char*) *data;
+  if (*size >= 2)
+  {
+    if (u[0] == 0xfe && u[1] == 0xff)
+    {
+      *data += 2;
+      *size -= 2;
+      return true;
+    }
+    if (u[0] == 0xff && u[1] == 0xfe)
+    {
+      *data += 2;
+      *size -= 2;
+      return false;
+    }
+  }
+  return (encoding == UTF16BE);
+}
+
+static inline unsigned int _utf16_unit(const char * data, unsigned int i, bool be)
+{
+  const unsigned char * u = (const unsigned char*) data + 2 * i;
+  return be ? ((u[0] << 8) | u[1]) : (u[0] | (u[1] << 8));
+}
+
+static inline bool _is_utf16(unsigned int encoding)
+{
+  return (encoding == UTF16 || encoding == UTF16BE || encoding == UTF16LE);
+}
+
+/**
+ * Decode the first string of a text frame into the field. Only the string
+ * of the field is allocated.
+ */
+static void _get_id3v2_text(unsigned int encoding, const char * data, unsigned int size, QString * out, bool strip)
+{
+  unsigned int start = 0, end;
+  if (_is_utf16(encoding))
+  {
+    bool be = _utf16_is_be(encoding, &data, &size);
+    unsigned int len = size / 2;
+    for (end = 0; end < len && _utf16_unit(data, end, be) != 0; ++end);
+    if (strip)
+    {
+      while (start < end && _is_space(_utf16_unit(data, start, be)))
+        ++start;
+      while (end > start && _is_space(_utf16_unit(data, end - 1, be)))
+        --end;
+    }
+    QString str(end - start, Qt::Uninitialized);
+    QChar * p = str.data();
+    for (unsigned int i = start; i < end; ++i)
+      *p++ = QChar((ushort) _utf16_unit(data, i, be));
+    *out = str;
+  }
+  else
+  {
+    const char * nul = (const char*) memchr(data, 0, size);
+    end = nul ? nul - data : size;
+    if (strip)
+    {
+      while (start < end && _is_space((unsigned char) data[start]))
+        ++start;
+      while (end > start && _is_space((unsigned char) data[end - 1]))
+        --end;
+    }
+    if (encoding == UTF8)
+      *out = QString::fromUtf8(data + start, end - start);
+    else
+      *out = QString::fromLatin1(data + start, end - start);
+  }
+}
+
+/**
+ * Decode a number from a text frame without allocation.
+ */
+static bool _get_id3v2_number(unsigned int encoding, const char * data, unsigned int size, int * out)
+{
+  char buf[16];
+  unsigned int len = 0;
+  if (_is_utf16(encoding))
+  {
+    bool be = _utf16_is_be(encoding, &data, &size);
+    for (unsigned int i = 0; i < size / 2 && len < sizeof(buf) - 1; ++i)
+    {
+      unsigned int c = _utf16_unit(data, i, be);
+      if (c == 0 || c > 0x7f)
+        break;
+      buf[len++] = (char) c;
+    }
+  }
   else
-    *str = csconv(frame_data, frame_size);
+  {
+    for (unsigned int i = 0; i < size && len < sizeof(buf) - 1 && data[i] != 0; ++i)
+      buf[len++] = data[i];
+  }
+  if (len == 0)
+    return false;
+  buf[len] = 0;
+  *out = atoi(buf);
+  return true;
 }
 
-static int _get_id3v2_artist(unsigned int index, const char * frame_data, unsigned int frame_size, ID3Iinfo * info, cs_conv_t csconv)
+static void _get_id3v2_artist(unsigned int index, unsigned int encoding, const char * frame_data, unsigned int frame_size, ID3Iinfo * info)
 {
   static const unsigned char artist_priorities[] = {3, 4, 2, 1};
   const unsigned int index_max = sizeof(artist_priorities) / sizeof(*artist_priorities);
 
   if (index >= index_max)
-    return -1;
+    return;
 
+  /* decode only if it would win */
   if (artist_priorities[index] > info->artist_priority)
   {
-    QByteArray artist;
-    _get_id3v2_frame_info(frame_data, frame_size, &artist, csconv, 1);
+    QString artist;
+    _get_id3v2_text(encoding, frame_data, frame_size, &artist, true);
     if (!artist.isEmpty())
     {
       info->artist = artist;
       info->artist_priority = artist_priorities[index];
     }
   }
-  return 0;
 }
 
-static int _get_id3v1_genre(unsigned int genre, QByteArray * out)
+static int _get_id3v1_genre(unsigned int genre, QString * out)
 {
   if (genre < id3v1_genres_len)
   {
-    out->clear();
-    out->append(id3v1_genres_str[genre]);
+    *out = QString::fromLatin1(id3v1_genres_str[genre]);
     return 0;
   }
   return -1;
 }
 
-static inline int _parse_id3v1_genre(const char * str_genre, QByteArray * out)
+static void _get_id3v2_genre(unsigned int encoding, const char * frame_data, unsigned int frame_size, QString * out)
 {
-  return _get_id3v1_genre(atoi(str_genre), out);
-}
+  QString genre;
 
-static void _get_id3v2_genre(const char * frame_data, unsigned int frame_size, QByteArray * out, cs_conv_t csconv)
-{
-  unsigned int i, is_number;
-  QByteArray genre;
-
-  _get_id3v2_frame_info(frame_data, frame_size, &genre, csconv, 1);
+  _get_id3v2_text(encoding, frame_data, frame_size, &genre, true);
   if (genre.isEmpty())
     return;
 
-  is_number = (genre.length() != 0 && genre.at(0) != '(');
-  if (is_number)
-  {
-    for (i = 0; i < genre.length(); ++i)
-    {
-      if (!isdigit(genre.at(i)))
-      {
-        is_number = 0;
-        break;
-      }
-    }
-  }
-
-  if (is_number && _parse_id3v1_genre(genre.constData(), out) == 0)
+  if (genre.at(0) != '(')
   {
+    bool is_number = false;
+    unsigned int number = genre.toUInt(&is_number);
     /* id3v1 genre found */
-    return;
+    if (is_number && _get_id3v1_genre(number, out) == 0)
+      return;
   }
 
   /* ID3v2.3 "content type" can contain a ID3v1 genre number in parenthesis at
@@ -490,28 +630,22 @@ static void _get_id3v2_genre(const char * frame_data, unsigned int frame_size, Q
    * authoritative and we return that instead. Or finally, the field may
    * simply be free text, in which case we just return the value. */
 
-  if (genre.length() > 1 && genre.at(0) == '(')
+  else if (genre.length() > 1)
   {
-    int closing = 0;
-    while (closing < genre.length() && genre.at(closing) != ')') ++closing;
-
-    if (closing < genre.length())
+    int closing = genre.indexOf(')');
+    if (closing > 0)
     {
       if (closing == genre.length() - 1)
       {
         /* ) is the last character and only appears once in the
          * string get the id3v1 genre enclosed by parentheses
          */
-        if (_parse_id3v1_genre(genre.constData() + 1, out) == 0)
-        {
+        if (_get_id3v1_genre(genre.mid(1, closing - 1).toUInt(), out) == 0)
           return;
-        }
       }
       else
       {
-        ++closing;
-        out->clear();
-        out->append(genre.constData() + closing, genre.length() - closing);
+        *out = genre.mid(closing + 1);
         return;
       }
     }
@@ -521,23 +655,13 @@ static void _get_id3v2_genre(const char * frame_data, unsigned int frame_size, Q
   *out = genre;
 }
 
-static void _get_id3v2_trackno(const char * frame_data, unsigned int frame_size, ID3Iinfo * info, cs_conv_t csconv)
+static void _parse_id3v2_frame(struct ID3v2FrameHeader * fh, const char * frame_data, unsigned int frame_size, ID3Iinfo * info)
 {
-  QByteArray buf;
-  _get_id3v2_frame_info(frame_data, frame_size, &buf, csconv, 0);
-  if (buf.isEmpty())
-    return;
-  info->track_no = atoi(buf.constData());
-}
-
-static void _parse_id3v2_frame(struct ID3v2FrameHeader * fh, const char * frame_data, ID3Iinfo * info)
-{
-  cs_conv_t csconv;
-  unsigned int text_encoding, frame_size;
+  unsigned int text_encoding;
   const char *fid;
 
   /* ignore frames which contains just the encoding */
-  if (fh->frame_size <= 1)
+  if (frame_size <= 1)
     return;
 
   /* All used frames start with 'T' */
@@ -545,149 +669,229 @@ static void _parse_id3v2_frame(struct ID3v2FrameHeader * fh, const char * frame_
   if (fid[0] != 'T')
     return;
 
-  text_encoding = frame_data[0];
+  text_encoding = (unsigned char) frame_data[0];
+  if (text_encoding >= id3_num_encodings)
+    text_encoding = Latin1;
 
   /* skip first byte - text encoding */
   frame_data += 1;
-  frame_size = fh->frame_size - 1;
-
-  if (text_encoding < id3_num_encodings)
-    csconv = _cs_conv[text_encoding];
-  else
-    csconv = _cs_conv[0];
+  frame_size -= 1;
 
   /* ID3v2.2 used 3 bytes for the frame id, so let's check it */
   if ((fid[1] == 'T' && fid[2] == '2') ||
           (fid[1] == 'I' && fid[2] == 'T' && fid[3] == '2'))
-    _get_id3v2_frame_info(frame_data, frame_size, &info->title, csconv, 1);
+    _get_id3v2_text(text_encoding, frame_data, frame_size, &info->title, true);
   else if (fid[1] == 'P')
   {
     if (fid[2] == 'E')
-      _get_id3v2_artist(fid[3] - '1', frame_data, frame_size, info, csconv);
+      _get_id3v2_artist(fid[3] - '1', text_encoding, frame_data, frame_size, info);
     else if (fid[2] >= '1' && fid[2] <= '4')
-      _get_id3v2_artist(fid[2] - '1', frame_data, frame_size, info, csconv);
+      _get_id3v2_artist(fid[2] - '1', text_encoding, frame_data, frame_size, info);
   }
     /* TALB, TAL */
   else if (fid[1] == 'A' && fid[2] == 'L')
-    _get_id3v2_frame_info(frame_data, frame_size, &info->album, csconv, 1);
+    _get_id3v2_text(text_encoding, frame_data, frame_size, &info->album, true);
     /* TCOM (Composer) */
   else if (fid[1] == 'C' && fid[2] == 'O' && fid[3] == 'M')
-    _get_id3v2_frame_info(frame_data, frame_size, &info->composer, csconv, 1);
+    _get_id3v2_text(text_encoding, frame_data, frame_size, &info->composer, true);
     /* TCON (Content/Genre) */
   else if (fid[1] == 'C' && fid[2] == 'O' && fid[3] == 'N')
-    _get_id3v2_genre(frame_data, frame_size, &info->genre, csconv);
+    _get_id3v2_genre(text_encoding, frame_data, frame_size, &info->genre);
   else if (fid[1] == 'R' && (fid[2] == 'K' ||
           (fid[2] == 'C' && fid[3] == 'K')))
-    _get_id3v2_trackno(frame_data, frame_size, info, csconv);
+    _get_id3v2_number(text_encoding, frame_data, frame_size, &info->track_no);
 }
 
-static int _parse_id3v2(FILE * fp, long id3v2_offset, ID3Iinfo * info, off_t * ptag_size)
+static void _get_id3v2_picture(unsigned int major_version, const char * frame_data, unsigned int frame_size, ID3Iinfo * info)
 {
-  char header_data[10], frame_header_data[10];
-  unsigned int tag_size, major_version, frame_data_pos, frame_data_length, frame_header_size;
-  int extended_header, footer_present;
-  struct ID3v2FrameHeader fh;
-  size_t nread;
-
-  fseek(fp, id3v2_offset, SEEK_SET);
+  const char *p = frame_data, *end = frame_data + frame_size, *nul;
+  unsigned int encoding;
+  int type;
 
-  /* parse header */
-  if (fread(header_data, 1, ID3V2_HEADER_SIZE, fp) != ID3V2_HEADER_SIZE)
-    return -1;
-
-  tag_size = _to_uint_max7b(header_data + 6, 4);
-  if (tag_size == 0)
-    return -1;
+  if (frame_size < 2)
+    return;
+  encoding = (unsigned char) *p++;
+  /* ID3v2.2 gives the image format in 3 bytes, else a MIME type follows */
+  if (major_version == 0x2)
+    p += 3;
+  else if ((nul = (const char*) memchr(p, 0, end - p)))
+    p = nul + 1;
+  else
+    return;
+  if (p >= end)
+    return;
+  type = (unsigned char) *p++;
 
-  *ptag_size = tag_size + ID3V2_HEADER_SIZE;
+  /* pass the description */
+  if (_is_utf16(encoding))
+  {
+    while (p + 1 < end && (p[0] != 0 || p[1] != 0))
+      p += 2;
+    p += 2;
+  }
+  else if ((nul = (const char*) memchr(p, 0, end - p)))
+    p = nul + 1;
+  else
+    return;
+  if (p >= end)
+    return;
 
-  /* parse frames */
-  major_version = header_data[3];
+  /* keep the first picture, unless the front cover follows */
+  if (info->picture_type < 0 || type == ID3_PICTURE_FRONT)
+  {
+    *info->picture = QByteArray(p, end - p);
+    info->picture_type = type;
+  }
+}
 
-  frame_data_pos = 0;
-  frame_data_length = tag_size;
+/**
+ * Parse the frames from the current position. The kept text frames are seen
+ * in place in the window of the source, so nothing is copied unless the
+ * data must be resynchronized.
+ */
+static int _parse_id3v2_frames(ByteSource * src, unsigned int major_version, unsigned char flags, unsigned int length, ID3Iinfo * info)
+{
+  const char * data;
+  unsigned int frame_data_pos = 0, frame_header_size;
+  struct ID3v2FrameHeader fh;
+  /* since ID3v2.4 the unsynchronisation is done by frame */
+  bool unsync = (major_version > 3 && (flags & 0x80));
 
   /* check for extended header */
-  extended_header = header_data[5] & 0x20; /* bit 6 */
-  if (extended_header)
+  if (flags & 0x40) /* bit 6 */
   {
-    /* skip extended header */
     unsigned int extended_header_size;
-    char extended_header_data[6];
-    bool crc;
-
-    if (fread(extended_header_data, 1, 4, fp) != 4)
+    if (!(data = src->fetch(4)))
       return -1;
-
-    extended_header_size = _to_uint(extended_header_data, 4);
-    crc = extended_header_data[5] & 0x8000;
-
-    *ptag_size += extended_header_size + (crc * 4);
-
-    fseek(fp, extended_header_size - 6, SEEK_CUR);
+    /* the size includes itself since ID3v2.4 */
+    if (major_version > 3)
+      extended_header_size = _to_uint_max7b(data, 4);
+    else
+      extended_header_size = _to_uint(data, 4) + 4;
+    if (extended_header_size < 4 || extended_header_size > length)
+      return -1;
+    src->seek(extended_header_size - 4, SEEK_CUR);
     frame_data_pos += extended_header_size;
-    frame_data_length -= extended_header_size;
   }
 
-  footer_present = header_data[5] & 0x8; /* bit 4 */
-  if (footer_present && frame_data_length > ID3V2_FOOTER_SIZE)
-    frame_data_length -= ID3V2_FOOTER_SIZE;
-
   frame_header_size = _get_id3v2_frame_header_size(major_version);
-  while (frame_data_pos < frame_data_length - frame_header_size)
+  while (frame_data_pos + frame_header_size < length)
   {
-    nread = fread(frame_header_data, 1, frame_header_size, fp);
-    if (nread == 0)
-      break;
+    if (!(data = src->fetch(frame_header_size)))
+      return (src->tell() >= src->size() ? 0 : -1);
 
-    if (nread != frame_header_size)
-      return -1;
+    if (data[0] == 0)
+      break; /* padding */
 
-    if (frame_header_data[0] == 0)
+    _parse_id3v2_frame_header(data, major_version, unsync, &fh);
+    /* a frame running past the tag or the file is corrupted */
+    if (fh.frame_size > length - frame_data_pos - frame_header_size ||
+            src->tell() + fh.frame_size > src->size())
       break;
-
-    _parse_id3v2_frame_header(frame_header_data, major_version, &fh);
+    frame_data_pos += fh.frame_size + frame_header_size;
 
     if (fh.frame_size > 0 &&
-            !fh.compression &&
+            !fh.skip &&
             fh.frame_id[0] == 'T' &&
             memcmp(fh.frame_id, "TXXX", 4) != 0)
     {
-      char *frame_data;
-
-      if (fh.data_length_indicator)
-        fseek(fp, 4, SEEK_CUR);
-
-      frame_data = (char*) malloc(sizeof(char) * fh.frame_size);
-      if (fread(frame_data, 1, fh.frame_size, fp) != (int) fh.frame_size)
+      unsigned int frame_size = fh.frame_size;
+      const char * frame_data = src->fetch(frame_size);
+      if (!frame_data)
       {
-        free(frame_data);
-        return -1;
+        /* the tag is truncated, else the frame is too large to be kept */
+        if (src->tell() + frame_size > src->size())
+          return -1;
+        src->seek(frame_size, SEEK_CUR);
+        continue;
       }
+      if (fh.data_offset >= frame_size)
+        continue;
+      frame_data += fh.data_offset;
+      frame_size -= fh.data_offset;
 
-      _parse_id3v2_frame(&fh, frame_data, info);
-      free(frame_data);
+      if (fh.unsync && _need_resync(frame_data, frame_size))
+      {
+        QByteArray& buffer = _resync_buffer();
+        buffer.resize(frame_size);
+        memcpy(buffer.data(), frame_data, frame_size);
+        frame_size = _resync(buffer.data(), frame_size);
+        frame_data = buffer.constData();
+      }
+      _parse_id3v2_frame(&fh, frame_data, frame_size, info);
     }
     else
     {
+      bool is_picture = false;
       if (major_version == 0x2 && memcmp(fh.frame_id, "PIC", 3) == 0)
-        info->has_art = true;
+        is_picture = info->has_art = true;
       else if (major_version > 0x2 && major_version < 0x5 && memcmp(fh.frame_id, "APIC", 4) == 0)
-        info->has_art = true;
+        is_picture = info->has_art = true;
 
-      if (fh.data_length_indicator)
-        fseek(fp, fh.frame_size + 4, SEEK_CUR);
+      if (is_picture && info->picture && !fh.skip &&
+              info->picture_type != ID3_PICTURE_FRONT &&
+              fh.frame_size > fh.data_offset &&
+              fh.frame_size <= ID3_PICTURE_MAX_SIZE)
+      {
+        QByteArray frame(fh.frame_size, Qt::Uninitialized);
+        if (src->read(frame.data(), fh.frame_size) != fh.frame_size)
+          return -1;
+        char * frame_data = frame.data() + fh.data_offset;
+        unsigned int frame_size = fh.frame_size - fh.data_offset;
+        if (fh.unsync)
+          frame_size = _resync(frame_data, frame_size);
+        _get_id3v2_picture(major_version, frame_data, frame_size, info);
+      }
       else
-        fseek(fp, fh.frame_size, SEEK_CUR);
+        src->seek(fh.frame_size, SEEK_CUR);
     }
-
-    frame_data_pos += fh.frame_size + frame_header_size;
   }
 
   return 0;
 }
 
-static inline void _id3v1_str_get(QByteArray * str, const char * buf, int maxlen, cs_conv_t csconv)
+static int _parse_id3v2(ByteSource * src, long id3v2_offset, ID3Iinfo * info, off_t * ptag_size)
+{
+  const char * header_data;
+  unsigned int tag_size, major_version;
+  unsigned char flags;
+
+  src->seek(id3v2_offset, SEEK_SET);
+
+  /* parse header */
+  if (!(header_data = src->fetch(ID3V2_HEADER_SIZE)))
+    return -1;
+
+  tag_size = _to_uint_max7b(header_data + 6, 4);
+  if (tag_size == 0)
+    return -1;
+
+  *ptag_size = tag_size + ID3V2_HEADER_SIZE;
+
+  major_version = header_data[3];
+  flags = header_data[5];
+
+  /* the footer isn't counted in the tag size */
+  if (major_version > 3 && (flags & 0x10)) /* bit 4 */
+    *ptag_size += ID3V2_FOOTER_SIZE;
+
+  /* Until ID3v2.3 the unsynchronisation is done for the whole tag, frame
+   * headers included, so the tag must be resynchronized before parsing */
+  if (major_version < 4 && (flags & 0x80)) /* bit 7 */
+  {
+    QByteArray& buffer = _resync_buffer();
+    buffer.resize(tag_size);
+    if (src->read(buffer.data(), tag_size) != tag_size)
+      return -1;
+    ByteSource tag;
+    tag.open(buffer.constData(), _resync(buffer.data(), tag_size));
+    return _parse_id3v2_frames(&tag, major_version, flags, (unsigned int) tag.size(), info);
+  }
+
+  return _parse_id3v2_frames(src, major_version, flags, tag_size, info);
+}
+
+static inline void _id3v1_str_get(QString * str, const char * buf, int maxlen)
 {
   int start, len;
   const char *p, *p_end, *p_last;
@@ -695,7 +899,7 @@ static inline void _id3v1_str_get(QByteArray * str, const char * buf, int maxlen
   start = 0;
   p_last = NULL;
   p_end = buf + maxlen;
-  for (p = buf; *p != '\0' && p < p_end; p++)
+  for (p = buf; p < p_end && *p != '\0'; p++)
   {
     if (!isspace(*p))
       p_last = p;
@@ -711,38 +915,38 @@ static inline void _id3v1_str_get(QByteArray * str, const char * buf, int maxlen
     return;
 
   ++len; /* p_last is not included yet */
-  *str = csconv(buf + start, len);
+  *str = QString::fromUtf8(buf + start, len);
 }
 
-static int _parse_id3v1(FILE * fp, ID3Iinfo * info, cs_conv_t csconv)
+static int _parse_id3v1(ByteSource * src, ID3Iinfo * info)
 {
-  struct ID3v1Tag tag;
-  if (fread(&tag, 1, sizeof(struct ID3v1Tag), fp) != sizeof(struct ID3v1Tag))
+  const struct ID3v1Tag * tag = (const struct ID3v1Tag*) src->fetch(sizeof(struct ID3v1Tag));
+  if (!tag)
     return -1;
 
   if (info->title.isEmpty())
-    _id3v1_str_get(&info->title, tag.title, sizeof(tag.title), csconv);
+    _id3v1_str_get(&info->title, tag->title, sizeof(tag->title));
   if (info->artist.isEmpty())
-    _id3v1_str_get(&info->artist, tag.artist, sizeof(tag.artist), csconv);
+    _id3v1_str_get(&info->artist, tag->artist, sizeof(tag->artist));
   if (info->album.isEmpty())
-    _id3v1_str_get(&info->album, tag.album, sizeof(tag.album), csconv);
+    _id3v1_str_get(&info->album, tag->album, sizeof(tag->album));
   if (info->genre.isEmpty())
-    _get_id3v1_genre(tag.genre, &info->genre);
+    _get_id3v1_genre(tag->genre, &info->genre);
   if (info->track_no == -1 &&
-          tag.comments[28] == '\0' && tag.comments[29] != '\0')
-    info->track_no = (unsigned char) tag.comments[29];
+          tag->comments[28] == '\0' && tag->comments[29] != '\0')
+    info->track_no = (unsigned char) tag->comments[29];
 
   return 0;
 }
-
 ////////////////////////////////////////////////////////////////////////////////
 ////
 //// MPEG Audio info
 ////
 
 #define MPEG_HEADER_SIZE 4
-#define N_FRAMES_BITRATE_ESTIMATE 512
-#define N_FRAMES_CBR_ESTIMATE 128
+#define MP3_SAMPLE_COUNT 4         // windows read in sampled mode
+#define MP3_SAMPLE_SIZE  32768     // size of a window
+#define MP3_RESYNC_LIMIT 4096      // bytes searched for a lost sync
 
 enum mpeg_audio_version
 {
@@ -822,14 +1026,14 @@ _bitrate_table[MPEG_AUDIO_VERSION_COUNT][MPEG_AUDIO_LAYER_COUNT][16] = {
   0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0,
   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
   /*MPEG_AUDIO_VERSION_2*/
-  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
   0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, 0,
   0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0,
+  0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0,
   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
   /*MPEG_AUDIO_VERSION_2_5*/
-  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
   0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, 0,
   0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0,
+  0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0,
   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
   /*MPEG_AUDIO_VERSION_4*/
   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -849,10 +1053,10 @@ _samples_per_frame_table[MPEG_AUDIO_VERSION_COUNT][MPEG_AUDIO_LAYER_COUNT] = {
 static int _fill_mpeg_header(struct mpeg_header * hdr, const uint8_t b[4]);
 static int _fill_aac_header(struct mpeg_header * hdr, const uint8_t b[4]);
 static int _fill_mp3_header(struct mpeg_header *hdr, const uint8_t b[4]);
-static int _parse_vbr_headers(FILE * fp, off_t mpeg_offset, struct mpeg_header * hdr);
-static int _estimate_mp3_bitrate_from_frames(FILE * fp, off_t mpeg_offset, struct mpeg_header * orig_hdr);
+static int _parse_vbr_headers(ByteSource * src, off_t mpeg_offset, struct mpeg_header * hdr);
+static int _estimate_mp3_duration(ByteSource * src, off_t mpeg_offset, size_t size, struct mpeg_header * hdr);
 
-static int _parse_mpeg_header(FILE * fp, off_t off, MediaInfo * audio_info, size_t size)
+static int _parse_mpeg_header(ByteSource * src, off_t off, MediaInfo * audio_info, size_t size)
 {
   uint8_t buffer[32];
   const uint8_t *p, *p_end;
@@ -860,13 +1064,13 @@ static int _parse_mpeg_header(FILE * fp, off_t off, MediaInfo * audio_info, size
   struct mpeg_header hdr = {};
   int r;
 
-  fseek(fp, off, SEEK_SET);
+  src->seek(off, SEEK_SET);
 
   /* Find sync word */
   prev_read = 0;
   do
   {
-    int nread = fread(buffer + prev_read, 1, sizeof(buffer) - prev_read, fp);
+    int nread = src->read(buffer + prev_read, sizeof(buffer) - prev_read);
     if (nread < MPEG_HEADER_SIZE)
       return -1;
 
@@ -906,14 +1110,14 @@ found:
   else
   {
     if ((r = _fill_mp3_header(&hdr, p) < 0) ||
-            (r = _parse_vbr_headers(fp, off, &hdr) < 0))
+            (r = _parse_vbr_headers(src, off, &hdr) < 0))
       return r;
 
     if (hdr.cbr)
       hdr.bitrate = _bitrate_table[hdr.version][hdr.layer][hdr.bitrate_idx] * 1000;
     else if (!hdr.bitrate)
     {
-      r = _estimate_mp3_bitrate_from_frames(fp, off, &hdr);
+      r = _estimate_mp3_duration(src, off, size, &hdr);
       if (r < 0)
         return r;
     }
@@ -1031,7 +1235,7 @@ static inline int _fill_mp3_header(struct mpeg_header * hdr, const uint8_t b[4])
   return 0;
 }
 
-static int _parse_vbr_headers(FILE * fp, off_t mpeg_offset, struct mpeg_header * hdr)
+static int _parse_vbr_headers(ByteSource * src, off_t mpeg_offset, struct mpeg_header * hdr)
 {
   unsigned int sampling_rate, samples_per_frame, flags, nframes = 0, size = 0;
   int xing_offset_table[2][2] = {/* [(version == 1)][channels == 1)] */
@@ -1043,10 +1247,10 @@ static int _parse_vbr_headers(FILE * fp, off_t mpeg_offset, struct mpeg_header *
 
   /* Try Xing first since it's the most likely to be there */
   xing_offset = mpeg_offset + 4 + 2 * hdr->crc
-          + xing_offset_table[(hdr->version == 1)][(hdr->channels == 1)];
+          + xing_offset_table[(hdr->version == MPEG_AUDIO_VERSION_1)][(hdr->channels == 1)];
 
-  fseek(fp, xing_offset, SEEK_SET);
-  if (fread(buf, 1, sizeof(buf), fp) != sizeof(buf))
+  src->seek(xing_offset, SEEK_SET);
+  if (src->read(buf, sizeof(buf)) != sizeof(buf))
     return -1;
 
   hdr->cbr = (memcmp(buf, "Info", 4) == 0);
@@ -1064,11 +1268,11 @@ static int _parse_vbr_headers(FILE * fp, off_t mpeg_offset, struct mpeg_header *
 
   /* VBRI is found in files encoded by Fraunhofer Encoder. Fixed location: 32
    * bytes after the mpeg header */
-  fseek(fp, mpeg_offset + 36, SEEK_SET);
-  if (fread(buf, 1, sizeof(buf), fp) != sizeof(buf))
+  src->seek(mpeg_offset + 36, SEEK_SET);
+  if (src->read(buf, sizeof(buf)) != sizeof(buf))
     return -1;
 
-  if (memcmp(buf, "VBRI", 4) == 0 && read16be(buf) == 1)
+  if (memcmp(buf, "VBRI", 4) == 0 && read16be(buf + 4) == 1)
   {
     size = read32be(&buf[10]);
     nframes = read32be(&buf[14]);
@@ -1092,69 +1296,152 @@ proceed:
   return 0;
 }
 
-static int _estimate_mp3_bitrate_from_frames(FILE * fp, off_t mpeg_offset, struct mpeg_header * orig_hdr)
+/**
+ * Return the size of the frame starting with the given header, or 0 if it
+ * isn't a frame of the same stream.
+ */
+static unsigned int _mp3_frame_size(const struct mpeg_header * ref, const uint8_t b[4])
 {
-  struct mpeg_header hdr = *orig_hdr;
-  off_t offset = mpeg_offset;
-  unsigned int sum = 0, i;
-  int r;
-  bool cbr = true;
-  /* For Layer I slot is 32 bits long, for Layer II and Layer III slot is 8
-   * bits long.
-   * [layer == 1] */
-  unsigned int padding_size_table[2] = {1, 4};
-  unsigned int samples_per_frame, sampling_rate;
+  struct mpeg_header hdr = {};
+  unsigned int bitrate, sampling_rate, samples_per_frame;
 
-  samples_per_frame = _samples_per_frame_table[hdr.version][hdr.layer];
+  if (b[0] != 0xff || (b[1] & 0xe0) != 0xe0 ||
+          _fill_mpeg_header(&hdr, b) < 0 ||
+          hdr.layer == MPEG_AUDIO_LAYER_AAC ||
+          _fill_mp3_header(&hdr, b) < 0)
+    return 0;
+  if (hdr.version != ref->version ||
+          hdr.layer != ref->layer ||
+          hdr.sampling_rate_idx != ref->sampling_rate_idx)
+    return 0;
+
+  bitrate = _bitrate_table[hdr.version][hdr.layer][hdr.bitrate_idx] * 1000;
+  if (bitrate == 0)
+    return 0; /* free or bad */
   sampling_rate = _sample_rates[hdr.sampling_rate_idx];
-  assert(sampling_rate != 0);
+  samples_per_frame = _samples_per_frame_table[hdr.version][hdr.layer];
 
-  for (i = 0; i < N_FRAMES_BITRATE_ESTIMATE;)
+  /* For Layer I slot is 32 bits long, for Layer II and Layer III slot is 8
+   * bits long */
+  if (hdr.layer == MPEG_AUDIO_LAYER_1)
+    return ((samples_per_frame / 32) * bitrate / sampling_rate + (hdr.padding ? 1 : 0)) * 4;
+  return (samples_per_frame / 8) * bitrate / sampling_rate + (hdr.padding ? 1 : 0);
+}
+
+struct mp3_frames
+{
+  uint64_t count;
+  uint64_t bytes;
+};
+
+/**
+ * Walk the frames from offset until end. The source serves the headers from
+ * its window, so the walk is done with large sequential reads. When the sync
+ * is not known, a frame is accepted only if it is followed by another one.
+ */
+static off_t _walk_mp3_frames(ByteSource * src, off_t offset, off_t end, bool synced,
+                              const struct mpeg_header * ref, struct mp3_frames * frames)
+{
+  unsigned int lost = 0;
+  while (offset + MPEG_HEADER_SIZE <= end)
   {
-    unsigned int bitrate, padding_size;
+    const uint8_t * b;
     unsigned int framesize;
-    uint8_t buf[4];
 
-    bitrate = _bitrate_table[hdr.version][hdr.layer][hdr.bitrate_idx];
-    if (cbr && bitrate == hdr.bitrate && i > N_FRAMES_CBR_ESTIMATE)
-    {
-      i = 1;
-      sum = bitrate;
+    src->seek(offset, SEEK_SET);
+    if (!(b = (const uint8_t*) src->fetch(MPEG_HEADER_SIZE)))
       break;
+    framesize = _mp3_frame_size(ref, b);
+    if (framesize && !synced)
+    {
+      src->seek(offset + framesize, SEEK_SET);
+      if (!(b = (const uint8_t*) src->fetch(MPEG_HEADER_SIZE)))
+        break;
+      synced = (_mp3_frame_size(ref, b) > 0);
     }
+    if (!framesize || !synced)
+    {
+      synced = false;
+      if (++lost > MP3_RESYNC_LIMIT)
+        break;
+      ++offset;
+      continue;
+    }
+    lost = 0;
+    frames->count++;
+    frames->bytes += framesize;
+    offset += framesize;
+  }
+  return offset;
+}
 
-    sum += bitrate;
-    i++;
-
-    padding_size = hdr.padding ? padding_size_table[hdr.layer == 1] : 0;
+/**
+ * Find the duration of a MP3 stream without VBR header, according to the
+ * selected mode: assume a constant bitrate from the first frame, extrapolate
+ * from a few windows spread across the file, or count all the frames.
+ */
+static int _estimate_mp3_duration(ByteSource * src, off_t mpeg_offset, size_t size, struct mpeg_header * hdr)
+{
+  ID3Parser::DurationMode mode = ID3Parser::durationMode();
+  unsigned int samples_per_frame, sampling_rate;
+  off_t audio_size = (off_t) size - mpeg_offset;
+  struct mp3_frames frames = { 0, 0 };
+  const char * probe;
+  IOStats io = IOStats::local();
+  QElapsedTimer timer;
+  timer.start();
 
-    framesize = 4; /* mpeg header */
-    framesize += (samples_per_frame / 8) * bitrate * 1000;
-    framesize /= sampling_rate;
-    framesize += (padding_size * samples_per_frame);
+  samples_per_frame = _samples_per_frame_table[hdr->version][hdr->layer];
+  sampling_rate = _sample_rates[hdr->sampling_rate_idx];
+  assert(sampling_rate != 0);
 
-    offset += framesize;
+  /* the small files are walked through in any case */
+  if (mode == ID3Parser::DurationSampled && audio_size <= MP3_SAMPLE_COUNT * MP3_SAMPLE_SIZE)
+    mode = ID3Parser::DurationExact;
 
-    fseek(fp, offset, SEEK_SET);
-    r = fread(buf, 1, sizeof(buf), fp);
+  switch (mode)
+  {
+  case ID3Parser::DurationHeaderOnly:
+    probe = "mp3-header";
+    hdr->bitrate = _bitrate_table[hdr->version][hdr->layer][hdr->bitrate_idx] * 1000;
+    break;
 
-    if (r < 0)
+  case ID3Parser::DurationSampled:
+    probe = "mp3-sampled";
+    for (int i = 0; i < MP3_SAMPLE_COUNT; ++i)
     {
-      qWarning("%s: ERROR reading frame header at %#x", __FUNCTION__, (unsigned int) offset);
-      break;
+      off_t start = mpeg_offset + (audio_size - MP3_SAMPLE_SIZE) * i / (MP3_SAMPLE_COUNT - 1);
+      /* the first window starts on the first frame */
+      _walk_mp3_frames(src, start, start + MP3_SAMPLE_SIZE, (i == 0), hdr, &frames);
     }
-    if (!r)
-      break;
+    if (frames.count > 0)
+    {
+      uint64_t count = (uint64_t) audio_size * frames.count / frames.bytes;
+      hdr->length = (unsigned int) (count * samples_per_frame / sampling_rate);
+      hdr->bitrate = (unsigned int) (8 * frames.bytes * sampling_rate / (frames.count * samples_per_frame));
+    }
+    break;
 
-    if (buf[0] != 0xff || !_is_id3v2_second_synch_byte(buf[1]) ||
-            _fill_mpeg_header(&hdr, buf) < 0 ||
-            _fill_mp3_header(&hdr, buf) < 0)
+  case ID3Parser::DurationExact:
+  default:
+    probe = "mp3-exact";
+    _walk_mp3_frames(src, mpeg_offset, (off_t) size, true, hdr, &frames);
+    if (frames.count > 0)
     {
-      break;
+      hdr->length = (unsigned int) (frames.count * samples_per_frame / sampling_rate);
+      hdr->bitrate = (unsigned int) (8 * frames.bytes * sampling_rate / (frames.count * samples_per_frame));
     }
+    break;
   }
-
-  orig_hdr->bitrate = sum / i * 1000;
+  /* no frame found, assume a constant bitrate */
+  if (!hdr->bitrate)
+    hdr->bitrate = _bitrate_table[hdr->version][hdr->layer][hdr->bitrate_idx] * 1000;
+
+  const IOStats& now = IOStats::local();
+  io.bytesRead = now.bytesRead - io.bytesRead;
+  io.reads = now.reads - io.reads;
+  io.seeks = now.seeks - io.seeks;
+  ScannerMetrics::addProbe(probe, timer.nsecsElapsed() / 1000, io);
 
   return 0;
 }
@@ -29,6 +29,20 @@ public:
   const char * commonName() override { return "ID3"; }
   bool match(const QFileInfo& fileInfo) override;
   bool parse(MediaFile * file, MediaInfo * info, bool debug) override;
+  bool extractArt(MediaFile * file, QByteArray& image) override;
+
+  /**
+   * The ways to find the duration of a MP3 stream without VBR header.
+   */
+  enum DurationMode
+  {
+    DurationHeaderOnly = 0, // assume a constant bitrate from the first frame
+    DurationSampled,        // extrapolate from a few windows across the file
+    DurationExact,          // count all the frames
+  };
+
+  static void setDurationMode(DurationMode mode);
+  static DurationMode durationMode();
 };
 
 }
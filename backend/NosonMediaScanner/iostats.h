@@ -0,0 +1,42 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef IOSTATS_H
+#define IOSTATS_H
+
+#include <QtGlobal>
+
+namespace mediascanner
+{
+
+/**
+ * The counters of the I/O done by the current thread. The parsers read
+ * through a ByteSource which feeds them, so the extractor can account the
+ * I/O of each parsing.
+ */
+struct IOStats
+{
+  qint64 bytesRead;     // bytes fetched from the file
+  qint64 reads;         // read syscalls
+  qint64 seeks;         // seeks out of the read-ahead window
+
+  static IOStats& local();
+};
+
+}
+
+#endif /* IOSTATS_H */
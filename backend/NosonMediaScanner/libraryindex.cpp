@@ -0,0 +1,217 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "libraryindex.h"
+#include "listmodel.h"
+
+#include <algorithm>
+
+using namespace mediascanner;
+
+LibraryIndex::LibraryIndex(QObject * parent)
+: QObject(parent)
+, m_artists()
+, m_albums()
+, m_genres()
+, m_composers()
+, m_tracks()
+, m_postings()
+, m_files()
+, m_models()
+, m_subscribers()
+{
+}
+
+LibraryIndex::~LibraryIndex()
+{
+}
+
+MediaFileList LibraryIndex::files(const LibraryFilter& filter) const
+{
+  MediaFileList files;
+  QList<const PostingList*> lists;
+  for (int t = 0; t < LibraryFilter::TagCount; ++t)
+  {
+    if (filter.keys[t].isEmpty())
+      continue;
+    QHash<QByteArray, PostingList>::const_iterator it = m_postings[t].find(filter.keys[t]);
+    if (it == m_postings[t].end())
+      return files;
+    lists << &it.value();
+  }
+  if (lists.isEmpty())
+    return m_files.values();
+  // walk the shortest list, then probe the others
+  std::sort(lists.begin(), lists.end(), [](const PostingList * a, const PostingList * b) { return a->size() < b->size(); });
+  for (unsigned id : *lists.first())
+  {
+    bool found = true;
+    for (int i = 1; i < lists.size() && found; ++i)
+      found = std::binary_search(lists[i]->begin(), lists[i]->end(), id);
+    if (found)
+      files << m_files.value(id);
+  }
+  return files;
+}
+
+void LibraryIndex::subscribe(ListModel * model, const LibraryFilter& filter)
+{
+  unsubscribe(model);
+  for (int t = 0; t < LibraryFilter::TagCount; ++t)
+  {
+    if (!filter.keys[t].isEmpty())
+    {
+      m_subscribers[t].insert(filter.keys[t], { model, filter });
+      return;
+    }
+  }
+  m_models << model;
+}
+
+void LibraryIndex::unsubscribe(ListModel * model)
+{
+  m_models.removeAll(model);
+  for (QMultiHash<QByteArray, Subscriber>& subscribers : m_subscribers)
+  {
+    QMultiHash<QByteArray, Subscriber>::iterator it = subscribers.begin();
+    while (it != subscribers.end())
+    {
+      if (it.value().model == model)
+        it = subscribers.erase(it);
+      else
+        ++it;
+    }
+  }
+}
+
+void LibraryIndex::post(const MediaFilePtr& file)
+{
+  m_files.insert(file->fileId, file);
+  for (int t = 0; t < LibraryFilter::TagCount; ++t)
+  {
+    const QByteArray& key = LibraryFilter::keyOf(*file->mediaInfo, static_cast<LibraryFilter::Tag>(t));
+    if (key.isEmpty())
+      continue;
+    PostingList& list = m_postings[t][key];
+    PostingList::iterator it = std::lower_bound(list.begin(), list.end(), file->fileId);
+    if (it == list.end() || *it != file->fileId)
+      list.insert(it, file->fileId);
+  }
+}
+
+void LibraryIndex::unpost(const MediaFilePtr& file)
+{
+  m_files.remove(file->fileId);
+  for (int t = 0; t < LibraryFilter::TagCount; ++t)
+  {
+    const QByteArray& key = LibraryFilter::keyOf(*file->mediaInfo, static_cast<LibraryFilter::Tag>(t));
+    QHash<QByteArray, PostingList>::iterator pl = m_postings[t].find(key);
+    if (pl == m_postings[t].end())
+      continue;
+    PostingList::iterator it = std::lower_bound(pl->begin(), pl->end(), file->fileId);
+    if (it != pl->end() && *it == file->fileId)
+      pl->erase(it);
+    if (pl->isEmpty())
+      m_postings[t].erase(pl);
+  }
+}
+
+void LibraryIndex::dispatch(const MediaFileList& files, const QList<QByteArray>& keys, Dispatch& filtered) const
+{
+  // files and keys are the tracks created, or erased, by the batch
+  for (int i = 0; i < files.size(); ++i)
+  {
+    const MediaInfo& info = *files[i]->mediaInfo;
+    for (int t = 0; t < LibraryFilter::TagCount; ++t)
+    {
+      const QByteArray& key = LibraryFilter::keyOf(info, static_cast<LibraryFilter::Tag>(t));
+      if (key.isEmpty())
+        continue;
+      QMultiHash<QByteArray, Subscriber>::const_iterator it = m_subscribers[t].find(key);
+      for (; it != m_subscribers[t].end() && it.key() == key; ++it)
+      {
+        if (!it.value().filter.matches(info))
+          continue;
+        LibraryChanges& changes = filtered[it.value().model];
+        changes.files << files[i];
+        changes.tracks << keys[i];
+      }
+    }
+  }
+}
+
+void LibraryIndex::onFilesAdded(const MediaFileList& files)
+{
+  LibraryChanges changes;
+  changes.files = files;
+  MediaFileList created;
+  for (const MediaFilePtr& file : files)
+  {
+    QByteArray key;
+    if (m_artists.insertFile(file, &key))
+      changes.artists << key;
+    if (m_albums.insertFile(file, &key))
+      changes.albums << key;
+    if (m_genres.insertFile(file, &key))
+      changes.genres << key;
+    if (m_composers.insertFile(file, &key))
+      changes.composers << key;
+    if (m_tracks.insertFile(file, &key))
+    {
+      changes.tracks << key;
+      created << file;
+      post(file);
+    }
+  }
+  Dispatch filtered;
+  dispatch(created, changes.tracks, filtered);
+  for (ListModel * model : m_models)
+    model->onFilesAdded(changes);
+  for (Dispatch::const_iterator it = filtered.begin(); it != filtered.end(); ++it)
+    it.key()->onFilesAdded(it.value());
+}
+
+void LibraryIndex::onFilesRemoved(const MediaFileList& files)
+{
+  LibraryChanges changes;
+  changes.files = files;
+  MediaFileList erased;
+  for (const MediaFilePtr& file : files)
+  {
+    QByteArray key;
+    if (m_artists.removeFile(file, &key))
+      changes.artists << key;
+    if (m_albums.removeFile(file, &key))
+      changes.albums << key;
+    if (m_genres.removeFile(file, &key))
+      changes.genres << key;
+    if (m_composers.removeFile(file, &key))
+      changes.composers << key;
+    if (m_tracks.removeFile(file, &key))
+    {
+      changes.tracks << key;
+      erased << file;
+      unpost(file);
+    }
+  }
+  Dispatch filtered;
+  dispatch(erased, changes.tracks, filtered);
+  for (ListModel * model : m_models)
+    model->onFilesRemoved(changes);
+  for (Dispatch::const_iterator it = filtered.begin(); it != filtered.end(); ++it)
+    it.key()->onFilesRemoved(it.value());
+}
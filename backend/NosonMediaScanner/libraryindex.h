@@ -0,0 +1,107 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef LIBRARYINDEX_H
+#define LIBRARYINDEX_H
+
+#include "aggregate/aggregate.h"
+#include "aggregate/artists.h"
+#include "aggregate/albums.h"
+#include "aggregate/genres.h"
+#include "aggregate/composers.h"
+#include "aggregate/tracks.h"
+
+#include <QObject>
+#include <QHash>
+#include <QMultiHash>
+#include <QVector>
+
+namespace mediascanner
+{
+
+class ListModel;
+
+/**
+ * The aggregates of the library, maintained once for all the list models.
+ * It is fed by the scanner with the batches of changes, then it notifies
+ * the models with the aggregates created or erased, so they can update
+ * their rows without aggregating the files on their own. It lives in the
+ * thread of the models.
+ * The tracks are also posted by the keys of their tags, so a filtered model
+ * fetches its rows from the intersection of the posting lists, and it is
+ * notified only with the files matching its filter.
+ */
+class LibraryIndex : public QObject
+{
+  Q_OBJECT
+
+public:
+  explicit LibraryIndex(QObject * parent = nullptr);
+  virtual ~LibraryIndex() override;
+
+  const Aggregate<ArtistModel>& artists() const { return m_artists; }
+  const Aggregate<AlbumModel>& albums() const { return m_albums; }
+  const Aggregate<GenreModel>& genres() const { return m_genres; }
+  const Aggregate<ComposerModel>& composers() const { return m_composers; }
+  const Aggregate<TrackModel>& tracks() const { return m_tracks; }
+
+  /**
+   * @return the files matching the filter, in the order of their id
+   */
+  MediaFileList files(const LibraryFilter& filter) const;
+
+  /**
+   * Notify the model with the changes matching the filter. The filter is
+   * held until the model is unsubscribed.
+   */
+  void subscribe(ListModel * model, const LibraryFilter& filter);
+  void unsubscribe(ListModel * model);
+
+public slots:
+  void onFilesAdded(const MediaFileList& files);
+  void onFilesRemoved(const MediaFileList& files);
+
+private:
+  Aggregate<ArtistModel> m_artists;
+  Aggregate<AlbumModel> m_albums;
+  Aggregate<GenreModel> m_genres;
+  Aggregate<ComposerModel> m_composers;
+  Aggregate<TrackModel> m_tracks;
+
+  typedef QVector<unsigned> PostingList;  // the sorted ids of the files
+  QHash<QByteArray, PostingList> m_postings[LibraryFilter::TagCount];
+  QHash<unsigned, MediaFilePtr> m_files;
+
+  void post(const MediaFilePtr& file);
+  void unpost(const MediaFilePtr& file);
+
+  struct Subscriber
+  {
+    ListModel * model;
+    LibraryFilter filter;
+  };
+  QList<ListModel*> m_models;
+  // the filtered models by the key of their first filtered tag
+  QMultiHash<QByteArray, Subscriber> m_subscribers[LibraryFilter::TagCount];
+
+  typedef QHash<ListModel*, LibraryChanges> Dispatch;
+  void dispatch(const MediaFileList& files, const QList<QByteArray>& keys, Dispatch& filtered) const;
+};
+
+}
+
+#endif /* LIBRARYINDEX_H */
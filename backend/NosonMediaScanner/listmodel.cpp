@@ -25,6 +25,7 @@ ListModel::ListModel(QObject * parent)
 , m_lock(0)
 , m_provider(MediaScanner::instance())
 , m_dataState(ListModel::New)
+, m_sortBy(ListModel::SortNone)
 , m_updateSignaled(false)
 {
   m_lock = new QRecursiveMutex();
@@ -49,3 +50,27 @@ bool ListModel::init(bool fill /*= true*/)
     return this->load();
   return false; // not filled
 }
+
+void ListModel::resubscribe()
+{
+  if (m_dataState == ListModel::New)
+    return;
+  m_provider->unregisterModel(this);
+  m_provider->registerModel(this);
+  if (m_dataState == ListModel::Loaded || m_dataState == ListModel::Synced)
+    load();
+}
+
+void ListModel::setSortBy(SortKey sortBy)
+{
+  {
+    LockGuard<QRecursiveMutex> g(m_lock);
+    if (sortBy == m_sortBy)
+      return;
+    m_sortBy = sortBy;
+    // the rows are loaded again in the new order
+    if (m_dataState == ListModel::Loaded || m_dataState == ListModel::Synced)
+      load();
+  }
+  emit sortByChanged();
+}
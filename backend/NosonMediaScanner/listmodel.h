@@ -19,10 +19,15 @@
 #define LISTMODEL
 
 #include "mediascanner.h"
+#include "aggregate/aggregate.h"
 #include "locked.h"
 
 #include <QObject>
 #include <QAbstractListModel>
+#include <QHash>
+#include <QVector>
+
+#include <algorithm>
 
 namespace mediascanner
 {
@@ -32,6 +37,7 @@ class MediaScanner;
 class ListModel : public QAbstractListModel
 {
   Q_OBJECT
+  Q_PROPERTY(SortKey sortBy READ sortBy WRITE setSortBy NOTIFY sortByChanged)
 
 public:
   ListModel(QObject * parent);
@@ -40,6 +46,11 @@ public:
   virtual void clear() = 0;
   virtual bool load() = 0;
 
+  /**
+   * @return the filter of the changes to be notified, empty for all
+   */
+  virtual LibraryFilter filter() const { return LibraryFilter(); }
+
   enum dataState {
     New     = 0,
     NoData  = 1,
@@ -47,18 +58,139 @@ public:
     Synced  = 3
   };
 
+  /**
+   * The order of the rows, maintained by the model as the changes come.
+   * The keys not supported by a model fall back to the name.
+   */
+  enum SortKey {
+    SortNone    = 0,  // the order of arrival
+    SortByName  = 1,  // the normalized name
+    SortByYear  = 2,  // the year, then the name
+    SortByTrack = 3,  // the track number, then the name
+  };
+  Q_ENUM(SortKey)
+
+  SortKey sortBy() const { return m_sortBy; }
+  void setSortBy(SortKey sortBy);
+
+signals:
+  void sortByChanged();
+
 
 public slots:
-  virtual void onFileAdded(const MediaFilePtr& file) = 0;
-  virtual void onFileRemoved(const MediaFilePtr& file) = 0;
+  /**
+   * Apply the changes of the library index. The rows are the aggregates
+   * held by the index, so a model only picks up those it shows.
+   */
+  virtual void onFilesAdded(const LibraryChanges& changes) = 0;
+  virtual void onFilesRemoved(const LibraryChanges& changes) = 0;
 
 protected:
   QRecursiveMutex * m_lock;
   MediaScanner * m_provider;
   dataState m_dataState;
+  SortKey m_sortBy;
 
   virtual bool init(bool fill = true);
 
+  /**
+   * Subscribe again to the index with the current filter, once the model is
+   * registered, and load the rows again if they were. The filter setters
+   * MUST call it holding the lock.
+   */
+  void resubscribe();
+
+  /**
+   * Index the rows of the items by the key of their model, from the given
+   * row to the end.
+   */
+  template<class T>
+  static void indexRows(const QList<T>& items, QHash<QByteArray, int>& rows, int from = 0)
+  {
+    if (from == 0)
+    {
+      rows.clear();
+      rows.reserve(items.count());
+    }
+    for (int row = from; row < items.count(); ++row)
+      rows.insert(items[row]->model.key(), row);
+  }
+
+  /**
+   * Append the items in the order of arrival.
+   */
+  template<class T>
+  void appendRows(QList<T>& items, QHash<QByteArray, int>& rows, const QList<T>& batch)
+  {
+    int from = items.count();
+    beginInsertRows(QModelIndex(), from, from + batch.count() - 1);
+    items.append(batch);
+    indexRows(items, rows, from);
+    endInsertRows();
+  }
+
+  /**
+   * Insert the items at their place in the sorted rows, found by binary
+   * search. The items of the batch going to the same place are inserted at
+   * once.
+   */
+  template<class T, class Less>
+  void insertRows(QList<T>& items, QHash<QByteArray, int>& rows, QList<T> batch, Less lessThan)
+  {
+    std::sort(batch.begin(), batch.end(), lessThan);
+    int from = items.count();
+    int i = 0;
+    while (i < batch.count())
+    {
+      int row = int(std::upper_bound(items.begin(), items.end(), batch[i], lessThan) - items.begin());
+      int j = i + 1;
+      while (j < batch.count() && (row == items.count() || lessThan(batch[j], items[row])))
+        ++j;
+      beginInsertRows(QModelIndex(), row, row + j - i - 1);
+      for (int k = i; k < j; ++k)
+        items.insert(row + k - i, batch[k]);
+      endInsertRows();
+      from = qMin(from, row);
+      i = j;
+    }
+    indexRows(items, rows, from);
+  }
+
+  /**
+   * Remove the rows of the given keys. The contiguous rows are removed at
+   * once, from the bottom so the rows above stay valid, then the rows below
+   * the first removed are indexed again.
+   */
+  template<class T>
+  void removeRows(QList<T>& items, QHash<QByteArray, int>& rows, const QList<QByteArray>& keys)
+  {
+    QVector<int> found;
+    found.reserve(keys.count());
+    for (const QByteArray& key : keys)
+    {
+      QHash<QByteArray, int>::iterator it = rows.find(key);
+      if (it != rows.end())
+      {
+        found << it.value();
+        rows.erase(it);
+      }
+    }
+    if (found.isEmpty())
+      return;
+    std::sort(found.begin(), found.end());
+    for (int i = found.count() - 1; i >= 0; )
+    {
+      int last = found[i];
+      int first = last;
+      while (--i >= 0 && found[i] == first - 1)
+        first = found[i];
+      beginRemoveRows(QModelIndex(), first, last);
+      items.erase(items.begin() + first, items.begin() + last + 1);
+      endRemoveRows();
+    }
+    indexRows(items, rows, found.first());
+  }
+
   bool updateSignaled() { return m_updateSignaled.Load(); }
   void setUpdateSignaled(bool val) { m_updateSignaled.Store(val); }
 
@@ -19,6 +19,7 @@
 #include "mediafile.h"
 #include "mediainfo.h"
 #include "byteorder.h"
+#include "bytesource.h"
 
 #include <cstdio>
 #include <string>
@@ -46,9 +47,9 @@ bool M4AParser::match(const QFileInfo& fileInfo)
 
 bool M4AParser::parse(MediaFile * file, MediaInfo * info, bool debug)
 {
-  std::string path(file->filePath.toUtf8().constData());
-  FILE * fp = fopen(path.c_str(), "rb");
-  if (!fp)
+  std::string path(file->filePath().toUtf8().constData());
+  ByteSource src;
+  if (!src.open(file->filePath()))
     return false;
 
   bool isValid = false;
@@ -60,7 +61,7 @@ bool M4AParser::parse(MediaFile * file, MediaInfo * info, bool debug)
   unsigned chunk;
   uint64_t size, remaining = M4A_HEADER_SIZE;
   int r;
-  while (!isLast && (r = nextChild(buf, &remaining, fp, &chunk, &size)) > 0)
+  while (!isLast && (r = nextChild(buf, &remaining, &src, &chunk, &size)) > 0)
   {
     if (debug)
       qDebug("%s: found chunk %08x size %lu", __FUNCTION__, chunk, (unsigned long)size);
@@ -68,7 +69,7 @@ bool M4AParser::parse(MediaFile * file, MediaInfo * info, bool debug)
     {
       if (debug)
         qDebug("%s: processing chunk ftyp", __FUNCTION__);
-      if (size < 4 || fread(buf, 1, 4, fp) != 4)
+      if (size < 4 || src.read(buf, 4) != 4)
         break;
       size -= 4;
       isValid = true;
@@ -79,7 +80,7 @@ bool M4AParser::parse(MediaFile * file, MediaInfo * info, bool debug)
       else
       {
         qWarning("%s: ERROR: bad magic header in file %s", __FUNCTION__, path.c_str());
-        fclose(fp);
+        src.close();
         return false;
       }
     }
@@ -87,7 +88,7 @@ bool M4AParser::parse(MediaFile * file, MediaInfo * info, bool debug)
     {
       if (debug)
         qDebug("%s: processing chunk moov", __FUNCTION__);
-      if (parse_moov(&size, fp, info) < 0)
+      if (parse_moov(&size, &src, info) < 0)
         break; // the parse failed
       isLast = true;
       // do sanity check before exit
@@ -96,23 +97,75 @@ bool M4AParser::parse(MediaFile * file, MediaInfo * info, bool debug)
     }
 
     // first chunk MUST be ftyp, else return an error
-    if (!isValid || (size && fseek(fp, size, SEEK_CUR) != 0))
+    if (!isValid || (size && src.seek(size, SEEK_CUR) != 0))
       break;
     // refill remaining
     remaining = M4A_HEADER_SIZE;
   }
-  fclose(fp);
+  src.close();
   if (debug)
     qDebug("%s: info:%s complete:%s", __FUNCTION__, isValid ? "true" : "false", isLast ? "true" : "false");
   // parsing is completed if all blocks have been parsed and info is valid
   return (isValid && isLast);
 }
 
-int M4AParser::nextChild(unsigned char * buf, uint64_t * remaining, FILE * fp, unsigned * child, uint64_t * childSize)
+bool M4AParser::extractArt(MediaFile * file, QByteArray& image)
+{
+  // the path of the cover: moov/udta/meta/ilst/covr
+  static const unsigned path[] = { 0x6d6f6f76, 0x75647461, 0x6d657461, 0x696c7374, 0x636f7672 };
+  static const unsigned depth = sizeof(path) / sizeof(*path);
+  ByteSource src;
+  if (!src.open(file->filePath()))
+    return false;
+
+  unsigned char buf[M4A_HEADER_SIZE];
+  unsigned child;
+  uint64_t size, remaining = (uint64_t)src.size();
+  unsigned level = 0;
+  bool found = false;
+  while (level < depth && nextChild(buf, &remaining, &src, &child, &size) > 0)
+  {
+    if (child == path[level])
+    {
+      // go down into the child
+      remaining = size;
+      ++level;
+      // skip flag bytes before reading children atoms
+      if (child == 0x6d657461) // meta
+      {
+        if (remaining < 4 || src.read(buf, 4) != 4)
+          break;
+        remaining -= 4;
+      }
+      continue;
+    }
+    // move to the end of child
+    if (size > remaining || (size && src.seek(size, SEEK_CUR) != 0))
+      break;
+    remaining -= size;
+  }
+  if (level == depth)
+  {
+    char * alloc = nullptr;
+    unsigned allocSize = 0;
+    // the datatype is 13 for jpeg, 14 for png, but any is accepted
+    if (loadDataValue(&remaining, &src, &alloc, &allocSize) >= 0 && allocSize > 8)
+    {
+      image = QByteArray(alloc + 8, allocSize - 8);
+      found = true;
+    }
+    if (alloc)
+      delete [] alloc;
+  }
+  src.close();
+  return found;
+}
+
+int M4AParser::nextChild(unsigned char * buf, uint64_t * remaining, ByteSource * src, unsigned * child, uint64_t * childSize)
 {
   if (*remaining < M4A_HEADER_SIZE)
     return 0; // end of chunk
-  if (fread(buf, 1, M4A_HEADER_SIZE, fp) == M4A_HEADER_SIZE)
+  if (src->read(buf, M4A_HEADER_SIZE) == M4A_HEADER_SIZE)
   {
     *remaining -= M4A_HEADER_SIZE;
     *child = (unsigned)read32be(buf + 4);
@@ -120,7 +173,7 @@ int M4AParser::nextChild(unsigned char * buf, uint64_t * remaining, FILE * fp, u
     if (*childSize == 1)
     {
       // size of 1 means the real size follows the header in next 8 bytes (64bits)
-      if (*remaining < 8 || fread(buf, 1, 8, fp) != 8)
+      if (*remaining < 8 || src->read(buf, 8) != 8)
         return -1; // error
       *remaining -= 8;
       *childSize = (((uint64_t)read32be(buf) << 32) | (uint32_t)read32be(buf + 4)) - M4A_HEADER_SIZE - 8;
@@ -135,19 +188,19 @@ int M4AParser::nextChild(unsigned char * buf, uint64_t * remaining, FILE * fp, u
   return -1; // error
 }
 
-int M4AParser::loadDataValue(uint64_t * remaining, FILE * fp, char ** alloc, unsigned * allocSize)
+int M4AParser::loadDataValue(uint64_t * remaining, ByteSource * src, char ** alloc, unsigned * allocSize)
 {
   unsigned char buf[M4A_HEADER_SIZE];
   unsigned child;
   uint64_t size;
   int r;
-  if ((r = nextChild(buf, remaining, fp, &child, &size)) > 0)
+  if ((r = nextChild(buf, remaining, src, &child, &size)) > 0)
   {
     if (*remaining < size || child != 0x64617461) // data
       return -1;
     //qDebug("%s: found chunk data size %lu", __FUNCTION__, (unsigned long)size);
     char * _alloc = new char [size];
-    if (fread(_alloc, 1, size, fp) != size)
+    if (src->read(_alloc, size) != size)
     {
       delete [] _alloc;
       return -1;
@@ -160,12 +213,12 @@ int M4AParser::loadDataValue(uint64_t * remaining, FILE * fp, char ** alloc, uns
   return r;
 }
 
-int M4AParser::loadUtf8Value(uint64_t * remaining, FILE * fp, QString& str)
+int M4AParser::loadUtf8Value(uint64_t * remaining, ByteSource * src, QString& str)
 {
   char * alloc = nullptr;
   unsigned allocSize = 0;
   int r;
-  if ((r = loadDataValue(remaining, fp, &alloc, &allocSize) == 1)) // 1 = datatype utf8 string
+  if ((r = loadDataValue(remaining, src, &alloc, &allocSize) == 1)) // 1 = datatype utf8 string
   {
     str = QString::fromUtf8(alloc + 8, allocSize - 8);
     //qDebug("%s: %s", __FUNCTION__, str.toUtf8().constData());
@@ -175,52 +228,63 @@ int M4AParser::loadUtf8Value(uint64_t * remaining, FILE * fp, QString& str)
   return r;
 }
 
-int M4AParser::parse_ilst(uint64_t * remaining, FILE * fp, MediaInfo * info)
+int M4AParser::parse_ilst(uint64_t * remaining, ByteSource * src, MediaInfo * info)
 {
   unsigned char buf[M4A_HEADER_SIZE];
   unsigned child;
   uint64_t size;
   int r;
-  while ((r = nextChild(buf, remaining, fp, &child, &size)) > 0)
+  QString str;
+  while ((r = nextChild(buf, remaining, src, &child, &size)) > 0)
   {
     uint64_t rest = size;
     if (child == 0xa96e616d) // _nam
-      loadUtf8Value(&rest, fp, info->title);
+      loadUtf8Value(&rest, src, info->title);
     else if (child == 0xa9616c62) // _alb
-      loadUtf8Value(&rest, fp, info->album);
-    else if (child == 0xa9415254) // _ART
-      loadUtf8Value(&rest, fp, info->artist);
-    else if (child == 0x61415254) // aART
-      loadUtf8Value(&rest, fp, info->artist);
+    {
+      if (loadUtf8Value(&rest, src, str) == 1)
+        info->album = str;
+    }
+    else if (child == 0xa9415254 || child == 0x61415254) // _ART, aART
+    {
+      if (loadUtf8Value(&rest, src, str) == 1)
+        info->artist = str;
+    }
     else if (child == 0xa967656e) // _gen
-      loadUtf8Value(&rest, fp, info->genre);
+    {
+      if (loadUtf8Value(&rest, src, str) == 1)
+        info->genre = str;
+    }
     else if (child == 0xa9777274) // _wrt
-      loadUtf8Value(&rest, fp, info->composer);
+    {
+      if (loadUtf8Value(&rest, src, str) == 1)
+        info->composer = str;
+    }
     else if (child == 0xa9646179) // _day
     {
       QString str;
-      loadUtf8Value(&rest, fp, str);
+      loadUtf8Value(&rest, src, str);
       if (str.length() > 3)
         info->year = str.mid(0, 4).toInt();
     }
     else if (child == 0x74726b6e) // trkn
     {
       QString str;
-      loadUtf8Value(&rest, fp, str);
+      loadUtf8Value(&rest, src, str);
       info->trackNo = str.toInt();
     }
     else if (child == 0x636f7672) // covr
       info->hasArt = (rest > M4A_HEADER_SIZE);
 
     // move to the end of child
-    if (rest && fseek(fp, rest, SEEK_CUR) != 0)
+    if (rest && src->seek(rest, SEEK_CUR) != 0)
       return -1;
     *remaining -= size;
   }
   return 1;
 }
 
-int M4AParser::parse_meta(uint64_t * remaining, FILE * fp, MediaInfo * info)
+int M4AParser::parse_meta(uint64_t * remaining, ByteSource * src, MediaInfo * info)
 {
   bool exit = false;
   unsigned char buf[M4A_HEADER_SIZE];
@@ -228,53 +292,53 @@ int M4AParser::parse_meta(uint64_t * remaining, FILE * fp, MediaInfo * info)
   uint64_t size;
   int r;
   // skip flag bytes before reading children atoms
-  if (*remaining < 4 || fread(buf, 1, 4, fp) != 4)
+  if (*remaining < 4 || src->read(buf, 4) != 4)
     return -1;
   *remaining -= 4;
-  while (!exit && (r = nextChild(buf, remaining, fp, &child, &size)) > 0)
+  while (!exit && (r = nextChild(buf, remaining, src, &child, &size)) > 0)
   {
     uint64_t rest = size;
     if (child == 0x696c7374) // ilst
     {
-      parse_ilst(&rest, fp, info);
+      parse_ilst(&rest, src, info);
       exit = true;
     }
     // move to the end of child
-    if (rest && fseek(fp, rest, SEEK_CUR) != 0)
+    if (rest && src->seek(rest, SEEK_CUR) != 0)
       break;
     *remaining -= size;
   }
   return 1;
 }
 
-int M4AParser::parse_udta(uint64_t * remaining, FILE * fp, MediaInfo * info)
+int M4AParser::parse_udta(uint64_t * remaining, ByteSource * src, MediaInfo * info)
 {
   bool exit = false;
   unsigned char buf[M4A_HEADER_SIZE];
   unsigned child;
   uint64_t size;
   int r;
-  while (!exit && (r = nextChild(buf, remaining, fp, &child, &size)) > 0)
+  while (!exit && (r = nextChild(buf, remaining, src, &child, &size)) > 0)
   {
     uint64_t rest = size;
     if (child == 0x6d657461) // meta
     {
-      parse_meta(&rest, fp, info);
+      parse_meta(&rest, src, info);
       exit = true;
     }
     // move to the end of child
-    if (rest && fseek(fp, rest, SEEK_CUR) != 0)
+    if (rest && src->seek(rest, SEEK_CUR) != 0)
       return -1;
     *remaining -= size;
   }
   return 1;
 }
 
-int M4AParser::parse_mvhd(uint64_t * remaining, FILE * fp, MediaInfo * info)
+int M4AParser::parse_mvhd(uint64_t * remaining, ByteSource * src, MediaInfo * info)
 {
 #define MVHD_SIZE 20
   unsigned char buf[MVHD_SIZE];
-  if (*remaining < MVHD_SIZE || fread(buf, 1, MVHD_SIZE, fp) != MVHD_SIZE)
+  if (*remaining < MVHD_SIZE || src->read(buf, MVHD_SIZE) != MVHD_SIZE)
     return -1;
   *remaining -= MVHD_SIZE;
   unsigned scale = read32be(buf + 12);
@@ -286,25 +350,25 @@ int M4AParser::parse_mvhd(uint64_t * remaining, FILE * fp, MediaInfo * info)
   return 1;
 }
 
-int M4AParser::parse_moov(uint64_t * remaining, FILE * fp, MediaInfo * info)
+int M4AParser::parse_moov(uint64_t * remaining, ByteSource * src, MediaInfo * info)
 {
   unsigned char buf[M4A_HEADER_SIZE];
   unsigned child;
   uint64_t size = 0;
   int r;
-  while ((r = nextChild(buf, remaining, fp, &child, &size)) > 0)
+  while ((r = nextChild(buf, remaining, src, &child, &size)) > 0)
   {
     uint64_t rest = size;
     if (child == 0x6d766864) // mvhd
     {
-      parse_mvhd(&rest, fp, info);
+      parse_mvhd(&rest, src, info);
     }
     else if (child == 0x75647461) // udta
     {
-      parse_udta(&rest, fp, info);
+      parse_udta(&rest, src, info);
     }
     // move to the end of child
-    if (rest && fseek(fp, rest, SEEK_CUR) != 0)
+    if (rest && src->seek(rest, SEEK_CUR) != 0)
       return -1;
     *remaining -= size;
   }
@@ -23,22 +23,25 @@
 namespace mediascanner
 {
 
+class ByteSource;
+
 class M4AParser : public MediaParser
 {
 public:
   const char * commonName() override { return "M4A"; }
   bool match(const QFileInfo& fileInfo) override;
   bool parse(MediaFile * file, MediaInfo * info, bool debug) override;
+  bool extractArt(MediaFile * file, QByteArray& image) override;
 
 private:
-  static int nextChild(unsigned char * buf, uint64_t * remaining, FILE * fp, unsigned * child, uint64_t * childSize);
-  static int loadDataValue(uint64_t * remaining, FILE * fp, char ** alloc, unsigned * allocSize);
-  static int loadUtf8Value(uint64_t * remaining, FILE * fp, QString& str);
-  static int parse_ilst(uint64_t * remaining, FILE * fp, MediaInfo * info);
-  static int parse_meta(uint64_t * remaining, FILE * fp, MediaInfo * info);
-  static int parse_udta(uint64_t * remaining, FILE * fp, MediaInfo * info);
-  static int parse_mvhd(uint64_t * remaining, FILE * fp, MediaInfo * info);
-  static int parse_moov(uint64_t * remaining, FILE * fp, MediaInfo * info);
+  static int nextChild(unsigned char * buf, uint64_t * remaining, ByteSource * src, unsigned * child, uint64_t * childSize);
+  static int loadDataValue(uint64_t * remaining, ByteSource * src, char ** alloc, unsigned * allocSize);
+  static int loadUtf8Value(uint64_t * remaining, ByteSource * src, QString& str);
+  static int parse_ilst(uint64_t * remaining, ByteSource * src, MediaInfo * info);
+  static int parse_meta(uint64_t * remaining, ByteSource * src, MediaInfo * info);
+  static int parse_udta(uint64_t * remaining, ByteSource * src, MediaInfo * info);
+  static int parse_mvhd(uint64_t * remaining, ByteSource * src, MediaInfo * info);
+  static int parse_moov(uint64_t * remaining, ByteSource * src, MediaInfo * info);
 };
 
 }
@@ -0,0 +1,268 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "mediadatabase.h"
+#include "locked.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QDataStream>
+
+#define DATABASE_MAGIC    0x4e4d5344 // NMSD
+#define DATABASE_VERSION  2
+
+using namespace mediascanner;
+
+static void writeMediaInfo(QDataStream& out, const MediaInfo& info)
+{
+  out << info.title << info.artist.value() << info.album.value() << info.genre.value() << info.composer.value()
+      << (qint32)info.trackNo << (qint32)info.year << info.hasArt
+      << info.container << info.codec
+      << (qint32)info.channels << (qint32)info.sampleRate << (qint32)info.bitRate << (qint32)info.duration;
+}
+
+static void readMediaInfo(QDataStream& in, MediaInfo& info)
+{
+  qint32 trackNo, year, channels, sampleRate, bitRate, duration;
+  QString artist, album, genre, composer;
+  in >> info.title >> artist >> album >> genre >> composer
+     >> trackNo >> year >> info.hasArt
+     >> info.container >> info.codec
+     >> channels >> sampleRate >> bitRate >> duration;
+  info.artist = artist;
+  info.album = album;
+  info.genre = genre;
+  info.composer = composer;
+  info.trackNo = trackNo;
+  info.year = year;
+  info.channels = channels;
+  info.sampleRate = sampleRate;
+  info.bitRate = bitRate;
+  info.duration = duration;
+}
+
+MediaDatabase::MediaDatabase()
+: m_filePath()
+, m_entries()
+, m_lock(new QMutex())
+, m_dirty(false)
+{
+}
+
+MediaDatabase::~MediaDatabase()
+{
+  delete m_lock;
+}
+
+bool MediaDatabase::load()
+{
+  LockGuard<QMutex> g(m_lock);
+  m_entries.clear();
+  m_dirty = false;
+  if (m_filePath.isEmpty())
+    return false;
+
+  QFile file(m_filePath);
+  if (!file.exists())
+    return true; // nothing to load
+  if (!file.open(QIODevice::ReadOnly))
+  {
+    qWarning("%s: cannot open %s", __FUNCTION__, m_filePath.toUtf8().constData());
+    return false;
+  }
+
+  QDataStream in(&file);
+  in.setVersion(QDataStream::Qt_5_6);
+  quint32 magic, version, count;
+  in >> magic >> version;
+  if (magic != DATABASE_MAGIC || version != DATABASE_VERSION)
+  {
+    qWarning("%s: discard incompatible index %s", __FUNCTION__, m_filePath.toUtf8().constData());
+    m_dirty = true;
+    return false;
+  }
+  in >> count;
+  m_entries.reserve(count);
+  while (count-- > 0 && in.status() == QDataStream::Ok)
+  {
+    QString path;
+    Entry entry;
+    entry.mediaInfo = MediaInfoPtr(new MediaInfo());
+    entry.seen = false;
+    in >> path >> entry.size >> entry.lastModified >> entry.parser;
+    readMediaInfo(in, *entry.mediaInfo);
+    if (in.status() == QDataStream::Ok)
+      m_entries.insert(path, entry);
+  }
+  if (in.status() != QDataStream::Ok)
+  {
+    qWarning("%s: discard corrupted index %s", __FUNCTION__, m_filePath.toUtf8().constData());
+    m_entries.clear();
+    m_dirty = true;
+    return false;
+  }
+  qInfo("%s: %d entries loaded from %s", __FUNCTION__, m_entries.size(), m_filePath.toUtf8().constData());
+  return true;
+}
+
+bool MediaDatabase::save()
+{
+  LockGuard<QMutex> g(m_lock);
+  if (m_filePath.isEmpty())
+    return false;
+  QDir().mkpath(QFileInfo(m_filePath).absolutePath());
+
+  QSaveFile file(m_filePath);
+  if (!file.open(QIODevice::WriteOnly))
+  {
+    qWarning("%s: cannot open %s", __FUNCTION__, m_filePath.toUtf8().constData());
+    return false;
+  }
+
+  QDataStream out(&file);
+  out.setVersion(QDataStream::Qt_5_6);
+  out << (quint32)DATABASE_MAGIC << (quint32)DATABASE_VERSION << (quint32)m_entries.size();
+  for (QHash<QString, Entry>::const_iterator it = m_entries.constBegin(); it != m_entries.constEnd(); ++it)
+  {
+    out << it.key() << it.value().size << it.value().lastModified << it.value().parser;
+    writeMediaInfo(out, *it.value().mediaInfo);
+  }
+  if (out.status() != QDataStream::Ok || !file.commit())
+  {
+    qWarning("%s: failed to write %s", __FUNCTION__, m_filePath.toUtf8().constData());
+    return false;
+  }
+  m_dirty = false;
+  return true;
+}
+
+void MediaDatabase::clear()
+{
+  LockGuard<QMutex> g(m_lock);
+  if (!m_entries.isEmpty())
+    m_dirty = true;
+  m_entries.clear();
+}
+
+bool MediaDatabase::find(const MediaFile& file, MediaInfoPtr& info)
+{
+  LockGuard<QMutex> g(m_lock);
+  QHash<QString, Entry>::iterator it = m_entries.find(file.filePath());
+  if (it == m_entries.end())
+    return false;
+  if (it.value().size != file.size ||
+          it.value().lastModified != file.mtime ||
+          it.value().parser != file.parser->commonName())
+  {
+    // the file has changed: the entry will be refreshed on update
+    it.value().seen = true;
+    return false;
+  }
+  it.value().seen = true;
+  info = it.value().mediaInfo;
+  return true;
+}
+
+void MediaDatabase::update(const MediaFile& file)
+{
+  if (!file.mediaInfo)
+    return;
+  Entry entry;
+  entry.size = file.size;
+  entry.lastModified = file.mtime;
+  entry.parser = QByteArray(file.parser->commonName());
+  entry.mediaInfo = file.mediaInfo;
+  entry.seen = true;
+  LockGuard<QMutex> g(m_lock);
+  m_entries.insert(file.filePath(), entry);
+  m_dirty = true;
+}
+
+void MediaDatabase::remove(const QString& filePath)
+{
+  LockGuard<QMutex> g(m_lock);
+  if (m_entries.remove(filePath) > 0)
+    m_dirty = true;
+}
+
+void MediaDatabase::touch(const QString& filePath)
+{
+  LockGuard<QMutex> g(m_lock);
+  QHash<QString, Entry>::iterator it = m_entries.find(filePath);
+  if (it != m_entries.end())
+    it.value().seen = true;
+}
+
+bool MediaDatabase::contains(const QString& filePath, qint64 lastModified) const
+{
+  LockGuard<QMutex> g(m_lock);
+  QHash<QString, Entry>::const_iterator it = m_entries.constFind(filePath);
+  return (it != m_entries.constEnd() && it.value().lastModified == lastModified);
+}
+
+void MediaDatabase::purge(const QStringList& scopes, const QSet<QString>& scannedDirs)
+{
+  LockGuard<QMutex> g(m_lock);
+  QHash<QString, bool> dirs; // the directories out of the scan, checked on disk
+  QHash<QString, Entry>::iterator it = m_entries.begin();
+  while (it != m_entries.end())
+  {
+    if (!it.value().seen)
+    {
+      const QString& filePath = it.key();
+      bool inScope = false;
+      for (const QString& scope : scopes)
+      {
+        if (filePath.length() > scope.length() && filePath.startsWith(scope) &&
+                (scope.endsWith(QChar('/')) || filePath.at(scope.length()) == QChar('/')))
+        {
+          inScope = true;
+          break;
+        }
+      }
+      if (inScope)
+      {
+        QString dirPath = filePath.left(filePath.lastIndexOf(QChar('/')));
+        bool stale = scannedDirs.contains(dirPath);
+        if (!stale)
+        {
+          QHash<QString, bool>::iterator dir = dirs.find(dirPath);
+          if (dir == dirs.end())
+            dir = dirs.insert(dirPath, !QFileInfo(dirPath).isDir());
+          stale = dir.value();
+        }
+        if (stale)
+        {
+          it = m_entries.erase(it);
+          m_dirty = true;
+          continue;
+        }
+      }
+    }
+    it.value().seen = false;
+    ++it;
+  }
+}
+
+int MediaDatabase::count() const
+{
+  LockGuard<QMutex> g(m_lock);
+  return m_entries.size();
+}
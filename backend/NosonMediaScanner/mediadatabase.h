@@ -0,0 +1,104 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef MEDIADATABASE_H
+#define MEDIADATABASE_H
+
+#include "mediafile.h"
+#include "mediainfo.h"
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+#include <QMutex>
+
+namespace mediascanner
+{
+
+/**
+ * The persistent index of parsed files. It stores the stat data and the
+ * parsed media info of each valid file, so a restart of the engine can
+ * publish unchanged files without parsing them again.
+ */
+class MediaDatabase
+{
+public:
+  MediaDatabase();
+  ~MediaDatabase();
+
+  void setFilePath(const QString& filePath) { m_filePath = filePath; }
+  const QString& filePath() const { return m_filePath; }
+
+  bool load();
+  bool save();
+  void clear();
+
+  /**
+   * Lookup the stored media info for the given file. The entry matches only
+   * when size, modification time and parser are unchanged.
+   * @param file
+   * @param info the stored info when found
+   * @return true if the entry matches
+   */
+  bool find(const MediaFile& file, MediaInfoPtr& info);
+  void update(const MediaFile& file);
+  void remove(const QString& filePath);
+
+  /**
+   * Mark the entry of a file still present, without looking it up.
+   */
+  void touch(const QString& filePath);
+
+  /**
+   * @return true if the file has an entry at the given modification time
+   */
+  bool contains(const QString& filePath, qint64 lastModified) const;
+
+  /**
+   * Erase the entries below the given scopes, not looked up, updated or
+   * touched since the last purge: those of the scanned directories, and
+   * those of the directories gone. Then the marks are reset for the next
+   * purge.
+   * @param scopes the scanned paths, available at scan time
+   * @param scannedDirs the directories listed by the scan
+   */
+  void purge(const QStringList& scopes, const QSet<QString>& scannedDirs);
+
+  bool isDirty() const { return m_dirty; }
+  int count() const;
+
+private:
+  struct Entry
+  {
+    qint64 size;
+    qint64 lastModified;
+    QByteArray parser;
+    MediaInfoPtr mediaInfo;
+    bool seen;
+  };
+
+  QString m_filePath;
+  QHash<QString, Entry> m_entries;
+  mutable QMutex * m_lock;
+  bool m_dirty;
+};
+
+}
+
+#endif /* MEDIADATABASE_H */
@@ -17,22 +17,66 @@
  */
 #include "mediaextractor.h"
 
+#include <QElapsedTimer>
+
 using namespace mediascanner;
 
-MediaExtractor::MediaExtractor(void * handle, MediaExtractorCallback callback, MediaFilePtr& filePtr, bool debug)
+MediaExtractor::MediaExtractor(void * handle, MediaExtractorCallback callback, MediaFilePtr& filePtr, bool debug, ScannerMetrics * metrics, ArtCache * artCache)
 : MediaRunnable(debug)
 , m_handle(handle)
 , m_callback(callback)
 , m_filePtr(filePtr)
+, m_metrics(metrics)
+, m_artCache(artCache)
+, m_preload(nullptr)
+, m_tuner(nullptr)
+, m_device(-1)
 {
 }
 
+void MediaExtractor::setPreload(Preload * preload)
+{
+  delete m_preload;
+  m_preload = preload;
+}
+
+void MediaExtractor::setTuner(ConcurrencyTuner * tuner, int device)
+{
+  m_tuner = tuner;
+  m_device = device;
+}
+
 void MediaExtractor::run()
 {
   if (m_callback)
   {
     MediaInfoPtr infoPtr(new MediaInfo());
-    if (m_filePtr->parser->parse(m_filePtr.data(), infoPtr.data(), m_debug))
+    IOStats io = IOStats::local();
+    QElapsedTimer timer;
+    timer.start();
+    ScannerMetrics::setCurrent(m_metrics);
+    ByteSource::setPreload(m_preload);
+    bool succeeded = m_filePtr->parser->parse(m_filePtr.data(), infoPtr.data(), m_debug);
+    if (m_metrics || m_tuner)
+    {
+      const IOStats& now = IOStats::local();
+      io.bytesRead = now.bytesRead - io.bytesRead;
+      io.reads = now.reads - io.reads;
+      io.seeks = now.seeks - io.seeks;
+      qint64 elapsedUs = timer.nsecsElapsed() / 1000;
+      if (m_metrics)
+        m_metrics->addParse(m_filePtr->parser->commonName(), elapsedUs, io, succeeded);
+      if (m_tuner)
+        m_tuner->addSample(m_device, elapsedUs, io.bytesRead);
+    }
+    // extract the art unless the album already provided it
+    if (succeeded && m_artCache && infoPtr->hasArt && !m_artCache->find(*m_filePtr))
+      m_artCache->extract(*m_filePtr);
+    ByteSource::setPreload(nullptr);
+    ScannerMetrics::setCurrent(nullptr);
+    // release the preloaded bytes and the descriptor at once
+    setPreload(nullptr);
+    if (succeeded)
     {
       // default undefined tags
       if (infoPtr->album.isEmpty())
@@ -44,7 +88,7 @@ void MediaExtractor::run()
       if (infoPtr->composer.isEmpty())
         infoPtr->composer = TAG_UNDEFINED;
 
-      //qDebug("parsing %s (%s) succeeded", m_filePtr->filePath.toUtf8().constData(), m_filePtr->parser->commonName());
+      //qDebug("parsing %s (%s) succeeded", m_filePtr->filePath().toUtf8().constData(), m_filePtr->parser->commonName());
       m_filePtr->mediaInfo.swap(infoPtr);
       m_filePtr->isValid = true;
       m_callback(m_handle, m_filePtr);
@@ -52,10 +96,10 @@ void MediaExtractor::run()
 #if 0
       MediaInfo * info = m_filePtr->mediaInfo.data();
       qDebug("title       = %s", info->title.toUtf8().constData());
-      qDebug("album       = %s", info->album.toUtf8().constData());
-      qDebug("artist      = %s", info->artist.toUtf8().constData());
-      qDebug("genre       = %s", info->genre.toUtf8().constData());
-      qDebug("composer    = %s", info->composer.toUtf8().constData());
+      qDebug("album       = %s", info->album.value().toUtf8().constData());
+      qDebug("artist      = %s", info->artist.value().toUtf8().constData());
+      qDebug("genre       = %s", info->genre.value().toUtf8().constData());
+      qDebug("composer    = %s", info->composer.value().toUtf8().constData());
       qDebug("track no    = %d", info->trackNo);
       qDebug("year        = %d", info->year);
       qDebug("container   = %s", info->container.toUtf8().constData());
@@ -68,7 +112,7 @@ void MediaExtractor::run()
     }
     else
     {
-      qWarning("parsing %s (%s) failed", m_filePtr->filePath.toUtf8().constData(), m_filePtr->parser->commonName());
+      qWarning("parsing %s (%s) failed", m_filePtr->filePath().toUtf8().constData(), m_filePtr->parser->commonName());
       m_filePtr->isValid = false;
       m_callback(m_handle, m_filePtr);
     }
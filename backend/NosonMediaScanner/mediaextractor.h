@@ -21,6 +21,10 @@
 #include "mediafile.h"
 #include "mediainfo.h"
 #include "mediarunnable.h"
+#include "scannermetrics.h"
+#include "artcache.h"
+#include "bytesource.h"
+#include "concurrencytuner.h"
 
 #define TAG_UNDEFINED  "<Undefined>"
 
@@ -32,15 +36,32 @@ typedef void (*MediaExtractorCallback)(void * handle, MediaFilePtr& filePtr);
 class MediaExtractor : public MediaRunnable
 {
 public:
-  MediaExtractor(void * handle, MediaExtractorCallback callback, MediaFilePtr& filePtr, bool debug);
-  virtual ~MediaExtractor() override {}
+  MediaExtractor(void * handle, MediaExtractorCallback callback, MediaFilePtr& filePtr, bool debug, ScannerMetrics * metrics = nullptr, ArtCache * artCache = nullptr);
+  virtual ~MediaExtractor() override { delete m_preload; }
 
   void run() override;
 
+  const MediaFilePtr& file() const { return m_filePtr; }
+
+  /**
+   * Give the file opened ahead to the parsing. The job takes the ownership.
+   */
+  void setPreload(Preload * preload);
+
+  /**
+   * Report the extraction time to the tuner of the pool, for the given device.
+   */
+  void setTuner(ConcurrencyTuner * tuner, int device);
+
 private:
   void * m_handle;
   MediaExtractorCallback m_callback;
   MediaFilePtr m_filePtr;
+  ScannerMetrics * m_metrics;
+  ArtCache * m_artCache;
+  Preload * m_preload;
+  ConcurrencyTuner * m_tuner;
+  int m_device;
 };
 
 }
@@ -0,0 +1,133 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "mediafile.h"
+
+#include <QFile>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_POSIX_IO
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
+using namespace mediascanner;
+
+void MediaFile::setFileInfo(const QFileInfo& fileInfo)
+{
+  DirectoryTable& table = DirectoryTable::instance();
+  unsigned id = table.intern(fileInfo.absolutePath());
+  table.release(dirId);
+  dirId = id;
+  name = fileInfo.fileName();
+  name.squeeze();
+  suffixId = (isDirectory ? SuffixUnknown : suffixOf(fileInfo.suffix()));
+  size = fileInfo.size();
+  mtime = fileInfo.lastModified().toSecsSinceEpoch();
+}
+
+bool MediaFile::readIdentity(const QString& filePath)
+{
+  if (!statIdentity(filePath, device, inode))
+  {
+    device = inode = 0;
+    return false;
+  }
+  return true;
+}
+
+bool MediaFile::statIdentity(const QString& path, quint64& device, quint64& inode)
+{
+#ifdef HAVE_POSIX_IO
+  struct stat st;
+  if (::stat(QFile::encodeName(path).constData(), &st) != 0)
+    return false;
+  device = static_cast<quint64>(st.st_dev);
+  inode = static_cast<quint64>(st.st_ino);
+  return (inode != 0);
+#else
+  Q_UNUSED(path);
+  Q_UNUSED(device);
+  Q_UNUSED(inode);
+  return false;
+#endif
+}
+
+QString MediaFile::filePath() const
+{
+  const QString& dirPath = path();
+  if (dirPath.isEmpty())
+    return name;
+  QString filePath;
+  filePath.reserve(dirPath.size() + 1 + name.size());
+  filePath.append(dirPath);
+  if (!dirPath.endsWith(QChar('/')))
+    filePath.append(QChar('/'));
+  filePath.append(name);
+  return filePath;
+}
+
+QString MediaFile::baseName() const
+{
+  int p = name.indexOf(QChar('.'));
+  return (p < 0 ? name : name.left(p));
+}
+
+QString MediaFile::suffix() const
+{
+  switch (suffixId)
+  {
+  case SuffixFLAC: { static const QString _s("flac"); return _s; }
+  case SuffixMP3:  { static const QString _s("mp3"); return _s; }
+  case SuffixMP2:  { static const QString _s("mp2"); return _s; }
+  case SuffixAAC:  { static const QString _s("aac"); return _s; }
+  case SuffixOGG:  { static const QString _s("ogg"); return _s; }
+  case SuffixM4A:  { static const QString _s("m4a"); return _s; }
+  case SuffixM4B:  { static const QString _s("m4b"); return _s; }
+  case SuffixOPUS: { static const QString _s("opus"); return _s; }
+  default:
+    break;
+  }
+  int p = name.lastIndexOf(QChar('.'));
+  return (p < 0 ? QString() : name.mid(p + 1).toLower());
+}
+
+qint64 MediaFile::footprint() const
+{
+  // the record, the shared pointer block and the name
+  return sizeof(MediaFile) + 2 * sizeof(void*) + sizeof(QArrayData) + name.capacity() * sizeof(QChar);
+}
+
+MediaFile::Suffix MediaFile::suffixOf(const QString& suffix)
+{
+  static const struct { const char * ext; Suffix id; } _suffixes[] = {
+    { "FLAC", SuffixFLAC },
+    { "MP3",  SuffixMP3 },
+    { "MP2",  SuffixMP2 },
+    { "AAC",  SuffixAAC },
+    { "OGG",  SuffixOGG },
+    { "M4A",  SuffixM4A },
+    { "M4B",  SuffixM4B },
+    { "OPUS", SuffixOPUS },
+  };
+  for (unsigned i = 0; i < sizeof(_suffixes) / sizeof(_suffixes[0]); ++i)
+  {
+    if (suffix.compare(QLatin1String(_suffixes[i].ext), Qt::CaseInsensitive) == 0)
+      return _suffixes[i].id;
+  }
+  return SuffixUnknown;
+}
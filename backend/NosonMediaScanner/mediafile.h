@@ -20,44 +20,135 @@
 
 #include "mediaparser.h"
 #include "mediainfo.h"
+#include "directorytable.h"
 
 #include <QString>
 #include <QDateTime>
+#include <QFileInfo>
+#include <QList>
+#include <QHash>
 
 namespace mediascanner
 {
 
+/**
+ * The identity of a physical file. The links and the overlapping roots lead
+ * to the same identity, so the file can be parsed and published once.
+ */
+struct FileIdentity
+{
+  quint64 device;
+  quint64 inode;
+  qint64 size;
+  qint64 mtime;
+
+  bool operator==(const FileIdentity& other) const
+  {
+    return (inode == other.inode && device == other.device &&
+            size == other.size && mtime == other.mtime);
+  }
+};
+
+inline uint qHash(const FileIdentity& id, uint seed = 0)
+{
+  return qHash(id.inode, seed) ^ qHash(id.device) ^ qHash(id.mtime);
+}
+
+/**
+ * The record is kept compact as it is held for each file of the library:
+ * the parent directory is a reference on an id of the directory table, and
+ * only the name of the file is stored. The paths are rebuilt on demand.
+ */
 struct MediaFile
 {
+  enum Suffix
+  {
+    SuffixUnknown = 0,
+    SuffixFLAC,
+    SuffixMP3,
+    SuffixMP2,
+    SuffixAAC,
+    SuffixOGG,
+    SuffixM4A,
+    SuffixM4B,
+    SuffixOPUS,
+  };
+
   unsigned fileId;
+  unsigned dirId;
   bool isPinned;
   bool isDirectory;
-  QString filePath;
-  QString baseName;
-  QString suffix;
-  QString path;
-  qint64 size;
-  QDateTime lastModified;
-  MediaParserPtr parser;
-  int retry;
   bool isValid;
   bool signaled;
+  bool isDuplicate;     // an alias of a file held by another item
+  quint8 suffixId;
+  int retry;
+  qint64 size;
+  qint64 mtime;         // seconds since epoch
+  quint64 device;       // zero when the identity isn't known
+  quint64 inode;
+  QString name;         // the file name including the suffix
+  MediaParserPtr parser;
   MediaInfoPtr mediaInfo;
 
   MediaFile(unsigned id)
   : fileId(id)
+  , dirId(0)
   , isPinned(false)
   , isDirectory(false)
-  , retry(0)
   , isValid(false)
   , signaled(false)
+  , isDuplicate(false)
+  , suffixId(SuffixUnknown)
+  , retry(0)
+  , size(0)
+  , mtime(0)
+  , device(0)
+  , inode(0)
   , mediaInfo(nullptr)
   { }
+
+  ~MediaFile() { DirectoryTable::instance().release(dirId); }
+
+  // the record owns a reference on its directory
+  MediaFile(const MediaFile&) = delete;
+  MediaFile& operator=(const MediaFile&) = delete;
+
+  void setFileInfo(const QFileInfo& fileInfo);
+
+  QString filePath() const;
+  const QString& path() const { return DirectoryTable::instance().path(dirId); }
+  QString baseName() const;
+  /**
+   * @return the suffix in lower case, shared for the known media suffixes
+   */
+  QString suffix() const;
+  QDateTime lastModified() const { return QDateTime::fromSecsSinceEpoch(mtime); }
+
+  /**
+   * Read the device and the inode of the file.
+   * @return false if the platform or the file doesn't provide them
+   */
+  bool readIdentity(const QString& filePath);
+  bool hasIdentity() const { return inode != 0; }
+  FileIdentity identity() const { return { device, inode, size, mtime }; }
+
+  /**
+   * Read the device and the inode of a path.
+   */
+  static bool statIdentity(const QString& path, quint64& device, quint64& inode);
+
+  /**
+   * @return the estimated size of the record in bytes, excluding the info
+   */
+  qint64 footprint() const;
+
+  static Suffix suffixOf(const QString& suffix);
 };
 
 typedef QSharedPointer<MediaFile> MediaFilePtr;
+typedef QList<MediaFilePtr> MediaFileList;
 
 }
 
 #endif /* MEDIAFILE_H */
-
@@ -18,7 +18,10 @@
 #ifndef MEDIAINFO_H
 #define MEDIAINFO_H
 
+#include "stringpool.h"
+
 #include <QString>
+#include <QSharedPointer>
 
 namespace mediascanner
 {
@@ -26,10 +29,11 @@ namespace mediascanner
 struct MediaInfo
 {
   QString title;
-  QString artist;
-  QString album;
-  QString genre;
-  QString composer;
+  // the tags shared by many tracks are interned
+  InternedString artist;
+  InternedString album;
+  InternedString genre;
+  InternedString composer;
   int trackNo;
   int year;
   bool hasArt;
@@ -20,6 +20,7 @@
 
 #include <QFileInfo>
 #include <QSharedPointer>
+#include <QByteArray>
 
 namespace mediascanner
 {
@@ -34,6 +35,14 @@ public:
   virtual const char * commonName() = 0;
   virtual bool match(const QFileInfo& fileInfo) = 0;
   virtual bool parse(MediaFile * file, MediaInfo * info, bool debug) = 0;
+
+  /**
+   * Extract the embedded picture of the file, preferably the front cover.
+   * @param file
+   * @param image the encoded image when found
+   * @return false if the file has no picture or it cannot be read
+   */
+  virtual bool extractArt(MediaFile * file, QByteArray& image) { (void)file; (void)image; return false; }
 };
 
 typedef QSharedPointer<MediaParser> MediaParserPtr;
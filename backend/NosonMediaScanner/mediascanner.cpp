@@ -23,10 +23,19 @@
 #include "m4aparser.h"
 #include "oggparser.h"
 #include "listmodel.h"
+#include "libraryindex.h"
+#include "locked.h"
 
 #include <QDebug>
+#include <QTimer>
+#include <QUrl>
+
+#define FEED_INTERVAL_MS  250
+#define FEED_BATCH_SIZE   256
+#define METRICS_INTERVAL_MS 5000
 
 static int mediaFilePtr_id = qRegisterMetaType<mediascanner::MediaFilePtr>("MediaFilePtr");
+static int mediaFileList_id = qRegisterMetaType<mediascanner::MediaFileList>("MediaFileList");
 
 using namespace mediascanner;
 
@@ -35,8 +44,23 @@ MediaScanner * MediaScanner::_instance = nullptr;
 MediaScanner::MediaScanner(QObject *parent)
 : QObject(parent)
 , m_engine(new MediaScannerEngine(this))
+, m_index(new LibraryIndex(this))
 , m_debug(false)
+, m_feedLock(new QMutex())
+, m_feed()
+, m_feedTimer(new QTimer(this))
+, m_metricsTimer(new QTimer(this))
 {
+  m_feedTimer->setSingleShot(true);
+  m_feedTimer->setInterval(FEED_INTERVAL_MS);
+  connect(m_feedTimer, &QTimer::timeout, this, &MediaScanner::flushChanges);
+  // the metrics are refreshed periodically while working
+  m_metricsTimer->setInterval(METRICS_INTERVAL_MS);
+  connect(m_metricsTimer, &QTimer::timeout, this, &MediaScanner::onMetricsTimeout);
+  connect(this, &MediaScanner::workingChanged, this, &MediaScanner::onWorkingChanged, Qt::QueuedConnection);
+  // always queued, so the batches are delivered in order whatever the flushing thread
+  connect(this, &MediaScanner::filesAdded, m_index, &LibraryIndex::onFilesAdded, Qt::QueuedConnection);
+  connect(this, &MediaScanner::filesRemoved, m_index, &LibraryIndex::onFilesRemoved, Qt::QueuedConnection);
   m_engine->addParser(new FLACParser);
 #ifdef ENABLE_ID3PARSER
   m_engine->addParser(new ID3Parser);
@@ -61,6 +85,7 @@ MediaScanner::~MediaScanner()
   if (m_engine->isRunning())
     m_engine->stop();
   delete m_engine;
+  delete m_feedLock;
 }
 
 void MediaScanner::start(int maxThread /*=MEDIASCANNER_MAX_THREAD*/) {
@@ -71,6 +96,11 @@ void MediaScanner::start(int maxThread /*=MEDIASCANNER_MAX_THREAD*/) {
   }
 }
 
+void MediaScanner::setThreadBounds(int minThread, int maxThread)
+{
+  m_engine->setThreadBounds(minThread, maxThread);
+}
+
 void MediaScanner::debug(bool enable)
 {
   m_debug = enable;
@@ -86,14 +116,78 @@ bool MediaScanner::working() const
   return m_engine ? m_engine->working() : false;
 }
 
+QVariantMap MediaScanner::progress() const
+{
+  return m_engine ? m_engine->progress() : QVariantMap();
+}
+
+QVariantMap MediaScanner::metrics() const
+{
+  return m_engine ? m_engine->metrics() : QVariantMap();
+}
+
+bool MediaScanner::artCache() const
+{
+  return m_engine ? m_engine->artCacheEnabled() : false;
+}
+
+void MediaScanner::setArtCache(bool enabled)
+{
+  if (!m_engine || m_engine->artCacheEnabled() == enabled)
+    return;
+  m_engine->setArtCacheEnabled(enabled);
+  emit artCacheChanged();
+}
+
+int MediaScanner::prefetch() const
+{
+  return m_engine ? static_cast<int>(m_engine->prefetchMode()) : PrefetchNone;
+}
+
+void MediaScanner::setPrefetch(int mode)
+{
+  if (!m_engine)
+    return;
+  Prefetcher::Mode before = m_engine->prefetchMode();
+  m_engine->setPrefetchMode(static_cast<Prefetcher::Mode>(mode));
+  if (m_engine->prefetchMode() != before)
+    emit prefetchChanged();
+}
+
+QString MediaScanner::artUrl(const QString& filePath, int size) const
+{
+  QString path = m_engine ? m_engine->artPath(filePath, size) : QString();
+  if (path.isEmpty())
+    return path;
+  return QUrl::fromLocalFile(path).toString();
+}
+
+void MediaScanner::onWorkingChanged()
+{
+  if (working())
+    m_metricsTimer->start();
+  else
+  {
+    m_metricsTimer->stop();
+    onMetricsTimeout();
+  }
+}
+
+void MediaScanner::onMetricsTimeout()
+{
+  if (isDebug())
+    qDebug("scanner metrics: %s", m_engine->metricsSummary().toUtf8().constData());
+  emit metricsChanged();
+}
+
 void MediaScanner::registerModel(ListModel * model)
 {
   if (model)
   {
     if (isDebug())
       qDebug("%s: %p", __FUNCTION__, model);
-    connect(this, &MediaScanner::put, model, &ListModel::onFileAdded);
-    connect(this, &MediaScanner::remove, model, &ListModel::onFileRemoved);
+    // the models follow the index in its thread
+    m_index->subscribe(model, model->filter());
   }
 }
 
@@ -103,8 +197,7 @@ void MediaScanner::unregisterModel(ListModel * model)
   {
     if (isDebug())
       qDebug("%s: %p", __FUNCTION__, model);
-    disconnect(this, &MediaScanner::put, model, &ListModel::onFileAdded);
-    disconnect(this, &MediaScanner::remove, model, &ListModel::onFileRemoved);
+    m_index->unsubscribe(model);
   }
 }
 
@@ -114,6 +207,68 @@ QList<MediaFilePtr> MediaScanner::allParsedFiles() const
   return m_engine->allParsedFiles();
 }
 
+void MediaScanner::put(const MediaFilePtr& filePtr)
+{
+  feed(false, filePtr);
+}
+
+void MediaScanner::remove(const MediaFilePtr& filePtr)
+{
+  feed(true, filePtr);
+}
+
+void MediaScanner::feed(bool removed, const MediaFilePtr& filePtr)
+{
+  LockGuard<QMutex> g(m_feedLock);
+  Change change;
+  change.removed = removed;
+  change.filePtr = filePtr;
+  m_feed.push_back(change);
+  if (m_feed.size() >= FEED_BATCH_SIZE)
+    flush();
+  else if (m_feed.size() == 1)
+  {
+    // the timer lives in the thread of the scanner
+    QMetaObject::invokeMethod(m_feedTimer, "start", Qt::QueuedConnection);
+  }
+}
+
+void MediaScanner::flushChanges()
+{
+  // the lock is held while emitting to keep the batches ordered
+  LockGuard<QMutex> g(m_feedLock);
+  flush();
+}
+
+void MediaScanner::flush()
+{
+  if (m_feed.isEmpty())
+    return;
+  if (isDebug())
+    qDebug("%s: %d changes", __FUNCTION__, m_feed.size());
+  // deliver the consecutive changes of the same kind as one batch
+  MediaFileList batch;
+  bool removed = m_feed.front().removed;
+  for (const Change& change : m_feed)
+  {
+    if (change.removed != removed)
+    {
+      if (removed)
+        emit filesRemoved(batch);
+      else
+        emit filesAdded(batch);
+      batch.clear();
+      removed = change.removed;
+    }
+    batch.push_back(change.filePtr);
+  }
+  if (removed)
+    emit filesRemoved(batch);
+  else
+    emit filesAdded(batch);
+  m_feed.clear();
+}
+
 bool MediaScanner::addRootPath(const QString &dirPath)
 {
   return m_engine ? m_engine->addRootPath(dirPath) : false;
@@ -129,3 +284,8 @@ void MediaScanner::clearRoots()
   if (m_engine)
     m_engine->clearRoots();
 }
+
+bool MediaScanner::prioritize(const QString& path)
+{
+  return m_engine ? m_engine->prioritize(path) : false;
+}
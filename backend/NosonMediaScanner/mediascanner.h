@@ -23,6 +23,8 @@
 #include <QObject>
 #include <QString>
 #include <QList>
+#include <QVariantMap>
+#include <QMutex>
 
 /*
  * By default all supported media are processed
@@ -39,8 +41,14 @@
 #endif
 
 #define MEDIASCANNER_MAX_THREAD 2
+#define MEDIASCANNER_AUTO_THREAD 0  /* tune the size from the observed storage */
+#define MEDIASCANNER_MIN_AUTO_THREAD 1
+#define MEDIASCANNER_MAX_AUTO_THREAD 8
+
+class QTimer;
 
 Q_DECLARE_METATYPE(mediascanner::MediaFilePtr)
+Q_DECLARE_METATYPE(mediascanner::MediaFileList)
 
 namespace mediascanner
 {
@@ -48,44 +56,123 @@ namespace mediascanner
 class MediaDatabase;
 class MediaScannerEngine;
 class ListModel;
+class LibraryIndex;
 
 class MediaScanner : public QObject
 {
   Q_OBJECT
   Q_PROPERTY(bool emptyState READ emptyState NOTIFY emptyStateChanged)
   Q_PROPERTY(bool working READ working NOTIFY workingChanged)
+  Q_PROPERTY(QVariantMap progress READ progress NOTIFY progressChanged)
+  Q_PROPERTY(QVariantMap metrics READ metrics NOTIFY metricsChanged)
+  Q_PROPERTY(bool artCache READ artCache WRITE setArtCache NOTIFY artCacheChanged)
+  Q_PROPERTY(int prefetch READ prefetch WRITE setPrefetch NOTIFY prefetchChanged)
 
 private:
     static MediaScanner * _instance;
     explicit MediaScanner(QObject * parent = nullptr);
 
 public:
+  enum Prefetch
+  {
+    PrefetchNone    = 0,
+    PrefetchAdvise  = 1,
+    PrefetchUring   = 2,
+  };
+  Q_ENUM(Prefetch)
+
   static MediaScanner * instance(QObject * parent = nullptr);
   virtual ~MediaScanner();
 
   Q_INVOKABLE void start(int maxThread = MEDIASCANNER_MAX_THREAD);
+
+  /**
+   * Configure the bounds of the extraction threads, when started with
+   * MEDIASCANNER_AUTO_THREAD. The chosen count and its rationale are
+   * reported per device in the metrics.
+   */
+  Q_INVOKABLE void setThreadBounds(int minThread, int maxThread);
   Q_INVOKABLE void debug(bool enable);
   bool isDebug() const { return m_debug; }
   bool emptyState() const;
   bool working() const;
+  QVariantMap progress() const;
+  QVariantMap metrics() const;
+  bool artCache() const;
+  void setArtCache(bool enabled);
+
+  /**
+   * The read ahead of the files queued for extraction. A mode not supported
+   * by the system falls back to the nearest one.
+   */
+  int prefetch() const;
+  void setPrefetch(int mode);
+
+  /**
+   * Return the URL of the cached art for the given file, in the smallest
+   * variant fitting the size, else an empty string.
+   */
+  Q_INVOKABLE QString artUrl(const QString& filePath, int size = 0) const;
 
   void registerModel(ListModel * model);
   void unregisterModel(ListModel * model);
   QList<MediaFilePtr> allParsedFiles() const;
 
+  /**
+   * The aggregates of the library shared by the models. It MUST be accessed
+   * from the thread of the scanner only.
+   */
+  LibraryIndex * index() const { return m_index; }
+
+  /**
+   * Feed the registered models with a change. The changes are delivered in
+   * batch on interval, or as soon as the batch is full.
+   */
+  void put(const MediaFilePtr& filePtr);
+  void remove(const MediaFilePtr& filePtr);
+
   Q_INVOKABLE bool addRootPath(const QString& dirPath);
   Q_INVOKABLE bool removeRootPath(const QString& dirPath);
   Q_INVOKABLE void clearRoots();
 
+  /**
+   * Scan and extract the files of the given path first, even during a
+   * running scan.
+   */
+  Q_INVOKABLE bool prioritize(const QString& path);
+
 signals:
   void emptyStateChanged();
   void workingChanged();
-  void put(MediaFilePtr filePtr);
-  void remove(MediaFilePtr filePtr);
+  void progressChanged();
+  void metricsChanged();
+  void artCacheChanged();
+  void prefetchChanged();
+  void filesAdded(const MediaFileList& files);
+  void filesRemoved(const MediaFileList& files);
+
+private slots:
+  void flushChanges();
+  void onWorkingChanged();
+  void onMetricsTimeout();
 
 private:
   MediaScannerEngine * m_engine;
+  LibraryIndex * m_index;
   bool m_debug;
+
+  struct Change
+  {
+    bool removed;
+    MediaFilePtr filePtr;
+  };
+  void feed(bool removed, const MediaFilePtr& filePtr);
+  void flush();
+
+  QMutex * m_feedLock;
+  QList<Change> m_feed;
+  QTimer * m_feedTimer;
+  QTimer * m_metricsTimer;
 };
 
 }
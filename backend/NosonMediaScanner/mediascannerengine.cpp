@@ -17,47 +17,94 @@
  */
 #include "mediascannerengine.h"
 #include "mediaextractor.h"
+#include "stringpool.h"
 #include "locked.h"
 
 #include <QDebug>
 #include <QStandardPaths>
 #include <QDirIterator>
-#include <QQueue>
+#include <QElapsedTimer>
+#include <QDateTime>
 #include <cassert>
+#include <algorithm>
+#include <functional>
 
-#define THREAD_EXPIRY_TIMEOUT 10000
 #define THREAD_WAIT_TIMEOUT   500
 #define DEFAULT_MAX_THREAD    2
-#define SCHEDULE_TIMEOUT_MS   10
+#define QUEUE_CAPACITY        64
 #define FILE_MIN_SIZE         1024
-#define RETRY_TIMEOUT_MS      5000
-#define RETRY_MAX             3
+#define RETRY_INITIAL_MS      1000
+#define RETRY_MAX_DELAY_MS    60000
+#define RETRY_MAX             6
+#define DATABASE_FILE         "mediascanner.db"
+#define ARTCACHE_DIR          "art"
+#define RECENT_PERIOD         (30 * 86400)  // in seconds
+#define PROGRESS_STEP         64
+#define DRAIN_CHECK_MS        200
 
 using namespace mediascanner;
 
+/**
+ * Return true if the path is the directory or one of its children. The
+ * paths are cleaned, so only the root of the file system ends with a
+ * separator.
+ */
+static bool _is_under(const QString& path, const QString& dirPath)
+{
+  if (!path.startsWith(dirPath))
+    return false;
+  int len = dirPath.length();
+  return (path.length() == len || dirPath.endsWith(QChar('/')) || path.at(len) == QChar('/'));
+}
+
 MediaScannerEngine::MediaScannerEngine(MediaScanner * scanner, QObject* parent)
 : QThread(parent)
 , m_scanner(scanner)
 , m_roots()
 , m_working(false)
 , m_sequence(0)
-, m_nodes()
-, m_items()
-, m_files()
+, m_tree()
+, m_owners()
+, m_aliases()
 , m_fileItemsLock(new QRecursiveMutex())
-, m_watcher()
+, m_watcher(this, &MediaScannerEngine::watcherCallback)
 , m_parsers()
-, m_workerPool()
+, m_workerPool(QUEUE_CAPACITY)
+, m_tuner(&m_workerPool)
+, m_walker(this, &MediaScannerEngine::walkerCallback)
+, m_database()
+, m_metrics()
+, m_artCache()
 , m_todo()
+, m_todoSequence(0)
+, m_deltas()
 , m_condLock(new QMutex())
 , m_cond()
 , m_countValid(0)
+, m_progressLock(new QMutex())
+, m_progress()
+, m_scanRoot()
+, m_scanParsers()
+, m_scanPriority(WorkerPool::PriorityLow)
+, m_scanDevice(-1)
+, m_requested()
+, m_overlaps()
+, m_purgeScopes()
+, m_scannedDirs()
 , m_delayed()
+, m_prefetcher()
 {
-  m_roots.append(QStandardPaths::standardLocations(QStandardPaths::MusicLocation));
-  m_workerPool.setExpiryTimeout(THREAD_EXPIRY_TIMEOUT);
-  m_workerPool.setMaxThreadCount(DEFAULT_MAX_THREAD);
+  for (const QString& path : QStandardPaths::standardLocations(QStandardPaths::MusicLocation))
+    m_roots.append(QDir::cleanPath(path));
+  checkOverlaps();
+  m_database.setFilePath(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+                         .append("/").append(DATABASE_FILE));
+  m_artCache.setRootPath(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+                         .append("/").append(ARTCACHE_DIR));
+  m_workerPool.setMaxThread(DEFAULT_MAX_THREAD);
+  m_tuner.setBounds(MEDIASCANNER_MIN_AUTO_THREAD, MEDIASCANNER_MAX_AUTO_THREAD);
   m_delayed.startProcessing(&m_workerPool);
+  m_prefetcher.startProcessing(&m_workerPool, &m_metrics);
   connect(this, &QThread::started, this, &MediaScannerEngine::onStarted);
 }
 
@@ -65,7 +112,14 @@ MediaScannerEngine::~MediaScannerEngine()
 {
   stop();
   m_delayed.stopProcessing();
-  m_workerPool.clear();
+  m_workerPool.stop();
+  // once the pool is closed, as it could block the prefetcher
+  m_prefetcher.stopProcessing();
+  if (m_database.isDirty())
+    m_database.save();
+  if (m_artCache.isDirty())
+    m_artCache.save();
+  delete m_progressLock;
   delete m_condLock;
   delete m_fileItemsLock;
 }
@@ -105,7 +159,10 @@ QList<MediaParserPtr> MediaScannerEngine::parsers()
 
 void MediaScannerEngine::setMaxThread(int maxThread)
 {
-  m_workerPool.setMaxThreadCount(maxThread);
+  // the tuned size applies from the next scan
+  m_tuner.setEnabled(maxThread <= 0);
+  if (maxThread > 0)
+    m_workerPool.setMaxThread(maxThread);
 }
 
 QList<MediaFilePtr> MediaScannerEngine::allParsedFiles() const
@@ -113,38 +170,43 @@ QList<MediaFilePtr> MediaScannerEngine::allParsedFiles() const
   LockGuard<QRecursiveMutex> g(m_fileItemsLock);
 
   QList<MediaFilePtr> list;
-  for (const MediaFilePtr& file : m_files)
+  for (const MediaFilePtr& file : m_tree.items())
     if (file->isValid)
       list.push_back(file);
   return list;
 }
 
-bool MediaScannerEngine::addRootPath(const QString& dirPath)
+bool MediaScannerEngine::addRootPath(const QString& path)
 {
-  for (const QString& path : m_roots)
+  QString dirPath = QDir::cleanPath(path);
+  for (const QString& root : m_roots)
   {
-    if (path == dirPath)
+    if (root == dirPath)
       return false;
   }
   m_roots.append(dirPath);
+  checkOverlaps();
   if (QThread::isRunning())
-    launchScan(dirPath);
+    launchScan(dirPath, WorkerPool::PriorityNormal);
   return true;
 }
 
-bool MediaScannerEngine::removeRootPath(const QString& dirPath)
+bool MediaScannerEngine::removeRootPath(const QString& path)
 {
+  QString dirPath = QDir::cleanPath(path);
   for(QStringList::iterator it = m_roots.begin(); it != m_roots.end(); ++it)
   {
     if (dirPath != *it)
       continue;
     m_roots.erase(it);
-    QList<FileMap::iterator> cleaned;
-    m_fileItemsLock->lock(); //is recursive
-    cleanNode(dirPath, true, cleaned);
-    for (FileMap::iterator it : cleaned)
-      m_files.erase(it);
-    m_fileItemsLock->unlock();
+    checkOverlaps();
+    m_progressLock->lock();
+    m_progress.remove(dirPath);
+    m_progressLock->unlock();
+    LockGuard<QRecursiveMutex> g(m_fileItemsLock);
+    DirectoryTree::Node * node = m_tree.find(dirPath);
+    if (node)
+      removeNode(node);
     return true;
   }
   return false;
@@ -155,12 +217,19 @@ void MediaScannerEngine::clearRoots()
   m_fileItemsLock->lock(); //is recursive
   for (const QString& path : m_roots)
   {
-    QList<FileMap::iterator> cleaned;
-    cleanNode(path, true, cleaned);
+    DirectoryTree::Node * node = m_tree.find(path);
+    if (node)
+      removeNode(node);
   }
-  m_files.clear();
+  m_tree.clear();
+  m_owners.clear();
+  m_aliases.clear();
   m_roots.clear();
   m_fileItemsLock->unlock();
+  m_progressLock->lock();
+  m_progress.clear();
+  m_overlaps.clear();
+  m_progressLock->unlock();
 }
 
 
@@ -169,6 +238,10 @@ void MediaScannerEngine::stop()
   if (QThread::isRunning())
   {
     QThread::requestInterruption();
+    m_walker.interrupt();
+    // release the producers blocked by a full queue
+    m_prefetcher.close();
+    m_workerPool.close();
     // wake the thread
     m_condLock->lock();
     m_cond.wakeOne();
@@ -180,92 +253,282 @@ void MediaScannerEngine::stop()
 
 void MediaScannerEngine::onStarted()
 {
+  // the full scan is background work
   for (QString root : m_roots)
-    launchScan(root);
-}
-
-void MediaScannerEngine::onFileChanged(const QString& filePath)
-{
-  QFile f(filePath);
-  if (f.exists() && f.size() > FILE_MIN_SIZE)
-  {
-    LockGuard<QRecursiveMutex> g(m_fileItemsLock);
-
-    NodeMap::iterator it = m_items.find(filePath);
-    if (it != m_items.end())
-      scheduleExtractor(it.value(), false);
-    m_watcher.removePath(filePath);
-  }
-}
-
-void MediaScannerEngine::onDirectoryChanged(const QString& dirPath)
-{
-  launchScan(dirPath);
+    launchScan(root, WorkerPool::PriorityLow);
 }
 
 void MediaScannerEngine::run()
 {
   qInfo("scanner engine started");
 
-  connect(&m_watcher, &QFileSystemWatcher::directoryChanged, this, &MediaScannerEngine::onDirectoryChanged);
-  connect(&m_watcher, &QFileSystemWatcher::fileChanged, this, &MediaScannerEngine::onFileChanged);
+  m_watcher.start();
+  if (m_scanner->isDebug())
+    qDebug("Watching with %s backend", m_watcher.isNative() ? "native" : "portable");
+
+  m_database.load();
+  m_artCache.load();
+  m_workerPool.open();
+  m_prefetcher.open();
 
+  bool purgeArt = false;
   m_condLock->lock();
   while (!isInterruptionRequested())
   {
-    if (m_todo.isEmpty()) // it could be filled before first loop
-      m_cond.wait(m_condLock);
+    if (m_todo.isEmpty() && m_deltas.isEmpty()) // it could be filled before first loop
+    {
+      // while working, check on interval for the end of the extraction
+      if (m_working)
+        m_cond.wait(m_condLock, DRAIN_CHECK_MS);
+      else
+        m_cond.wait(m_condLock);
+    }
+
+    if (!isInterruptionRequested() && !m_deltas.isEmpty())
+    {
+      FileSystemWatcher::DeltaList deltas;
+      deltas.swap(m_deltas);
+      m_condLock->unlock();
+      processDeltas(deltas, parsers());
+      m_condLock->lock();
+    }
 
     if (!isInterruptionRequested() && !m_todo.isEmpty())
     {
       QList<MediaParserPtr> parserList = parsers();
-      // signal start working
-      m_working = true;
-      m_scanner->workingChanged();
+      // signal start working, unless the files of a previous walk are
+      // still extracted
+      if (!m_working)
+      {
+        m_metrics.scanStarted();
+        m_workerPool.setRunning(true);
+        m_working = true;
+        m_scanner->workingChanged();
+      }
       do
       {
-        QString path = m_todo.dequeue();
+        std::pop_heap(m_todo.begin(), m_todo.end(), std::greater<ScanEntry>());
+        ScanEntry entry = m_todo.back();
+        m_todo.pop_back();
         m_condLock->unlock();
-        scanDir(path, parserList);
+        scanDir(entry.path, entry.priority, parserList);
         m_condLock->lock();
       }
       while (!isInterruptionRequested() && !m_todo.isEmpty());
+      // all pending nodes have been scanned, so entries not seen are stale
+      if (!isInterruptionRequested())
+      {
+        m_condLock->unlock();
+        m_progressLock->lock();
+        QStringList scopes;
+        QSet<QString> scannedDirs;
+        scopes.swap(m_purgeScopes);
+        scannedDirs.swap(m_scannedDirs);
+        m_progressLock->unlock();
+        m_database.purge(scopes, scannedDirs);
+        if (m_database.isDirty())
+          m_database.save();
+        // release the tags of the vanished files
+        int released = StringPool::instance().purge();
+        if (m_scanner->isDebug())
+          qDebug("Interned tags: %d, released: %d", StringPool::instance().count(), released);
+        // the art is purged once the extractors have stored theirs
+        purgeArt = true;
+        m_condLock->lock();
+      }
+    }
+
+    // the work is done when the walks and the extraction are drained
+    if (m_working && !isInterruptionRequested() && m_todo.isEmpty() && m_deltas.isEmpty() && isDrained())
+    {
+      if (purgeArt)
+      {
+        purgeArt = false;
+        m_condLock->unlock();
+        int images = m_artCache.purge(m_database);
+        if (m_artCache.isDirty())
+          m_artCache.save();
+        if (m_database.isDirty())
+          m_database.save();
+        if (m_scanner->isDebug())
+          qDebug("Art cache files removed: %d", images);
+        m_condLock->lock();
+      }
       // signal stop working
+      m_metrics.scanFinished();
+      m_workerPool.setRunning(false);
       m_working = false;
       m_scanner->workingChanged();
     }
   }
+  if (m_working)
+  {
+    m_metrics.scanFinished();
+    m_workerPool.setRunning(false);
+    m_working = false;
+    m_scanner->workingChanged();
+  }
   m_condLock->unlock();
 
-  disconnect(&m_watcher, &QFileSystemWatcher::fileChanged, this, &MediaScannerEngine::onFileChanged);
-  disconnect(&m_watcher, &QFileSystemWatcher::directoryChanged, this, &MediaScannerEngine::onDirectoryChanged);
+  m_watcher.stop();
 
   // purge
   m_fileItemsLock->lock();
-  m_items.clear();
+  m_tree.clear();
+  m_owners.clear();
+  m_aliases.clear();
   m_fileItemsLock->unlock();
 
+  // flush the pending updates
+  if (m_database.isDirty())
+    m_database.save();
+  if (m_artCache.isDirty())
+    m_artCache.save();
+
   qInfo("scanner engine stopped");
 }
 
-void MediaScannerEngine::launchScan(const QString& dirPath)
+void MediaScannerEngine::launchScan(const QString& dirPath, WorkerPool::Priority priority)
 {
-  m_condLock->lock();
-  m_todo.enqueue(dirPath);
+  LockGuard<QMutex> g(m_condLock);
+  for (ScanEntry& entry : m_todo)
+  {
+    if (entry.path != dirPath)
+      continue;
+    // already pending: raise its priority when needed
+    if (priority < entry.priority)
+    {
+      entry.priority = priority;
+      std::make_heap(m_todo.begin(), m_todo.end(), std::greater<ScanEntry>());
+    }
+    return;
+  }
+  ScanEntry entry;
+  entry.priority = priority;
+  entry.sequence = m_todoSequence++;
+  entry.path = dirPath;
+  m_todo.push_back(entry);
+  std::push_heap(m_todo.begin(), m_todo.end(), std::greater<ScanEntry>());
   m_cond.wakeOne();
-  m_condLock->unlock();
 }
 
-void MediaScannerEngine::scanDir(const QString &dirPath, const QList<MediaParserPtr>& parsers, bool deepScan /*= false*/)
+bool MediaScannerEngine::prioritize(const QString& path)
+{
+  QFileInfo info(path);
+  QString dirPath = (info.isDir() ? info.absoluteFilePath() : info.absolutePath());
+  bool rooted = false;
+  {
+    LockGuard<QRecursiveMutex> g(m_fileItemsLock);
+    for (const QString& root : m_roots)
+    {
+      if (_is_under(dirPath, root))
+      {
+        rooted = true;
+        break;
+      }
+    }
+  }
+  if (!rooted)
+    return false;
+  if (m_scanner->isDebug())
+    qDebug("Prioritize %s", dirPath.toUtf8().constData());
+  {
+    LockGuard<QMutex> g(m_progressLock);
+    if (!m_requested.contains(dirPath))
+      m_requested.push_back(dirPath);
+  }
+  // jump the queue of the running walk, else scan it next
+  if (!m_walker.prioritize(dirPath))
+    launchScan(dirPath, WorkerPool::PriorityHigh);
+  return true;
+}
+
+/**
+ * Scan the given node, then walk concurrently the new sub-nodes found.
+ * @param dirPath
+ * @param parsers
+ */
+void MediaScannerEngine::scanDir(const QString& dirPath, WorkerPool::Priority priority, const QList<MediaParserPtr>& parsers)
+{
+  QElapsedTimer timer;
+  timer.start();
+  QString root = rootOf(dirPath);
+  ScanProgress before = { 0, 0, false };
+  m_progressLock->lock();
+  m_scanParsers = parsers;
+  m_scanPriority = priority;
+  m_scanRoot = root;
+  // the progress is kept by root: a rescan below a root adds to its counts
+  if (!root.isEmpty())
+  {
+    ScanProgress& progress = m_progress[root];
+    if (root == dirPath)
+    {
+      progress.directories = progress.files = 0;
+      progress.done = false;
+    }
+    before = progress;
+  }
+  // an unmounted storage leaves an empty or unreadable mount point, then
+  // its entries are kept
+  QFileInfo dirInfo(dirPath);
+  if (dirInfo.isDir() && dirInfo.isReadable() && !QDir(dirPath).isEmpty())
+    m_purgeScopes.push_back(dirPath);
+  m_progressLock->unlock();
+  // size the pool for the storage of the root
+  m_scanDevice.store(m_tuner.select(dirPath));
+  // the walk lists the same storage, so it follows the size of the pool
+  m_walker.setMaxThread(m_workerPool.maxThread());
+
+  QStringList subDirs;
+  scanNode(dirPath, parsers, subDirs);
+  if (!subDirs.isEmpty() && !isInterruptionRequested())
+    m_walker.walk(subDirs);
+
+  m_progressLock->lock();
+  ScanProgress after = before;
+  QMap<QString, ScanProgress>::iterator it = m_progress.find(root);
+  if (it != m_progress.end())
+  {
+    if (root == dirPath)
+      it.value().done = !isInterruptionRequested();
+    after = it.value();
+  }
+  m_scanRoot.clear();
+  m_scanDevice.store(-1);
+  // the requested paths have been visited by the walk
+  m_requested.clear();
+  if (m_scanner->isDebug())
+    qDebug("Scanned %s: %d directories, %d files in %lld ms", dirPath.toUtf8().constData(),
+           after.directories - before.directories, after.files - before.files, (long long)timer.elapsed());
+  m_progressLock->unlock();
+  emit m_scanner->progressChanged();
+}
+
+/**
+ * Scan the content of one node. Files and sub-nodes are pinned or created,
+ * and the unpinned items are cleaned. It can run concurrently for distinct
+ * nodes, as the bookkeeping is done under the lock of file items.
+ * @param dirPath
+ * @param parsers
+ * @param subDirs the new sub-nodes to scan
+ */
+void MediaScannerEngine::scanNode(const QString& dirPath, const QList<MediaParserPtr>& parsers, QStringList& subDirs)
 {
   if (m_scanner->isDebug())
-    qDebug("Watch node %s, deepScan=%s", dirPath.toUtf8().constData(), (deepScan ? "true" : "false"));
-  m_watcher.addPath(dirPath);
-  resetNode(dirPath);
-  QDirIterator::IteratorFlags flags = QDirIterator::NoIteratorFlags;
-  if (deepScan)
-    flags |= QDirIterator::Subdirectories;
-  QDirIterator di(QDir(dirPath), flags);
+    qDebug("Watch node %s", dirPath.toUtf8().constData());
+  {
+    LockGuard<QRecursiveMutex> g(m_fileItemsLock);
+    DirectoryTree::Node * node = nodeOf(dirPath);
+    if (!node)
+      return; // out of the roots
+    m_tree.reset(node);
+  }
+  m_watcher.addDirectory(dirPath);
+  WorkerPool::Priority priority = nodePriority(dirPath);
+  QMultiMap<qint64, QString> newDirs;
+  int fileCount = 0;
+  QDirIterator di(QDir(dirPath), QDirIterator::NoIteratorFlags);
   while (di.hasNext() && !isInterruptionRequested())
   {
     QString o = di.next();
@@ -281,159 +544,638 @@ void MediaScannerEngine::scanDir(const QString &dirPath, const QList<MediaParser
         MediaParserPtr p = matchParser(parsers, info);
         if (p)
         {
-          LockGuard<QRecursiveMutex> g(m_fileItemsLock);
-
-          NodeMap::iterator itf = m_items.find(info.absoluteFilePath());
-          if (itf == m_items.end())
+          MediaFilePtr mf;
+          ++fileCount;
           {
-            // create the file item
-            MediaFilePtr mf(new MediaFile(++m_sequence));
-            mf->isPinned = true;
-            mf->isDirectory = false;
-            mf->filePath = info.absoluteFilePath();
-            mf->baseName = info.baseName();
-            mf->suffix = info.suffix();
-            mf->path = info.absolutePath();
-            mf->size = info.size();
-            mf->lastModified = info.lastModified();
-            mf->parser = p;
-            if (m_scanner->isDebug())
-              qDebug("Add item %s (%s)", info.absoluteFilePath().toUtf8().constData(), p->commonName());
-            m_items.insert(info.absoluteFilePath(), mf);
-            m_files.insert(info.absolutePath(), mf);
-            if (mf->size > FILE_MIN_SIZE)
-              scheduleExtractor(mf);
+            LockGuard<QRecursiveMutex> g(m_fileItemsLock);
+
+            MediaFilePtr item = m_tree.findItem(info.absoluteFilePath());
+            if (item)
+            {
+              item->isPinned = true;
+              // the entry is still valid, as the item is known
+              m_database.touch(info.absoluteFilePath());
+            }
             else
-              m_watcher.addPath(mf->filePath);
-          }
-          else
-          {
-            itf.value()->isPinned = true;
+            {
+              // the node could have been removed meanwhile
+              DirectoryTree::Node * node = m_tree.find(dirPath);
+              if (node)
+                mf = createItem(info, p, node);
+            }
           }
+          // schedule outside the lock as it could wait for a free worker
+          if (mf)
+            scheduleExtractor(mf, (priority != WorkerPool::PriorityHigh), priority);
         }
       }
       else if (info.isDir())
       {
-        NodeMap::iterator itn = m_nodes.find(info.absoluteFilePath());
-        if (itn == m_nodes.end())
+        // a link to an ancestor would be walked endlessly
+        if (info.isSymLink())
         {
+          QString target = info.canonicalFilePath();
+          QString current = QFileInfo(dirPath).canonicalFilePath();
+          if (_is_under(current, target))
+            continue;
+        }
+        LockGuard<QRecursiveMutex> g(m_fileItemsLock);
+
+        DirectoryTree::Node * child = m_tree.find(info.absoluteFilePath());
+        if (!child)
+        {
+          DirectoryTree::Node * node = m_tree.find(dirPath);
+          if (!node)
+            continue;
           // create the file node
           MediaFilePtr md(new MediaFile(++m_sequence));
           md->isPinned = true;
           md->isDirectory = true;
-          md->filePath = info.absoluteFilePath();
-          md->path = info.absolutePath();
-          md->lastModified = info.lastModified();
-          m_nodes.insert(info.absoluteFilePath(), md);
-
-          m_fileItemsLock->lock();
-          m_files.insert(info.absolutePath(), md);
-          if (deepScan)
-          {
-            m_watcher.addPath(info.absoluteFilePath());
-            m_fileItemsLock->unlock();
-          }
-          else
-          {
-            m_fileItemsLock->unlock();
-            scanDir(info.absoluteFilePath(), parsers, true);
-          }
-
+          md->setFileInfo(info);
+          m_tree.addChild(node, md, info.absoluteFilePath());
+          newDirs.insert(info.lastModified().toSecsSinceEpoch(), info.absoluteFilePath());
         }
         else
         {
-          itn.value()->isPinned = true;
-          resetNode(info.absoluteFilePath());
+          child->record->isPinned = true;
+          // a node created out of the walk has still to be scanned
+          if (!child->scanned)
+            newDirs.insert(info.lastModified().toSecsSinceEpoch(), info.absoluteFilePath());
         }
       }
     }
   }
+  // the walker pops the last first, so the most recently modified
+  subDirs.append(newDirs.values());
+  if (!isInterruptionRequested() && QFileInfo(dirPath).isReadable())
+  {
+    // the missing files of a listed directory are stale in the database
+    m_progressLock->lock();
+    m_scannedDirs.insert(dirPath);
+    m_progressLock->unlock();
+  }
+
   // clean unpinned files
-  QList<FileMap::iterator> cleaned;
-  cleanNode(dirPath, false, cleaned);
-  m_fileItemsLock->lock();
-  for (FileMap::iterator it : cleaned)
-    m_files.erase(it);
-  m_fileItemsLock->unlock();
+  if (!isInterruptionRequested())
+  {
+    LockGuard<QRecursiveMutex> g(m_fileItemsLock);
+    DirectoryTree::Node * node = m_tree.find(dirPath);
+    if (node)
+    {
+      cleanNode(node, false);
+      node->scanned = true;
+    }
+  }
+
+  m_progressLock->lock();
+  bool notify = false;
+  QMap<QString, ScanProgress>::iterator it = m_progress.find(m_scanRoot);
+  if (it != m_progress.end())
+  {
+    it.value().directories += 1;
+    it.value().files += fileCount;
+    notify = ((it.value().directories % PROGRESS_STEP) == 0);
+  }
+  m_progressLock->unlock();
+  m_metrics.addDirectory(fileCount);
+  if (notify)
+    emit m_scanner->progressChanged();
+}
+
+void MediaScannerEngine::walkerCallback(void * handle, const QString& dirPath, QStringList& subDirs)
+{
+  MediaScannerEngine * engine = static_cast<MediaScannerEngine*>(handle);
+  if (!engine)
+    return;
+  engine->m_progressLock->lock();
+  QList<MediaParserPtr> parsers = engine->m_scanParsers;
+  engine->m_progressLock->unlock();
+  engine->scanNode(dirPath, parsers, subDirs);
+}
+
+QVariantMap MediaScannerEngine::progress() const
+{
+  LockGuard<QMutex> g(m_progressLock);
+  QVariantMap map;
+  for (QMap<QString, ScanProgress>::const_iterator it = m_progress.constBegin(); it != m_progress.constEnd(); ++it)
+  {
+    QVariantMap item;
+    item["directories"] = it.value().directories;
+    item["files"] = it.value().files;
+    item["pending"] = (it.key() == m_scanRoot ? m_walker.pending() : 0);
+    item["done"] = it.value().done;
+    map[it.key()] = item;
+  }
+  return map;
+}
+
+QVariantMap MediaScannerEngine::queueStats() const
+{
+  WorkerPool::Stats stats = m_workerPool.stats();
+  QVariantMap map;
+  map["depth"] = stats.depth;
+  map["prefetching"] = m_prefetcher.pending();
+  map["maxDepth"] = stats.maxDepth;
+  map["threads"] = stats.threads;
+  map["busy"] = stats.busy;
+  map["enqueued"] = stats.enqueued;
+  map["completed"] = stats.completed;
+  map["enqueueWaits"] = stats.enqueueWaits;
+  map["enqueueWaitMs"] = stats.enqueueWaitUs / 1000;
+  map["busyMs"] = stats.busyUs / 1000;
+  map["idleMs"] = stats.idleUs / 1000;
+  qint64 total = stats.busyUs + stats.idleUs;
+  map["utilisation"] = (total > 0 ? double(stats.busyUs) / double(total) : 0.0);
+  return map;
+}
+
+QVariantMap MediaScannerEngine::metrics() const
+{
+  QVariantMap map = m_metrics.toVariantMap();
+  map["queue"] = queueStats();
+  map["concurrency"] = m_tuner.toVariantMap();
+  m_progressLock->lock();
+  map["overlappingRoots"] = m_overlaps;
+  m_progressLock->unlock();
+  return map;
+}
+
+QString MediaScannerEngine::artPath(const QString& filePath, int size) const
+{
+  if (!m_artCache.isEnabled())
+    return QString();
+  return m_artCache.lookup(filePath, size);
+}
+
+QString MediaScannerEngine::metricsSummary() const
+{
+  WorkerPool::Stats stats = m_workerPool.stats();
+  qint64 total = stats.busyUs + stats.idleUs;
+  QString str = m_metrics.toString()
+      .append(QString(" queue=%1/%2 busy=%3% wait=%4ms")
+              .arg(stats.depth)
+              .arg(stats.maxDepth)
+              .arg(total > 0 ? (100 * stats.busyUs) / total : 0)
+              .arg(stats.enqueueWaitUs / 1000));
+  QString tuning = m_tuner.toString();
+  if (!tuning.isEmpty())
+    str.append(" ").append(tuning);
+  return str;
 }
 
 /**
- * Unpin the subitems of the given node. That clean the state before a new scan,
- * or that set all subitems for delete.
- * @param nodeName
+ * Return the node of a directory under the roots. The node of a root is
+ * created on its first scan, and the missing parents of a path requested
+ * out of the walk are created on the way, to be scanned later.
+ * The lock of file items MUST be held by the caller.
+ * @param dirPath
+ * @return the node, else null if the path is out of the roots
  */
-void MediaScannerEngine::resetNode(const QString& nodeName)
+DirectoryTree::Node * MediaScannerEngine::nodeOf(const QString& dirPath)
 {
-  QPair<FileMap::iterator, FileMap::iterator> pair = m_files.equal_range(nodeName);
-  FileMap::iterator it = pair.first;
-  while (it != pair.second)
+  DirectoryTree::Node * node = m_tree.find(dirPath);
+  if (node)
+    return node;
+  if (m_roots.contains(dirPath))
+    return m_tree.addRoot(dirPath);
+  int pos = dirPath.lastIndexOf(QChar('/'));
+  if (pos <= 0)
+    return nullptr;
+  DirectoryTree::Node * parent = nodeOf(dirPath.left(pos));
+  QFileInfo info(dirPath);
+  if (!parent || !info.isDir())
+    return nullptr;
+  MediaFilePtr md(new MediaFile(++m_sequence));
+  md->isPinned = true;
+  md->isDirectory = true;
+  md->setFileInfo(info);
+  return m_tree.addChild(parent, md, dirPath);
+}
+
+/**
+ * Return the root containing a directory, the nearest one when the roots
+ * are nested.
+ * @param dirPath
+ * @return the root, else an empty string if the path is out of the roots
+ */
+QString MediaScannerEngine::rootOf(const QString& dirPath) const
+{
+  LockGuard<QRecursiveMutex> g(m_fileItemsLock);
+  QString found;
+  for (const QString& root : m_roots)
   {
-    it.value()->isPinned = false;
-    ++it;
+    if (_is_under(dirPath, root) && root.length() > found.length())
+      found = root;
   }
+  return found;
 }
 
 /**
- * Erase subitems from a node
- * @param nodeName
+ * Return true when no extraction is queued or running. A running job could
+ * queue its retry before it is released, so the delayed jobs are checked
+ * again after the pool.
+ */
+bool MediaScannerEngine::isDrained() const
+{
+  if (m_prefetcher.pending() > 0 || m_delayed.pending() > 0)
+    return false;
+  WorkerPool::Stats stats = m_workerPool.stats();
+  return (stats.depth == 0 && stats.busy == 0 && m_delayed.pending() == 0);
+}
+
+/**
+ * Erase the subitems of a node
+ * @param node
  * @param evenPinned true to erase all, else false to erase unpinned only
- * @param cleaned the list to callback all erased
  */
-void MediaScannerEngine::cleanNode(const QString& nodeName, bool evenPinned, QList<FileMap::iterator>& cleaned)
+void MediaScannerEngine::cleanNode(DirectoryTree::Node * node, bool evenPinned)
 {
   if (m_scanner->isDebug())
-    qDebug("Clean node %s", nodeName.toUtf8().constData());
+    qDebug("Clean node %s", node->path.toUtf8().constData());
 
   LockGuard<QRecursiveMutex> g(m_fileItemsLock);
+  QList<MediaFilePtr> files;
+  QStringList dirs;
+  m_tree.clean(node, evenPinned, files, dirs);
+  releaseNodes(files, dirs);
+}
 
-  QPair<FileMap::iterator, FileMap::iterator> pair = m_files.equal_range(nodeName);
-  FileMap::iterator it = pair.first;
-  while (it != pair.second)
+/**
+ * Erase a node and its subitems
+ * @param node
+ */
+void MediaScannerEngine::removeNode(DirectoryTree::Node * node)
+{
+  LockGuard<QRecursiveMutex> g(m_fileItemsLock);
+  QList<MediaFilePtr> files;
+  QStringList dirs;
+  m_tree.remove(node, files, dirs);
+  releaseNodes(files, dirs);
+}
+
+void MediaScannerEngine::releaseNodes(const QList<MediaFilePtr>& files, const QStringList& dirs)
+{
+  for (const QString& dirPath : dirs)
   {
-    if (evenPinned || !it.value()->isPinned)
+    m_watcher.removeDirectory(dirPath);
+    if (m_scanner->isDebug())
+      qDebug("Remove node %s", dirPath.toUtf8().constData());
+  }
+  for (const MediaFilePtr& file : files)
+    releaseItem(file);
+}
+
+bool MediaScannerEngine::isKnownNode(const QString& nodeName)
+{
+  LockGuard<QRecursiveMutex> g(m_fileItemsLock);
+  return (m_tree.find(nodeName) || m_roots.contains(nodeName));
+}
+
+/**
+ * Return the priority to extract the files of a node. The files of the
+ * requested paths come first, then the recently modified directories are
+ * raised above the background scan, as they are likely the new albums.
+ * @param dirPath
+ * @return the priority
+ */
+WorkerPool::Priority MediaScannerEngine::nodePriority(const QString& dirPath)
+{
+  WorkerPool::Priority priority;
+  {
+    LockGuard<QMutex> g(m_progressLock);
+    for (const QString& path : m_requested)
     {
-      cleaned.push_back(it);
-      if (it.value()->isDirectory)
-      {
-        m_watcher.removePath(it.value()->filePath);
-        if (m_scanner->isDebug())
-          qDebug("Remove node %s", it.value()->filePath.toUtf8().constData());
-        cleanNode(it.value()->filePath, true, cleaned);
-        m_nodes.remove(it.value()->filePath);
-      }
-      else
+      if (_is_under(dirPath, path))
+        return WorkerPool::PriorityHigh;
+    }
+    priority = m_scanPriority;
+  }
+  if (priority == WorkerPool::PriorityLow &&
+          QFileInfo(dirPath).lastModified().toSecsSinceEpoch() > QDateTime::currentSecsSinceEpoch() - RECENT_PERIOD)
+    return WorkerPool::PriorityNormal;
+  return priority;
+}
+
+/**
+ * Create the item for a new file in a scanned node. The item is published
+ * at once when the database holds its info, else it has to be extracted.
+ * The lock of file items MUST be held by the caller.
+ * @param fileInfo
+ * @param parser
+ * @param node the node of the parent directory
+ * @return the item to schedule for extraction, else null
+ */
+MediaFilePtr MediaScannerEngine::createItem(const QFileInfo& fileInfo, const MediaParserPtr& parser, DirectoryTree::Node * node)
+{
+  MediaFilePtr mf(new MediaFile(++m_sequence));
+  mf->isPinned = true;
+  mf->isDirectory = false;
+  mf->setFileInfo(fileInfo);
+  mf->parser = parser;
+  if (m_scanner->isDebug())
+    qDebug("Add item %s (%s)", fileInfo.absoluteFilePath().toUtf8().constData(), parser->commonName());
+  m_tree.addItem(node, mf, fileInfo.absoluteFilePath());
+  // a file reached through another path is held by its first item
+  mf->readIdentity(fileInfo.absoluteFilePath());
+  if (!bindIdentity(mf))
+    return MediaFilePtr();
+  // bypass the parsing of unchanged file, unless its art is missing
+  if (m_database.find(*mf, mf->mediaInfo) &&
+      !(m_artCache.isEnabled() && mf->mediaInfo->hasArt && !m_artCache.find(*mf)))
+  {
+    m_metrics.addCached();
+    mf->isValid = true;
+    publishFile(mf);
+  }
+  else if (mf->size > FILE_MIN_SIZE)
+    return mf;
+  else
+    m_watcher.addFile(fileInfo.absoluteFilePath());
+  return MediaFilePtr();
+}
+
+/**
+ * Refresh the item of a file which has been created or rewritten. A new
+ * file is added only when its node is already known.
+ * @param filePath
+ * @param parsers
+ */
+void MediaScannerEngine::updateItem(const QString& filePath, const QList<MediaParserPtr>& parsers)
+{
+  QFileInfo info(filePath);
+  if (!info.isFile() || info.isHidden() || !info.isReadable())
+    return;
+  MediaParserPtr p = matchParser(parsers, info);
+  if (!p)
+    return;
+
+  MediaFilePtr created;
+  {
+    LockGuard<QRecursiveMutex> g(m_fileItemsLock);
+
+    MediaFilePtr mf = m_tree.findItem(info.absoluteFilePath());
+    if (mf)
+    {
+      if ((mf->isValid || mf->isDuplicate) && mf->size == info.size() && mf->mtime == info.lastModified().toSecsSinceEpoch())
+        return; // unchanged
+      if (m_scanner->isDebug())
+        qDebug("Update item %s", filePath.toUtf8().constData());
+      // a published record is never changed: the models could still read it,
+      // and its removal is delivered later. So it is retired for a new one.
+      m_tree.removeItem(info.absoluteFilePath());
+      releaseItem(mf);
+    }
+    else if (!isKnownNode(info.absolutePath()))
+      return;
+    DirectoryTree::Node * node = nodeOf(info.absolutePath());
+    created = (node ? createItem(info, p, node) : MediaFilePtr());
+    if (created)
+      m_watcher.removeFile(filePath);
+  }
+  // schedule outside the lock as it could wait for a free worker
+  if (created)
+    scheduleExtractor(created);
+}
+
+/**
+ * Erase the item of a removed file, and detach it from its node.
+ * @param filePath
+ */
+void MediaScannerEngine::removeItem(const QString& filePath)
+{
+  LockGuard<QRecursiveMutex> g(m_fileItemsLock);
+
+  MediaFilePtr mf = m_tree.removeItem(filePath);
+  if (!mf)
+    return;
+  m_watcher.removeFile(filePath);
+  releaseItem(mf);
+}
+
+/**
+ * Withdraw an erased item from the database and the registered models.
+ * @param filePtr
+ */
+void MediaScannerEngine::releaseItem(const MediaFilePtr& filePtr)
+{
+  QString filePath = filePtr->filePath();
+  if (m_scanner->isDebug())
+    qDebug("Remove item %s", filePath.toUtf8().constData());
+  bool duplicate = filePtr->isDuplicate;
+  releaseIdentity(filePtr);
+  // an alias has never been published
+  if (duplicate)
+    return;
+  m_database.remove(filePath);
+  m_scanner->remove(filePtr);
+  // check empty state
+  if (filePtr->signaled)
+  {
+    if (1 == m_countValid--)
+      emit m_scanner->emptyStateChanged();
+    filePtr->signaled = false;
+  }
+}
+
+/**
+ * Register the identity of an item. The first item of a physical file holds
+ * it, and the next ones are kept as aliases, neither parsed nor published.
+ * The lock of file items MUST be held by the caller.
+ * @param filePtr
+ * @return false if the item is an alias
+ */
+bool MediaScannerEngine::bindIdentity(const MediaFilePtr& filePtr)
+{
+  filePtr->isDuplicate = false;
+  if (!filePtr->hasIdentity())
+    return true;
+  FileIdentity id = filePtr->identity();
+  QHash<FileIdentity, MediaFilePtr>::const_iterator it = m_owners.constFind(id);
+  if (it == m_owners.constEnd())
+  {
+    m_owners.insert(id, filePtr);
+    return true;
+  }
+  if (it.value() == filePtr)
+    return true;
+  if (m_scanner->isDebug())
+    qDebug("Alias item %s of %s", filePtr->filePath().toUtf8().constData(),
+           it.value()->filePath().toUtf8().constData());
+  filePtr->isDuplicate = true;
+  m_aliases.insert(id, filePtr);
+  m_metrics.addDuplicate();
+  return false;
+}
+
+/**
+ * Unregister the identity of an item. When the holder goes, an alias takes
+ * over the file, with the info already parsed if any.
+ * The lock of file items MUST be held by the caller.
+ * @param filePtr
+ */
+void MediaScannerEngine::releaseIdentity(const MediaFilePtr& filePtr)
+{
+  if (!filePtr->hasIdentity())
+    return;
+  FileIdentity id = filePtr->identity();
+  if (filePtr->isDuplicate)
+  {
+    m_aliases.remove(id, filePtr);
+    filePtr->isDuplicate = false;
+    return;
+  }
+  QHash<FileIdentity, MediaFilePtr>::iterator it = m_owners.find(id);
+  if (it == m_owners.end() || it.value() != filePtr)
+    return;
+  m_owners.erase(it);
+  // hand over the file to an alias still reaching it
+  QMultiHash<FileIdentity, MediaFilePtr>::iterator ai;
+  while ((ai = m_aliases.find(id)) != m_aliases.end())
+  {
+    MediaFilePtr alias = ai.value();
+    m_aliases.erase(ai);
+    QFileInfo info(alias->filePath());
+    if (!info.exists())
+      continue; // its removal is pending
+    // the file could have been rewritten meanwhile
+    alias->size = info.size();
+    alias->mtime = info.lastModified().toSecsSinceEpoch();
+    alias->readIdentity(info.absoluteFilePath());
+    if (!bindIdentity(alias))
+      continue;
+    if (m_scanner->isDebug())
+      qDebug("Promote item %s", alias->filePath().toUtf8().constData());
+    if (filePtr->isValid && alias->identity() == id)
+    {
+      alias->mediaInfo = filePtr->mediaInfo;
+      alias->isValid = true;
+      m_database.update(*alias);
+      publishFile(alias);
+    }
+    else if (alias->size > FILE_MIN_SIZE)
+      scheduleExtractor(alias, false);
+    break;
+  }
+}
+
+/**
+ * Find the roots reaching the same directories, through links, bind mounts
+ * or nesting. Their files are held once, as the items are bound to the
+ * identity of the physical files.
+ */
+void MediaScannerEngine::checkOverlaps()
+{
+  struct Root
+  {
+    QString path;
+    QString canonical;
+    quint64 device;
+    quint64 inode;
+  };
+  QVector<Root> roots;
+  for (const QString& path : m_roots)
+  {
+    Root root;
+    root.path = path;
+    root.canonical = QFileInfo(path).canonicalFilePath();
+    if (!MediaFile::statIdentity(path, root.device, root.inode))
+      root.device = root.inode = 0;
+    roots.push_back(root);
+  }
+  QStringList overlaps;
+  for (int i = 0; i < roots.size(); ++i)
+  {
+    for (int j = 0; j < roots.size(); ++j)
+    {
+      const Root& a = roots[i];
+      const Root& b = roots[j];
+      if (i == j || a.canonical.isEmpty() || b.canonical.isEmpty())
+        continue;
+      if (a.canonical == b.canonical || (a.inode != 0 && a.inode == b.inode && a.device == b.device))
       {
-        if (m_scanner->isDebug())
-          qDebug("Remove item %s", it.value()->filePath.toUtf8().constData());
-        m_items.remove(it.value()->filePath);
-        m_scanner->remove(it.value());
-        // check empty state
-        if (it.value()->signaled)
-        {
-          if (1 == m_countValid--)
-            emit m_scanner->emptyStateChanged();
-          it.value()->signaled = false;
-        }
+        if (i < j)
+          overlaps.push_back(QString("%1 = %2").arg(a.path, b.path));
       }
+      else if (a.canonical.startsWith(b.canonical) &&
+               (b.canonical.endsWith(QChar('/')) || a.canonical.at(b.canonical.length()) == QChar('/')))
+        overlaps.push_back(QString("%1 < %2").arg(a.path, b.path));
     }
-    ++it;
   }
+  for (const QString& overlap : overlaps)
+    qInfo("Overlapping roots: %s", overlap.toUtf8().constData());
+  LockGuard<QMutex> g(m_progressLock);
+  m_overlaps.swap(overlaps);
 }
 
-void MediaScannerEngine::scheduleExtractor(MediaFilePtr filePtr, bool wait /*= true*/)
+void MediaScannerEngine::watcherCallback(void * handle, const FileSystemWatcher::DeltaList& deltas)
 {
-  MediaExtractor * job = new MediaExtractor(this, &MediaScannerEngine::mediaExtractorCallback, filePtr, m_scanner->isDebug());
-  if (wait)
+  MediaScannerEngine * engine = static_cast<MediaScannerEngine*>(handle);
+  if (!engine)
+    return;
+  engine->m_condLock->lock();
+  engine->m_deltas.append(deltas);
+  engine->m_cond.wakeOne();
+  engine->m_condLock->unlock();
+}
+
+/**
+ * Apply the changes reported by the watcher. Files are processed one by
+ * one, whereas a change of sub-directory requires to rescan its parent.
+ * @param deltas
+ * @param parsers
+ */
+void MediaScannerEngine::processDeltas(const FileSystemWatcher::DeltaList& deltas, const QList<MediaParserPtr>& parsers)
+{
+  QSet<QString> rescans;
+  for (const FileSystemWatcher::Delta& delta : deltas)
   {
-    while (!isInterruptionRequested())
+    if (isInterruptionRequested())
+      return;
+    if (m_scanner->isDebug())
+      qDebug("Change %d on %s", (int)delta.change, delta.path.toUtf8().constData());
+    switch (delta.change)
     {
-      if (m_workerPool.tryStart(job))
-        break;
-      msleep(SCHEDULE_TIMEOUT_MS);
+    case FileSystemWatcher::FileChanged:
+      updateItem(delta.path, parsers);
+      break;
+    case FileSystemWatcher::FileRemoved:
+      removeItem(delta.path);
+      break;
+    case FileSystemWatcher::DirectoryAdded:
+    case FileSystemWatcher::DirectoryRemoved:
+    {
+      QString parentPath = QFileInfo(delta.path).absolutePath();
+      if (isKnownNode(parentPath))
+        rescans.insert(parentPath);
+      break;
+    }
+    case FileSystemWatcher::DirectoryChanged:
+      rescans.insert(delta.path);
+      break;
     }
   }
-  else if (!isInterruptionRequested())
-    m_workerPool.start(job);
+  for (const QString& dirPath : rescans)
+    launchScan(dirPath, WorkerPool::PriorityNormal);
+}
+
+void MediaScannerEngine::scheduleExtractor(MediaFilePtr filePtr, bool wait /*= true*/, WorkerPool::Priority priority /*= PriorityNormal*/)
+{
+  if (isInterruptionRequested())
+    return;
+  MediaExtractor * job = new MediaExtractor(this, &MediaScannerEngine::mediaExtractorCallback, filePtr, m_scanner->isDebug(), &m_metrics, artCache());
+  int device = m_scanDevice.load();
+  if (device >= 0)
+    job->setTuner(&m_tuner, device);
+  // block while the queue is full, so the traversal runs at the pace of the extraction
+  // read ahead the files in batch, unless they are requested
+  if (priority != WorkerPool::PriorityHigh && Prefetcher::mode() != Prefetcher::PrefetchNone)
+  {
+    if (!m_prefetcher.enqueue(job, wait, priority))
+      delete job;
+    return;
+  }
+  if (!m_workerPool.enqueue(job, wait, priority))
+    delete job;
 }
 
 void MediaScannerEngine::mediaExtractorCallback(void * handle, MediaFilePtr& filePtr)
@@ -441,22 +1183,37 @@ void MediaScannerEngine::mediaExtractorCallback(void * handle, MediaFilePtr& fil
   MediaScannerEngine * engine = static_cast<MediaScannerEngine*>(handle);
   if (!engine)
     return;
+  // the item could have been retired while extracted: then it is dropped
+  LockGuard<QRecursiveMutex> g(engine->m_fileItemsLock);
+  if (engine->m_tree.findItem(filePtr->filePath()) != filePtr)
+    return;
   if (filePtr->isValid)
   {
-    engine->m_scanner->put(filePtr);
-    // check empty state
-    if (!filePtr->signaled)
-    {
-      if (0 == engine->m_countValid++)
-        emit engine->m_scanner->emptyStateChanged();
-      filePtr->signaled = true;
-    }
+    engine->m_database.update(*filePtr);
+    engine->publishFile(filePtr);
   }
   else if (filePtr->retry < RETRY_MAX)
   {
+    // exponential backoff: the file could be still written
+    qint64 delay = qMin<qint64>(qint64(RETRY_INITIAL_MS) << filePtr->retry, RETRY_MAX_DELAY_MS);
     filePtr->retry++;
-    MediaExtractor * job = new MediaExtractor(engine, &MediaScannerEngine::mediaExtractorCallback, filePtr, engine->m_scanner->isDebug());
-    engine->m_delayed.enqueue(job);
+    engine->m_metrics.addRetry();
+    MediaExtractor * job = new MediaExtractor(engine, &MediaScannerEngine::mediaExtractorCallback, filePtr, engine->m_scanner->isDebug(), &engine->m_metrics, engine->artCache());
+    engine->m_delayed.enqueue(job, delay);
+  }
+  else
+    engine->m_metrics.addAbandoned();
+}
+
+void MediaScannerEngine::publishFile(MediaFilePtr& filePtr)
+{
+  m_scanner->put(filePtr);
+  // check empty state
+  if (!filePtr->signaled)
+  {
+    if (0 == m_countValid++)
+      emit m_scanner->emptyStateChanged();
+    filePtr->signaled = true;
   }
 }
 
@@ -474,8 +1231,12 @@ MediaScannerEngine::DelayedQueue::DelayedQueue()
 : QThread()
 , m_workerPool(nullptr)
 , m_delayedJobsLock(new QMutex())
+, m_delayedJobsCond()
 , m_delayedJobs()
+, m_clock()
+, m_sequence(0)
 {
+  m_clock.start();
 }
 
 MediaScannerEngine::DelayedQueue::~DelayedQueue()
@@ -485,23 +1246,34 @@ MediaScannerEngine::DelayedQueue::~DelayedQueue()
   delete m_delayedJobsLock;
 }
 
-void MediaScannerEngine::DelayedQueue::enqueue(MediaRunnable* runnable)
+void MediaScannerEngine::DelayedQueue::enqueue(MediaRunnable* runnable, qint64 delay)
 {
-  m_delayedJobsLock->lock();
-  runnable->setTimeout(RETRY_TIMEOUT_MS);
-  m_delayedJobs.enqueue(runnable);
-  m_delayedJobsLock->unlock();
+  LockGuard<QMutex> g(m_delayedJobsLock);
+  Entry entry;
+  entry.deadline = m_clock.elapsed() + (delay > 0 ? delay : 0);
+  entry.sequence = m_sequence++;
+  entry.job = runnable;
+  m_delayedJobs.push_back(entry);
+  std::push_heap(m_delayedJobs.begin(), m_delayedJobs.end(), std::greater<Entry>());
+  // the new job could be the next due
+  m_delayedJobsCond.wakeOne();
 }
 
 void MediaScannerEngine::DelayedQueue::clear()
 {
-  m_delayedJobsLock->lock();
-  while (!m_delayedJobs.isEmpty())
-    delete m_delayedJobs.dequeue();
-  m_delayedJobsLock->unlock();
+  LockGuard<QMutex> g(m_delayedJobsLock);
+  for (const Entry& entry : m_delayedJobs)
+    delete entry.job;
+  m_delayedJobs.clear();
 }
 
-void MediaScannerEngine::DelayedQueue::startProcessing(QThreadPool* pool)
+int MediaScannerEngine::DelayedQueue::pending() const
+{
+  LockGuard<QMutex> g(m_delayedJobsLock);
+  return m_delayedJobs.size();
+}
+
+void MediaScannerEngine::DelayedQueue::startProcessing(WorkerPool* pool)
 {
   assert(pool);
   stopProcessing();
@@ -513,27 +1285,37 @@ void MediaScannerEngine::DelayedQueue::stopProcessing()
 {
   if (QThread::isRunning())
   {
-    QThread::requestInterruption();
-    while (!QThread::isFinished())
-      QThread::msleep(THREAD_WAIT_TIMEOUT);
+    {
+      LockGuard<QMutex> g(m_delayedJobsLock);
+      QThread::requestInterruption();
+      m_delayedJobsCond.wakeOne();
+    }
+    QThread::wait();
     m_workerPool = nullptr;
   }
 }
 
 void MediaScannerEngine::DelayedQueue::run()
 {
+  LockGuard<QMutex> g(m_delayedJobsLock);
   while (!isInterruptionRequested())
   {
-    QThread::msleep(THREAD_WAIT_TIMEOUT);
+    if (m_delayedJobs.isEmpty())
     {
-      m_delayedJobsLock->lock();
-      while (!m_delayedJobs.isEmpty() && !isInterruptionRequested())
-      {
-        if (m_delayedJobs.front()->timeLeft() > 0)
-          break;
-        m_workerPool->start(m_delayedJobs.dequeue());
-      }
-      m_delayedJobsLock->unlock();
+      m_delayedJobsCond.wait(m_delayedJobsLock);
+      continue;
+    }
+    qint64 left = m_delayedJobs.front().deadline - m_clock.elapsed();
+    if (left > 0)
+    {
+      m_delayedJobsCond.wait(m_delayedJobsLock, static_cast<unsigned long>(left));
+      continue;
     }
+    std::pop_heap(m_delayedJobs.begin(), m_delayedJobs.end(), std::greater<Entry>());
+    MediaRunnable * job = m_delayedJobs.back().job;
+    m_delayedJobs.pop_back();
+    // never block here, the retries are queued beyond the capacity
+    if (!m_workerPool->enqueue(job, false))
+      delete job;
   }
 }
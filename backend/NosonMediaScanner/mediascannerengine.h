@@ -20,23 +20,31 @@
 #include "mediaparser.h"
 #include "mediarunnable.h"
 #include "mediascanner.h"
+#include "mediadatabase.h"
+#include "filesystemwatcher.h"
+#include "directorywalker.h"
+#include "directorytree.h"
+#include "workerpool.h"
+#include "prefetcher.h"
+#include "concurrencytuner.h"
+#include "scannermetrics.h"
+#include "artcache.h"
 #include "locked.h"
 
 #include <QThread>
-#include <QThreadPool>
 #include <QWaitCondition>
 #include <QList>
 #include <QSet>
+#include <QHash>
 #include <QMultiMap>
-#include <QQueue>
 #include <QFileInfo>
-#include <QFileSystemWatcher>
+#include <QVariantMap>
+#include <QVector>
+#include <QElapsedTimer>
 
 namespace mediascanner
 {
 
-class MediaDatabase;
-
 class MediaScannerEngine : public QThread
 {
 public:
@@ -46,72 +54,168 @@ public:
   void addParser(MediaParser * parser);
   void removeParser(const QString& name);
   QList<MediaParserPtr> parsers();
+  /**
+   * Set the size of the extraction pool. Zero lets the tuner size the pool
+   * within the bounds, for the device of each scanned root.
+   */
   void setMaxThread(int maxThread);
+  void setThreadBounds(int minThread, int maxThread) { m_tuner.setBounds(minThread, maxThread); }
   bool emptyState() const { return (m_countValid == 0); }
   bool working() const { return m_working; }
   QList<MediaFilePtr> allParsedFiles() const;
+  QVariantMap progress() const;
+  QVariantMap queueStats() const;
+  QVariantMap metrics() const;
+  QString metricsSummary() const;
+  void setArtCacheEnabled(bool enabled) { m_artCache.setEnabled(enabled); }
+  bool artCacheEnabled() const { return m_artCache.isEnabled(); }
+  void setPrefetchMode(Prefetcher::Mode mode) { Prefetcher::setMode(mode); }
+  Prefetcher::Mode prefetchMode() const { return Prefetcher::mode(); }
+  QString artPath(const QString& filePath, int size) const;
 
   bool addRootPath(const QString& dirPath);
   bool removeRootPath(const QString& dirPath);
   void clearRoots();
 
+  /**
+   * Scan the given path before the background work, even during a running
+   * scan. The files found there are extracted first.
+   * @param path a directory, or a file of the directory, under a root
+   * @return false if the path is out of the roots
+   */
+  bool prioritize(const QString& path);
+
   void stop();
 
 private slots:
   void onStarted();
-  void onFileChanged(const QString& filePath);
-  void onDirectoryChanged(const QString& dirPath);
 
 private:
   void run() override;
 
-  typedef QMap<QString, MediaFilePtr> NodeMap;
-  typedef QMultiMap<QString, MediaFilePtr> FileMap;
-
-  void launchScan(const QString& dirPath);
-  void scanDir(const QString& dirPath, const QList<MediaParserPtr>& parsers, bool deepScan = false);
-  void resetNode(const QString& nodeName);
-  void cleanNode(const QString& nodeName, bool evenPinned, QList<FileMap::iterator>& cleaned);
-
-  void scheduleExtractor(MediaFilePtr filePtr, bool wait = true);
+  void launchScan(const QString& dirPath, WorkerPool::Priority priority);
+  void scanDir(const QString& dirPath, WorkerPool::Priority priority, const QList<MediaParserPtr>& parsers);
+  void scanNode(const QString& dirPath, const QList<MediaParserPtr>& parsers, QStringList& subDirs);
+  static void walkerCallback(void * handle, const QString& dirPath, QStringList& subDirs);
+  DirectoryTree::Node * nodeOf(const QString& dirPath);
+  QString rootOf(const QString& dirPath) const;
+  bool isDrained() const;
+  void cleanNode(DirectoryTree::Node * node, bool evenPinned);
+  void removeNode(DirectoryTree::Node * node);
+  void releaseNodes(const QList<MediaFilePtr>& files, const QStringList& dirs);
+  bool isKnownNode(const QString& nodeName);
+  WorkerPool::Priority nodePriority(const QString& dirPath);
+  MediaFilePtr createItem(const QFileInfo& fileInfo, const MediaParserPtr& parser, DirectoryTree::Node * node);
+  void updateItem(const QString& filePath, const QList<MediaParserPtr>& parsers);
+  void removeItem(const QString& filePath);
+  void releaseItem(const MediaFilePtr& filePtr);
+  bool bindIdentity(const MediaFilePtr& filePtr);
+  void releaseIdentity(const MediaFilePtr& filePtr);
+  void checkOverlaps();
+
+  static void watcherCallback(void * handle, const FileSystemWatcher::DeltaList& deltas);
+  void processDeltas(const FileSystemWatcher::DeltaList& deltas, const QList<MediaParserPtr>& parsers);
+
+  void scheduleExtractor(MediaFilePtr filePtr, bool wait = true, WorkerPool::Priority priority = WorkerPool::PriorityNormal);
+  void publishFile(MediaFilePtr& filePtr);
   static void mediaExtractorCallback(void * handle, MediaFilePtr& filePtr);
+  ArtCache * artCache() { return (m_artCache.isEnabled() ? &m_artCache : nullptr); }
   static MediaParserPtr matchParser(const QList<MediaParserPtr>& parsers, const QFileInfo& fileInfo);
 
   MediaScanner * m_scanner;
   QStringList m_roots;
   bool m_working;
   unsigned m_sequence;
-  NodeMap m_nodes;
-  NodeMap m_items;
-  FileMap m_files;
+  DirectoryTree m_tree;
+  QHash<FileIdentity, MediaFilePtr> m_owners;       // the item parsed for each physical file
+  QMultiHash<FileIdentity, MediaFilePtr> m_aliases; // the other items of the same file
   QRecursiveMutex * m_fileItemsLock;
-  QFileSystemWatcher m_watcher;
+  FileSystemWatcher m_watcher;
   QList<MediaParserPtr> m_parsers;
-  QThreadPool m_workerPool;
-
-  QQueue<QString> m_todo;
+  WorkerPool m_workerPool;
+  ConcurrencyTuner m_tuner;
+  DirectoryWalker m_walker;
+  MediaDatabase m_database;
+  ScannerMetrics m_metrics;
+  ArtCache m_artCache;
+
+  /**
+   * The pending scans are held in a min-heap ordered by priority, then in
+   * order of arrival.
+   */
+  struct ScanEntry
+  {
+    WorkerPool::Priority priority;
+    quint64 sequence;
+    QString path;
+    bool operator>(const ScanEntry& other) const
+    {
+      return (priority > other.priority ||
+              (priority == other.priority && sequence > other.sequence));
+    }
+  };
+  QVector<ScanEntry> m_todo;
+  quint64 m_todoSequence;
+  FileSystemWatcher::DeltaList m_deltas;
   QMutex * m_condLock;
   QWaitCondition m_cond;
 
   QAtomicInt m_countValid;
 
+  struct ScanProgress
+  {
+    int directories;
+    int files;
+    bool done;
+  };
+  QMutex * m_progressLock;
+  QMap<QString, ScanProgress> m_progress;
+  QString m_scanRoot;       // the root of the running scan, keying its progress
+  QList<MediaParserPtr> m_scanParsers;
+  WorkerPool::Priority m_scanPriority;
+  QAtomicInt m_scanDevice;  // the device of the running scan for the tuner
+  QStringList m_requested;  // the paths prioritized during the scan
+  QStringList m_overlaps;   // the roots reaching the same directories
+  QStringList m_purgeScopes;      // the scanned paths available at scan time
+  QSet<QString> m_scannedDirs;    // the directories listed by the pass
+
+  /**
+   * The jobs are held in a min-heap ordered by deadline. The thread sleeps
+   * until the next deadline, and it is woken on enqueue or stop.
+   */
   class DelayedQueue: private QThread
   {
   public:
     DelayedQueue();
     virtual ~DelayedQueue() override;
-    void enqueue(MediaRunnable * runnable);
+    void enqueue(MediaRunnable * runnable, qint64 delay);
     void clear();
-    void startProcessing(QThreadPool * pool);
+    int pending() const;
+    void startProcessing(WorkerPool * pool);
     void stopProcessing();
   private:
     void run() override;
-    QThreadPool *  m_workerPool;
+    struct Entry
+    {
+      qint64 deadline;
+      quint64 sequence;
+      MediaRunnable * job;
+      bool operator>(const Entry& other) const
+      {
+        return (deadline > other.deadline ||
+                (deadline == other.deadline && sequence > other.sequence));
+      }
+    };
+    WorkerPool *  m_workerPool;
     QMutex * m_delayedJobsLock;
-    QQueue<MediaRunnable*> m_delayedJobs;
+    QWaitCondition m_delayedJobsCond;
+    QVector<Entry> m_delayedJobs;
+    QElapsedTimer m_clock;
+    quint64 m_sequence;
   };
 
   DelayedQueue m_delayed;
+  Prefetcher m_prefetcher;
 };
 
 }
@@ -19,20 +19,27 @@
 #include "mediafile.h"
 #include "mediainfo.h"
 #include "byteorder.h"
+#include "bytesource.h"
+#include "flacparser.h"
 
 #include <cstdio>
 #include <string>
 #include <QDebug>
 
 #define OGG_CODEC        "vorbis"
+#define OPUS_CODEC       "opus"
 #define OGG_BLOCK_SIZE   27
 #define OGG_PACKET_RSVSIZE 200*1024
 #define OGG_PACKET_MAXSIZE 500*1024
+#define OGG_SEEK_BLOCK   65536     // fits the read window of the source
+#define OGG_SEEK_LIMIT   4*65536   // a page is 65307 bytes at most
+#define OPUS_HEAD_SIZE   19
+#define OPUS_GRANULE_RATE 48000
 
 
 using namespace mediascanner;
 
-static const char * _exts[] = { "OGG" };
+static const char * _exts[] = { "OGG", "OPUS" };
 static int _exts_len = sizeof(_exts) / sizeof(const char*);
 
 bool OGGParser::match(const QFileInfo& fileInfo)
@@ -48,36 +55,54 @@ bool OGGParser::match(const QFileInfo& fileInfo)
 
 bool OGGParser::parse(MediaFile * file, MediaInfo * info, bool debug)
 {
-  std::string path(file->filePath.toUtf8().constData());
+  return parse_stream(file, info, nullptr, debug);
+}
+
+bool OGGParser::extractArt(MediaFile * file, QByteArray& image)
+{
+  MediaInfo info;
+  return parse_stream(file, &info, &image, false);
+}
+
+/**
+ * Parse the stream until the last page. When a picture is requested, the
+ * parsing ends with the comment header.
+ */
+bool OGGParser::parse_stream(MediaFile * file, MediaInfo * info, QByteArray * picture, bool debug)
+{
+  std::string path(file->filePath().toUtf8().constData());
   unsigned char buf[OGG_BLOCK_SIZE];
   unsigned char lacing[255];
   bool isLast = false;
   bool isInfoValid = false;
   bool gotoLast = false;
+  bool isOpus = false;
+  unsigned preSkip = 0;
+  uint32_t serial = 0;
   packet_t packet = { nullptr, 0, nullptr, 0 };
-  FILE * fp = fopen(path.c_str(), "rb");
-  if (!fp)
+  ByteSource src;
+  if (!src.open(file->filePath()))
     return false;
 
   for (;;)
   {
     // check the magic file header, else close and return a null payload
-    if (fread(buf, 1, OGG_BLOCK_SIZE, fp) != OGG_BLOCK_SIZE || memcmp(buf, "OggS", 4) != 0)
+    if (src.read(buf, OGG_BLOCK_SIZE) != OGG_BLOCK_SIZE || memcmp(buf, "OggS", 4) != 0)
     {
       qWarning("%s: ERROR: bad magic header in file %s", __FUNCTION__, path.c_str());
-      fclose(fp);
+      src.close();
       return false;
     }
     //char stream_structure_version = read8(buf + 4);
     unsigned char header_type_flag = (unsigned char)read8(buf + 5);
     uint64_t granule_position = ((uint64_t)read32le(buf + 6)) + ((uint64_t)read32le(buf + 10) << 32);
-    //uint32_t bitstream_serial _number = read32le(buf + 14);
+    uint32_t bitstream_serial_number = (uint32_t)read32le(buf + 14);
     //uint32_t page_sequence_number = (uint32_t)read32le(buf + 18);
     //uint32_t CRC_checksum = read32le(buf + 22);
     unsigned char number_page_segments = (unsigned char)read8(buf + 26);
 
     uint32_t segment_table = 0;
-    if (fread(lacing, 1, number_page_segments, fp) != number_page_segments)
+    if (src.read(lacing, number_page_segments) != number_page_segments)
     {
       if (debug)
         qDebug("%s: file read error %s", __FUNCTION__, path.c_str());
@@ -93,7 +118,7 @@ bool OGGParser::parse(MediaFile * file, MediaInfo * info, bool debug)
       // append data and process the packet
       isLast = true;
       resize_packet(&packet, packet.datalen + segment_table);
-      if (!fill_packet(&packet,segment_table, fp))
+      if (!fill_packet(&packet,segment_table, &src))
       {
         if (debug)
           qDebug("%s: file read error %s", __FUNCTION__, path.c_str());
@@ -104,16 +129,17 @@ bool OGGParser::parse(MediaFile * file, MediaInfo * info, bool debug)
     {
       // bypass the page until last
       packet.datalen = 0;
-      fseek(fp, segment_table, SEEK_CUR);
+      src.seek(segment_table, SEEK_CUR);
       continue;
     }
     // bit 0x02: this is the first page of a logical bitstream (bos)
     else if ((header_type_flag & 0x02) == 0x02)
     {
       // fill fresh data and read next page
+      serial = bitstream_serial_number;
       packet.datalen = 0;
       resize_packet(&packet, OGG_PACKET_RSVSIZE);
-      if (!fill_packet(&packet, segment_table, fp))
+      if (!fill_packet(&packet, segment_table, &src))
       {
         if (debug)
           qDebug("%s: file read error %s", __FUNCTION__, path.c_str());
@@ -126,7 +152,7 @@ bool OGGParser::parse(MediaFile * file, MediaInfo * info, bool debug)
     {
       // append data and read next page
       resize_packet(&packet, packet.datalen + segment_table);
-      if (!fill_packet(&packet,segment_table, fp))
+      if (!fill_packet(&packet,segment_table, &src))
       {
         if (debug)
           qDebug("%s: file read error %s", __FUNCTION__, path.c_str());
@@ -158,19 +184,53 @@ bool OGGParser::parse(MediaFile * file, MediaInfo * info, bool debug)
       {
         // parse identification header
         isInfoValid = parse_identification(&packet, info, debug);
-        info->container = file->suffix.toLower();
+        info->container = file->suffix().toLower();
       }
       else if (block == 0x03)
       {
         // parse comment header
-        if (!parse_comment(&packet, info, debug))
+        if (!parse_comment(&packet, 7, info, picture, debug))
         {
           isInfoValid = false;
           break;
         }
+        if (picture)
+          break;
         if (info->title.isEmpty())
-          info->title = file->baseName; // default title
-        gotoLast = isInfoValid;
+          info->title = file->baseName(); // default title
+        // the end is searched backward, else all pages are walked through
+        if (isInfoValid && find_last_granule(&src, serial, &granule_position))
+          isLast = true;
+        else
+          gotoLast = isInfoValid;
+      }
+    }
+    // check for opus header
+    else if (packet.datalen >= 8 && memcmp(packet.data, "Opus", 4) == 0)
+    {
+      if (debug)
+        qDebug("%s: on opus header %.8s len %u", __FUNCTION__, packet.data, (unsigned)packet.datalen);
+
+      if (memcmp(packet.data + 4, "Head", 4) == 0 && !isInfoValid)
+      {
+        isInfoValid = isOpus = parse_opus_head(&packet, info, &preSkip, debug);
+        info->container = file->suffix().toLower();
+      }
+      else if (memcmp(packet.data + 4, "Tags", 4) == 0)
+      {
+        if (!parse_comment(&packet, 8, info, picture, debug))
+        {
+          isInfoValid = false;
+          break;
+        }
+        if (picture)
+          break;
+        if (info->title.isEmpty())
+          info->title = file->baseName(); // default title
+        if (isInfoValid && find_last_granule(&src, serial, &granule_position))
+          isLast = true;
+        else
+          gotoLast = isInfoValid;
       }
     }
 
@@ -178,14 +238,23 @@ bool OGGParser::parse(MediaFile * file, MediaInfo * info, bool debug)
     {
       if (debug)
         qDebug("%s: granule_position=%" PRIu64 " sample_rate=%d", __FUNCTION__, granule_position, info->sampleRate);
-      if (info->sampleRate > 0)
+      if (isOpus)
+      {
+        // the granule runs at 48 kHz whatever the input rate, and it counts
+        // the samples to skip at the beginning of the stream
+        if (granule_position > preSkip)
+          info->duration = (granule_position - preSkip) / OPUS_GRANULE_RATE;
+        if (info->duration > 0)
+          info->bitRate = (int)(file->size * 8 / info->duration);
+      }
+      else if (info->sampleRate > 0)
         info->duration = granule_position / info->sampleRate;
       break; // finish
     }
 
     // fill fresh data and read next page
     packet.datalen = 0;
-    if (!fill_packet(&packet, segment_table, fp))
+    if (!fill_packet(&packet, segment_table, &src))
     {
       if (debug)
         qDebug("%s: ERROR: reading file %s", __FUNCTION__, path.c_str());
@@ -195,9 +264,11 @@ bool OGGParser::parse(MediaFile * file, MediaInfo * info, bool debug)
 
   if (packet.buf != nullptr)
     delete [] packet.buf;
-  fclose(fp);
+  src.close();
   if (debug)
       qDebug("%s: info:%s complete:%s", __FUNCTION__, isInfoValid ? "true" : "false", isLast ? "true" : "false");
+  if (picture)
+    return !picture->isEmpty();
   // parsing is completed if all blocks have been parsed and info is valid
   return (isInfoValid && isLast);
 }
@@ -219,10 +290,10 @@ bool OGGParser::resize_packet(packet_t * packet, uint32_t size)
   return true;
 }
 
-bool OGGParser::fill_packet(packet_t * packet, uint32_t len, FILE * fp)
+bool OGGParser::fill_packet(packet_t * packet, uint32_t len, ByteSource * src)
 {
   if (!resize_packet(packet, packet->datalen + len) ||
-      fread(packet->buf + packet->datalen, 1, len, fp) != len)
+      src->read(packet->buf + packet->datalen, len) != len)
     return false;
   packet->data = packet->buf;
   packet->datalen += len;
@@ -251,13 +322,37 @@ bool OGGParser::parse_identification(packet_t * packet, MediaInfo *info, bool de
   return true;
 }
 
-bool OGGParser::parse_comment(packet_t * packet, MediaInfo *info, bool debug)
+bool OGGParser::parse_opus_head(packet_t * packet, MediaInfo * info, unsigned * preSkip, bool debug)
+{
+  if (packet->datalen < OPUS_HEAD_SIZE)
+    return false;
+  unsigned char * opus = packet->data;
+  int channels = read8(opus + 9);
+  *preSkip = (uint16_t)read16le(opus + 10);
+  // the rate of the original input, as the decoder always runs at 48 kHz
+  int sampleRate = read32le(opus + 12);
+  if (channels == 0)
+    return false;
+  info->codec = QString::fromUtf8(OPUS_CODEC);
+  info->sampleRate = (sampleRate > 0 ? sampleRate : OPUS_GRANULE_RATE);
+  info->channels = channels;
+  info->bitRate = 0; // computed with the duration
+  info->duration = 0; // not set
+  // consume the rest of data
+  packet->datalen = 0;
+  if (debug)
+    qDebug("%s: codec:%s sr:%d ch:%d pre-skip:%u", __FUNCTION__, info->codec.toUtf8().constData(), info->sampleRate, info->channels, *preSkip);
+  return true;
+}
+
+bool OGGParser::parse_comment(packet_t * packet, unsigned magicLen, MediaInfo *info, QByteArray * picture, bool debug)
 {
   unsigned char * ve = packet->data + packet->datalen;
-  unsigned char * vp = packet->data + 7; // pass magic string
+  unsigned char * vp = packet->data + magicLen; // pass magic string
   vp += read32le(vp) + 4; // pass vendor string
   int count = read32le(vp); // comment list length;
   vp += 4;
+  unsigned pictureType = 0;
   while (count > 0)
   {
     int len = read32le(vp);
@@ -280,13 +375,137 @@ bool OGGParser::parse_comment(packet_t * packet, MediaInfo *info, bool debug)
     else if (str.startsWith("DATE=", Qt::CaseInsensitive))
       info->year = str.mid(5,4).toInt(); // format should be 'yyyy-mm-dd'
     else if (str.startsWith("METADATA_BLOCK_PICTURE=", Qt::CaseInsensitive))
+    {
       info->hasArt = true;
+      // keep the first picture, unless the front cover follows
+      if (picture && (picture->isEmpty() || pictureType != 3))
+      {
+        QByteArray block = QByteArray::fromBase64(QByteArray::fromRawData(reinterpret_cast<char*>(vp) + 23, len - 23));
+        QByteArray image;
+        unsigned type = 0;
+        if (FLACParser::loadPicture(reinterpret_cast<const unsigned char*>(block.constData()), block.size(), image, &type) &&
+            (picture->isEmpty() || type == 3))
+        {
+          picture->swap(image);
+          pictureType = type;
+        }
+      }
+    }
     vp += len;
     --count;
     if (debug)
       qDebug("%s", str.toUtf8().constData());
   }
-  packet->data = vp + *vp;
-  packet->datalen -= ve - vp - *vp;
+  // the vorbis header ends with the framing bit, the opus one has none
+  if (vp < ve)
+  {
+    packet->data = vp + *vp;
+    packet->datalen -= ve - vp - *vp;
+  }
+  else
+    packet->datalen = 0;
   return (count == 0);
 }
+
+/**
+ * The CRC of the pages: polynomial 0x04c11db7, direct, with no final xor.
+ */
+class OggCRC
+{
+public:
+  OggCRC()
+  {
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+      uint32_t r = i << 24;
+      for (int k = 0; k < 8; ++k)
+        r = (r & 0x80000000) ? (r << 1) ^ 0x04c11db7 : (r << 1);
+      m_table[i] = r;
+    }
+  }
+  uint32_t update(uint32_t crc, const unsigned char * data, size_t len) const
+  {
+    for (size_t i = 0; i < len; ++i)
+      crc = (crc << 8) ^ m_table[((crc >> 24) ^ data[i]) & 0xff];
+    return crc;
+  }
+private:
+  uint32_t m_table[256];
+};
+
+static const OggCRC& _ogg_crc()
+{
+  static const OggCRC crc;
+  return crc;
+}
+
+bool OGGParser::check_page(ByteSource * src, qint64 offset, uint32_t serial, uint64_t * granule)
+{
+  static const unsigned char zero[4] = { 0, 0, 0, 0 };
+  const OggCRC& crc = _ogg_crc();
+  const unsigned char * data;
+
+  if (src->seek(offset, SEEK_SET) != 0 ||
+      !(data = reinterpret_cast<const unsigned char*>(src->fetch(OGG_BLOCK_SIZE))))
+    return false;
+  if (read8(data + 4) != 0 || (uint32_t)read32le(data + 14) != serial)
+    return false;
+  uint64_t granule_position = ((uint64_t)(uint32_t)read32le(data + 6)) + ((uint64_t)(uint32_t)read32le(data + 10) << 32);
+  // no packet is completed on the page
+  if (granule_position == (uint64_t)(-1))
+    return false;
+  uint32_t checksum = (uint32_t)read32le(data + 22);
+  unsigned char number_page_segments = data[26];
+  // the checksum is computed with the field zeroed
+  uint32_t value = crc.update(0, data, 22);
+  value = crc.update(value, zero, 4);
+  value = crc.update(value, data + 26, 1);
+
+  if (!(data = reinterpret_cast<const unsigned char*>(src->fetch(number_page_segments))))
+    return false;
+  uint32_t segment_table = 0;
+  for (int i = 0; i < number_page_segments; ++i)
+    segment_table += data[i];
+  value = crc.update(value, data, number_page_segments);
+
+  if (!(data = reinterpret_cast<const unsigned char*>(src->fetch(segment_table))))
+    return false;
+  value = crc.update(value, data, segment_table);
+  if (value != checksum)
+    return false;
+  *granule = granule_position;
+  return true;
+}
+
+bool OGGParser::find_last_granule(ByteSource * src, uint32_t serial, uint64_t * granule)
+{
+  qint64 pos = src->tell();
+  qint64 end = src->size();
+  qint64 limit = (end > OGG_SEEK_LIMIT ? end - OGG_SEEK_LIMIT : 0);
+  while (end - limit >= 4)
+  {
+    qint64 start = (end - OGG_SEEK_BLOCK > limit ? end - OGG_SEEK_BLOCK : limit);
+    size_t len = (size_t)(end - start);
+    const unsigned char * block = nullptr;
+    // search the capture pattern from the end
+    for (size_t i = len - 4 + 1; i-- > 0; )
+    {
+      // the checks move the source, so the block must be fetched again
+      if (!block && (src->seek(start, SEEK_SET) != 0 ||
+          !(block = reinterpret_cast<const unsigned char*>(src->fetch(len)))))
+        break;
+      if (block[i] != 'O' || memcmp(block + i, "OggS", 4) != 0)
+        continue;
+      if (check_page(src, start + i, serial, granule))
+        return true;
+      block = nullptr;
+    }
+    if (start == limit)
+      break;
+    // overlap the blocks to catch a pattern across them
+    end = start + 3;
+  }
+  // restore the position for the forward walk
+  src->seek(pos, SEEK_SET);
+  return false;
+}
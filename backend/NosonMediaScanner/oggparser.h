@@ -23,12 +23,15 @@
 namespace mediascanner
 {
 
+class ByteSource;
+
 class OGGParser : public MediaParser
 {
 public:
   const char * commonName() override { return "OGG"; }
   bool match(const QFileInfo& fileInfo) override;
   bool parse(MediaFile * file, MediaInfo * info, bool debug) override;
+  bool extractArt(MediaFile * file, QByteArray& image) override;
 
 private:
   typedef struct
@@ -39,9 +42,18 @@ private:
     uint32_t datalen;
   } packet_t;
   static bool resize_packet(packet_t * packet, uint32_t size);
-  static bool fill_packet(packet_t * packet, uint32_t len, FILE * fp);
+  static bool fill_packet(packet_t * packet, uint32_t len, ByteSource * src);
   static bool parse_identification(packet_t * packet, MediaInfo * info, bool debug);
-  static bool parse_comment(packet_t * packet, MediaInfo * info, bool debug);
+  static bool parse_opus_head(packet_t * packet, MediaInfo * info, unsigned * preSkip, bool debug);
+  static bool parse_stream(MediaFile * file, MediaInfo * info, QByteArray * picture, bool debug);
+  static bool parse_comment(packet_t * packet, unsigned magicLen, MediaInfo * info, QByteArray * picture, bool debug);
+
+  /**
+   * Search backward from the end the last page of the logical stream, and
+   * return its granule position. The pages are verified with their CRC.
+   */
+  static bool find_last_granule(ByteSource * src, uint32_t serial, uint64_t * granule);
+  static bool check_page(ByteSource * src, qint64 offset, uint32_t serial, uint64_t * granule);
 };
 
 }
@@ -0,0 +1,439 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "prefetcher.h"
+#include "mediaextractor.h"
+#include "bytesource.h"
+#include "locked.h"
+
+#include <QFile>
+#include <QElapsedTimer>
+#include <cassert>
+
+#if defined(__linux__)
+#define HAVE_FADVISE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#else
+#undef HAVE_LIBURING
+#endif
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#define PREFETCH_BATCH        32
+#define PREFETCH_CAPACITY     (2 * PREFETCH_BATCH)
+#define PREFETCH_SIZE         65536   // the window of the sources
+#define ID3V1_SIZE            128
+
+using namespace mediascanner;
+
+static QAtomicInt _mode(Prefetcher::PrefetchNone);
+
+/**
+ * Return the bytes to read ahead at the end of the file: the formats with
+ * a trailer are parsed from both ends.
+ */
+static qint64 _tail_size(quint8 suffixId)
+{
+  switch (suffixId)
+  {
+  case MediaFile::SuffixMP3:
+  case MediaFile::SuffixMP2:
+  case MediaFile::SuffixAAC:
+    return ID3V1_SIZE;
+  case MediaFile::SuffixOGG:
+  case MediaFile::SuffixOPUS:
+  case MediaFile::SuffixM4A:
+  case MediaFile::SuffixM4B:
+    return PREFETCH_SIZE;
+  default:
+    return 0;
+  }
+}
+
+void Prefetcher::setMode(Mode mode)
+{
+  if (mode == PrefetchUring && !isSupported(PrefetchUring))
+    mode = PrefetchAdvise;
+  if (!isSupported(mode))
+    mode = PrefetchNone;
+  _mode.store(mode);
+}
+
+Prefetcher::Mode Prefetcher::mode()
+{
+  return static_cast<Mode>(_mode.load());
+}
+
+bool Prefetcher::isSupported(Mode mode)
+{
+  switch (mode)
+  {
+  case PrefetchNone:
+    return true;
+#ifdef HAVE_FADVISE
+  case PrefetchAdvise:
+    return true;
+#endif
+#ifdef HAVE_LIBURING
+  case PrefetchUring:
+    return true;
+#endif
+  default:
+    return false;
+  }
+}
+
+Prefetcher::Prefetcher()
+: QThread()
+, m_workerPool(nullptr)
+, m_metrics(nullptr)
+, m_lock(new QMutex())
+, m_notEmpty()
+, m_notFull()
+, m_jobs()
+, m_depth(0)
+, m_closed(false)
+, m_pending(0)
+, m_ring(nullptr)
+, m_ringFailed(false)
+{
+}
+
+Prefetcher::~Prefetcher()
+{
+  stopProcessing();
+  clear();
+  delete m_lock;
+}
+
+bool Prefetcher::enqueue(MediaExtractor * job, bool wait, WorkerPool::Priority priority)
+{
+  LockGuard<QMutex> g(m_lock);
+  while (wait && m_depth >= PREFETCH_CAPACITY && !m_closed)
+    m_notFull.wait(m_lock);
+  if (m_closed)
+    return false;
+  Entry entry;
+  entry.job = job;
+  entry.priority = priority;
+  m_jobs[priority].enqueue(entry);
+  ++m_depth;
+  m_pending.ref();
+  m_notEmpty.wakeOne();
+  return true;
+}
+
+void Prefetcher::close()
+{
+  LockGuard<QMutex> g(m_lock);
+  m_closed = true;
+  m_notFull.wakeAll();
+}
+
+void Prefetcher::open()
+{
+  LockGuard<QMutex> g(m_lock);
+  m_closed = false;
+}
+
+void Prefetcher::clear()
+{
+  QList<Entry> jobs;
+  {
+    LockGuard<QMutex> g(m_lock);
+    for (QQueue<Entry>& queue : m_jobs)
+    {
+      jobs.append(queue);
+      queue.clear();
+    }
+    m_pending.fetchAndAddOrdered(-m_depth);
+    m_depth = 0;
+    m_notFull.wakeAll();
+  }
+  for (const Entry& entry : jobs)
+    delete entry.job;
+}
+
+void Prefetcher::startProcessing(WorkerPool * pool, ScannerMetrics * metrics)
+{
+  assert(pool);
+  stopProcessing();
+  m_workerPool = pool;
+  m_metrics = metrics;
+  QThread::start();
+}
+
+/**
+ * Stop the stage. The pool must be closed first, as the stage could be
+ * blocked by a full pool.
+ */
+void Prefetcher::stopProcessing()
+{
+  if (QThread::isRunning())
+  {
+    {
+      LockGuard<QMutex> g(m_lock);
+      QThread::requestInterruption();
+      m_notEmpty.wakeOne();
+    }
+    QThread::wait();
+    m_workerPool = nullptr;
+  }
+}
+
+void Prefetcher::run()
+{
+  ScannerMetrics::setCurrent(m_metrics);
+  QVector<Entry> batch;
+  batch.reserve(PREFETCH_BATCH);
+  m_lock->lock();
+  while (!isInterruptionRequested())
+  {
+    if (m_depth == 0)
+    {
+      m_notEmpty.wait(m_lock);
+      continue;
+    }
+    // take what is queued by priority, so the batch grows with the load
+    batch.clear();
+    for (QQueue<Entry>& queue : m_jobs)
+    {
+      while (!queue.isEmpty() && batch.size() < PREFETCH_BATCH)
+        batch.push_back(queue.dequeue());
+    }
+    m_depth -= batch.size();
+    m_notFull.wakeAll();
+    m_lock->unlock();
+
+    Mode m = mode();
+    if (m == PrefetchUring && !uringBatch(batch))
+      m = PrefetchAdvise;
+    if (m == PrefetchAdvise)
+      adviseBatch(batch);
+    for (const Entry& entry : batch)
+    {
+      // block while the pool is full, so the stage runs at the pace of the extraction
+      if (!m_workerPool->enqueue(entry.job, true, entry.priority))
+        delete entry.job;
+      m_pending.deref();
+    }
+    m_lock->lock();
+  }
+  m_lock->unlock();
+#ifdef HAVE_LIBURING
+  if (m_ring)
+  {
+    io_uring_queue_exit(m_ring);
+    delete m_ring;
+    m_ring = nullptr;
+  }
+#endif
+  ScannerMetrics::setCurrent(nullptr);
+}
+
+/**
+ * Open the files, and hint the kernel to read ahead their first and last
+ * bytes. The reads of the workers then hit the page cache.
+ */
+void Prefetcher::adviseBatch(const QVector<Entry>& batch)
+{
+#ifdef HAVE_FADVISE
+  IOStats io = { 0, 0, 0 };
+  QElapsedTimer timer;
+  timer.start();
+  for (const Entry& entry : batch)
+  {
+    const MediaFilePtr& file = entry.job->file();
+    QString filePath = file->filePath();
+    int fd = ::open(QFile::encodeName(filePath).constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      continue;
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+      ::close(fd);
+      continue;
+    }
+    qint64 headLen = qMin<qint64>(st.st_size, PREFETCH_SIZE);
+    qint64 tailLen = qMin<qint64>(st.st_size - headLen, _tail_size(file->suffixId));
+    // count the hints as the read requests
+    if (headLen > 0 && posix_fadvise(fd, 0, (off_t)headLen, POSIX_FADV_WILLNEED) == 0)
+      ++io.reads;
+    if (tailLen > 0 && posix_fadvise(fd, (off_t)(st.st_size - tailLen), (off_t)tailLen, POSIX_FADV_WILLNEED) == 0)
+      ++io.reads;
+    Preload * preload = new Preload();
+    preload->filePath = filePath;
+    preload->fd = fd;
+    preload->size = st.st_size;
+    entry.job->setPreload(preload);
+  }
+  ScannerMetrics::addProbe("prefetch-advise", timer.nsecsElapsed() / 1000, io);
+#else
+  Q_UNUSED(batch);
+#endif
+}
+
+#ifdef HAVE_LIBURING
+/**
+ * Submit the prepared requests, and collect their results indexed by the
+ * user data.
+ */
+static bool _uring_wait(struct io_uring * ring, unsigned count, QVector<int>& results)
+{
+  int r;
+  while ((r = io_uring_submit_and_wait(ring, count)) == -EINTR);
+  if (r < 0)
+    return false;
+  for (unsigned n = 0; n < count; ++n)
+  {
+    struct io_uring_cqe * cqe;
+    while ((r = io_uring_wait_cqe(ring, &cqe)) == -EINTR);
+    if (r < 0)
+      return false;
+    if (cqe->user_data < (unsigned)results.size())
+      results[(int)cqe->user_data] = cqe->res;
+    io_uring_cqe_seen(ring, cqe);
+  }
+  return true;
+}
+#endif
+
+/**
+ * Open and stat the files in one submission, then read their first and
+ * last bytes in a second one. The workers parse them from memory.
+ * @return false if io_uring is not available
+ */
+bool Prefetcher::uringBatch(const QVector<Entry>& batch)
+{
+#ifdef HAVE_LIBURING
+  if (!m_ring)
+  {
+    if (m_ringFailed)
+      return false;
+    m_ring = new struct io_uring;
+    int r = io_uring_queue_init(2 * PREFETCH_BATCH, m_ring, 0);
+    if (r < 0)
+    {
+      qWarning("%s: io_uring is not available (%d), fall back to advise", __FUNCTION__, r);
+      delete m_ring;
+      m_ring = nullptr;
+      m_ringFailed = true;
+      return false;
+    }
+  }
+
+  IOStats io = { 0, 0, 0 };
+  QElapsedTimer timer;
+  timer.start();
+  int count = batch.size();
+  QVector<QString> filePaths(count);
+  QVector<QByteArray> paths(count);
+  QVector<struct statx> stx(count);
+  QVector<int> results(2 * count, -ECANCELED);
+  QVector<Preload*> preloads(count, nullptr);
+
+  // the requests of a file are told by the low bit of the user data
+  for (int i = 0; i < count; ++i)
+  {
+    filePaths[i] = batch[i].job->file()->filePath();
+    paths[i] = QFile::encodeName(filePaths[i]);
+    struct io_uring_sqe * sqe = io_uring_get_sqe(m_ring);
+    io_uring_prep_openat(sqe, AT_FDCWD, paths[i].constData(), O_RDONLY | O_CLOEXEC, 0);
+    sqe->user_data = (i << 1);
+    sqe = io_uring_get_sqe(m_ring);
+    io_uring_prep_statx(sqe, AT_FDCWD, paths[i].constData(), 0, STATX_SIZE, &stx[i]);
+    sqe->user_data = (i << 1) | 1;
+  }
+  bool ok = _uring_wait(m_ring, 2 * count, results);
+
+  unsigned reads = 0;
+  for (int i = 0; i < count; ++i)
+  {
+    int fd = results[i << 1];
+    if (fd < 0)
+      continue;
+    if (!ok || results[(i << 1) | 1] != 0)
+    {
+      ::close(fd);
+      continue;
+    }
+    Preload * preload = new Preload();
+    preload->filePath = filePaths[i];
+    preload->fd = fd;
+    preload->size = (qint64)stx[i].stx_size;
+    preloads[i] = preload;
+    qint64 headLen = qMin<qint64>(preload->size, PREFETCH_SIZE);
+    qint64 tailLen = qMin<qint64>(preload->size - headLen, _tail_size(batch[i].job->file()->suffixId));
+    if (headLen > 0)
+    {
+      preload->head = QByteArray((int)headLen, Qt::Uninitialized);
+      struct io_uring_sqe * sqe = io_uring_get_sqe(m_ring);
+      io_uring_prep_read(sqe, fd, preload->head.data(), (unsigned)headLen, 0);
+      sqe->user_data = (i << 1);
+      ++reads;
+    }
+    if (tailLen > 0)
+    {
+      preload->tail = QByteArray((int)tailLen, Qt::Uninitialized);
+      struct io_uring_sqe * sqe = io_uring_get_sqe(m_ring);
+      io_uring_prep_read(sqe, fd, preload->tail.data(), (unsigned)tailLen, (quint64)(preload->size - tailLen));
+      sqe->user_data = (i << 1) | 1;
+      ++reads;
+    }
+  }
+  results.fill(-ECANCELED);
+  if (ok && reads > 0)
+    ok = _uring_wait(m_ring, reads, results);
+  if (!ok)
+  {
+    // the ring is left in an unknown state: give it up
+    qWarning("%s: io_uring failed, fall back to advise", __FUNCTION__);
+    io_uring_queue_exit(m_ring);
+    delete m_ring;
+    m_ring = nullptr;
+    m_ringFailed = true;
+  }
+
+  for (int i = 0; i < count; ++i)
+  {
+    Preload * preload = preloads[i];
+    if (!preload)
+      continue;
+    int r = results[i << 1];
+    if (!ok || r < 0)
+      preload->head.clear();
+    else if (r < preload->head.size())
+      preload->head.truncate(r);
+    // the tail is valid only up to the end of file
+    if (!ok || results[(i << 1) | 1] != preload->tail.size())
+      preload->tail.clear();
+    io.bytesRead += preload->head.size() + preload->tail.size();
+    batch[i].job->setPreload(preload);
+  }
+  io.reads = reads;
+  ScannerMetrics::addProbe("prefetch-uring", timer.nsecsElapsed() / 1000, io);
+  return true;
+#else
+  Q_UNUSED(batch);
+  return false;
+#endif
+}
@@ -0,0 +1,118 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PREFETCHER_H
+#define PREFETCHER_H
+
+#include "workerpool.h"
+#include "scannermetrics.h"
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QVector>
+#include <QAtomicInt>
+
+struct io_uring;
+
+namespace mediascanner
+{
+
+class MediaExtractor;
+
+/**
+ * The stage reading ahead the files queued for extraction. The jobs are
+ * taken in batch: their files are opened and their first and last bytes
+ * are requested at once, then the jobs are pushed to the pool with the
+ * preload of their file. So the workers parse from memory or from a warm
+ * page cache, instead of waiting for each read in turn.
+ */
+class Prefetcher : private QThread
+{
+public:
+  enum Mode
+  {
+    PrefetchNone    = 0,  // the workers open and read the files
+    PrefetchAdvise,       // open ahead, and hint the kernel to read ahead
+    PrefetchUring,        // open, stat and read ahead in batch with io_uring
+  };
+
+  static void setMode(Mode mode);
+  static Mode mode();
+  static bool isSupported(Mode mode);
+
+  Prefetcher();
+  virtual ~Prefetcher() override;
+  Prefetcher(const Prefetcher& other) = delete;
+  Prefetcher& operator=(const Prefetcher& other) = delete;
+
+  /**
+   * Queue a job. The stage takes the ownership of the job when it is
+   * accepted.
+   * @param job
+   * @param wait true to block while the stage is full, else the job is
+   *             queued beyond the capacity
+   * @param priority
+   * @return false if the stage is closed, and the job isn't taken
+   */
+  bool enqueue(MediaExtractor * job, bool wait, WorkerPool::Priority priority);
+
+  /**
+   * Reject the enqueues, and release the waiting producers.
+   */
+  void close();
+  void open();
+  void clear();
+
+  /**
+   * @return the jobs queued or in progress
+   */
+  int pending() const { return m_pending.load(); }
+
+  void startProcessing(WorkerPool * pool, ScannerMetrics * metrics);
+  void stopProcessing();
+
+private:
+  void run() override;
+
+  struct Entry
+  {
+    MediaExtractor * job;
+    WorkerPool::Priority priority;
+  };
+
+  void adviseBatch(const QVector<Entry>& batch);
+  bool uringBatch(const QVector<Entry>& batch);
+
+  WorkerPool * m_workerPool;
+  ScannerMetrics * m_metrics;
+  QMutex * m_lock;
+  QWaitCondition m_notEmpty;
+  QWaitCondition m_notFull;
+  static const int PriorityCount = WorkerPool::PriorityLow + 1;
+  QQueue<Entry> m_jobs[PriorityCount];
+  int m_depth;
+  bool m_closed;
+  QAtomicInt m_pending;
+  struct io_uring * m_ring;
+  bool m_ringFailed;
+};
+
+}
+
+#endif /* PREFETCHER_H */
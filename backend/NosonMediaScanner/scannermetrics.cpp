@@ -0,0 +1,276 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "scannermetrics.h"
+#include "locked.h"
+
+#include <QVariantList>
+#include <cstring>
+
+using namespace mediascanner;
+
+IOStats& IOStats::local()
+{
+  static thread_local IOStats _stats = { 0, 0, 0 };
+  return _stats;
+}
+
+static thread_local ScannerMetrics * _current = nullptr;
+
+void ScannerMetrics::Histogram::add(qint64 us)
+{
+  int b = 0;
+  while (b < METRICS_HISTOGRAM_BUCKETS - 1 && (us >> (b + 1)) > 0)
+    ++b;
+  ++buckets[b];
+  ++count;
+  sumUs += us;
+  if (us > maxUs)
+    maxUs = us;
+}
+
+qint64 ScannerMetrics::Histogram::quantile(double q) const
+{
+  // the upper bound of the bucket holding the quantile
+  qint64 rank = static_cast<qint64>(q * count);
+  qint64 sum = 0;
+  for (int b = 0; b < METRICS_HISTOGRAM_BUCKETS; ++b)
+  {
+    sum += buckets[b];
+    if (sum > rank)
+      return qMin(qint64(2) << b, maxUs);
+  }
+  return maxUs;
+}
+
+ScannerMetrics::ScannerMetrics()
+: m_lock(new QMutex())
+, m_timer()
+, m_activeMs(0)
+, m_directories(0)
+, m_files(0)
+, m_cached(0)
+, m_retries(0)
+, m_abandoned(0)
+, m_duplicates(0)
+, m_parsers()
+, m_probes()
+{
+}
+
+ScannerMetrics::~ScannerMetrics()
+{
+  delete m_lock;
+}
+
+void ScannerMetrics::scanStarted()
+{
+  LockGuard<QMutex> g(m_lock);
+  if (!m_timer.isValid())
+    m_timer.start();
+}
+
+void ScannerMetrics::scanFinished()
+{
+  LockGuard<QMutex> g(m_lock);
+  if (m_timer.isValid())
+  {
+    m_activeMs += m_timer.elapsed();
+    m_timer.invalidate();
+  }
+}
+
+void ScannerMetrics::addDirectory(int files)
+{
+  LockGuard<QMutex> g(m_lock);
+  ++m_directories;
+  m_files += files;
+}
+
+void ScannerMetrics::addCached()
+{
+  LockGuard<QMutex> g(m_lock);
+  ++m_cached;
+}
+
+void ScannerMetrics::addRetry()
+{
+  LockGuard<QMutex> g(m_lock);
+  ++m_retries;
+}
+
+void ScannerMetrics::addAbandoned()
+{
+  LockGuard<QMutex> g(m_lock);
+  ++m_abandoned;
+}
+
+void ScannerMetrics::addDuplicate()
+{
+  LockGuard<QMutex> g(m_lock);
+  ++m_duplicates;
+}
+
+void ScannerMetrics::addParse(const char * parser, qint64 elapsedUs, const IOStats& io, bool succeeded)
+{
+  LockGuard<QMutex> g(m_lock);
+  QMap<QByteArray, ParserStats>::iterator it = m_parsers.find(QByteArray(parser));
+  if (it == m_parsers.end())
+  {
+    ParserStats stats;
+    memset(&stats, 0, sizeof(ParserStats));
+    it = m_parsers.insert(QByteArray(parser), stats);
+  }
+  ParserStats& stats = it.value();
+  stats.latency.add(elapsedUs);
+  if (succeeded)
+    ++stats.succeeded;
+  else
+    ++stats.failed;
+  stats.io.bytesRead += io.bytesRead;
+  stats.io.reads += io.reads;
+  stats.io.seeks += io.seeks;
+}
+
+void ScannerMetrics::setCurrent(ScannerMetrics * metrics)
+{
+  _current = metrics;
+}
+
+void ScannerMetrics::addProbe(const char * probe, qint64 elapsedUs, const IOStats& io)
+{
+  if (_current)
+    _current->recordProbe(probe, elapsedUs, io);
+}
+
+void ScannerMetrics::recordProbe(const char * probe, qint64 elapsedUs, const IOStats& io)
+{
+  LockGuard<QMutex> g(m_lock);
+  QMap<QByteArray, ProbeStats>::iterator it = m_probes.find(QByteArray(probe));
+  if (it == m_probes.end())
+  {
+    ProbeStats stats;
+    memset(&stats, 0, sizeof(ProbeStats));
+    it = m_probes.insert(QByteArray(probe), stats);
+  }
+  ProbeStats& stats = it.value();
+  ++stats.count;
+  stats.sumUs += elapsedUs;
+  stats.io.bytesRead += io.bytesRead;
+  stats.io.reads += io.reads;
+  stats.io.seeks += io.seeks;
+}
+
+qint64 ScannerMetrics::activeMs() const
+{
+  return m_activeMs + (m_timer.isValid() ? m_timer.elapsed() : 0);
+}
+
+QVariantMap ScannerMetrics::toVariantMap() const
+{
+  LockGuard<QMutex> g(m_lock);
+  QVariantMap map;
+  qint64 ms = activeMs();
+  qint64 parsed = 0, failed = 0, bytesRead = 0;
+  QVariantMap parsers;
+  for (QMap<QByteArray, ParserStats>::const_iterator it = m_parsers.constBegin(); it != m_parsers.constEnd(); ++it)
+  {
+    const ParserStats& stats = it.value();
+    QVariantMap item;
+    item["succeeded"] = stats.succeeded;
+    item["failed"] = stats.failed;
+    item["bytesRead"] = stats.io.bytesRead;
+    item["reads"] = stats.io.reads;
+    item["seeks"] = stats.io.seeks;
+    item["meanUs"] = (stats.latency.count > 0 ? stats.latency.sumUs / stats.latency.count : 0);
+    item["p50Us"] = stats.latency.quantile(0.50);
+    item["p95Us"] = stats.latency.quantile(0.95);
+    item["maxUs"] = stats.latency.maxUs;
+    QVariantList buckets;
+    for (int b = 0; b < METRICS_HISTOGRAM_BUCKETS; ++b)
+      buckets.push_back(stats.latency.buckets[b]);
+    item["histogram"] = buckets;
+    parsers[QString::fromLatin1(it.key())] = item;
+    parsed += stats.succeeded;
+    failed += stats.failed;
+    bytesRead += stats.io.bytesRead;
+  }
+  map["parsers"] = parsers;
+  QVariantMap probes;
+  for (QMap<QByteArray, ProbeStats>::const_iterator it = m_probes.constBegin(); it != m_probes.constEnd(); ++it)
+  {
+    const ProbeStats& stats = it.value();
+    QVariantMap item;
+    item["count"] = stats.count;
+    item["bytesRead"] = stats.io.bytesRead;
+    item["reads"] = stats.io.reads;
+    item["seeks"] = stats.io.seeks;
+    item["meanUs"] = (stats.count > 0 ? stats.sumUs / stats.count : 0);
+    probes[QString::fromLatin1(it.key())] = item;
+  }
+  map["probes"] = probes;
+  map["activeMs"] = ms;
+  map["directories"] = m_directories;
+  map["files"] = m_files;
+  map["cached"] = m_cached;
+  map["parsed"] = parsed;
+  map["failed"] = failed;
+  map["retries"] = m_retries;
+  map["abandoned"] = m_abandoned;
+  map["duplicates"] = m_duplicates;
+  map["bytesRead"] = bytesRead;
+  map["directoriesPerSec"] = (ms > 0 ? 1000.0 * m_directories / ms : 0.0);
+  // the rate of the completed extractions, as the files found could be served from the index
+  map["filesPerSec"] = (ms > 0 ? 1000.0 * (parsed + failed) / ms : 0.0);
+  return map;
+}
+
+QString ScannerMetrics::toString() const
+{
+  QVariantMap map = toVariantMap();
+  QString str = QString("dirs=%1 (%2/s) files=%3 cached=%4 parsed=%5 failed=%6 (%7/s) retries=%8 read=%9KB dups=%10")
+      .arg(map["directories"].toLongLong())
+      .arg(map["directoriesPerSec"].toDouble(), 0, 'f', 1)
+      .arg(map["files"].toLongLong())
+      .arg(map["cached"].toLongLong())
+      .arg(map["parsed"].toLongLong())
+      .arg(map["failed"].toLongLong())
+      .arg(map["filesPerSec"].toDouble(), 0, 'f', 1)
+      .arg(map["retries"].toLongLong())
+      .arg(map["bytesRead"].toLongLong() / 1024)
+      .arg(map["duplicates"].toLongLong());
+  QVariantMap parsers = map["parsers"].toMap();
+  for (QVariantMap::const_iterator it = parsers.constBegin(); it != parsers.constEnd(); ++it)
+  {
+    QVariantMap item = it.value().toMap();
+    str.append(QString(" %1:p50=%2us,p95=%3us")
+               .arg(it.key())
+               .arg(item["p50Us"].toLongLong())
+               .arg(item["p95Us"].toLongLong()));
+  }
+  QVariantMap probes = map["probes"].toMap();
+  for (QVariantMap::const_iterator it = probes.constBegin(); it != probes.constEnd(); ++it)
+  {
+    QVariantMap item = it.value().toMap();
+    str.append(QString(" %1:n=%2,mean=%3us,reads=%4")
+               .arg(it.key())
+               .arg(item["count"].toLongLong())
+               .arg(item["meanUs"].toLongLong())
+               .arg(item["reads"].toLongLong()));
+  }
+  return str;
+}
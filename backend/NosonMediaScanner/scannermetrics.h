@@ -0,0 +1,126 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef SCANNERMETRICS_H
+#define SCANNERMETRICS_H
+
+#include "iostats.h"
+
+#include <QString>
+#include <QByteArray>
+#include <QMap>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <QVariantMap>
+
+#define METRICS_HISTOGRAM_BUCKETS 24
+
+namespace mediascanner
+{
+
+/**
+ * The counters of the scanner activity. The throughput is computed over
+ * the time spent scanning, from the completed extractions, and the parse times are recorded per parser
+ * in histograms with log2 buckets of microseconds.
+ */
+class ScannerMetrics
+{
+public:
+  ScannerMetrics();
+  ~ScannerMetrics();
+
+  void scanStarted();
+  void scanFinished();
+
+  void addDirectory(int files);
+  void addCached();
+  void addRetry();
+  void addAbandoned();
+  void addDuplicate();
+
+  /**
+   * Record the parsing of a file.
+   * @param parser the common name of the parser
+   * @param elapsedUs the parse time in microseconds
+   * @param io the I/O done by the parser
+   * @param succeeded
+   */
+  void addParse(const char * parser, qint64 elapsedUs, const IOStats& io, bool succeeded);
+
+  /**
+   * Make the metrics current for the calling thread, so the parsers can
+   * report their probes while parsing. Pass nullptr to release them.
+   */
+  static void setCurrent(ScannerMetrics * metrics);
+
+  /**
+   * Record a probe done by a parser, as the estimation of a duration, into
+   * the current metrics of the thread if any.
+   * @param probe the name of the probe
+   * @param elapsedUs the time spent in microseconds
+   * @param io the I/O done by the probe
+   */
+  static void addProbe(const char * probe, qint64 elapsedUs, const IOStats& io);
+
+  QVariantMap toVariantMap() const;
+  QString toString() const;
+
+private:
+  struct Histogram
+  {
+    qint64 buckets[METRICS_HISTOGRAM_BUCKETS];
+    qint64 count;
+    qint64 sumUs;
+    qint64 maxUs;
+    void add(qint64 us);
+    qint64 quantile(double q) const;
+  };
+
+  struct ParserStats
+  {
+    Histogram latency;
+    qint64 succeeded;
+    qint64 failed;
+    IOStats io;
+  };
+
+  struct ProbeStats
+  {
+    qint64 count;
+    qint64 sumUs;
+    IOStats io;
+  };
+
+  void recordProbe(const char * probe, qint64 elapsedUs, const IOStats& io);
+  qint64 activeMs() const;
+
+  mutable QMutex * m_lock;
+  QElapsedTimer m_timer;
+  qint64 m_activeMs;
+  qint64 m_directories;
+  qint64 m_files;
+  qint64 m_cached;
+  qint64 m_retries;
+  qint64 m_abandoned;
+  qint64 m_duplicates;
+  QMap<QByteArray, ParserStats> m_parsers;
+  QMap<QByteArray, ProbeStats> m_probes;
+};
+
+}
+
+#endif /* SCANNERMETRICS_H */
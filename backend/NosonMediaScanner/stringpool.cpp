@@ -0,0 +1,91 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "stringpool.h"
+#include "locked.h"
+#include "tools.h"
+
+using namespace mediascanner;
+
+InternedString::Data InternedString::_empty;
+
+InternedString& InternedString::operator=(const QString& value)
+{
+  *this = StringPool::instance().intern(value);
+  return *this;
+}
+
+StringPool& StringPool::instance()
+{
+  static StringPool _pool;
+  return _pool;
+}
+
+StringPool::StringPool()
+: m_lock(new QMutex())
+, m_strings()
+{
+}
+
+StringPool::~StringPool()
+{
+  delete m_lock;
+}
+
+InternedString StringPool::intern(const QString& value)
+{
+  if (value.isEmpty())
+    return InternedString();
+  LockGuard<QMutex> g(m_lock);
+  QHash<QString, QExplicitlySharedDataPointer<InternedString::Data> >::const_iterator it = m_strings.constFind(value);
+  if (it != m_strings.constEnd())
+    return InternedString(it.value().data());
+  InternedString::Data * d = new InternedString::Data();
+  d->value = value;
+  d->value.squeeze();
+  d->key = InternedString::keyOf(value);
+  // an ASCII value is its own normalized form, then it is shared
+  d->normalized = normalizedString(d->value);
+  // the key of the hash shares the value
+  m_strings.insert(d->value, QExplicitlySharedDataPointer<InternedString::Data>(d));
+  return InternedString(d);
+}
+
+int StringPool::count() const
+{
+  LockGuard<QMutex> g(m_lock);
+  return m_strings.size();
+}
+
+int StringPool::purge()
+{
+  LockGuard<QMutex> g(m_lock);
+  int count = 0;
+  QHash<QString, QExplicitlySharedDataPointer<InternedString::Data> >::iterator it = m_strings.begin();
+  while (it != m_strings.end())
+  {
+    // a new reference can be taken only by intern, under the lock
+    if (it.value()->ref.load() == 1)
+    {
+      it = m_strings.erase(it);
+      ++count;
+    }
+    else
+      ++it;
+  }
+  return count;
+}
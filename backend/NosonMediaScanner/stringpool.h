@@ -0,0 +1,96 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef STRINGPOOL_H
+#define STRINGPOOL_H
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QSharedData>
+#include <QExplicitlySharedDataPointer>
+
+namespace mediascanner
+{
+
+/**
+ * An immutable string shared through the pool. It holds the value with its
+ * lowered UTF-8 key and its normalized form, so they are computed once for
+ * all the tags having the same value.
+ */
+class InternedString
+{
+public:
+  InternedString() { }
+  InternedString(const QString& value) { *this = value; }
+  InternedString& operator=(const QString& value);
+
+  const QString& value() const { return (m_d ? m_d->value : _empty.value); }
+  const QByteArray& key() const { return (m_d ? m_d->key : _empty.key); }
+  const QString& normalized() const { return (m_d ? m_d->normalized : _empty.normalized); }
+
+  /**
+   * @return the key of a value, as held by the interned string
+   */
+  static QByteArray keyOf(const QString& value) { return value.toLower().toUtf8(); }
+
+  operator const QString&() const { return value(); }
+  bool isEmpty() const { return !m_d; }
+  bool operator==(const InternedString& other) const { return m_d == other.m_d; }
+  bool operator!=(const InternedString& other) const { return m_d != other.m_d; }
+
+  struct Data : public QSharedData
+  {
+    QString value;
+    QByteArray key;
+    QString normalized;
+  };
+
+private:
+  friend class StringPool;
+  explicit InternedString(Data * d) : m_d(d) { }
+
+  QExplicitlySharedDataPointer<Data> m_d;
+  static Data _empty;
+};
+
+class StringPool
+{
+public:
+  static StringPool& instance();
+
+  InternedString intern(const QString& value);
+  int count() const;
+
+  /**
+   * Release the strings no longer held outside the pool.
+   * @return the number of released strings
+   */
+  int purge();
+
+private:
+  StringPool();
+  ~StringPool();
+
+  mutable QMutex * m_lock;
+  QHash<QString, QExplicitlySharedDataPointer<InternedString::Data> > m_strings;
+};
+
+}
+
+#endif /* STRINGPOOL_H */
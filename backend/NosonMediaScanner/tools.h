@@ -20,8 +20,36 @@
 
 #include <QString>
 
+/**
+ * @return true if all the characters are ASCII. The characters are merged by
+ * blocks, so the inner loop is vectorized by the compiler.
+ */
+static inline bool isAsciiString(const QString& str)
+{
+  const ushort * p = str.utf16();
+  int n = str.size();
+  int i = 0;
+  for (; i + 16 <= n; i += 16)
+  {
+    ushort bits = 0;
+    for (int k = 0; k < 16; ++k)
+      bits |= p[i + k];
+    if (bits & 0xff80)
+      return false;
+  }
+  for (; i < n; ++i)
+  {
+    if (p[i] & 0xff80)
+      return false;
+  }
+  return true;
+}
+
 static inline QString normalizedString(const QString& str)
 {
+  // the decomposition leaves the ASCII as is, and it has no mark to strip
+  if (isAsciiString(str))
+    return str;
   QString ret;
   QString tmp = str.normalized(QString::NormalizationForm_D);
   ret.reserve(tmp.size());
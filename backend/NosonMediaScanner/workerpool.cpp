@@ -0,0 +1,250 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "workerpool.h"
+#include "locked.h"
+
+#include <cstring>
+
+using namespace mediascanner;
+
+WorkerPool::WorkerPool(int capacity)
+: m_capacity(capacity > 0 ? capacity : 1)
+, m_target(0)
+, m_closed(false)
+, m_stopped(false)
+, m_lock(new QMutex())
+, m_notEmpty()
+, m_notFull()
+, m_jobs()
+, m_depth(0)
+, m_workers()
+, m_active()
+, m_running(false)
+, m_idle(0)
+, m_clock()
+, m_markUs(0)
+, m_stats()
+{
+  memset(&m_stats, 0, sizeof(Stats));
+  m_clock.start();
+}
+
+WorkerPool::~WorkerPool()
+{
+  stop();
+  for (Worker * worker : m_workers)
+    delete worker;
+  delete m_lock;
+}
+
+void WorkerPool::setMaxThread(int maxThread)
+{
+  QList<Worker*> toStart;
+  {
+    LockGuard<QMutex> g(m_lock);
+    if (m_stopped)
+      return;
+    m_target = (maxThread > 0 ? maxThread : 1);
+    while (m_workers.size() < m_target)
+    {
+      m_workers.push_back(new Worker(this, m_workers.size()));
+      m_active.push_back(false);
+    }
+    for (int i = 0; i < m_target; ++i)
+    {
+      if (!m_active[i])
+      {
+        m_active[i] = true;
+        toStart.push_back(m_workers[i]);
+      }
+    }
+    // release the idle workers to retire the extra ones
+    m_notEmpty.wakeAll();
+  }
+  for (Worker * worker : toStart)
+  {
+    // a retired worker could be still leaving
+    worker->wait();
+    worker->start();
+  }
+}
+
+int WorkerPool::maxThread() const
+{
+  LockGuard<QMutex> g(m_lock);
+  return m_target;
+}
+
+bool WorkerPool::enqueue(QRunnable * job, bool wait, Priority priority)
+{
+  LockGuard<QMutex> g(m_lock);
+  if (wait && m_depth >= m_capacity && !m_closed)
+  {
+    QElapsedTimer timer;
+    timer.start();
+    while (m_depth >= m_capacity && !m_closed)
+      m_notFull.wait(m_lock);
+    ++m_stats.enqueueWaits;
+    m_stats.enqueueWaitUs += timer.nsecsElapsed() / 1000;
+  }
+  if (m_stopped || (wait && m_closed))
+    return false;
+  accountIdle();
+  m_jobs[priority].enqueue(job);
+  ++m_depth;
+  ++m_stats.enqueued;
+  if (m_depth > m_stats.maxDepth)
+    m_stats.maxDepth = m_depth;
+  m_notEmpty.wakeOne();
+  return true;
+}
+
+void WorkerPool::close()
+{
+  LockGuard<QMutex> g(m_lock);
+  m_closed = true;
+  m_notFull.wakeAll();
+}
+
+void WorkerPool::open()
+{
+  LockGuard<QMutex> g(m_lock);
+  m_closed = false;
+}
+
+void WorkerPool::clear()
+{
+  QList<QRunnable*> jobs;
+  {
+    LockGuard<QMutex> g(m_lock);
+    for (QQueue<QRunnable*>& queue : m_jobs)
+    {
+      jobs.append(queue);
+      queue.clear();
+    }
+    accountIdle();
+    m_depth = 0;
+    m_notFull.wakeAll();
+  }
+  for (QRunnable * job : jobs)
+  {
+    if (job->autoDelete())
+      delete job;
+  }
+}
+
+void WorkerPool::stop()
+{
+  {
+    LockGuard<QMutex> g(m_lock);
+    m_stopped = true;
+    m_closed = true;
+    m_notFull.wakeAll();
+    m_notEmpty.wakeAll();
+  }
+  clear();
+  for (Worker * worker : m_workers)
+    worker->wait();
+}
+
+void WorkerPool::setRunning(bool running)
+{
+  LockGuard<QMutex> g(m_lock);
+  accountIdle();
+  m_running = running;
+}
+
+WorkerPool::Stats WorkerPool::stats() const
+{
+  LockGuard<QMutex> g(m_lock);
+  Stats stats = m_stats;
+  stats.depth = m_depth;
+  // add the idle time since the last accounting
+  if (m_running || m_depth > 0)
+    stats.idleUs += m_idle * (m_clock.nsecsElapsed() / 1000 - m_markUs);
+  return stats;
+}
+
+/**
+ * Add the time waited by the idle workers since the last accounting. It
+ * MUST be called with the lock held, before the count of idle workers, the
+ * depth or the running state is changed.
+ */
+void WorkerPool::accountIdle()
+{
+  qint64 now = m_clock.nsecsElapsed() / 1000;
+  if (m_running || m_depth > 0)
+    m_stats.idleUs += m_idle * (now - m_markUs);
+  m_markUs = now;
+}
+
+QRunnable * WorkerPool::dequeue(int index, qint64 lastBusyUs)
+{
+  LockGuard<QMutex> g(m_lock);
+  if (lastBusyUs >= 0)
+  {
+    --m_stats.busy;
+    ++m_stats.completed;
+    m_stats.busyUs += lastBusyUs;
+  }
+  accountIdle();
+  ++m_idle;
+  while (m_depth == 0 && !m_stopped && index < m_target)
+    m_notEmpty.wait(m_lock);
+  accountIdle();
+  --m_idle;
+  if (m_stopped || index >= m_target)
+  {
+    // retire
+    m_active[index] = false;
+    --m_stats.threads;
+    return nullptr;
+  }
+  QRunnable * job = nullptr;
+  for (QQueue<QRunnable*>& queue : m_jobs)
+  {
+    if (!queue.isEmpty())
+    {
+      job = queue.dequeue();
+      break;
+    }
+  }
+  --m_depth;
+  ++m_stats.busy;
+  m_notFull.wakeOne();
+  return job;
+}
+
+void WorkerPool::work(int index)
+{
+  {
+    LockGuard<QMutex> g(m_lock);
+    ++m_stats.threads;
+  }
+  qint64 busyUs = -1;
+  QRunnable * job;
+  while ((job = dequeue(index, busyUs)))
+  {
+    QElapsedTimer timer;
+    timer.start();
+    job->run();
+    if (job->autoDelete())
+      delete job;
+    busyUs = timer.nsecsElapsed() / 1000;
+  }
+}
@@ -0,0 +1,133 @@
+/*
+ *      Copyright (C) 2019 Jean-Luc Barriere
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <QThread>
+#include <QRunnable>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QVector>
+#include <QElapsedTimer>
+
+namespace mediascanner
+{
+
+/**
+ * A pool of workers draining a bounded job queue. Producers are blocked
+ * while the queue is full, and workers are blocked while it is empty, so
+ * no one has to poll. The size of the pool can be changed live: extra
+ * workers retire after their current job. Jobs are dequeued by priority,
+ * then in order of arrival.
+ */
+class WorkerPool
+{
+public:
+  enum Priority
+  {
+    PriorityHigh    = 0,  // requested by the user
+    PriorityNormal  = 1,
+    PriorityLow     = 2,  // background work
+  };
+
+  explicit WorkerPool(int capacity);
+  ~WorkerPool();
+
+  void setMaxThread(int maxThread);
+  int maxThread() const;
+
+  /**
+   * Push a job to the queue. The pool takes the ownership of the job when
+   * it is accepted, as for QThreadPool.
+   * @param job
+   * @param wait true to block while the queue is full, else the job is
+   *             queued beyond the capacity
+   * @param priority
+   * @return false if the pool is closed, and the job isn't taken
+   */
+  bool enqueue(QRunnable * job, bool wait = true, Priority priority = PriorityNormal);
+
+  /**
+   * Reject the blocking enqueues, and release the waiting producers.
+   */
+  void close();
+  void open();
+
+  void clear();
+  void stop();
+
+  /**
+   * Mark the period the producers are running. The workers waiting for a
+   * job are counted idle only within it, or while jobs are pending.
+   */
+  void setRunning(bool running);
+
+  struct Stats
+  {
+    int depth;            // jobs waiting in queue
+    int maxDepth;
+    int threads;          // running workers
+    int busy;             // workers running a job
+    qint64 enqueued;
+    qint64 completed;
+    qint64 enqueueWaits;  // enqueues blocked by a full queue
+    qint64 enqueueWaitUs; // time spent blocked in enqueue
+    qint64 busyUs;        // time spent by workers running jobs
+    qint64 idleUs;        // time spent by workers waiting for jobs while running
+  };
+
+  Stats stats() const;
+
+private:
+  class Worker : public QThread
+  {
+  public:
+    Worker(WorkerPool * pool, int index) : QThread(), m_pool(pool), m_index(index) { }
+  private:
+    void run() override { m_pool->work(m_index); }
+    WorkerPool * m_pool;
+    int m_index;
+  };
+
+  void work(int index);
+  QRunnable * dequeue(int index, qint64 lastBusyUs);
+  void accountIdle();
+
+  int m_capacity;
+  int m_target;
+  bool m_closed;
+  bool m_stopped;
+  mutable QMutex * m_lock;
+  QWaitCondition m_notEmpty;
+  QWaitCondition m_notFull;
+  static const int PriorityCount = PriorityLow + 1;
+  QQueue<QRunnable*> m_jobs[PriorityCount];
+  int m_depth;
+  QVector<Worker*> m_workers;
+  QVector<bool> m_active;
+  bool m_running;
+  int m_idle;             // workers waiting for a job
+  QElapsedTimer m_clock;
+  qint64 m_markUs;        // the last accounting of the idle time
+  Stats m_stats;
+};
+
+}
+
+#endif /* WORKERPOOL_H */
@@ -131,6 +131,8 @@ MusicPage {
         genres.init();
         if (settings.musicLocation.length > 0)
             MediaScanner.addRootPath(settings.musicLocation);
+        MediaScanner.artCache = settings.artCache;
+        MediaScanner.prefetch = (settings.readAhead ? MediaScanner.PrefetchUring : MediaScanner.PrefetchNone);
         MediaScanner.start();
     }
 
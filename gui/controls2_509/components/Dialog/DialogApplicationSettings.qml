@@ -52,6 +52,8 @@ DialogBase {
         themeBox.acceptedValue = settings.theme;
         apiKey.text = settings.lastfmKey;
         addMusicPath.text = settings.musicLocation;
+        artCacheBox.checked = settings.artCache;
+        readAheadBox.checked = settings.readAhead;
     }
     onAccepted: {
         var needRestart = (styleBox.currentIndex !== styleBox.styleIndex ||
@@ -82,6 +84,16 @@ DialogBase {
                 settings.musicLocation = "";
         }
 
+        if (settings.artCache !== artCacheBox.checked) {
+            settings.artCache = artCacheBox.checked;
+            MediaScanner.artCache = settings.artCache;
+        }
+
+        if (settings.readAhead !== readAheadBox.checked) {
+            settings.readAhead = readAheadBox.checked;
+            MediaScanner.prefetch = (settings.readAhead ? MediaScanner.PrefetchUring : MediaScanner.PrefetchNone);
+        }
+
         if (needRestart) {
             mainView.jobRunning = true;
             Qt.exit(16);
@@ -274,6 +286,32 @@ DialogBase {
             }
         }
 
+        RowLayout {
+            spacing: units.gu(1)
+            Layout.fillWidth: true
+            Label {
+                text: qsTr("Cache the embedded art")
+                font.pointSize: units.fs("medium")
+                Layout.fillWidth: true
+            }
+            MusicCheckBox {
+                id: artCacheBox
+            }
+        }
+
+        RowLayout {
+            spacing: units.gu(1)
+            Layout.fillWidth: true
+            Label {
+                text: qsTr("Read ahead the media files")
+                font.pointSize: units.fs("medium")
+                Layout.fillWidth: true
+            }
+            MusicCheckBox {
+                id: readAheadBox
+            }
+        }
+
         ColumnLayout {
             visible: true
             spacing: units.gu(0.5)
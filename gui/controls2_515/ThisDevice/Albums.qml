@@ -33,13 +33,14 @@ MusicPage {
 
     AlbumList {
         id: albums
+        sortBy: AlbumList.SortByName
         Component.onCompleted: init()
     }
 
     function makeFileCoverSource(hasArt, filePath, artist, album) {
         var art = "";
         if (hasArt)
-            art = player.makeFilePictureLocalURL(filePath);
+            art = MediaScanner.artUrl(filePath, units.gu(20)) || player.makeFilePictureLocalURL(filePath);
         return makeCoverSource(art, artist, album);
     }
 
@@ -57,9 +58,6 @@ MusicPage {
 
         model: SortFilterModel {
             model: albums
-            sort.property: "album"
-            sort.order: Qt.AscendingOrder
-            sortCaseSensitivity: Qt.CaseInsensitive
             filter.property: "normalized"
             filter.pattern: new RegExp(normalizedInput(filter.displayText), "i")
             filterCaseSensitivity: Qt.CaseInsensitive
@@ -42,13 +42,14 @@ MusicPage {
     AlbumList {
         id: albums
         composer: composerViewPage.composer
+        sortBy: AlbumList.SortByName
         Component.onCompleted: init()
     }
 
     function makeFileCoverSource(hasArt, filePath, artist, album) {
         var art = "";
         if (hasArt)
-            art = player.makeFilePictureLocalURL(filePath);
+            art = MediaScanner.artUrl(filePath, units.gu(20)) || player.makeFilePictureLocalURL(filePath);
         return makeCoverSource(art, artist, album);
     }
 
@@ -158,12 +159,7 @@ MusicPage {
             }
         }
 
-        model: SortFilterModel {
-            model: albums
-            sort.property: "album"
-            sort.order: Qt.AscendingOrder
-            sortCaseSensitivity: Qt.CaseInsensitive
-        }
+        model: albums
 
         delegate: Card {
             id: albumCard
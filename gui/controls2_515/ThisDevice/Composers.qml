@@ -33,6 +33,7 @@ MusicPage {
 
     ComposerList {
         id: composers
+        sortBy: ComposerList.SortByName
         Component.onCompleted: init()
     }
 
@@ -50,9 +51,6 @@ MusicPage {
 
         model: SortFilterModel {
             model: composers
-            sort.property: "composer"
-            sort.order: Qt.AscendingOrder
-            sortCaseSensitivity: Qt.CaseInsensitive
             filter.property: "normalized"
             filter.pattern: new RegExp(normalizedInput(filter.displayText), "i")
             filterCaseSensitivity: Qt.CaseInsensitive
@@ -33,6 +33,7 @@ MusicPage {
 
     GenreList {
         id: genres
+        sortBy: GenreList.SortByName
         Component.onCompleted: init()
     }
 
@@ -50,9 +51,6 @@ MusicPage {
 
         model: SortFilterModel {
             model: genres
-            sort.property: "genre"
-            sort.order: Qt.AscendingOrder
-            sortCaseSensitivity: Qt.CaseInsensitive
             filter.property: "normalized"
             filter.pattern: new RegExp(normalizedInput(filter.displayText), "i")
             filterCaseSensitivity: Qt.CaseInsensitive
@@ -56,7 +56,8 @@ MusicPage {
     }
 
     TrackList {
-        id: tracks
+        id: songsModel
+        sortBy: isAlbum ? TrackList.SortByTrack : TrackList.SortByName
         album: trackStackPage.album
         artist: trackStackPage.artist
         genre: trackStackPage.genre
@@ -64,18 +65,10 @@ MusicPage {
         Component.onCompleted: init()
     }
 
-    SortFilterModel {
-        id: songsModel
-        model: tracks
-        sort.property: isAlbum ? "albumTrackNo" : "normalized"
-        sort.order: Qt.AscendingOrder
-        sortCaseSensitivity: Qt.CaseInsensitive
-    }
-
     function makeFileCoverSource(modelItem) {
         var art = "";
         if (modelItem.hasArt)
-            art = player.makeFilePictureLocalURL(modelItem.filePath);
+            art = MediaScanner.artUrl(modelItem.filePath, units.gu(20)) || player.makeFilePictureLocalURL(modelItem.filePath);
         return makeCoverSource(art, modelItem.author, modelItem.album);
     }
 
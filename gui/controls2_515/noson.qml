@@ -55,6 +55,8 @@ ApplicationWindow {
         property string deviceUrl: ""
         property string musicLocation: ""
         property bool preferListView: false
+        property bool artCache: false
+        property bool readAhead: false
     }
 
     Material.accent: Material.Grey